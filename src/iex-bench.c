@@ -0,0 +1,536 @@
+/*
+ * iex-bench.c - In-process microbenchmarks for the IEX-TP and TOPS dissectors
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "packet-iextp.h"
+#include "packet-iextops.h"
+
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include <glib.h>
+
+#include <register.h>
+#include <epan/epan.h>
+#include <epan/epan_dissect.h>
+#include <epan/frame_data.h>
+#include <epan/packet.h>
+#include <wiretap/wtap.h>
+
+#pragma GCC diagnostic error "-Wpadded"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Calibrate each case so a sample takes about this long */
+#define BENCH_SAMPLE_NS 50000000L
+
+#define BENCH_SESSION   1074790400U
+#define BENCH_SEND_TIME 1416999372000000000L
+
+/* From plugin.c */
+void plugin_register( void );
+void plugin_reg_handoff( void );
+
+/* One payload, fed to one named dissector */
+typedef struct _bench_case
+{
+  const gchar *id;
+  const gchar *name;
+  const gchar *dissector;
+  guint8      *data;
+  guint        len;
+  guint        messages;
+  gboolean     tree;
+  guint32      __padding;
+} bench_case;
+
+/* Nanoseconds per payload over the samples, with the half-width of its 95% confidence interval */
+typedef struct _bench_result
+{
+  gdouble mean;
+  gdouble half_width;
+} bench_result;
+
+/* Command line options */
+static gint bench_samples = 20;
+static gint bench_iterations = 0;
+static gchar *bench_filter = NULL;
+static gchar *bench_save = NULL;
+static gchar *bench_compare = NULL;
+static gdouble bench_tolerance = 5.0;
+
+static GOptionEntry bench_options[] =
+{
+  { "samples", 's', 0, G_OPTION_ARG_INT, &bench_samples, "Samples per case (default: 20)", "N" },
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &bench_iterations,
+    "Payloads per sample (default: calibrated to about 50 ms)", "N" },
+  { "filter", 'f', 0, G_OPTION_ARG_STRING, &bench_filter, "Only run cases whose id contains this", "TEXT" },
+  { "save", 0, 0, G_OPTION_ARG_FILENAME, &bench_save, "Save the results as a baseline", "FILE" },
+  { "compare", 'c', 0, G_OPTION_ARG_FILENAME, &bench_compare,
+    "Fail if any case is slower than in this baseline, beyond the tolerance and both confidence intervals", "FILE" },
+  { "tolerance", 't', 0, G_OPTION_ARG_DOUBLE, &bench_tolerance, "Allowed slowdown in percent (default: 5)", "PCT" },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+/* Two-sided 95% Student's t for 1 to 30 degrees of freedom (1.96 beyond) */
+static const gdouble bench_t95[] =
+{
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+
+static void
+bench_register_protocols( register_cb cb, gpointer client_data )
+{
+  register_all_protocols( cb, client_data );
+  plugin_register();
+}
+
+
+static void
+bench_register_handoffs( register_cb cb, gpointer client_data )
+{
+  register_all_protocol_handoffs( cb, client_data );
+  plugin_reg_handoff();
+}
+
+
+static void
+bench_report_failure( const char *msg_format, va_list ap )
+{
+  vfprintf( stderr, msg_format, ap );
+  fputc( '\n', stderr );
+}
+
+
+static void
+bench_report_open_failure( const char *filename, int err, gboolean for_writing )
+{
+  g_printerr( "could not open %s for %s: %s\n", filename, for_writing ? "writing" : "reading", g_strerror( err ) );
+}
+
+
+static void
+bench_report_read_failure( const char *filename, int err )
+{
+  g_printerr( "could not read %s: %s\n", filename, g_strerror( err ) );
+}
+
+
+static void
+bench_report_write_failure( const char *filename, int err )
+{
+  g_printerr( "could not write %s: %s\n", filename, g_strerror( err ) );
+}
+
+
+static inline gint64
+bench_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ( gint64 ) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+/* A TOPS segment with n_msgs quotes, or a heartbeat when n_msgs is zero */
+static guint8 *
+bench_segment( guint n_msgs, guint *len )
+{
+  iextp_seg seg;
+  guint8 *data;
+  guint8 *p;
+
+  *len = ( guint )( sizeof( iextp_seg ) + n_msgs * ( sizeof( guint16 ) + sizeof( iextops_msg ) ) );
+  data = g_malloc0( *len );
+
+  memset( &seg, 0, sizeof( seg ) );
+  seg.version = 1;
+  seg.protocol = GUINT16_TO_LE( IEXTP_PROTO_IEXTOPS );
+  seg.channel = GUINT32_TO_LE( 1 );
+  seg.session = GUINT32_TO_LE( BENCH_SESSION );
+  seg.length = GUINT16_TO_LE( ( guint16 )( *len - sizeof( iextp_seg ) ) );
+  seg.count = GUINT16_TO_LE( ( guint16 ) n_msgs );
+  seg.offset = GINT64_TO_LE( 4096 );
+  seg.first_seqno = GINT64_TO_LE( 100 );
+  seg.send_time = GINT64_TO_LE( BENCH_SEND_TIME );
+  memcpy( data, &seg, sizeof( seg ) );
+
+  p = data + sizeof( iextp_seg );
+  for ( guint i = 0; i < n_msgs; i++ )
+    {
+      iextops_msg msg;
+      gchar symbol[IEXTOPS_SYMBOL_LEN + 1];
+      guint16 msg_len = GUINT16_TO_LE( sizeof( iextops_msg ) );
+      gint64 price = 500000 + ( gint64 )( i % 7 ) * 100;
+
+      memset( &msg, 0, sizeof( msg ) );
+      msg.msgtype = IEXTOPS_MSG_QUOTE;
+      msg.flags = 0x40;
+      msg.timestamp = GINT64_TO_LE( BENCH_SEND_TIME - 1000 + i );
+      g_snprintf( symbol, sizeof( symbol ), "SYM%-5u", i % 10 );
+      memcpy( msg.symbol, symbol, IEXTOPS_SYMBOL_LEN );
+      msg.bid_size = GUINT32_TO_LE( 100 * ( i % 5 + 1 ) );
+      msg.bid_price = GINT64_TO_LE( price );
+      msg.ask_price = GINT64_TO_LE( price + 100 );
+      msg.ask_size = GUINT32_TO_LE( 200 );
+
+      memcpy( p, &msg_len, sizeof( msg_len ) );
+      memcpy( p + sizeof( msg_len ), &msg, sizeof( msg ) );
+      p += sizeof( msg_len ) + sizeof( msg );
+    }
+
+  return data;
+}
+
+
+/* UDP payloads the heuristic must reject, the last one only at its final check */
+static guint8 *
+bench_non_iex( guint kind, guint *len )
+{
+  static const guint8 dns_query[] =
+  {
+    0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x03, 'w', 'w', 'w', 0x0a, 'i', 'e', 'x', 't', 'r', 'a', 'd', 'i', 'n', 'g',
+    0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01
+  };
+  guint8 *data;
+
+  switch ( kind )
+    {
+    case 0:
+      *len = 6;
+      data = g_malloc( *len );
+      memcpy( data, dns_query, *len );
+      return data;
+
+    case 1:
+      *len = sizeof( dns_query ) + 8;
+      data = g_malloc0( *len );
+      memcpy( data, dns_query, sizeof( dns_query ) );
+      return data;
+
+    default:
+      data = bench_segment( 1, len );
+      ( ( iextp_seg * ) data )->session = 0;
+      return data;
+    }
+}
+
+
+static gboolean
+bench_selected( const bench_case *bc )
+{
+  return NULL == bench_filter || NULL != strstr( bc->id, bench_filter );
+}
+
+
+/* Dissect the case's payload iterations times, as new frames, and return the elapsed nanoseconds */
+static gint64
+bench_sample( const bench_case *bc, dissector_handle_t handle, guint iterations )
+{
+  epan_t *session;
+  epan_dissect_t *edt;
+  struct wtap_pkthdr phdr;
+  gint64 start;
+  gint64 elapsed;
+
+  /* A fresh session per sample, so per-file state does not build up across samples */
+  session = epan_new();
+  edt = epan_dissect_new( session, bc->tree, bc->tree );
+
+  memset( &phdr, 0, sizeof( phdr ) );
+  phdr.caplen = bc->len;
+  phdr.len = bc->len;
+
+  start = bench_now();
+
+  for ( guint i = 0; i < iterations; i++ )
+    {
+      frame_data fdata;
+
+      phdr.ts.secs = BENCH_SEND_TIME / 1000000000L;
+      phdr.ts.nsecs = ( int )( i % 1000000000U );
+      frame_data_init( &fdata, i + 1, &phdr, 0, 0 );
+
+      wmem_enter_packet_scope();
+
+      edt->pi.fd = &fdata;
+      edt->tvb = tvb_new_real_data( bc->data, bc->len, ( gint ) bc->len );
+      call_dissector_only( handle, edt->tvb, &edt->pi, edt->tree, NULL );
+      epan_dissect_reset( edt );
+
+      wmem_leave_packet_scope();
+
+      frame_data_destroy( &fdata );
+    }
+
+  elapsed = bench_now() - start;
+
+  epan_dissect_free( edt );
+  epan_free( session );
+
+  return elapsed;
+}
+
+
+static bench_result
+bench_run( const bench_case *bc )
+{
+  dissector_handle_t handle;
+  bench_result result;
+  gdouble *per_payload;
+  gdouble sum = 0;
+  gdouble sq = 0;
+  guint iterations = ( guint ) bench_iterations;
+  guint df;
+
+  handle = find_dissector( bc->dissector );
+  if ( NULL == handle )
+    {
+      g_printerr( "dissector %s is not registered\n", bc->dissector );
+      exit( EXIT_FAILURE );
+    }
+
+  /* Warm up, and size the samples */
+  if ( 0 == iterations )
+    {
+      gint64 elapsed;
+
+      iterations = 1000;
+      while ( ( elapsed = bench_sample( bc, handle, iterations ) ) < BENCH_SAMPLE_NS / 10 )
+        {
+          iterations *= 2;
+        }
+
+      iterations = ( guint ) MAX( 1000, ( gint64 ) iterations * BENCH_SAMPLE_NS / MAX( elapsed, 1 ) );
+    }
+  else
+    {
+      bench_sample( bc, handle, iterations );
+    }
+
+  per_payload = g_new( gdouble, bench_samples );
+  for ( gint i = 0; i < bench_samples; i++ )
+    {
+      per_payload[i] = ( gdouble ) bench_sample( bc, handle, iterations ) / iterations;
+      sum += per_payload[i];
+    }
+
+  result.mean = sum / bench_samples;
+  for ( gint i = 0; i < bench_samples; i++ )
+    {
+      sq += ( per_payload[i] - result.mean ) * ( per_payload[i] - result.mean );
+    }
+
+  df = ( guint ) bench_samples - 1;
+  result.half_width = ( df <= G_N_ELEMENTS( bench_t95 ) ? bench_t95[df - 1] : 1.96 )
+                      * sqrt( sq / df ) / sqrt( ( gdouble ) bench_samples );
+
+  g_free( per_payload );
+
+  return result;
+}
+
+
+/*
+ * A case regressed if, even at the fast end of its interval, it is slower than
+ * the slow end of the baseline's interval by more than the tolerance.
+ */
+static gboolean
+bench_check( GKeyFile *baseline, const bench_case *bc, const bench_result *result )
+{
+  gdouble mean;
+  gdouble half_width;
+  gdouble limit;
+
+  if ( !g_key_file_has_group( baseline, bc->id ) )
+    {
+      return TRUE;
+    }
+
+  mean = g_key_file_get_double( baseline, bc->id, "mean", NULL );
+  half_width = g_key_file_get_double( baseline, bc->id, "half_width", NULL );
+  limit = ( mean + half_width ) * ( 1.0 + bench_tolerance / 100.0 );
+
+  if ( result->mean - result->half_width > limit )
+    {
+      g_printerr( "%s: %.1f ns is slower than the baseline %.1f ns +- %.1f\n", bc->id, result->mean, mean,
+                  half_width );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GKeyFile *baseline = NULL;
+  GKeyFile *results;
+  bench_case cases[9];
+  guint n_cases = 0;
+  gboolean ok = TRUE;
+
+  context = g_option_context_new( "- benchmark the IEX-TP and TOPS dissectors" );
+  g_option_context_add_main_entries( context, bench_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) )
+    {
+      g_printerr( "%s\n", error->message );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( 2 > bench_samples )
+    {
+      g_printerr( "at least 2 samples are needed\n" );
+      return EXIT_FAILURE;
+    }
+
+  if ( NULL != bench_compare )
+    {
+      baseline = g_key_file_new();
+      if ( !g_key_file_load_from_file( baseline, bench_compare, G_KEY_FILE_NONE, &error ) )
+        {
+          g_printerr( "%s: %s\n", bench_compare, error->message );
+          return EXIT_FAILURE;
+        }
+    }
+
+  /* Headless epan with every built-in dissector, plus this plugin linked in */
+  epan_init( bench_register_protocols, bench_register_handoffs, NULL, NULL, bench_report_failure,
+             bench_report_open_failure, bench_report_read_failure, bench_report_write_failure );
+
+  for ( guint tree = 0; tree < 2; tree++ )
+    {
+      static const guint n_msgs[] = { 0, 1, 40 };
+
+      for ( guint i = 0; i < G_N_ELEMENTS( n_msgs ); i++ )
+        {
+          bench_case *bc = &cases[n_cases++];
+
+          bc->id = g_strdup_printf( "iextp-%u-%s", n_msgs[i], tree ? "tree" : "notree" );
+          bc->name = g_strdup_printf( "dissect_iextp, %s, %s", 0 == n_msgs[i] ? "heartbeat"
+                                      : 1 == n_msgs[i] ? "1 message" : "40 messages",
+                                      tree ? "tree" : "no tree" );
+          bc->dissector = "iextp";
+          bc->data = bench_segment( n_msgs[i], &bc->len );
+          bc->messages = n_msgs[i];
+          bc->tree = tree;
+        }
+    }
+
+  for ( guint kind = 0; kind < 3; kind++ )
+    {
+      static const gchar *kinds[] = { "short", "dns", "near-miss" };
+      bench_case *bc = &cases[n_cases++];
+
+      bc->id = g_strdup_printf( "heur-%s", kinds[kind] );
+      bc->name = g_strdup_printf( "dissect_iextp_heur, %s non-IEX payload", kinds[kind] );
+      bc->dissector = "iextp_heur";
+      bc->data = bench_non_iex( kind, &bc->len );
+      bc->messages = 0;
+      bc->tree = FALSE;
+    }
+
+  results = g_key_file_new();
+
+  g_print( "%-45s %14s %10s %14s\n", "case", "ns/segment", "+-95%", "ns/message" );
+  for ( guint i = 0; i < n_cases; i++ )
+    {
+      bench_case *bc = &cases[i];
+      bench_result result;
+
+      if ( !bench_selected( bc ) )
+        {
+          continue;
+        }
+
+      result = bench_run( bc );
+
+      if ( 0 != bc->messages )
+        {
+          g_print( "%-45s %14.1f %10.1f %14.1f\n", bc->name, result.mean, result.half_width,
+                   result.mean / bc->messages );
+        }
+      else
+        {
+          g_print( "%-45s %14.1f %10.1f %14s\n", bc->name, result.mean, result.half_width, "-" );
+        }
+
+      g_key_file_set_double( results, bc->id, "mean", result.mean );
+      g_key_file_set_double( results, bc->id, "half_width", result.half_width );
+
+      if ( NULL != baseline && !bench_check( baseline, bc, &result ) )
+        {
+          ok = FALSE;
+        }
+    }
+
+  if ( NULL != bench_save )
+    {
+      gchar *data = g_key_file_to_data( results, NULL, NULL );
+
+      if ( !g_file_set_contents( bench_save, data, -1, &error ) )
+        {
+          g_printerr( "%s: %s\n", bench_save, error->message );
+          g_clear_error( &error );
+          ok = FALSE;
+        }
+
+      g_free( data );
+    }
+
+  for ( guint i = 0; i < n_cases; i++ )
+    {
+      g_free( ( gchar * ) cases[i].id );
+      g_free( ( gchar * ) cases[i].name );
+      g_free( cases[i].data );
+    }
+
+  g_key_file_free( results );
+  if ( NULL != baseline )
+    {
+      g_key_file_free( baseline );
+    }
+
+  epan_cleanup();
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
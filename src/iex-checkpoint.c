@@ -0,0 +1,282 @@
+/*
+ * iex-checkpoint.c - Periodic state checkpoints for random access into captures
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-checkpoint.h"
+
+#include <string.h>
+
+/*
+ * Journal entries per chunk. The journal grows with every quote in a session,
+ * so it is kept in fixed-size chunks rather than one array which would have
+ * to be reallocated (and sized in a guint by older glibs) as a day's file is
+ * read.
+ */
+#define IEX_CKPT_CHUNK_ENTRIES 4096
+
+/* A journal entry header, the changed record follows it */
+typedef struct _iex_ckpt_entry
+{
+  guint32 frame;
+  guint32 slot;
+  gint64  time;
+} iex_ckpt_entry;
+
+/* A copy of the whole state after the first journal_pos journal entries */
+typedef struct _iex_ckpt
+{
+  guint32 frame;
+  guint32 n_slots;
+  gint64  time;
+  guint64 journal_pos;
+  guint8 *snapshot;
+} iex_ckpt;
+
+struct _iex_ckpt_store
+{
+  GPtrArray *chunks;
+  GArray    *ckpts;
+  guint64    n_entries;
+  gint64     every_ns;
+  gint64     last_time;
+  guint32    every_frames;
+  guint32    last_frame;
+  guint      record_size;
+  guint      entry_size;
+};
+
+
+static inline iex_ckpt_entry *
+iex_ckpt_store_entry( const iex_ckpt_store *store, guint64 pos )
+{
+  guint8 *chunk = ( guint8 * ) g_ptr_array_index( store->chunks, ( guint )( pos / IEX_CKPT_CHUNK_ENTRIES ) );
+
+  return ( iex_ckpt_entry * ) ( chunk + ( gsize )( pos % IEX_CKPT_CHUNK_ENTRIES ) * store->entry_size );
+}
+
+
+iex_ckpt_store *
+iex_ckpt_store_new( guint record_size, guint32 every_frames, gint64 every_ns )
+{
+  iex_ckpt_store *store;
+
+  store = g_new0( iex_ckpt_store, 1 );
+  store->record_size = record_size;
+  store->entry_size = ( guint )( ( sizeof( iex_ckpt_entry ) + record_size + 7 ) & ~( gsize ) 7 );
+  store->every_frames = every_frames;
+  store->every_ns = every_ns;
+  store->last_time = G_MININT64;
+  store->chunks = g_ptr_array_new_with_free_func( g_free );
+  store->ckpts = g_array_new( FALSE, TRUE, sizeof( iex_ckpt ) );
+
+  return store;
+}
+
+
+void
+iex_ckpt_store_free( iex_ckpt_store *store )
+{
+  if ( NULL == store )
+    {
+      return;
+    }
+
+  for ( guint i = 0; i < store->ckpts->len; i++ )
+    {
+      g_free( g_array_index( store->ckpts, iex_ckpt, i ).snapshot );
+    }
+
+  g_array_free( store->ckpts, TRUE );
+  g_ptr_array_free( store->chunks, TRUE );
+  g_free( store );
+}
+
+
+static gboolean
+iex_ckpt_store_due( const iex_ckpt_store *store, guint32 frame, gint64 time )
+{
+  const iex_ckpt *last;
+
+  if ( 0 == store->ckpts->len )
+    {
+      return TRUE;
+    }
+
+  last = &g_array_index( store->ckpts, iex_ckpt, store->ckpts->len - 1 );
+
+  /* Nothing has changed since the last checkpoint */
+  if ( last->journal_pos == store->n_entries )
+    {
+      return FALSE;
+    }
+
+  if ( 0 != store->every_frames && frame - last->frame >= store->every_frames )
+    {
+      return TRUE;
+    }
+
+  return 0 != store->every_ns && time - last->time >= store->every_ns;
+}
+
+
+/*
+ * Journal a change to one slot. Must be called in frame order with the state
+ * as it was before the change (which may be copied into a new checkpoint).
+ */
+void
+iex_ckpt_store_record( iex_ckpt_store *store,
+                       guint32         frame,
+                       gint64          time,
+                       guint32         slot,
+                       gconstpointer   record,
+                       gconstpointer   state,
+                       guint32         n_slots )
+{
+  iex_ckpt_entry *entry;
+
+  if ( iex_ckpt_store_due( store, frame, time ) )
+    {
+      iex_ckpt ckpt;
+
+      ckpt.frame = store->last_frame;
+      ckpt.n_slots = n_slots;
+      ckpt.time = store->last_time;
+      ckpt.journal_pos = store->n_entries;
+      ckpt.snapshot = g_malloc( ( gsize ) n_slots * store->record_size );
+      memcpy( ckpt.snapshot, state, ( gsize ) n_slots * store->record_size );
+
+      g_array_append_val( store->ckpts, ckpt );
+    }
+
+  if ( 0 == store->n_entries % IEX_CKPT_CHUNK_ENTRIES )
+    {
+      g_ptr_array_add( store->chunks, g_malloc( ( gsize ) IEX_CKPT_CHUNK_ENTRIES * store->entry_size ) );
+    }
+
+  entry = iex_ckpt_store_entry( store, store->n_entries++ );
+  entry->frame = frame;
+  entry->slot = slot;
+  entry->time = time;
+  memcpy( entry + 1, record, store->record_size );
+
+  store->last_frame = frame;
+  store->last_time = time;
+}
+
+
+static void
+iex_ckpt_store_apply( const iex_ckpt_store *store, const iex_ckpt *ckpt, GArray *out,
+                      gboolean by_time, gint64 limit )
+{
+  g_array_set_size( out, 0 );
+  g_array_append_vals( out, ckpt->snapshot, ckpt->n_slots );
+
+  for ( guint64 pos = ckpt->journal_pos; pos < store->n_entries; pos++ )
+    {
+      const iex_ckpt_entry *entry = iex_ckpt_store_entry( store, pos );
+
+      if ( ( by_time ? entry->time : ( gint64 ) entry->frame ) > limit )
+        {
+          break;
+        }
+
+      if ( entry->slot >= out->len )
+        {
+          g_array_set_size( out, entry->slot + 1 );
+        }
+
+      memcpy( out->data + ( gsize ) entry->slot * store->record_size, entry + 1, store->record_size );
+    }
+}
+
+
+/* Find the last checkpoint taken at or before the given frame (or time) */
+static const iex_ckpt *
+iex_ckpt_store_find( const iex_ckpt_store *store, gboolean by_time, gint64 limit )
+{
+  guint lo = 0;
+  guint hi = store->ckpts->len;
+
+  while ( hi - lo > 1 )
+    {
+      guint mid = lo + ( hi - lo ) / 2;
+      const iex_ckpt *ckpt = &g_array_index( store->ckpts, iex_ckpt, mid );
+
+      if ( ( by_time ? ckpt->time : ( gint64 ) ckpt->frame ) <= limit )
+        {
+          lo = mid;
+        }
+      else
+        {
+          hi = mid;
+        }
+    }
+
+  return &g_array_index( store->ckpts, iex_ckpt, lo );
+}
+
+
+/* Rebuild the state as of the end of the given frame into out (record_size elements) */
+gboolean
+iex_ckpt_store_restore_frame( const iex_ckpt_store *store, guint32 frame, GArray *out )
+{
+  g_return_val_if_fail( g_array_get_element_size( out ) == store->record_size, FALSE );
+
+  if ( 0 == store->ckpts->len )
+    {
+      g_array_set_size( out, 0 );
+      return FALSE;
+    }
+
+  iex_ckpt_store_apply( store, iex_ckpt_store_find( store, FALSE, frame ), out, FALSE, frame );
+
+  return TRUE;
+}
+
+
+/* Rebuild the state as of the given time (in journal order) into out */
+gboolean
+iex_ckpt_store_restore_time( const iex_ckpt_store *store, gint64 time, GArray *out )
+{
+  g_return_val_if_fail( g_array_get_element_size( out ) == store->record_size, FALSE );
+
+  if ( 0 == store->ckpts->len )
+    {
+      g_array_set_size( out, 0 );
+      return FALSE;
+    }
+
+  iex_ckpt_store_apply( store, iex_ckpt_store_find( store, TRUE, time ), out, TRUE, time );
+
+  return TRUE;
+}
+
+
+guint
+iex_ckpt_store_count( const iex_ckpt_store *store )
+{
+  return store->ckpts->len;
+}
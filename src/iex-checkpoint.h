@@ -0,0 +1,60 @@
+/*
+ * iex-checkpoint.h - Periodic state checkpoints for random access into captures
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_CHECKPOINT_H__
+#define __IEX_CHECKPOINT_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+/*
+ * A checkpoint store tracks state made of an array of fixed-size records
+ * (e.g. one iex_quote per symbol slot). Every change is appended to a journal
+ * in frame order, and every so many frames (or nanoseconds of send time) the
+ * whole array is copied aside. The state at any frame or time is rebuilt by
+ * copying the nearest earlier checkpoint and replaying only the journal since.
+ */
+typedef struct _iex_ckpt_store iex_ckpt_store;
+
+iex_ckpt_store *iex_ckpt_store_new( guint record_size, guint32 every_frames, gint64 every_ns );
+void iex_ckpt_store_free( iex_ckpt_store *store );
+
+void iex_ckpt_store_record( iex_ckpt_store *store,
+                            guint32         frame,
+                            gint64          time,
+                            guint32         slot,
+                            gconstpointer   record,
+                            gconstpointer   state,
+                            guint32         n_slots );
+
+gboolean iex_ckpt_store_restore_frame( const iex_ckpt_store *store, guint32 frame, GArray *out );
+gboolean iex_ckpt_store_restore_time( const iex_ckpt_store *store, gint64 time, GArray *out );
+
+guint iex_ckpt_store_count( const iex_ckpt_store *store );
+
+G_END_DECLS
+
+#endif /* __IEX_CHECKPOINT_H__ */
@@ -0,0 +1,421 @@
+/*
+ * iex-convert-test.c - Check every version of the conversion kernels against the plain C one
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-convert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Random values, then edge cases, in one array, converted at every offset and length up to a few vectors */
+#define TEST_RANDOM 100000
+#define TEST_ALIGN  16
+
+#define TEST_NS_PER_SEC 1000000000LL
+
+/* Seconds the vector versions hand over to plain C around: 32-bit multiplies need them below 2^32 */
+#define TEST_TIME_EDGE 4294967296LL
+
+/* Prices the AVX2 version hands over to plain C around: beyond +/- 2^51 the magic number trick fails */
+#define TEST_PRICE_EDGE ( 1LL << 51 )
+
+/* Four implied decimal places, as TOPS prices have */
+#define TEST_PRICE_SCALE 1e-4
+
+typedef struct _test_data
+{
+  gchar   *symbols;
+  gint64  *prices;
+  gint64  *timestamps;
+  gsize    n_symbols;
+  gsize    n_prices;
+  gsize    n_timestamps;
+} test_data;
+
+typedef struct _test_results
+{
+  guint8  *lens;
+  guint8  *plain;
+  gdouble *dollars;
+  gint64  *secs;
+  gint32  *nsecs;
+} test_results;
+
+static guint64 test_state = G_GUINT64_CONSTANT( 0x9E3779B97F4A7C15 );
+
+
+/* xorshift64*, so every run checks the same values */
+static guint64
+test_random( void )
+{
+  test_state ^= test_state >> 12;
+  test_state ^= test_state << 25;
+  test_state ^= test_state >> 27;
+
+  return test_state * G_GUINT64_CONSTANT( 0x2545F4914F6CDD1D );
+}
+
+
+static void
+test_add_symbol( GByteArray *symbols, const gchar *symbol )
+{
+  g_byte_array_append( symbols, ( const guint8 * ) symbol, 8 );
+}
+
+
+static void
+test_add_price( GArray *prices, gint64 price )
+{
+  g_array_append_val( prices, price );
+}
+
+
+static void
+test_add_timestamp( GArray *timestamps, gint64 timestamp )
+{
+  g_array_append_val( timestamps, timestamp );
+}
+
+
+static void
+test_build( test_data *data )
+{
+  static const gchar tricky[] = { 'A', 'Z', '.', '-', ' ', '\0', '"', '\\', ',', 0x1f, 0x7f, ( gchar ) 0x80,
+                                  ( gchar ) 0xc3, ( gchar ) 0xff };
+  GByteArray *symbols = g_byte_array_new();
+  GArray *prices = g_array_new( FALSE, FALSE, sizeof( gint64 ) );
+  GArray *timestamps = g_array_new( FALSE, FALSE, sizeof( gint64 ) );
+  gchar symbol[8];
+
+  for ( guint i = 0; i < TEST_RANDOM; i++ )
+    {
+      guint len = ( guint )( test_random() % 9 );
+
+      /* Mostly tickers, padded with spaces or NULs, and sometimes any bytes at all */
+      for ( guint j = 0; j < 8; j++ )
+        {
+          if ( 0 == i % 4 )
+            {
+              symbol[j] = tricky[test_random() % sizeof( tricky )];
+            }
+          else if ( j < len )
+            {
+              symbol[j] = ( gchar )( 'A' + test_random() % 26 );
+            }
+          else
+            {
+              symbol[j] = 0 == i % 3 ? '\0' : ' ';
+            }
+        }
+
+      test_add_symbol( symbols, symbol );
+
+      /* Mostly real prices, and sometimes any integer at all */
+      if ( 0 == i % 8 )
+        {
+          test_add_price( prices, ( gint64 ) test_random() >> ( test_random() % 64 ) );
+        }
+      else
+        {
+          test_add_price( prices, ( gint64 )( test_random() % 100000000000LL ) );
+        }
+
+      switch ( test_random() % 4 )
+        {
+        case 0:
+          test_add_timestamp( timestamps, ( gint64 ) test_random() );
+          break;
+
+        case 1:
+          test_add_timestamp( timestamps, -( gint64 )( test_random() >> ( test_random() % 64 ) ) );
+          break;
+
+        default:
+          test_add_timestamp( timestamps,
+                              1416999372000000000LL + ( gint64 )( test_random() % ( 86400 * TEST_NS_PER_SEC ) ) );
+          break;
+        }
+    }
+
+  /* Each byte which is padding, or which needs quoting, in every position */
+  for ( guint b = 0; b < sizeof( tricky ); b++ )
+    {
+      for ( guint j = 0; j < 8; j++ )
+        {
+          memcpy( symbol, "IEXG    ", 8 );
+          symbol[j] = tricky[b];
+          test_add_symbol( symbols, symbol );
+
+          memcpy( symbol, "ABCDEFGH", 8 );
+          symbol[j] = tricky[b];
+          test_add_symbol( symbols, symbol );
+        }
+    }
+
+  test_add_symbol( symbols, "        " );
+  test_add_symbol( symbols, "\0\0\0\0\0\0\0\0" );
+  test_add_symbol( symbols, " \0 \0 \0 \0" );
+  test_add_symbol( symbols, "\0      A" );
+
+  /* Around +/- 2^51, where the AVX2 version hands over to plain C, and the ends of the range */
+  for ( gint64 k = -8; k <= 8; k++ )
+    {
+      test_add_price( prices, TEST_PRICE_EDGE + k );
+      test_add_price( prices, -TEST_PRICE_EDGE + k );
+      test_add_price( prices, k );
+    }
+
+  test_add_price( prices, G_MAXINT64 );
+  test_add_price( prices, G_MININT64 );
+  test_add_price( prices, G_MININT64 + 1 );
+
+  /* Around zero, where C division truncates towards it */
+  for ( gint64 t = -3 * TEST_NS_PER_SEC; t <= 3 * TEST_NS_PER_SEC; t += TEST_NS_PER_SEC )
+    {
+      for ( gint64 d = -2; d <= 2; d++ )
+        {
+          test_add_timestamp( timestamps, t + d );
+        }
+    }
+
+  /*
+   * Around 2^32 seconds, where the vector versions hand over to plain C:
+   * doubles this large are a microsecond apart, so estimated seconds just
+   * below a whole second round up to it.
+   */
+  for ( gint64 edge = ( TEST_TIME_EDGE - 2 ) * TEST_NS_PER_SEC; edge <= ( TEST_TIME_EDGE + 1 ) * TEST_NS_PER_SEC;
+        edge += TEST_NS_PER_SEC )
+    {
+      for ( gint64 k = 0; k < 1024; k++ )
+        {
+          test_add_timestamp( timestamps, edge - 1 - k );
+          test_add_timestamp( timestamps, edge - 1 - k * 999983 );
+          test_add_timestamp( timestamps, edge + k );
+        }
+    }
+
+  test_add_timestamp( timestamps, G_MAXINT64 );
+  test_add_timestamp( timestamps, G_MAXINT64 - 1 );
+  test_add_timestamp( timestamps, G_MININT64 );
+  test_add_timestamp( timestamps, G_MININT64 + 1 );
+
+  data->n_symbols = symbols->len / 8;
+  data->symbols = ( gchar * ) g_byte_array_free( symbols, FALSE );
+  data->n_prices = prices->len;
+  data->prices = ( gint64 * ) ( gpointer ) g_array_free( prices, FALSE );
+  data->n_timestamps = timestamps->len;
+  data->timestamps = ( gint64 * ) ( gpointer ) g_array_free( timestamps, FALSE );
+}
+
+
+static void
+test_results_init( test_results *results, const test_data *data )
+{
+  results->lens = g_new( guint8, data->n_symbols );
+  results->plain = g_new( guint8, data->n_symbols );
+  results->dollars = g_new( gdouble, data->n_prices );
+  results->secs = g_new( gint64, data->n_timestamps );
+  results->nsecs = g_new( gint32, data->n_timestamps );
+}
+
+
+static void
+test_results_clear( test_results *results )
+{
+  g_free( results->lens );
+  g_free( results->plain );
+  g_free( results->dollars );
+  g_free( results->secs );
+  g_free( results->nsecs );
+}
+
+
+/* Convert everything in one call */
+static void
+test_convert( const test_data *data, test_results *results )
+{
+  iex_convert_symbols( data->symbols, data->n_symbols, results->lens, results->plain );
+  iex_convert_prices( data->prices, data->n_prices, TEST_PRICE_SCALE, results->dollars );
+  iex_convert_timestamps( data->timestamps, data->n_timestamps, results->secs, results->nsecs );
+}
+
+
+static gboolean
+test_compare( const test_data *data, const test_results *expected, const test_results *got, const gchar *isa )
+{
+  gboolean ok = TRUE;
+
+  for ( gsize i = 0; i < data->n_symbols; i++ )
+    {
+      if ( expected->lens[i] != got->lens[i] || expected->plain[i] != got->plain[i] )
+        {
+          const guint8 *s = ( const guint8 * ) data->symbols + i * 8;
+
+          g_printerr( "%s: symbol %" G_GSIZE_FORMAT " %02x %02x %02x %02x %02x %02x %02x %02x: "
+                      "length %u plain %u, expected %u and %u\n", isa, i, s[0], s[1], s[2], s[3], s[4], s[5],
+                      s[6], s[7], got->lens[i], got->plain[i], expected->lens[i], expected->plain[i] );
+          ok = FALSE;
+        }
+    }
+
+  /* Bit for bit, so a value rounded differently (or a -0.0) counts */
+  for ( gsize i = 0; i < data->n_prices; i++ )
+    {
+      if ( 0 != memcmp( &expected->dollars[i], &got->dollars[i], sizeof( gdouble ) ) )
+        {
+          g_printerr( "%s: price %" G_GINT64_FORMAT ": %.17g, expected %.17g\n", isa, data->prices[i],
+                      got->dollars[i], expected->dollars[i] );
+          ok = FALSE;
+        }
+    }
+
+  for ( gsize i = 0; i < data->n_timestamps; i++ )
+    {
+      if ( expected->secs[i] != got->secs[i] || expected->nsecs[i] != got->nsecs[i] )
+        {
+          g_printerr( "%s: timestamp %" G_GINT64_FORMAT ": %" G_GINT64_FORMAT " s %d ns, expected %"
+                      G_GINT64_FORMAT " s %d ns\n", isa, data->timestamps[i], got->secs[i], got->nsecs[i],
+                      expected->secs[i], expected->nsecs[i] );
+          ok = FALSE;
+        }
+    }
+
+  return ok;
+}
+
+
+/* The tails of vectors, where each version hands over to the next one down */
+static gboolean
+test_tails( const test_data *data, const test_results *expected, const gchar *isa )
+{
+  guint8 lens[TEST_ALIGN * 4];
+  guint8 plain[TEST_ALIGN * 4];
+  gdouble dollars[TEST_ALIGN * 4];
+  gint64 secs[TEST_ALIGN * 4];
+  gint32 nsecs[TEST_ALIGN * 4];
+  gboolean ok = TRUE;
+
+  for ( gsize off = 0; off < TEST_ALIGN; off++ )
+    {
+      for ( gsize n = 0; n <= TEST_ALIGN * 3; n++ )
+        {
+          iex_convert_symbols( data->symbols + off * 8, n, lens, plain );
+          iex_convert_prices( data->prices + off, n, TEST_PRICE_SCALE, dollars );
+          iex_convert_timestamps( data->timestamps + off, n, secs, nsecs );
+
+          if ( 0 != memcmp( lens, expected->lens + off, n ) || 0 != memcmp( plain, expected->plain + off, n )
+               || 0 != memcmp( dollars, expected->dollars + off, n * sizeof( gdouble ) )
+               || 0 != memcmp( secs, expected->secs + off, n * sizeof( gint64 ) )
+               || 0 != memcmp( nsecs, expected->nsecs + off, n * sizeof( gint32 ) ) )
+            {
+              g_printerr( "%s: %" G_GSIZE_FORMAT " values from %" G_GSIZE_FORMAT " differ\n", isa, n, off );
+              ok = FALSE;
+            }
+        }
+    }
+
+  return ok;
+}
+
+
+int
+main( void )
+{
+  iex_convert_isa best = iex_convert_get_isa();
+  test_results expected;
+  test_data data;
+  gboolean ok = TRUE;
+
+  test_build( &data );
+  test_results_init( &expected, &data );
+
+  iex_convert_set_isa( IEX_CONVERT_SCALAR );
+  test_convert( &data, &expected );
+
+  /* The plain C version is the reference, but check it against the spec here */
+  for ( gsize i = 0; i < data.n_prices; i++ )
+    {
+      gdouble want = ( gdouble ) data.prices[i] * TEST_PRICE_SCALE;
+
+      if ( 0 != memcmp( &expected.dollars[i], &want, sizeof( gdouble ) ) )
+        {
+          g_printerr( "scalar: price %" G_GINT64_FORMAT " is not converted as a cast would\n", data.prices[i] );
+          ok = FALSE;
+        }
+    }
+
+  for ( gsize i = 0; i < data.n_timestamps; i++ )
+    {
+      gint64 t = data.timestamps[i];
+
+      if ( expected.secs[i] != t / TEST_NS_PER_SEC || expected.nsecs[i] != t % TEST_NS_PER_SEC )
+        {
+          g_printerr( "scalar: timestamp %" G_GINT64_FORMAT " is not split as C division would\n", t );
+          ok = FALSE;
+        }
+    }
+
+  for ( iex_convert_isa isa = IEX_CONVERT_SCALAR + 1; isa <= best; isa++ )
+    {
+      const gchar *name = iex_convert_isa_name( isa );
+      test_results got;
+
+      if ( !iex_convert_set_isa( isa ) )
+        {
+          g_printerr( "%s: could not be selected\n", name );
+          ok = FALSE;
+          continue;
+        }
+
+      test_results_init( &got, &data );
+      test_convert( &data, &got );
+
+      if ( test_compare( &data, &expected, &got, name ) && test_tails( &data, &expected, name ) )
+        {
+          printf( "%s: %" G_GSIZE_FORMAT " symbols, %" G_GSIZE_FORMAT " prices and %" G_GSIZE_FORMAT
+                  " timestamps match\n", name, data.n_symbols, data.n_prices, data.n_timestamps );
+        }
+      else
+        {
+          ok = FALSE;
+        }
+
+      test_results_clear( &got );
+    }
+
+  if ( IEX_CONVERT_SCALAR == best )
+    {
+      printf( "only the plain C version is available\n" );
+    }
+
+  test_results_clear( &expected );
+  g_free( data.symbols );
+  g_free( data.prices );
+  g_free( data.timestamps );
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
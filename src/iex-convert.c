@@ -0,0 +1,540 @@
+/*
+ * iex-convert.c - Batch conversion of TOPS fields, dispatched on the CPU at run time
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-convert.h"
+
+#include <string.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+# define IEX_CONVERT_X86 1
+# pragma GCC diagnostic ignored "-Wpadded"
+# include <immintrin.h>
+# pragma GCC diagnostic error "-Wpadded"
+#endif
+
+#define IEX_CONVERT_SYMBOL_LEN 8
+
+/* 1.5 * 2^52 and 2^52: adding an integer to the bits of these gives it as a double */
+#define IEX_CONVERT_MAGIC_SIGNED   0x4338000000000000LL
+#define IEX_CONVERT_MAGIC_UNSIGNED 0x4330000000000000LL
+
+/*
+ * Timestamps split in vectors are below 2^32 - 1 seconds, so that even if
+ * the estimate rounds up by one, secs * 1e9 fits a 32x32 bit multiply.
+ */
+#define IEX_CONVERT_TIME_LIMIT ( 4294967295LL * 1000000000LL )
+
+typedef struct _iex_convert_ops
+{
+  void ( *symbols )( const gchar *symbols, gsize n, guint8 *lens, guint8 *plain );
+  void ( *prices )( const gint64 *prices, gsize n, gdouble scale, gdouble *out );
+  void ( *timestamps )( const gint64 *timestamps, gsize n, gint64 *secs, gint32 *nsecs );
+} iex_convert_ops;
+
+static const gchar *iex_convert_isa_names[IEX_CONVERT_LAST] =
+{
+  "scalar",
+  "sse4.2",
+  "avx2",
+  "avx512"
+};
+
+
+/*
+ * Plain C versions, which also finish off what does not fill a vector
+ */
+
+static void
+iex_convert_symbols_scalar( const gchar *symbols, gsize n, guint8 *lens, guint8 *plain )
+{
+  for ( gsize i = 0; i < n; i++ )
+    {
+      const guchar *symbol = ( const guchar * ) symbols + i * IEX_CONVERT_SYMBOL_LEN;
+      guint len = IEX_CONVERT_SYMBOL_LEN;
+      gboolean ok = TRUE;
+
+      while ( 0 < len && ( ' ' == symbol[len - 1] || '\0' == symbol[len - 1] ) )
+        {
+          len--;
+        }
+
+      for ( guint j = 0; j < len; j++ )
+        {
+          guchar c = symbol[j];
+
+          ok = ok && 0x20 <= c && 0x7f > c && '"' != c && '\\' != c && ',' != c;
+        }
+
+      lens[i] = ( guint8 ) len;
+      plain[i] = ( guint8 ) ok;
+    }
+}
+
+
+static void
+iex_convert_prices_scalar( const gint64 *prices, gsize n, gdouble scale, gdouble *out )
+{
+  for ( gsize i = 0; i < n; i++ )
+    {
+      out[i] = ( gdouble ) prices[i] * scale;
+    }
+}
+
+
+static void
+iex_convert_timestamps_scalar( const gint64 *timestamps, gsize n, gint64 *secs, gint32 *nsecs )
+{
+  for ( gsize i = 0; i < n; i++ )
+    {
+      secs[i] = timestamps[i] / 1000000000LL;
+      nsecs[i] = ( gint32 )( timestamps[i] - secs[i] * 1000000000LL );
+    }
+}
+
+
+#ifdef IEX_CONVERT_X86
+
+/*
+ * Turn byte masks over count symbols (bit 8 * k + j for byte j of symbol k)
+ * into lengths and plain flags: the length runs up to the last byte which is
+ * not padding, and a symbol is plain if none of those bytes are bad.
+ */
+static inline void
+iex_convert_symbol_masks( guint64 pad, guint64 bad, guint count, guint8 *lens, guint8 *plain )
+{
+  for ( guint k = 0; k < count; k++ )
+    {
+      guint kept = ( guint )( ~pad >> ( 8 * k ) ) & 0xff;
+      guint len = 0 == kept ? 0 : 32 - ( guint ) __builtin_clz( kept );
+
+      lens[k] = ( guint8 ) len;
+      plain[k] = 0 == ( ( bad >> ( 8 * k ) ) & ( ( 1U << len ) - 1 ) );
+    }
+}
+
+
+/*
+ * SSE4.2: two symbols at a time. Without 64-bit conversions or multiplies,
+ * two-lane versions of the other kernels are slower than plain C.
+ */
+
+__attribute__( ( target( "sse4.2" ) ) )
+static void
+iex_convert_symbols_sse42( const gchar *symbols, gsize n, guint8 *lens, guint8 *plain )
+{
+  const __m128i space = _mm_set1_epi8( ' ' );
+  const __m128i nul = _mm_setzero_si128();
+  const __m128i control = _mm_set1_epi8( 0x20 );
+  const __m128i del = _mm_set1_epi8( 0x7f );
+  const __m128i quote = _mm_set1_epi8( '"' );
+  const __m128i backslash = _mm_set1_epi8( '\\' );
+  const __m128i comma = _mm_set1_epi8( ',' );
+  gsize i = 0;
+
+  for ( ; i + 2 <= n; i += 2 )
+    {
+      __m128i v = _mm_loadu_si128( ( const __m128i * )( symbols + i * IEX_CONVERT_SYMBOL_LEN ) );
+      __m128i pad = _mm_or_si128( _mm_cmpeq_epi8( v, space ), _mm_cmpeq_epi8( v, nul ) );
+      __m128i bad;
+
+      /* A signed compare also catches bytes 0x80 and up */
+      bad = _mm_or_si128( _mm_cmplt_epi8( v, control ), _mm_cmpeq_epi8( v, del ) );
+      bad = _mm_or_si128( bad, _mm_cmpeq_epi8( v, quote ) );
+      bad = _mm_or_si128( bad, _mm_or_si128( _mm_cmpeq_epi8( v, backslash ), _mm_cmpeq_epi8( v, comma ) ) );
+
+      iex_convert_symbol_masks( ( guint ) _mm_movemask_epi8( pad ), ( guint ) _mm_movemask_epi8( bad ), 2,
+                                lens + i, plain + i );
+    }
+
+  iex_convert_symbols_scalar( symbols + i * IEX_CONVERT_SYMBOL_LEN, n - i, lens + i, plain + i );
+}
+
+
+/*
+ * AVX2: four at a time. Prices within +/- 2^51 convert exactly through the
+ * bits of a double, and anything else is redone in plain C.
+ */
+
+__attribute__( ( target( "avx2" ) ) )
+static void
+iex_convert_symbols_avx2( const gchar *symbols, gsize n, guint8 *lens, guint8 *plain )
+{
+  const __m256i space = _mm256_set1_epi8( ' ' );
+  const __m256i nul = _mm256_setzero_si256();
+  const __m256i control = _mm256_set1_epi8( 0x20 );
+  const __m256i del = _mm256_set1_epi8( 0x7f );
+  const __m256i quote = _mm256_set1_epi8( '"' );
+  const __m256i backslash = _mm256_set1_epi8( '\\' );
+  const __m256i comma = _mm256_set1_epi8( ',' );
+  gsize i = 0;
+
+  for ( ; i + 4 <= n; i += 4 )
+    {
+      __m256i v = _mm256_loadu_si256( ( const __m256i * )( symbols + i * IEX_CONVERT_SYMBOL_LEN ) );
+      __m256i pad = _mm256_or_si256( _mm256_cmpeq_epi8( v, space ), _mm256_cmpeq_epi8( v, nul ) );
+      __m256i bad;
+
+      bad = _mm256_or_si256( _mm256_cmpgt_epi8( control, v ), _mm256_cmpeq_epi8( v, del ) );
+      bad = _mm256_or_si256( bad, _mm256_cmpeq_epi8( v, quote ) );
+      bad = _mm256_or_si256( bad, _mm256_or_si256( _mm256_cmpeq_epi8( v, backslash ), _mm256_cmpeq_epi8( v, comma ) ) );
+
+      iex_convert_symbol_masks( ( guint32 ) _mm256_movemask_epi8( pad ), ( guint32 ) _mm256_movemask_epi8( bad ), 4,
+                                lens + i, plain + i );
+    }
+
+  iex_convert_symbols_sse42( symbols + i * IEX_CONVERT_SYMBOL_LEN, n - i, lens + i, plain + i );
+}
+
+
+__attribute__( ( target( "avx2" ) ) )
+static void
+iex_convert_prices_avx2( const gint64 *prices, gsize n, gdouble scale, gdouble *out )
+{
+  const __m256i magic = _mm256_set1_epi64x( IEX_CONVERT_MAGIC_SIGNED );
+  const __m256d magic_d = _mm256_castsi256_pd( magic );
+  const __m256i low = _mm256_set1_epi64x( -( 1LL << 51 ) - 1 );
+  const __m256i high = _mm256_set1_epi64x( 1LL << 51 );
+  const __m256d s = _mm256_set1_pd( scale );
+  gsize i = 0;
+
+  for ( ; i + 4 <= n; i += 4 )
+    {
+      __m256i x = _mm256_loadu_si256( ( const __m256i * )( prices + i ) );
+      __m256i ok = _mm256_and_si256( _mm256_cmpgt_epi64( x, low ), _mm256_cmpgt_epi64( high, x ) );
+      __m256d d = _mm256_sub_pd( _mm256_castsi256_pd( _mm256_add_epi64( x, magic ) ), magic_d );
+
+      _mm256_storeu_pd( out + i, _mm256_mul_pd( d, s ) );
+
+      if ( 0xf != _mm256_movemask_pd( _mm256_castsi256_pd( ok ) ) )
+        {
+          iex_convert_prices_scalar( prices + i, 4, scale, out + i );
+        }
+    }
+
+  iex_convert_prices_scalar( prices + i, n - i, scale, out + i );
+}
+
+
+/*
+ * The quotient is estimated in doubles (to within one), and corrected with
+ * exact integer arithmetic. Negative or far future timestamps are redone in
+ * plain C.
+ */
+__attribute__( ( target( "avx2" ) ) )
+static void
+iex_convert_timestamps_avx2( const gint64 *timestamps, gsize n, gint64 *secs, gint32 *nsecs )
+{
+  const __m256i magic = _mm256_set1_epi64x( IEX_CONVERT_MAGIC_UNSIGNED );
+  const __m256d magic_d = _mm256_castsi256_pd( magic );
+  const __m256i low32 = _mm256_set1_epi64x( 0xffffffffLL );
+  const __m256d two32 = _mm256_set1_pd( 4294967296.0 );
+  const __m256i billion = _mm256_set1_epi64x( 1000000000LL );
+  const __m256d billion_d = _mm256_set1_pd( 1e9 );
+  const __m256i below_billion = _mm256_set1_epi64x( 999999999LL );
+  const __m256i limit = _mm256_set1_epi64x( IEX_CONVERT_TIME_LIMIT );
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i even = _mm256_setr_epi32( 0, 2, 4, 6, 0, 2, 4, 6 );
+  gsize i = 0;
+
+  for ( ; i + 4 <= n; i += 4 )
+    {
+      __m256i x = _mm256_loadu_si256( ( const __m256i * )( timestamps + i ) );
+      __m256i ok = _mm256_andnot_si256( _mm256_cmpgt_epi64( zero, x ), _mm256_cmpgt_epi64( limit, x ) );
+      __m256d hi = _mm256_sub_pd( _mm256_castsi256_pd( _mm256_or_si256( _mm256_srli_epi64( x, 32 ), magic ) ), magic_d );
+      __m256d lo = _mm256_sub_pd( _mm256_castsi256_pd( _mm256_or_si256( _mm256_and_si256( x, low32 ), magic ) ),
+                                  magic_d );
+      __m256d q = _mm256_div_pd( _mm256_add_pd( _mm256_mul_pd( hi, two32 ), lo ), billion_d );
+      __m256i s;
+      __m256i r;
+      __m256i fix;
+
+      q = _mm256_round_pd( q, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC );
+      s = _mm256_sub_epi64( _mm256_castpd_si256( _mm256_add_pd( q, magic_d ) ), magic );
+      r = _mm256_sub_epi64( x, _mm256_mul_epu32( s, billion ) );
+
+      fix = _mm256_cmpgt_epi64( zero, r );
+      s = _mm256_add_epi64( s, fix );
+      r = _mm256_add_epi64( r, _mm256_and_si256( fix, billion ) );
+
+      fix = _mm256_cmpgt_epi64( r, below_billion );
+      s = _mm256_sub_epi64( s, fix );
+      r = _mm256_sub_epi64( r, _mm256_and_si256( fix, billion ) );
+
+      _mm256_storeu_si256( ( __m256i * )( secs + i ), s );
+      _mm_storeu_si128( ( __m128i * )( nsecs + i ),
+                        _mm256_castsi256_si128( _mm256_permutevar8x32_epi32( r, even ) ) );
+
+      if ( 0xf != _mm256_movemask_pd( _mm256_castsi256_pd( ok ) ) )
+        {
+          iex_convert_timestamps_scalar( timestamps + i, 4, secs + i, nsecs + i );
+        }
+    }
+
+  iex_convert_timestamps_scalar( timestamps + i, n - i, secs + i, nsecs + i );
+}
+
+
+# ifdef HAVE_AVX512
+
+/*
+ * AVX-512 (F, DQ and BW): eight at a time, with native 64-bit conversions
+ */
+
+__attribute__( ( target( "avx512f,avx512dq,avx512bw" ) ) )
+static void
+iex_convert_symbols_avx512( const gchar *symbols, gsize n, guint8 *lens, guint8 *plain )
+{
+  const __m512i space = _mm512_set1_epi8( ' ' );
+  const __m512i nul = _mm512_setzero_si512();
+  const __m512i control = _mm512_set1_epi8( 0x20 );
+  const __m512i del = _mm512_set1_epi8( 0x7f );
+  const __m512i quote = _mm512_set1_epi8( '"' );
+  const __m512i backslash = _mm512_set1_epi8( '\\' );
+  const __m512i comma = _mm512_set1_epi8( ',' );
+  gsize i = 0;
+
+  for ( ; i + 8 <= n; i += 8 )
+    {
+      __m512i v = _mm512_loadu_si512( symbols + i * IEX_CONVERT_SYMBOL_LEN );
+      __mmask64 pad = _mm512_cmpeq_epi8_mask( v, space ) | _mm512_cmpeq_epi8_mask( v, nul );
+      __mmask64 bad;
+
+      bad = _mm512_cmplt_epi8_mask( v, control ) | _mm512_cmpeq_epi8_mask( v, del );
+      bad |= _mm512_cmpeq_epi8_mask( v, quote ) | _mm512_cmpeq_epi8_mask( v, backslash );
+      bad |= _mm512_cmpeq_epi8_mask( v, comma );
+
+      iex_convert_symbol_masks( pad, bad, 8, lens + i, plain + i );
+    }
+
+  iex_convert_symbols_avx2( symbols + i * IEX_CONVERT_SYMBOL_LEN, n - i, lens + i, plain + i );
+}
+
+
+__attribute__( ( target( "avx512f,avx512dq,avx512bw" ) ) )
+static void
+iex_convert_prices_avx512( const gint64 *prices, gsize n, gdouble scale, gdouble *out )
+{
+  const __m512d s = _mm512_set1_pd( scale );
+  gsize i = 0;
+
+  for ( ; i + 8 <= n; i += 8 )
+    {
+      __m512i x = _mm512_loadu_si512( prices + i );
+
+      _mm512_storeu_pd( out + i, _mm512_mul_pd( _mm512_cvtepi64_pd( x ), s ) );
+    }
+
+  iex_convert_prices_avx2( prices + i, n - i, scale, out + i );
+}
+
+
+__attribute__( ( target( "avx512f,avx512dq,avx512bw" ) ) )
+static void
+iex_convert_timestamps_avx512( const gint64 *timestamps, gsize n, gint64 *secs, gint32 *nsecs )
+{
+  const __m512i billion = _mm512_set1_epi64( 1000000000LL );
+  const __m512d billion_d = _mm512_set1_pd( 1e9 );
+  const __m512i below_billion = _mm512_set1_epi64( 999999999LL );
+  const __m512i limit = _mm512_set1_epi64( IEX_CONVERT_TIME_LIMIT );
+  const __m512i one = _mm512_set1_epi64( 1 );
+  const __m512i zero = _mm512_setzero_si512();
+  gsize i = 0;
+
+  for ( ; i + 8 <= n; i += 8 )
+    {
+      __m512i x = _mm512_loadu_si512( timestamps + i );
+      __mmask8 ok = _mm512_cmpge_epi64_mask( x, zero ) & _mm512_cmplt_epi64_mask( x, limit );
+      __m512d q = _mm512_div_pd( _mm512_cvtepi64_pd( x ), billion_d );
+      __m512i s;
+      __m512i r;
+      __mmask8 fix;
+
+      q = _mm512_roundscale_pd( q, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC );
+      s = _mm512_cvttpd_epi64( q );
+      r = _mm512_sub_epi64( x, _mm512_mullo_epi64( s, billion ) );
+
+      fix = _mm512_cmplt_epi64_mask( r, zero );
+      s = _mm512_mask_sub_epi64( s, fix, s, one );
+      r = _mm512_mask_add_epi64( r, fix, r, billion );
+
+      fix = _mm512_cmpgt_epi64_mask( r, below_billion );
+      s = _mm512_mask_add_epi64( s, fix, s, one );
+      r = _mm512_mask_sub_epi64( r, fix, r, billion );
+
+      _mm512_storeu_si512( secs + i, s );
+      _mm256_storeu_si256( ( __m256i * )( nsecs + i ), _mm512_cvtepi64_epi32( r ) );
+
+      if ( 0xff != ok )
+        {
+          iex_convert_timestamps_scalar( timestamps + i, 8, secs + i, nsecs + i );
+        }
+    }
+
+  iex_convert_timestamps_avx2( timestamps + i, n - i, secs + i, nsecs + i );
+}
+
+# endif /* HAVE_AVX512 */
+#endif /* IEX_CONVERT_X86 */
+
+
+static const iex_convert_ops iex_convert_table[IEX_CONVERT_LAST] =
+{
+  { iex_convert_symbols_scalar, iex_convert_prices_scalar, iex_convert_timestamps_scalar },
+#ifdef IEX_CONVERT_X86
+  { iex_convert_symbols_sse42, iex_convert_prices_scalar, iex_convert_timestamps_scalar },
+  { iex_convert_symbols_avx2, iex_convert_prices_avx2, iex_convert_timestamps_avx2 },
+# ifdef HAVE_AVX512
+  { iex_convert_symbols_avx512, iex_convert_prices_avx512, iex_convert_timestamps_avx512 }
+# else
+  { iex_convert_symbols_avx2, iex_convert_prices_avx2, iex_convert_timestamps_avx2 }
+# endif
+#else
+  { iex_convert_symbols_scalar, iex_convert_prices_scalar, iex_convert_timestamps_scalar },
+  { iex_convert_symbols_scalar, iex_convert_prices_scalar, iex_convert_timestamps_scalar },
+  { iex_convert_symbols_scalar, iex_convert_prices_scalar, iex_convert_timestamps_scalar }
+#endif
+};
+
+
+static iex_convert_isa
+iex_convert_detect( void )
+{
+  iex_convert_isa isa = IEX_CONVERT_SCALAR;
+  const gchar *cap;
+
+#ifdef IEX_CONVERT_X86
+  __builtin_cpu_init();
+
+  if ( __builtin_cpu_supports( "sse4.2" ) )
+    {
+      isa = IEX_CONVERT_SSE42;
+    }
+
+  if ( __builtin_cpu_supports( "avx2" ) )
+    {
+      isa = IEX_CONVERT_AVX2;
+    }
+
+# ifdef HAVE_AVX512
+  if ( __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512dq" )
+       && __builtin_cpu_supports( "avx512bw" ) )
+    {
+      isa = IEX_CONVERT_AVX512;
+    }
+# endif
+#endif
+
+  cap = g_getenv( "IEX_CONVERT_ISA" );
+  if ( NULL != cap )
+    {
+      for ( guint i = 0; i < IEX_CONVERT_LAST; i++ )
+        {
+          if ( 0 == g_ascii_strcasecmp( cap, iex_convert_isa_names[i] ) )
+            {
+              isa = MIN( isa, ( iex_convert_isa ) i );
+            }
+        }
+    }
+
+  return isa;
+}
+
+
+/* The best version allowed, and the one in use */
+static gint iex_convert_best = IEX_CONVERT_SCALAR;
+static gint iex_convert_selected = IEX_CONVERT_SCALAR;
+
+
+static void
+iex_convert_init( void )
+{
+  static gsize done = 0;
+
+  if ( g_once_init_enter( &done ) )
+    {
+      iex_convert_best = iex_convert_detect();
+      g_atomic_int_set( &iex_convert_selected, iex_convert_best );
+      g_once_init_leave( &done, 1 );
+    }
+}
+
+
+iex_convert_isa
+iex_convert_get_isa( void )
+{
+  iex_convert_init();
+
+  return ( iex_convert_isa ) g_atomic_int_get( &iex_convert_selected );
+}
+
+
+/* Switch to another version, which must be no better than the one picked at first */
+gboolean
+iex_convert_set_isa( iex_convert_isa isa )
+{
+  g_return_val_if_fail( IEX_CONVERT_LAST > isa, FALSE );
+
+  iex_convert_init();
+  if ( ( gint ) isa > iex_convert_best )
+    {
+      return FALSE;
+    }
+
+  g_atomic_int_set( &iex_convert_selected, isa );
+
+  return TRUE;
+}
+
+
+const gchar *
+iex_convert_isa_name( iex_convert_isa isa )
+{
+  g_return_val_if_fail( IEX_CONVERT_LAST > isa, NULL );
+
+  return iex_convert_isa_names[isa];
+}
+
+
+void
+iex_convert_symbols( const gchar *symbols, gsize n, guint8 *lens, guint8 *plain )
+{
+  iex_convert_table[iex_convert_get_isa()].symbols( symbols, n, lens, plain );
+}
+
+
+void
+iex_convert_prices( const gint64 *prices, gsize n, gdouble scale, gdouble *out )
+{
+  iex_convert_table[iex_convert_get_isa()].prices( prices, n, scale, out );
+}
+
+
+void
+iex_convert_timestamps( const gint64 *timestamps, gsize n, gint64 *secs, gint32 *nsecs )
+{
+  iex_convert_table[iex_convert_get_isa()].timestamps( timestamps, n, secs, nsecs );
+}
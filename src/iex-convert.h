@@ -0,0 +1,69 @@
+/*
+ * iex-convert.h - Batch conversion of TOPS fields, dispatched on the CPU at run time
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_CONVERT_H__
+#define __IEX_CONVERT_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+/*
+ * Each kernel has a plain C version and AVX2 and AVX-512 versions (and an
+ * SSE4.2 one for symbols), the best one the CPU supports being picked the
+ * first time any of them is called. Setting IEX_CONVERT_ISA (to scalar,
+ * sse4.2, avx2 or avx512) in the environment caps the choice, and
+ * iex_convert_set_isa() switches down to a lesser version, e.g. to compare
+ * versions. All versions give the same results as the plain C one.
+ */
+typedef enum _iex_convert_isa
+{
+  IEX_CONVERT_SCALAR,
+  IEX_CONVERT_SSE42,
+  IEX_CONVERT_AVX2,
+  IEX_CONVERT_AVX512,
+  IEX_CONVERT_LAST
+} iex_convert_isa;
+
+iex_convert_isa iex_convert_get_isa( void );
+gboolean iex_convert_set_isa( iex_convert_isa isa );
+const gchar *iex_convert_isa_name( iex_convert_isa isa );
+
+/*
+ * n symbols of 8 bytes each, back to back: the length of each without its
+ * trailing space (or NUL) padding, and whether those bytes are all printable
+ * ASCII other than '"', '\\' and ',' (so can be written out unquoted).
+ */
+void iex_convert_symbols( const gchar *symbols, gsize n, guint8 *lens, guint8 *plain );
+
+/* Fixed-point prices (or any integers) times scale, e.g. 1e-4 for dollars */
+void iex_convert_prices( const gint64 *prices, gsize n, gdouble scale, gdouble *out );
+
+/* Nanosecond timestamps split into seconds and nanoseconds, as C division would */
+void iex_convert_timestamps( const gint64 *timestamps, gsize n, gint64 *secs, gint32 *nsecs );
+
+G_END_DECLS
+
+#endif /* __IEX_CONVERT_H__ */
@@ -0,0 +1,592 @@
+/*
+ * iex-health.c - Microburst and feed health statistics for IEX-TP segments
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-health.h"
+
+#include <string.h>
+
+/* The IEX-TP segment header, counted in the bytes of every segment */
+#define IEX_HEALTH_SEG_HEADER 40
+
+/* One bucket of a window's ring */
+typedef struct _iex_health_bucket
+{
+  gint64  index;
+  guint64 messages;
+  guint64 bytes;
+  guint64 first_frame;
+} iex_health_bucket;
+
+/* A burst: the busiest window among windows which overlap each other */
+typedef struct _iex_health_burst
+{
+  gint64  start;
+  gint64  end;
+  guint64 messages;
+  guint64 bytes;
+  guint64 first_frame;
+  guint64 last_frame;
+  guint32 channel;
+  guint32 __padding;
+} iex_health_burst;
+
+/* One window size on one channel */
+typedef struct _iex_health_window
+{
+  iex_health_bucket ring[IEX_HEALTH_BUCKETS];
+  iex_health_burst  burst;
+  gint64            head;
+  guint64           messages;
+  guint64           bytes;
+  guint64           peak_messages;
+  gint64            peak_messages_time;
+  guint64           peak_messages_frame;
+  guint64           peak_bytes;
+  gint64            peak_bytes_time;
+  guint64           peak_bytes_frame;
+  guint64           late;
+} iex_health_window;
+
+typedef struct _iex_health_channel
+{
+  iex_health_window windows[IEX_HEALTH_MAX_WINDOWS];
+  guint64           segments;
+  guint64           messages;
+  guint64           bytes;
+  guint64           max_count_frame;
+  guint64           heartbeats;
+  gint64            last_heartbeat;
+  guint64           hb_intervals;
+  gint64            hb_min;
+  gint64            hb_max;
+  gint64            hb_total;
+  guint64           hb_max_frame;
+  guint32           channel;
+  guint32           hb_session;
+  guint16           max_count;
+  guint16           __padding[3];
+} iex_health_channel;
+
+struct _iex_health
+{
+  gint64              windows[IEX_HEALTH_MAX_WINDOWS];
+  gint64              widths[IEX_HEALTH_MAX_WINDOWS];
+  GArray             *bursts[IEX_HEALTH_MAX_WINDOWS];
+  GHashTable         *by_channel;
+  GPtrArray          *channels;
+  iex_health_channel *last;
+  guint               n_windows;
+  guint               top_k;
+};
+
+
+iex_health *
+iex_health_new( const gint64 *windows, guint n_windows, guint top_k )
+{
+  iex_health *health;
+
+  g_return_val_if_fail( 0 < n_windows && IEX_HEALTH_MAX_WINDOWS >= n_windows, NULL );
+
+  health = g_new0( iex_health, 1 );
+  health->n_windows = n_windows;
+  health->top_k = MAX( 1, top_k );
+  health->by_channel = g_hash_table_new( g_direct_hash, g_direct_equal );
+  health->channels = g_ptr_array_new_with_free_func( g_free );
+
+  for ( guint i = 0; i < n_windows; i++ )
+    {
+      health->windows[i] = windows[i];
+      health->widths[i] = MAX( 1, windows[i] / IEX_HEALTH_BUCKETS );
+      health->bursts[i] = g_array_sized_new( FALSE, FALSE, sizeof( iex_health_burst ), health->top_k );
+    }
+
+  return health;
+}
+
+
+void
+iex_health_free( iex_health *health )
+{
+  if ( NULL == health )
+    {
+      return;
+    }
+
+  for ( guint i = 0; i < health->n_windows; i++ )
+    {
+      g_array_free( health->bursts[i], TRUE );
+    }
+
+  g_hash_table_destroy( health->by_channel );
+  g_ptr_array_free( health->channels, TRUE );
+  g_free( health );
+}
+
+
+void
+iex_health_reset( iex_health *health )
+{
+  for ( guint i = 0; i < health->n_windows; i++ )
+    {
+      g_array_set_size( health->bursts[i], 0 );
+    }
+
+  g_hash_table_remove_all( health->by_channel );
+  g_ptr_array_set_size( health->channels, 0 );
+  health->last = NULL;
+}
+
+
+static iex_health_channel *
+iex_health_get_channel( iex_health *health, guint32 channel )
+{
+  iex_health_channel *chan;
+
+  if ( NULL != health->last && channel == health->last->channel )
+    {
+      return health->last;
+    }
+
+  chan = g_hash_table_lookup( health->by_channel, GUINT_TO_POINTER( channel ) );
+  if ( NULL == chan )
+    {
+      chan = g_new0( iex_health_channel, 1 );
+      chan->channel = channel;
+      chan->last_heartbeat = G_MININT64;
+      chan->hb_min = G_MAXINT64;
+
+      for ( guint i = 0; i < health->n_windows; i++ )
+        {
+          chan->windows[i].head = G_MININT64;
+        }
+
+      g_hash_table_insert( health->by_channel, GUINT_TO_POINTER( channel ), chan );
+      g_ptr_array_add( health->channels, chan );
+    }
+
+  health->last = chan;
+
+  return chan;
+}
+
+
+/* Bursts are kept in a min-heap on messages, so the quietest is the one replaced */
+static void
+iex_health_keep_burst( iex_health *health, guint w, const iex_health_burst *burst )
+{
+  GArray *heap = health->bursts[w];
+  iex_health_burst *items;
+  guint i;
+
+  if ( 0 == burst->messages )
+    {
+      return;
+    }
+
+  if ( heap->len < health->top_k )
+    {
+      g_array_append_val( heap, *burst );
+      items = ( iex_health_burst * ) heap->data;
+
+      for ( i = heap->len - 1; 0 != i && items[( i - 1 ) / 2].messages > burst->messages; i = ( i - 1 ) / 2 )
+        {
+          items[i] = items[( i - 1 ) / 2];
+        }
+
+      items[i] = *burst;
+      return;
+    }
+
+  items = ( iex_health_burst * ) heap->data;
+  if ( items[0].messages >= burst->messages )
+    {
+      return;
+    }
+
+  for ( i = 0;; )
+    {
+      guint child = 2 * i + 1;
+
+      if ( child >= heap->len )
+        {
+          break;
+        }
+
+      if ( child + 1 < heap->len && items[child + 1].messages < items[child].messages )
+        {
+          child++;
+        }
+
+      if ( items[child].messages >= burst->messages )
+        {
+          break;
+        }
+
+      items[i] = items[child];
+      i = child;
+    }
+
+  items[i] = *burst;
+}
+
+
+/* The window as it stands after a segment, compared with the burst in progress */
+static void
+iex_health_window_check( iex_health *health, guint w, iex_health_window *win, guint32 channel, guint64 frame )
+{
+  iex_health_burst *burst = &win->burst;
+  gint64 width = health->widths[w];
+  gint64 start = ( win->head - IEX_HEALTH_BUCKETS + 1 ) * width;
+
+  if ( 0 != burst->messages && start >= burst->end )
+    {
+      iex_health_keep_burst( health, w, burst );
+      memset( burst, 0, sizeof( *burst ) );
+    }
+
+  if ( win->messages > burst->messages )
+    {
+      burst->start = start;
+      burst->end = ( win->head + 1 ) * width;
+      burst->messages = win->messages;
+      burst->bytes = win->bytes;
+      burst->last_frame = frame;
+      burst->channel = channel;
+      burst->first_frame = frame;
+
+      for ( guint b = 0; b < IEX_HEALTH_BUCKETS; b++ )
+        {
+          const iex_health_bucket *bucket = &win->ring[b];
+
+          if ( 0 != bucket->messages && bucket->index > win->head - IEX_HEALTH_BUCKETS
+               && bucket->first_frame < burst->first_frame )
+            {
+              burst->first_frame = bucket->first_frame;
+            }
+        }
+    }
+
+  if ( win->messages > win->peak_messages )
+    {
+      win->peak_messages = win->messages;
+      win->peak_messages_time = start;
+      win->peak_messages_frame = frame;
+    }
+
+  if ( win->bytes > win->peak_bytes )
+    {
+      win->peak_bytes = win->bytes;
+      win->peak_bytes_time = start;
+      win->peak_bytes_frame = frame;
+    }
+}
+
+
+static void
+iex_health_window_add( iex_health *health, guint w, iex_health_window *win, guint32 channel, guint64 frame,
+                       gint64 send_time, guint64 messages, guint64 bytes )
+{
+  gint64 index = send_time / health->widths[w];
+  iex_health_bucket *bucket;
+
+  if ( index > win->head )
+    {
+      /* Slide forward, dropping the buckets which fall out of the window */
+      gint64 from = MAX( win->head + 1, index - IEX_HEALTH_BUCKETS + 1 );
+
+      if ( G_MININT64 == win->head || index - win->head >= IEX_HEALTH_BUCKETS )
+        {
+          memset( win->ring, 0, sizeof( win->ring ) );
+          win->messages = 0;
+          win->bytes = 0;
+        }
+
+      for ( gint64 i = from; i <= index; i++ )
+        {
+          bucket = &win->ring[i % IEX_HEALTH_BUCKETS];
+          win->messages -= bucket->messages;
+          win->bytes -= bucket->bytes;
+          bucket->index = i;
+          bucket->messages = 0;
+          bucket->bytes = 0;
+          bucket->first_frame = frame;
+        }
+
+      win->head = index;
+    }
+  else if ( index <= win->head - IEX_HEALTH_BUCKETS )
+    {
+      /* Older than anything still in the window */
+      win->late++;
+      return;
+    }
+
+  bucket = &win->ring[index % IEX_HEALTH_BUCKETS];
+  bucket->messages += messages;
+  bucket->bytes += bytes;
+  win->messages += messages;
+  win->bytes += bytes;
+
+  iex_health_window_check( health, w, win, channel, frame );
+}
+
+
+void
+iex_health_add( iex_health *health,
+                guint64     frame,
+                gint64      send_time,
+                guint32     channel,
+                guint32     session,
+                guint16     count,
+                guint16     length )
+{
+  iex_health_channel *chan;
+  guint64 bytes = IEX_HEALTH_SEG_HEADER + ( guint64 ) length;
+
+  chan = iex_health_get_channel( health, channel );
+  chan->segments++;
+  chan->messages += count;
+  chan->bytes += bytes;
+
+  if ( count > chan->max_count )
+    {
+      chan->max_count = count;
+      chan->max_count_frame = frame;
+    }
+
+  if ( 0 == length )
+    {
+      /* Heartbeat intervals only make sense within a session */
+      if ( session == chan->hb_session && G_MININT64 != chan->last_heartbeat
+           && send_time >= chan->last_heartbeat )
+        {
+          gint64 interval = send_time - chan->last_heartbeat;
+
+          chan->hb_intervals++;
+          chan->hb_total += interval;
+          chan->hb_min = MIN( chan->hb_min, interval );
+          if ( interval > chan->hb_max )
+            {
+              chan->hb_max = interval;
+              chan->hb_max_frame = frame;
+            }
+        }
+
+      chan->heartbeats++;
+      chan->hb_session = session;
+      chan->last_heartbeat = send_time;
+    }
+
+  for ( guint w = 0; w < health->n_windows; w++ )
+    {
+      iex_health_window_add( health, w, &chan->windows[w], channel, frame, send_time, count, bytes );
+    }
+}
+
+
+static void
+iex_health_append_duration( GString *out, gint64 ns )
+{
+  if ( 0 == ns % 1000000000 )
+    {
+      g_string_append_printf( out, "%" G_GINT64_FORMAT "s", ns / 1000000000 );
+    }
+  else if ( 0 == ns % 1000000 )
+    {
+      g_string_append_printf( out, "%" G_GINT64_FORMAT "ms", ns / 1000000 );
+    }
+  else if ( 0 == ns % 1000 )
+    {
+      g_string_append_printf( out, "%" G_GINT64_FORMAT "us", ns / 1000 );
+    }
+  else
+    {
+      g_string_append_printf( out, "%" G_GINT64_FORMAT "ns", ns );
+    }
+}
+
+
+/* A measured interval, in whichever unit keeps it readable */
+static void
+iex_health_append_interval( GString *out, gint64 ns )
+{
+  if ( ns >= 1000000000 )
+    {
+      g_string_append_printf( out, "%.3f s", ( gdouble ) ns / 1e9 );
+    }
+  else if ( ns >= 1000000 )
+    {
+      g_string_append_printf( out, "%.3f ms", ( gdouble ) ns / 1e6 );
+    }
+  else if ( ns >= 1000 )
+    {
+      g_string_append_printf( out, "%.3f us", ( gdouble ) ns / 1e3 );
+    }
+  else
+    {
+      g_string_append_printf( out, "%" G_GINT64_FORMAT " ns", ns );
+    }
+}
+
+
+static void
+iex_health_append_time( GString *out, gint64 ns )
+{
+  GDateTime *dt;
+  gchar *text;
+
+  dt = g_date_time_new_from_unix_utc( ns / 1000000000 );
+  if ( NULL == dt )
+    {
+      g_string_append_printf( out, "%" G_GINT64_FORMAT, ns );
+      return;
+    }
+
+  text = g_date_time_format( dt, "%Y-%m-%d %H:%M:%S" );
+  g_string_append_printf( out, "%s.%09" G_GINT64_FORMAT, text, ns % 1000000000 );
+  g_free( text );
+  g_date_time_unref( dt );
+}
+
+
+static gint
+iex_health_burst_cmp( gconstpointer a, gconstpointer b )
+{
+  const iex_health_burst *x = a;
+  const iex_health_burst *y = b;
+
+  if ( x->messages != y->messages )
+    {
+      return x->messages > y->messages ? -1 : 1;
+    }
+
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+
+static gint
+iex_health_channel_cmp( gconstpointer a, gconstpointer b )
+{
+  const iex_health_channel *x = *( iex_health_channel * const * ) a;
+  const iex_health_channel *y = *( iex_health_channel * const * ) b;
+
+  return x->channel < y->channel ? -1 : x->channel > y->channel;
+}
+
+
+static void
+iex_health_report_channel( iex_health *health, const iex_health_channel *chan, GString *out )
+{
+  g_string_append_printf( out, "Channel %" G_GUINT32_FORMAT ": %" G_GUINT64_FORMAT " segments, %" G_GUINT64_FORMAT
+                          " messages, %" G_GUINT64_FORMAT " bytes\n", chan->channel, chan->segments, chan->messages,
+                          chan->bytes );
+  g_string_append_printf( out, "  Messages per segment: max %u (frame %" G_GUINT64_FORMAT ")\n", chan->max_count,
+                          chan->max_count_frame );
+
+  g_string_append_printf( out, "  Heartbeats: %" G_GUINT64_FORMAT, chan->heartbeats );
+  if ( 0 != chan->hb_intervals )
+    {
+      g_string_append( out, ", interval min " );
+      iex_health_append_interval( out, chan->hb_min );
+      g_string_append( out, ", mean " );
+      iex_health_append_interval( out, chan->hb_total / ( gint64 ) chan->hb_intervals );
+      g_string_append( out, ", max " );
+      iex_health_append_interval( out, chan->hb_max );
+      g_string_append_printf( out, " (frame %" G_GUINT64_FORMAT ")", chan->hb_max_frame );
+    }
+
+  g_string_append( out, "\n" );
+
+  for ( guint w = 0; w < health->n_windows; w++ )
+    {
+      const iex_health_window *win = &chan->windows[w];
+
+      g_string_append( out, "  Peak per " );
+      iex_health_append_duration( out, health->windows[w] );
+      g_string_append_printf( out, ": %" G_GUINT64_FORMAT " messages (frame %" G_GUINT64_FORMAT ", ",
+                              win->peak_messages, win->peak_messages_frame );
+      iex_health_append_time( out, win->peak_messages_time );
+      g_string_append_printf( out, "), %" G_GUINT64_FORMAT " bytes (frame %" G_GUINT64_FORMAT ", ",
+                              win->peak_bytes, win->peak_bytes_frame );
+      iex_health_append_time( out, win->peak_bytes_time );
+      g_string_append( out, ")" );
+
+      if ( 0 != win->late )
+        {
+          g_string_append_printf( out, ", %" G_GUINT64_FORMAT " segments too late to count", win->late );
+        }
+
+      g_string_append( out, "\n" );
+    }
+}
+
+
+/*
+ * Bursts still in progress are kept before reporting, so a report is the
+ * final one: more segments may not be added afterwards without a reset.
+ */
+void
+iex_health_report( iex_health *health, GString *out )
+{
+  g_ptr_array_sort( health->channels, iex_health_channel_cmp );
+
+  for ( guint c = 0; c < health->channels->len; c++ )
+    {
+      iex_health_channel *chan = g_ptr_array_index( health->channels, c );
+
+      for ( guint w = 0; w < health->n_windows; w++ )
+        {
+          iex_health_keep_burst( health, w, &chan->windows[w].burst );
+          memset( &chan->windows[w].burst, 0, sizeof( iex_health_burst ) );
+        }
+
+      iex_health_report_channel( health, chan, out );
+    }
+
+  for ( guint w = 0; w < health->n_windows; w++ )
+    {
+      GArray *bursts = health->bursts[w];
+
+      g_array_sort( bursts, iex_health_burst_cmp );
+
+      g_string_append_printf( out, "\nTop %u bursts per ", bursts->len );
+      iex_health_append_duration( out, health->windows[w] );
+      g_string_append( out, "\n" );
+
+      for ( guint i = 0; i < bursts->len; i++ )
+        {
+          const iex_health_burst *burst = &g_array_index( bursts, iex_health_burst, i );
+
+          g_string_append_printf( out, "  %3u  channel %" G_GUINT32_FORMAT ", %" G_GUINT64_FORMAT " messages, %"
+                                  G_GUINT64_FORMAT " bytes from ", i + 1, burst->channel, burst->messages,
+                                  burst->bytes );
+          iex_health_append_time( out, burst->start );
+          g_string_append_printf( out, ", frames %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "\n",
+                                  burst->first_frame, burst->last_frame );
+        }
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * iex-health.h - Microburst and feed health statistics for IEX-TP segments
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_HEALTH_H__
+#define __IEX_HEALTH_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+/* Each window is tracked as this many buckets, so bursts are found to within a tenth of the window */
+#define IEX_HEALTH_BUCKETS 10
+
+#define IEX_HEALTH_MAX_WINDOWS 8
+
+/*
+ * Per-channel message and byte rates over sliding windows of send time,
+ * segment sizes, and heartbeat cadence, fed one segment at a time in a
+ * single pass. Memory is fixed per channel and window: windows are rings of
+ * buckets, and only the top K bursts (per window size) are kept, each with
+ * the frames it spans.
+ */
+typedef struct _iex_health iex_health;
+
+/* Windows are in nanoseconds, and must be whole multiples of IEX_HEALTH_BUCKETS */
+
+iex_health *iex_health_new( const gint64 *windows, guint n_windows, guint top_k );
+void iex_health_free( iex_health *health );
+void iex_health_reset( iex_health *health );
+
+void iex_health_add( iex_health *health,
+                     guint64     frame,
+                     gint64      send_time,
+                     guint32     channel,
+                     guint32     session,
+                     guint16     count,
+                     guint16     length );
+
+void iex_health_report( iex_health *health, GString *out );
+
+G_END_DECLS
+
+#endif /* __IEX_HEALTH_H__ */
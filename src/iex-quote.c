@@ -0,0 +1,254 @@
+/*
+ * iex-quote.c - Per-symbol top of book state for IEX quote feeds
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-quote.h"
+
+#include <string.h>
+
+#define IEX_QUOTE_BOOK_MIN_BITS 10
+
+/* An open-addressed symbol -> slot entry, the symbol is compared as an integer */
+typedef struct _iex_quote_intern
+{
+  guint64 key;
+  guint32 slot;
+  guint32 used;
+} iex_quote_intern;
+
+struct _iex_quote_book
+{
+  GArray           *quotes;
+  iex_quote_intern *table;
+  guint32           bits;
+  guint32           mask;
+};
+
+
+static inline guint64
+iex_quote_key( const gchar *symbol )
+{
+  guint64 key;
+
+  memcpy( &key, symbol, sizeof( key ) );
+
+  return key;
+}
+
+
+static inline guint32
+iex_quote_hash( guint64 key, guint32 bits )
+{
+  return ( guint32 )( ( key * G_GUINT64_CONSTANT( 0x9E3779B97F4A7C15 ) ) >> ( 64 - bits ) );
+}
+
+
+static void
+iex_quote_book_grow( iex_quote_book *book )
+{
+  iex_quote_intern *old_table;
+  guint32 old_size;
+
+  old_table = book->table;
+  old_size = book->mask + 1;
+
+  book->bits++;
+  book->mask = ( 1U << book->bits ) - 1;
+  book->table = g_new0( iex_quote_intern, book->mask + 1 );
+
+  for ( guint32 i = 0; i < old_size; i++ )
+    {
+      guint32 pos;
+
+      if ( !old_table[i].used )
+        {
+          continue;
+        }
+
+      pos = iex_quote_hash( old_table[i].key, book->bits );
+      while ( book->table[pos].used )
+        {
+          pos = ( pos + 1 ) & book->mask;
+        }
+
+      book->table[pos] = old_table[i];
+    }
+
+  g_free( old_table );
+}
+
+
+iex_quote_book *
+iex_quote_book_new( void )
+{
+  iex_quote_book *book;
+
+  book = g_new0( iex_quote_book, 1 );
+  book->quotes = g_array_new( FALSE, TRUE, sizeof( iex_quote ) );
+  book->bits = IEX_QUOTE_BOOK_MIN_BITS;
+  book->mask = ( 1U << book->bits ) - 1;
+  book->table = g_new0( iex_quote_intern, book->mask + 1 );
+
+  return book;
+}
+
+
+void
+iex_quote_book_free( iex_quote_book *book )
+{
+  if ( NULL == book )
+    {
+      return;
+    }
+
+  g_array_free( book->quotes, TRUE );
+  g_free( book->table );
+  g_free( book );
+}
+
+
+/* Return the slot for the given 8-byte symbol, adding an empty quote if it is new */
+guint32
+iex_quote_book_intern( iex_quote_book *book, const gchar *symbol )
+{
+  guint64 key;
+  guint32 pos;
+  iex_quote *quote;
+
+  key = iex_quote_key( symbol );
+  pos = iex_quote_hash( key, book->bits );
+
+  while ( book->table[pos].used )
+    {
+      if ( book->table[pos].key == key )
+        {
+          return book->table[pos].slot;
+        }
+
+      pos = ( pos + 1 ) & book->mask;
+    }
+
+  book->table[pos].key = key;
+  book->table[pos].slot = book->quotes->len;
+  book->table[pos].used = 1;
+
+  g_array_set_size( book->quotes, book->quotes->len + 1 );
+  quote = &g_array_index( book->quotes, iex_quote, book->quotes->len - 1 );
+  memcpy( quote->symbol, symbol, IEX_SYMBOL_LEN );
+
+  /* Keep the load factor at or below one half */
+  if ( book->quotes->len * 2 > book->mask )
+    {
+      iex_quote_book_grow( book );
+    }
+
+  return book->quotes->len - 1;
+}
+
+
+guint32
+iex_quote_book_lookup( const iex_quote_book *book, const gchar *symbol )
+{
+  guint64 key;
+  guint32 pos;
+
+  key = iex_quote_key( symbol );
+  pos = iex_quote_hash( key, book->bits );
+
+  while ( book->table[pos].used )
+    {
+      if ( book->table[pos].key == key )
+        {
+          return book->table[pos].slot;
+        }
+
+      pos = ( pos + 1 ) & book->mask;
+    }
+
+  return IEX_QUOTE_NO_SLOT;
+}
+
+
+guint32
+iex_quote_book_size( const iex_quote_book *book )
+{
+  return book->quotes->len;
+}
+
+
+iex_quote *
+iex_quote_book_get( iex_quote_book *book, guint32 slot )
+{
+  return &g_array_index( book->quotes, iex_quote, slot );
+}
+
+
+iex_quote *
+iex_quote_book_quotes( iex_quote_book *book )
+{
+  return ( iex_quote * ) book->quotes->data;
+}
+
+
+/*
+ * Check a new quote, and the previous quote for the same symbol (if any) for
+ * crossed/locked markets, sizes without prices, and an update gap longer than
+ * stale_ns (zero disables the staleness check).
+ */
+guint32
+iex_quote_check( const iex_quote *prev, const iex_quote *quote, gint64 stale_ns )
+{
+  guint32 flags = 0;
+
+  if ( 0 != quote->bid_price && 0 != quote->ask_price )
+    {
+      if ( quote->bid_price > quote->ask_price )
+        {
+          flags |= IEX_QUOTE_CROSSED;
+        }
+      else if ( quote->bid_price == quote->ask_price )
+        {
+          flags |= IEX_QUOTE_LOCKED;
+        }
+    }
+
+  if ( 0 != quote->bid_price && 0 == quote->bid_size )
+    {
+      flags |= IEX_QUOTE_ZERO_BID_SIZE;
+    }
+
+  if ( 0 != quote->ask_price && 0 == quote->ask_size )
+    {
+      flags |= IEX_QUOTE_ZERO_ASK_SIZE;
+    }
+
+  if ( NULL != prev && 0 != prev->timestamp && 0 < stale_ns && quote->timestamp - prev->timestamp > stale_ns )
+    {
+      flags |= IEX_QUOTE_STALE;
+    }
+
+  return flags;
+}
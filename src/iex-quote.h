@@ -0,0 +1,75 @@
+/*
+ * iex-quote.h - Per-symbol top of book state for IEX quote feeds
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_QUOTE_H__
+#define __IEX_QUOTE_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+#define IEX_SYMBOL_LEN 8
+
+/* Sentinel returned when a symbol is not (and will not be) interned */
+#define IEX_QUOTE_NO_SLOT G_MAXUINT32
+
+/* The result of checking a quote against the previous quote for a symbol */
+typedef enum _iex_quote_flags
+{
+  IEX_QUOTE_CROSSED       = 1 << 0,
+  IEX_QUOTE_LOCKED        = 1 << 1,
+  IEX_QUOTE_ZERO_BID_SIZE = 1 << 2,
+  IEX_QUOTE_ZERO_ASK_SIZE = 1 << 3,
+  IEX_QUOTE_STALE         = 1 << 4
+} iex_quote_flags;
+
+/* The last known quote for a symbol, fixed-size so a book can be copied wholesale */
+typedef struct _iex_quote
+{
+  gchar   symbol[IEX_SYMBOL_LEN];
+  gint64  timestamp;
+  gint64  bid_price;
+  gint64  ask_price;
+  guint32 bid_size;
+  guint32 ask_size;
+} iex_quote;
+
+/* A dense array of quotes, indexed through a symbol intern table */
+typedef struct _iex_quote_book iex_quote_book;
+
+iex_quote_book *iex_quote_book_new( void );
+void iex_quote_book_free( iex_quote_book *book );
+
+guint32 iex_quote_book_intern( iex_quote_book *book, const gchar *symbol );
+guint32 iex_quote_book_lookup( const iex_quote_book *book, const gchar *symbol );
+guint32 iex_quote_book_size( const iex_quote_book *book );
+iex_quote *iex_quote_book_get( iex_quote_book *book, guint32 slot );
+iex_quote *iex_quote_book_quotes( iex_quote_book *book );
+
+guint32 iex_quote_check( const iex_quote *prev, const iex_quote *quote, gint64 stale_ns );
+
+G_END_DECLS
+
+#endif /* __IEX_QUOTE_H__ */
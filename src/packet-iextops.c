@@ -26,6 +26,9 @@
 #endif /* HAVE_CONFIG_H */
 
 #include "packet-iextops.h"
+#include "packet-iextp.h"
+#include "iex-quote.h"
+#include "iex-checkpoint.h"
 
 #pragma GCC diagnostic ignored "-Wpadded"
 
@@ -42,9 +45,8 @@
 
 #include <libintl.h>
 #include <stdbool.h>
+#include <stdio.h>
 
-#define IEXTP_PROTO_IEXTOPS 32769
-#define IEXTOPS_SYMBOL_LEN 8
 #define IEXTOPS_FLAGS_BITLEN 8
 
 typedef enum _iextops_flags
@@ -83,36 +85,52 @@ typedef enum _iextops_ef_type
   IEXTOPS_EF_INVALID_BID,
   IEXTOPS_EF_INVALID_ASK,
 
+  IEXTOPS_EF_CROSSED,
+  IEXTOPS_EF_LOCKED,
+  IEXTOPS_EF_ZERO_SIZE,
+  IEXTOPS_EF_STALE,
+
   IEXTOPS_EF_LAST
 } iextops_ef_type;
 
-typedef enum _iextops_msg_type
-{
-  IEXTOPS_MSG_QUOTE = 0x51,
-  IEXTOPS_MSG_LAST
-} iextops_msg_type;
-
-/* IEX TOPS Message Structure */
-typedef struct _iextops_msg
+/* The quote check results for a message, cached on the first pass */
+typedef struct _iextops_quote_result
 {
-  guint8  msgtype;
-  guint8  flags;
-  gint64  timestamp;
-  gchar   symbol[8];
-  guint32 bid_size;
-  gint64  bid_price;
-  gint64  ask_price;
-  guint32 ask_size;
-} __attribute__( ( packed ) ) iextops_msg;
+  guint32 flags;
+  guint32 __padding;
+  gint64  stale_ns;
+} iextops_quote_result;
 
 /* Classwide Vars */
 static int proto_iextops = -1;
 static int ett_iextops = -1;
+static int ett_iextops_book = -1;
 
 static dissector_handle_t iextops_handle = NULL;
 
 static int hf_iextops_filter[IEXTOPS_HF_LAST] = { 0 };
 
+/* Per-session top of book, and checkpoints of it, rebuilt for each file */
+typedef struct _iextops_session
+{
+  iex_quote_book *book;
+  iex_ckpt_store *ckpts;
+} iextops_session;
+
+/* Sessions keyed by IEX-TP session ID */
+static GHashTable *iextops_sessions = NULL;
+
+/* Scratch space the book is restored into for display */
+static GArray *iextops_book_scratch = NULL;
+
+/* Preferences */
+static gboolean iextops_check_quotes = TRUE;
+static guint iextops_stale_ms = 0;
+static guint iextops_ckpt_frames = 100000;
+static guint iextops_ckpt_ms = 0;
+static gboolean iextops_show_book = FALSE;
+static const char *iextops_book_time = "";
+
 static expert_field ei_iextops_errors[IEXTOPS_EF_LAST] =
 {
   EI_INIT,
@@ -125,14 +143,262 @@ static const value_string iextops_msgtype_values[IEXTOPS_MSG_LAST] =
 };
 
 static void
-dissect_iextops( tvbuff_t    *tvb __attribute__( ( unused ) ),
-                 packet_info *pinfo __attribute__( ( unused ) ),
-                 proto_tree  *ptree )
+iextops_session_free( iextops_session *session )
+{
+  iex_quote_book_free( session->book );
+  iex_ckpt_store_free( session->ckpts );
+  g_free( session );
+}
+
+
+static void
+iextops_init( void )
+{
+  if ( NULL != iextops_sessions )
+    {
+      g_hash_table_destroy( iextops_sessions );
+    }
+
+  if ( NULL == iextops_book_scratch )
+    {
+      iextops_book_scratch = g_array_new( FALSE, TRUE, sizeof( iex_quote ) );
+    }
+
+  iextops_sessions = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL,
+                                            ( GDestroyNotify ) iextops_session_free );
+}
+
+
+static iextops_session *
+iextops_get_session( guint32 session_id, gboolean create )
 {
+  iextops_session *session;
+
+  session = ( iextops_session * ) g_hash_table_lookup( iextops_sessions, GUINT_TO_POINTER( session_id ) );
+  if ( NULL == session && create )
+    {
+      session = g_new0( iextops_session, 1 );
+      session->book = iex_quote_book_new();
+      session->ckpts = iex_ckpt_store_new( sizeof( iex_quote ), iextops_ckpt_frames,
+                                           ( gint64 ) iextops_ckpt_ms * 1000000L );
+      g_hash_table_insert( iextops_sessions, GUINT_TO_POINTER( session_id ), session );
+    }
+
+  return session;
+}
+
+
+/*
+ * Update the session's top of book with this quote and check it, only ever
+ * done on the first (in-order) pass, the result is then cached per message.
+ */
+static iextops_quote_result *
+iextops_check_quote( tvbuff_t             *tvb,
+                     packet_info          *pinfo,
+                     const iextp_msg_info *msg_info )
+{
+  iextops_quote_result *result;
+  iextops_session *session;
+  iex_quote quote;
+  iex_quote *prev;
+  guint32 slot;
+
+  result = ( iextops_quote_result * ) p_get_proto_data( wmem_file_scope(), pinfo, proto_iextops, msg_info->index );
+  if ( NULL != result || PINFO_FD_VISITED( pinfo ) )
+    {
+      return result;
+    }
+
+  session = iextops_get_session( msg_info->session, TRUE );
+
+  tvb_memcpy( tvb, quote.symbol, offsetof( iextops_msg, symbol ), IEX_SYMBOL_LEN );
+  quote.timestamp = tvb_get_letoh64( tvb, offsetof( iextops_msg, timestamp ) );
+  quote.bid_size = tvb_get_letohl( tvb, offsetof( iextops_msg, bid_size ) );
+  quote.bid_price = tvb_get_letoh64( tvb, offsetof( iextops_msg, bid_price ) );
+  quote.ask_price = tvb_get_letoh64( tvb, offsetof( iextops_msg, ask_price ) );
+  quote.ask_size = tvb_get_letohl( tvb, offsetof( iextops_msg, ask_size ) );
+
+  slot = iex_quote_book_intern( session->book, quote.symbol );
+
+  /* Journal the update against the book as it was before it, only needed to show the book */
+  if ( iextops_show_book )
+    {
+      iex_ckpt_store_record( session->ckpts, pinfo->fd->num, msg_info->send_time, slot, &quote,
+                             iex_quote_book_quotes( session->book ), iex_quote_book_size( session->book ) );
+    }
+
+  prev = iex_quote_book_get( session->book, slot );
+
+  result = wmem_new0( wmem_file_scope(), iextops_quote_result );
+  result->flags = iex_quote_check( prev, &quote, ( gint64 ) iextops_stale_ms * 1000000L );
+  if ( 0 != prev->timestamp )
+    {
+      result->stale_ns = quote.timestamp - prev->timestamp;
+    }
+
+  *prev = quote;
+
+  p_add_proto_data( wmem_file_scope(), pinfo, proto_iextops, msg_info->index, result );
+
+  return result;
+}
+
+
+static void
+iextops_add_quote_info( packet_info                *pinfo,
+                        proto_item                 *ti,
+                        const iextops_quote_result *result )
+{
+  if ( result->flags & IEX_QUOTE_CROSSED )
+    {
+      expert_add_info( pinfo, ti, &ei_iextops_errors[IEXTOPS_EF_CROSSED] );
+    }
+
+  if ( result->flags & IEX_QUOTE_LOCKED )
+    {
+      expert_add_info( pinfo, ti, &ei_iextops_errors[IEXTOPS_EF_LOCKED] );
+    }
+
+  if ( result->flags & ( IEX_QUOTE_ZERO_BID_SIZE | IEX_QUOTE_ZERO_ASK_SIZE ) )
+    {
+      expert_add_info_format( pinfo, ti, &ei_iextops_errors[IEXTOPS_EF_ZERO_SIZE],
+                              "Zero size with a price on the %s",
+                              ( result->flags & IEX_QUOTE_ZERO_BID_SIZE )
+                              ? ( ( result->flags & IEX_QUOTE_ZERO_ASK_SIZE ) ? "bid and ask" : "bid" )
+                              : "ask" );
+    }
+
+  if ( result->flags & IEX_QUOTE_STALE )
+    {
+      expert_add_info_format( pinfo, ti, &ei_iextops_errors[IEXTOPS_EF_STALE],
+                              "Quote was stale for %" G_GINT64_FORMAT ".%06" G_GINT64_FORMAT " ms",
+                              result->stale_ns / 1000000, result->stale_ns % 1000000 );
+    }
+}
+
+
+/* Parse a UTC time of day, "HH:MM:SS[.fraction]", into nanoseconds */
+static gboolean
+iextops_parse_time_of_day( const char *str, gint64 *tod_ns )
+{
+  guint hours, mins, secs;
+  gint64 frac_ns = 0;
+  gint64 scale = 100000000L;
+  int used = 0;
+
+  if ( 3 != sscanf( str, "%u:%u:%u%n", &hours, &mins, &secs, &used ) || hours > 23 || mins > 59 || secs > 60 )
+    {
+      return FALSE;
+    }
+
+  str += used;
+  if ( '.' == *str )
+    {
+      for ( str++; *str >= '0' && *str <= '9' && 0 < scale; str++, scale /= 10 )
+        {
+          frac_ns += ( *str - '0' ) * scale;
+        }
+    }
+
+  *tod_ns = ( ( hours * 60 + mins ) * 60 + secs ) * 1000000000L + frac_ns;
+
+  return TRUE;
+}
+
+
+/*
+ * Show the session's whole top of book, as of the end of this frame or as of
+ * the "book_time" preference on this segment's day, rebuilt from the nearest
+ * checkpoint rather than by replaying the capture from the start.
+ */
+static void
+iextops_add_book( tvbuff_t             *tvb,
+                  packet_info          *pinfo,
+                  proto_tree           *ptree,
+                  const iextp_msg_info *msg_info )
+{
+  iextops_session *session;
+  proto_item *ti;
+  proto_tree *book_tree;
+  gint64 tod_ns;
+  gint64 at;
+
+  session = iextops_get_session( msg_info->session, FALSE );
+  if ( NULL == session )
+    {
+      return;
+    }
+
+  if ( NULL != iextops_book_time && '\0' != *iextops_book_time
+       && iextops_parse_time_of_day( iextops_book_time, &tod_ns ) )
+    {
+      at = msg_info->send_time - ( msg_info->send_time % ( 86400L * 1000000000L ) ) + tod_ns;
+      iex_ckpt_store_restore_time( session->ckpts, at, iextops_book_scratch );
+      ti = proto_tree_add_text( ptree, tvb, 0, 0, "Top of Book at %s UTC (session %" G_GUINT32_FORMAT ")",
+                                iextops_book_time, msg_info->session );
+    }
+  else
+    {
+      iex_ckpt_store_restore_frame( session->ckpts, pinfo->fd->num, iextops_book_scratch );
+      ti = proto_tree_add_text( ptree, tvb, 0, 0, "Top of Book after frame %u (session %" G_GUINT32_FORMAT ")",
+                                pinfo->fd->num, msg_info->session );
+    }
+
+  PROTO_ITEM_SET_GENERATED( ti );
+  book_tree = proto_item_add_subtree( ti, ett_iextops_book );
+
+  for ( guint i = 0; i < iextops_book_scratch->len; i++ )
+    {
+      const iex_quote *quote = &g_array_index( iextops_book_scratch, iex_quote, i );
+
+      if ( 0 == quote->timestamp )
+        {
+          continue;
+        }
+
+      ti = proto_tree_add_text( book_tree, tvb, 0, 0,
+                                "%.8s %" G_GUINT32_FORMAT " @ %" G_GINT64_FORMAT ".%04" G_GINT64_FORMAT
+                                " x %" G_GINT64_FORMAT ".%04" G_GINT64_FORMAT " @ %" G_GUINT32_FORMAT,
+                                quote->symbol, quote->bid_size, quote->bid_price / 10000, quote->bid_price % 10000,
+                                quote->ask_price / 10000, quote->ask_price % 10000, quote->ask_size );
+      PROTO_ITEM_SET_GENERATED( ti );
+    }
+}
+
+
+static int
+dissect_iextops( tvbuff_t    *tvb,
+                 packet_info *pinfo,
+                 proto_tree  *ptree,
+                 void        *data )
+{
+  const iextp_msg_info *msg_info = ( const iextp_msg_info * ) data;
   proto_item *ti;
   nstime_t tv;
   guint64 price;
 
+  if ( iextops_check_quotes && NULL != msg_info && sizeof( iextops_msg ) <= tvb_captured_length( tvb )
+       && IEXTOPS_MSG_QUOTE == tvb_get_guint8( tvb, offsetof( iextops_msg, msgtype ) ) )
+    {
+      const iextops_quote_result *result;
+
+      result = iextops_check_quote( tvb, pinfo, msg_info );
+      if ( NULL != result && 0 != result->flags )
+        {
+          iextops_add_quote_info( pinfo, proto_tree_get_parent( ptree ), result );
+        }
+    }
+
+  if ( NULL == ptree )
+    {
+      return tvb_captured_length( tvb );
+    }
+
+  if ( iextops_check_quotes && iextops_show_book && NULL != msg_info && 0 == msg_info->index )
+    {
+      iextops_add_book( tvb, pinfo, ptree, msg_info );
+    }
+
   ti = proto_tree_get_parent( ptree );
 
   proto_item_set_text( ti, "%s Message",
@@ -166,15 +432,17 @@ dissect_iextops( tvbuff_t    *tvb __attribute__( ( unused ) ),
                        sizeof( guint32 ), ENC_LITTLE_ENDIAN );
   price = tvb_get_letoh64( tvb, offsetof( iextops_msg, bid_price ) );
   proto_tree_add_text( ptree, tvb, offsetof( iextops_msg, bid_price ), sizeof( gint64 ),
-                       "Bid Price: %" G_GINT64_FORMAT ".%05" G_GINT64_FORMAT,
+                       "Bid Price: %" G_GINT64_FORMAT ".%04" G_GINT64_FORMAT,
                        ( price / 10000 ), ( price - ( ( price / 10000 ) * 10000 ) ) );
 
   price = tvb_get_letoh64( tvb, offsetof( iextops_msg, ask_price ) );
   proto_tree_add_text( ptree, tvb, offsetof( iextops_msg, ask_price ), sizeof( gint64 ),
-                       "Ask Price: %" G_GINT64_FORMAT ".%05" G_GINT64_FORMAT, ( price / 10000 ),
+                       "Ask Price: %" G_GINT64_FORMAT ".%04" G_GINT64_FORMAT, ( price / 10000 ),
                        ( price - ( ( price / 10000 ) * 10000 ) ) );
   proto_tree_add_item( ptree, hf_iextops_filter[IEXTOPS_HF_ASKSIZE], tvb, offsetof( iextops_msg, ask_size ),
                        sizeof( guint32 ), ENC_LITTLE_ENDIAN );
+
+  return tvb_captured_length( tvb );
 }
 
 void
@@ -182,7 +450,7 @@ proto_reg_handoff_iextops( void )
 {
   if ( NULL == iextops_handle )
     {
-      iextops_handle = create_dissector_handle( dissect_iextops, proto_iextops );
+      iextops_handle = new_create_dissector_handle( dissect_iextops, proto_iextops );
       dissector_add_uint( "iextp.proto", IEXTP_PROTO_IEXTOPS, iextops_handle );
     }
 }
@@ -327,7 +595,8 @@ proto_register_iextops( void )
 
   static int *ett[] =
   {
-    &ett_iextops
+    &ett_iextops,
+    &ett_iextops_book
   };
 
   static ei_register_info ei[] =
@@ -381,12 +650,53 @@ proto_register_iextops( void )
         .summary  = "Previous messages not captured (common at capture start)",
         EXPFILL
       }
+    },
+    {
+      .ids    = &ei_iextops_errors[IEXTOPS_EF_CROSSED],
+      .eiinfo = {
+        .name     = "iextops.quote.crossed",
+        .group    = PI_PROTOCOL,
+        .severity = PI_WARN,
+        .summary  = "Crossed quote (bid above ask)",
+        EXPFILL
+      }
+    },
+    {
+      .ids    = &ei_iextops_errors[IEXTOPS_EF_LOCKED],
+      .eiinfo = {
+        .name     = "iextops.quote.locked",
+        .group    = PI_PROTOCOL,
+        .severity = PI_NOTE,
+        .summary  = "Locked quote (bid equals ask)",
+        EXPFILL
+      }
+    },
+    {
+      .ids    = &ei_iextops_errors[IEXTOPS_EF_ZERO_SIZE],
+      .eiinfo = {
+        .name     = "iextops.quote.zero_size",
+        .group    = PI_PROTOCOL,
+        .severity = PI_WARN,
+        .summary  = "Zero size with a price",
+        EXPFILL
+      }
+    },
+    {
+      .ids    = &ei_iextops_errors[IEXTOPS_EF_STALE],
+      .eiinfo = {
+        .name     = "iextops.quote.stale",
+        .group    = PI_SEQUENCE,
+        .severity = PI_NOTE,
+        .summary  = "Quote was not updated within the stale threshold",
+        EXPFILL
+      }
     }
   };
 
   if ( -1 == proto_iextops )
     {
       expert_module_t *expert_iextops;
+      module_t *iextops_module;
 
       proto_iextops = proto_register_protocol( "IEX TOPS", "IEX-TOPS", "iextops" );
 
@@ -395,5 +705,32 @@ proto_register_iextops( void )
 
       expert_iextops = expert_register_protocol( proto_iextops );
       expert_register_field_array( expert_iextops, ei, array_length( ei ) );
+
+      iextops_module = prefs_register_protocol( proto_iextops, NULL );
+      prefs_register_bool_preference( iextops_module, "check_quotes", "Check quotes",
+                                      "Track the last quote for each symbol and flag crossed, locked, zero-size "
+                                      "and stale quotes", &iextops_check_quotes );
+      prefs_register_uint_preference( iextops_module, "stale_threshold", "Stale quote threshold (ms)",
+                                      "Flag a quote whose timestamp is more than this many milliseconds after "
+                                      "the previous quote for the same symbol (0 to disable)",
+                                      10, &iextops_stale_ms );
+      prefs_register_uint_preference( iextops_module, "checkpoint_frames", "Checkpoint interval (frames)",
+                                      "Copy each session's top of book aside every this many frames, so the "
+                                      "book at any frame is rebuilt from the nearest copy (0 to disable)",
+                                      10, &iextops_ckpt_frames );
+      prefs_register_uint_preference( iextops_module, "checkpoint_interval", "Checkpoint interval (ms)",
+                                      "Also copy each session's top of book aside every this many milliseconds "
+                                      "of IEX-TP send time (0 to disable)",
+                                      10, &iextops_ckpt_ms );
+      prefs_register_bool_preference( iextops_module, "show_book", "Show top of book",
+                                      "Show every symbol's quote in the session as of each segment (this keeps "
+                                      "a journal of every quote and the checkpoints above, so costs memory)",
+                                      &iextops_show_book );
+      prefs_register_string_preference( iextops_module, "book_time", "Top of book time (UTC)",
+                                        "Show the top of book as of this UTC time of day (HH:MM:SS.fffffffff) "
+                                        "instead of as of each segment",
+                                        &iextops_book_time );
+
+      register_init_routine( &iextops_init );
     }
 }
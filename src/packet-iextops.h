@@ -30,6 +30,28 @@
 
 G_BEGIN_DECLS
 
+#define IEXTP_PROTO_IEXTOPS 32769
+#define IEXTOPS_SYMBOL_LEN 8
+
+typedef enum _iextops_msg_type
+{
+  IEXTOPS_MSG_QUOTE = 0x51,
+  IEXTOPS_MSG_LAST
+} iextops_msg_type;
+
+/* IEX TOPS Message Structure */
+typedef struct _iextops_msg
+{
+  guint8  msgtype;
+  guint8  flags;
+  gint64  timestamp;
+  gchar   symbol[8];
+  guint32 bid_size;
+  gint64  bid_price;
+  gint64  ask_price;
+  guint32 ask_size;
+} __attribute__( ( packed ) ) iextops_msg;
+
 void proto_reg_handoff_iextops (void);
 void proto_register_iextops (void);
 
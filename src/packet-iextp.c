@@ -37,6 +37,7 @@
 #include <epan/conversation.h>
 #include <epan/packet.h>
 #include <epan/prefs.h>
+#include <epan/tap.h>
 
 #pragma GCC diagnostic error "-Wpadded"
 
@@ -96,26 +97,11 @@ typedef struct _iextp_packet_data
   guint32 __padding;
 } iextp_packet_data;
 
-/* IEX TP Segment Structure */
-typedef struct _iextp_seg
-{
-  guint8  version;
-  guint8  __reserved;
-  guint16 protocol;
-  guint32 channel;
-  guint32 session;
-  guint16 length;
-  guint16 count;
-  gint64  offset;
-  gint64  first_seqno;
-  gint64  send_time;
-  guchar  msg_data[0];
-} __attribute__( ( packed ) ) iextp_seg;
-
 
 /* Classwide Vars */
 static int proto_iextp = -1;
 static int ett_iextp = -1;
+static int iextp_tap = -1;
 
 static dissector_table_t iextp_protocol_dissector_table = NULL;
 static dissector_handle_t iextp_handle = NULL;
@@ -141,7 +127,9 @@ dissect_iextp( tvbuff_t    *tvb,
   guint32 channel;
   gint64 seqno;
   gint64 offset;
+  gint64 send_time;
   dissector_handle_t subproto_handle;
+  proto_tree *iextp_tree = NULL;
 
   col_clear( pinfo->cinfo, COL_INFO );
 
@@ -152,6 +140,7 @@ dissect_iextp( tvbuff_t    *tvb,
   seqno = tvb_get_letoh64( tvb, offsetof( iextp_seg, first_seqno ) );
   offset = tvb_get_letoh64( tvb, offsetof( iextp_seg, offset ) );
   msg_len = tvb_get_h_guint16( tvb, offsetof( iextp_seg, length ) );
+  send_time = tvb_get_letoh64( tvb, offsetof( iextp_seg, send_time ) );
 
   subproto_handle = dissector_get_uint_handle( iextp_protocol_dissector_table, protocol );
   if ( NULL != subproto_handle )
@@ -207,9 +196,7 @@ dissect_iextp( tvbuff_t    *tvb,
   if ( NULL != ptree )
     {
       proto_item *ti;
-      proto_tree *iextp_tree;
       nstime_t tv;
-      guint16 total_len;
 
       ti = proto_tree_add_item( ptree, proto_iextp, tvb, 0, -1, ENC_NA );
       iextp_tree = proto_item_add_subtree( ti, ett_iextp );
@@ -233,35 +220,72 @@ dissect_iextp( tvbuff_t    *tvb,
       proto_tree_add_item( iextp_tree, hf_iextp_filter[IEXTP_HF_SEQNO], tvb, offsetof( iextp_seg, first_seqno ),
                            sizeof( gint64 ), ENC_LITTLE_ENDIAN );
 
-      tv.secs = ( gint64 ) tvb_get_letoh64( tvb, offsetof( iextp_seg, send_time ) ) / 1000000000L;
-      tv.nsecs = ( gint )( tvb_get_letoh64( tvb, offsetof( iextp_seg, send_time ) ) - ( tv.secs * 1000000000L ) );
+      tv.secs = ( gint64 ) send_time / 1000000000L;
+      tv.nsecs = ( gint )( send_time - ( tv.secs * 1000000000L ) );
       proto_tree_add_time( iextp_tree, hf_iextp_filter[IEXTP_HF_SENDTIME], tvb, offsetof( iextp_seg, send_time ),
                            sizeof( gint64 ), &tv );
+    }
+
+  if ( have_tap_listener( iextp_tap ) )
+    {
+      iextp_tap_info *tap_info;
+
+      tap_info = wmem_new( wmem_packet_scope(), iextp_tap_info );
+      tap_info->send_time = send_time;
+      tap_info->frame = pinfo->fd->num;
+      tap_info->channel = channel;
+      tap_info->session = session;
+      tap_info->length = msg_len;
+      tap_info->count = msg_count;
+      tap_queue_packet( iextp_tap, pinfo, tap_info );
+    }
+
+  /*
+   * Sub-protocols see every message, with or without a tree, so they can keep
+   * state on the first pass (e.g. when tshark is not building trees).
+   */
+  if ( NULL != subproto_handle )
+    {
+      iextp_msg_info msg_info;
+      guint16 total_len;
+
+      msg_info.channel = channel;
+      msg_info.session = session;
+      msg_info.send_time = send_time;
+      msg_info.count = msg_count;
+      msg_info.__padding = 0;
 
       total_len = 0;
 
       for ( guint16 msg_i = 0; msg_i < msg_count; msg_i++ )
         {
           proto_tree *msg_ptree;
-          guint16 msg_len;
+          guint16 this_len;
           tvbuff_t *next_tvb;
-          proto_item *pi;
 
-          msg_len = tvb_get_h_guint16( tvb, sizeof( iextp_seg ) );
+          this_len = tvb_get_h_guint16( tvb, sizeof( iextp_seg ) + total_len );
+          next_tvb = tvb_new_subset_length( tvb, sizeof( iextp_seg ) + total_len + sizeof( guint16 ), this_len );
 
-          pi = proto_tree_add_text( iextp_tree, tvb, sizeof( iextp_seg ) + total_len + sizeof( guint16 ),
-                                    sizeof( guint16 ) + msg_len, "Message" );
+          msg_ptree = NULL;
+          if ( NULL != iextp_tree )
+            {
+              proto_item *pi;
 
-          next_tvb = tvb_new_subset_length( tvb, sizeof( iextp_seg ) + total_len + sizeof( guint16 ), msg_len );
+              pi = proto_tree_add_text( iextp_tree, tvb, sizeof( iextp_seg ) + total_len + sizeof( guint16 ),
+                                        sizeof( guint16 ) + this_len, "Message" );
 
-          msg_ptree = proto_item_add_subtree( pi, msg_i );
+              msg_ptree = proto_item_add_subtree( pi, msg_i );
 
-          proto_tree_add_item( msg_ptree, hf_iextp_filter[IEXTP_HF_MSGLEN], tvb, sizeof( iextp_seg ) + total_len,
-                               sizeof( guint16 ), ENC_LITTLE_ENDIAN );
+              proto_tree_add_item( msg_ptree, hf_iextp_filter[IEXTP_HF_MSGLEN], tvb, sizeof( iextp_seg ) + total_len,
+                                   sizeof( guint16 ), ENC_LITTLE_ENDIAN );
+            }
 
-          call_dissector( subproto_handle, next_tvb, pinfo, msg_ptree );
+          msg_info.index = msg_i;
+          msg_info.seqno = seqno + msg_i;
 
-          total_len += sizeof( guint16 ) + msg_len;
+          call_dissector_with_data( subproto_handle, next_tvb, pinfo, msg_ptree, &msg_info );
+
+          total_len += sizeof( guint16 ) + this_len;
         }
     }
 }
@@ -278,37 +302,7 @@ dissect_iextp_heur( tvbuff_t    *tvb,
       return FALSE;
     }
 
-  if ( 1 != tvb_get_bits8( tvb, offsetof( iextp_seg, version ), 8 ) )
-    {
-      return FALSE;
-    }
-
-  if ( 0 == tvb_get_letohs( tvb, offsetof( iextp_seg, protocol ) ) )
-    {
-      return FALSE;
-    }
-
-  if ( 0 > ( gint64 ) tvb_get_letoh64( tvb, offsetof( iextp_seg, offset ) ) )
-    {
-      return FALSE;
-    }
-
-  if ( 0 > ( gint64 ) tvb_get_letoh64( tvb, offsetof( iextp_seg, first_seqno ) ) )
-    {
-      return FALSE;
-    }
-
-  if ( 0 > ( gint64 ) tvb_get_letoh64( tvb, offsetof( iextp_seg, send_time ) ) )
-    {
-      return FALSE;
-    }
-
-  if ( 0 == tvb_get_h_guint32( tvb, offsetof( iextp_seg, channel ) ) )
-    {
-      return FALSE;
-    }
-
-  if ( 0 == tvb_get_h_guint32( tvb, offsetof( iextp_seg, session ) ) )
+  if ( !iextp_seg_check( tvb_get_ptr( tvb, 0, sizeof( iextp_seg ) ), sizeof( iextp_seg ) ) )
     {
       return FALSE;
     }
@@ -319,6 +313,17 @@ dissect_iextp_heur( tvbuff_t    *tvb,
 }
 
 
+/* The heuristic as a named dissector, so it can be called directly (e.g. by iex-bench) */
+static int
+dissect_iextp_heur_named( tvbuff_t    *tvb,
+                          packet_info *pinfo,
+                          proto_tree  *ptree,
+                          void        *data )
+{
+  return dissect_iextp_heur( tvb, pinfo, ptree, data ) ? ( int ) tvb_captured_length( tvb ) : 0;
+}
+
+
 void
 proto_reg_handoff_iextp( void )
 {
@@ -521,5 +526,10 @@ proto_register_iextp( void )
 
       iextp_protocol_dissector_table = register_dissector_table( "iextp.proto", "IEX-TP Protocol",
                                                                  FT_UINT16, BASE_DEC );
+
+      register_dissector( "iextp", dissect_iextp, proto_iextp );
+      new_register_dissector( "iextp_heur", dissect_iextp_heur_named, proto_iextp );
+
+      iextp_tap = register_tap( "iextp" );
     }
 }
@@ -30,6 +30,97 @@
 
 G_BEGIN_DECLS
 
+/* IEX TP Segment Structure */
+typedef struct _iextp_seg
+{
+  guint8  version;
+  guint8  __reserved;
+  guint16 protocol;
+  guint32 channel;
+  guint32 session;
+  guint16 length;
+  guint16 count;
+  gint64  offset;
+  gint64  first_seqno;
+  gint64  send_time;
+  guchar  msg_data[0];
+} __attribute__( ( packed ) ) iextp_seg;
+
+/*
+ * The checks dissect_iextp_heur() uses to claim a UDP payload as IEX-TP, shared
+ * with the standalone tools so both agree on what a segment is.
+ */
+static inline gboolean
+iextp_seg_check( const guint8 *data, gsize len )
+{
+  const iextp_seg *seg = ( const iextp_seg * ) data;
+
+  if ( sizeof( iextp_seg ) > len )
+    {
+      return FALSE;
+    }
+
+  if ( 1 != seg->version )
+    {
+      return FALSE;
+    }
+
+  if ( 0 == GUINT16_FROM_LE( seg->protocol ) )
+    {
+      return FALSE;
+    }
+
+  if ( 0 > GINT64_FROM_LE( seg->offset ) )
+    {
+      return FALSE;
+    }
+
+  if ( 0 > GINT64_FROM_LE( seg->first_seqno ) )
+    {
+      return FALSE;
+    }
+
+  if ( 0 > GINT64_FROM_LE( seg->send_time ) )
+    {
+      return FALSE;
+    }
+
+  if ( 0 == GUINT32_FROM_LE( seg->channel ) )
+    {
+      return FALSE;
+    }
+
+  if ( 0 == GUINT32_FROM_LE( seg->session ) )
+    {
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Passed as dissector data to the protocol dissectors registered in "iextp.proto" */
+typedef struct _iextp_msg_info
+{
+  guint32 channel;
+  guint32 session;
+  gint64  send_time;
+  gint64  seqno;
+  guint16 index;
+  guint16 count;
+  guint32 __padding;
+} iextp_msg_info;
+
+/* Queued to the "iextp" tap for every segment */
+typedef struct _iextp_tap_info
+{
+  gint64  send_time;
+  guint32 frame;
+  guint32 channel;
+  guint32 session;
+  guint16 length;
+  guint16 count;
+} iextp_tap_info;
+
 void proto_reg_handoff_iextp( void );
 void proto_register_iextp( void );
 
@@ -29,6 +29,7 @@
 
 #include "packet-iextp.h"
 #include "packet-iextops.h"
+#include "tap-iextp-health.h"
 
 G_MODULE_EXPORT void
 plugin_reg_handoff (void)
@@ -43,3 +44,9 @@ plugin_register (void)
   proto_register_iextp();
   proto_register_iextops();
 }
+
+G_MODULE_EXPORT void
+plugin_register_tap_listener (void)
+{
+  register_tap_listener_iextp_health();
+}
@@ -0,0 +1,123 @@
+/*
+ * tap-iextp-health.c - "tshark -z iextp,health" microburst and feed health statistics
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "tap-iextp-health.h"
+#include "packet-iextp.h"
+#include "iex-health.h"
+
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#include <glib.h>
+
+#include <epan/packet.h>
+#include <epan/tap.h>
+#include <epan/stat_cmd_args.h>
+
+#pragma GCC diagnostic error "-Wpadded"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IEXTP_HEALTH_TOP_K 10
+
+/* The same defaults as the iex-health tool: 1us, 10us, 100us and 1ms */
+static const gint64 iextp_health_windows[] = { 1000, 10000, 100000, 1000000 };
+
+
+static void
+iextp_health_reset( void *tapdata )
+{
+  iex_health_reset( ( iex_health * ) tapdata );
+}
+
+
+static gboolean
+iextp_health_packet( void           *tapdata,
+                     packet_info    *pinfo __attribute__( ( unused ) ),
+                     epan_dissect_t *edt __attribute__( ( unused ) ),
+                     const void     *data )
+{
+  const iextp_tap_info *info = ( const iextp_tap_info * ) data;
+
+  iex_health_add( ( iex_health * ) tapdata, info->frame, info->send_time, info->channel, info->session, info->count,
+                  info->length );
+
+  return TRUE;
+}
+
+
+static void
+iextp_health_draw( void *tapdata )
+{
+  GString *report;
+
+  report = g_string_new( NULL );
+  iex_health_report( ( iex_health * ) tapdata, report );
+
+  printf( "\n===================================================================\n" );
+  printf( "IEX-TP Feed Health\n" );
+  printf( "===================================================================\n" );
+  fputs( report->str, stdout );
+  printf( "===================================================================\n" );
+
+  g_string_free( report, TRUE );
+}
+
+
+/* -z iextp,health[,filter] */
+static void
+iextp_health_init( const char *opt_arg, void *userdata __attribute__( ( unused ) ) )
+{
+  iex_health *health;
+  const char *filter = NULL;
+  GString *error_string;
+
+  if ( 0 == strncmp( opt_arg, "iextp,health,", strlen( "iextp,health," ) ) )
+    {
+      filter = opt_arg + strlen( "iextp,health," );
+    }
+
+  health = iex_health_new( iextp_health_windows, G_N_ELEMENTS( iextp_health_windows ), IEXTP_HEALTH_TOP_K );
+
+  error_string = register_tap_listener( "iextp", health, filter, 0, iextp_health_reset, iextp_health_packet,
+                                        iextp_health_draw );
+  if ( NULL != error_string )
+    {
+      iex_health_free( health );
+      fprintf( stderr, "tshark: Couldn't register iextp,health tap: %s\n", error_string->str );
+      g_string_free( error_string, TRUE );
+      exit( 1 );
+    }
+}
+
+
+void
+register_tap_listener_iextp_health( void )
+{
+  register_stat_cmd_arg( "iextp,health", iextp_health_init, NULL );
+}
@@ -0,0 +1,37 @@
+/*
+ * tap-iextp-health.h - "tshark -z iextp,health" microburst and feed health statistics
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TAP_IEXTP_HEALTH_H__
+#define __TAP_IEXTP_HEALTH_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+void register_tap_listener_iextp_health( void );
+
+G_END_DECLS
+
+#endif /* __TAP_IEXTP_HEALTH_H__ */
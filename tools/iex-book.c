@@ -0,0 +1,505 @@
+/*
+ * iex-book.c - Shared memory top of book table, published from decoded TOPS quotes
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-book.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+# include <immintrin.h>
+# define iex_book_relax() _mm_pause()
+#else
+# define iex_book_relax() do { } while ( 0 )
+#endif
+
+/* Spins on a slot held odd before checking the publisher is still there */
+#define IEX_BOOK_READ_SPINS ( 1U << 20 )
+
+G_STATIC_ASSERT( 64 == sizeof( iex_book_header ) );
+G_STATIC_ASSERT( 64 == sizeof( iex_book_slot ) );
+G_STATIC_ASSERT( 16 == sizeof( iex_book_entry ) );
+
+struct _iex_book
+{
+  gsize            size;
+  iex_book_header *header;
+  iex_book_entry  *index;
+  iex_book_slot   *slots;
+  guint32          capacity;
+  guint32          mask;
+  guint32          bits;
+  gboolean         writer;
+};
+
+
+G_DEFINE_QUARK( iex-book-error-quark, iex_book_error )
+
+
+static inline guint64
+iex_book_key( const gchar *symbol )
+{
+  guint64 key;
+
+  memcpy( &key, symbol, sizeof( key ) );
+
+  return key;
+}
+
+
+/* The same hash as the quote book's intern table */
+static inline guint32
+iex_book_hash( guint64 key, guint32 bits )
+{
+  return ( guint32 )( ( key * G_GUINT64_CONSTANT( 0x9E3779B97F4A7C15 ) ) >> ( 64 - bits ) );
+}
+
+
+static gsize
+iex_book_layout_size( guint32 capacity, guint32 index_size )
+{
+  return sizeof( iex_book_header ) + ( gsize ) index_size * sizeof( iex_book_entry )
+         + ( gsize ) capacity * sizeof( iex_book_slot );
+}
+
+
+static void
+iex_book_attach( iex_book *book, guint8 *base, gsize size )
+{
+  book->size = size;
+  book->header = ( iex_book_header * ) base;
+  book->capacity = book->header->capacity;
+  book->mask = book->header->index_size - 1;
+  book->bits = ( guint32 ) g_bit_storage( book->mask );
+  book->index = ( iex_book_entry * )( base + sizeof( iex_book_header ) );
+  book->slots = ( iex_book_slot * )( base + sizeof( iex_book_header )
+                                     + ( gsize ) book->header->index_size * sizeof( iex_book_entry ) );
+}
+
+
+/* Map an existing table read-only; any number of readers can share one table */
+iex_book *
+iex_book_open( const gchar *name, GError **error )
+{
+  iex_book *book;
+  struct stat st;
+  iex_book_header *header;
+  void *base;
+  int fd;
+
+  fd = shm_open( name, O_RDONLY, 0 );
+  if ( -1 == fd )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, errno, "%s: %s", name, g_strerror( errno ) );
+      return NULL;
+    }
+
+  if ( -1 == fstat( fd, &st ) )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, errno, "%s: %s", name, g_strerror( errno ) );
+      close( fd );
+      return NULL;
+    }
+
+  if ( ( gsize ) st.st_size < sizeof( iex_book_header ) )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, 0, "%s: not a top of book table", name );
+      close( fd );
+      return NULL;
+    }
+
+  base = mmap( NULL, ( gsize ) st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( MAP_FAILED == base )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, errno, "%s: %s", name, g_strerror( errno ) );
+      return NULL;
+    }
+
+  /* The magic is set last, so check it before believing the rest */
+  header = ( iex_book_header * ) base;
+  if ( IEX_BOOK_MAGIC != __atomic_load_n( &header->magic, __ATOMIC_ACQUIRE ) || IEX_BOOK_VERSION != header->version
+       || 0 == header->index_size ||0 != ( header->index_size & ( header->index_size - 1 ) )
+       || iex_book_layout_size( header->capacity, header->index_size ) > ( gsize ) st.st_size )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, 0, "%s: not a version %d top of book table", name, IEX_BOOK_VERSION );
+      munmap( base, ( gsize ) st.st_size );
+      return NULL;
+    }
+
+  book = g_new0( iex_book, 1 );
+  iex_book_attach( book, ( guint8 * ) base, ( gsize ) st.st_size );
+
+  return book;
+}
+
+
+/*
+ * Create (or replace) a table with room for capacity symbols. Readers of a
+ * table being replaced keep their mapping of the old one, which is marked
+ * closed so they know to open the name again.
+ */
+iex_book *
+iex_book_create( const gchar *name, guint32 capacity, GError **error )
+{
+  iex_book *book;
+  iex_book_header *header;
+  guint32 index_size;
+  gsize size;
+  void *base;
+  int fd;
+
+  if ( 0 == capacity || capacity > G_MAXUINT32 / 4 )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, 0, "invalid capacity %u", capacity );
+      return NULL;
+    }
+
+  /* Keep the index at most half full */
+  index_size = 1U << g_bit_storage( capacity * 2 - 1 );
+  size = iex_book_layout_size( capacity, index_size );
+
+  fd = shm_open( name, O_RDWR, 0 );
+  if ( -1 != fd )
+    {
+      struct stat st;
+
+      if ( 0 == fstat( fd, &st ) && ( gsize ) st.st_size >= sizeof( iex_book_header ) )
+        {
+          base = mmap( NULL, ( gsize ) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+          if ( MAP_FAILED != base )
+            {
+              header = ( iex_book_header * ) base;
+              if ( IEX_BOOK_MAGIC == header->magic )
+                {
+                  __atomic_store_n( &header->closed, 1, __ATOMIC_RELEASE );
+                }
+
+              munmap( base, ( gsize ) st.st_size );
+            }
+        }
+
+      close( fd );
+      shm_unlink( name );
+    }
+
+  fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0644 );
+  if ( -1 == fd )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, errno, "%s: %s", name, g_strerror( errno ) );
+      return NULL;
+    }
+
+  if ( -1 == ftruncate( fd, ( off_t ) size ) )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, errno, "%s: %s", name, g_strerror( errno ) );
+      close( fd );
+      shm_unlink( name );
+      return NULL;
+    }
+
+  base = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( MAP_FAILED == base )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, errno, "%s: %s", name, g_strerror( errno ) );
+      shm_unlink( name );
+      return NULL;
+    }
+
+  /* A new object is zero-filled, so only the header needs setting up; the magic goes last */
+  header = ( iex_book_header * ) base;
+  header->version = IEX_BOOK_VERSION;
+  header->capacity = capacity;
+  header->index_size = index_size;
+  header->publisher_pid = ( guint32 ) getpid();
+  header->created = g_get_real_time() * 1000;
+  __atomic_store_n( &header->magic, IEX_BOOK_MAGIC, __ATOMIC_RELEASE );
+
+  book = g_new0( iex_book, 1 );
+  iex_book_attach( book, ( guint8 * ) base, size );
+  book->writer = TRUE;
+
+  return book;
+}
+
+
+/* A writer's table is marked closed, but left for readers until it is unlinked or replaced */
+void
+iex_book_close( iex_book *book )
+{
+  if ( NULL == book )
+    {
+      return;
+    }
+
+  if ( book->writer )
+    {
+      __atomic_store_n( &book->header->closed, 1, __ATOMIC_RELEASE );
+    }
+
+  munmap( book->header, book->size );
+  g_free( book );
+}
+
+
+gboolean
+iex_book_unlink( const gchar *name, GError **error )
+{
+  if ( -1 == shm_unlink( name ) )
+    {
+      g_set_error( error, IEX_BOOK_ERROR, errno, "%s: %s", name, g_strerror( errno ) );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/*
+ * Return the slot for the given 8-byte symbol, adding it if it is new, or
+ * IEX_BOOK_NO_SLOT once the table is full. Writer only.
+ */
+guint32
+iex_book_intern( iex_book *book, const gchar *symbol )
+{
+  iex_book_entry *entry;
+  guint64 key;
+  guint32 pos;
+  guint32 slot;
+
+  key = iex_book_key( symbol );
+  if ( 0 == key )
+    {
+      return IEX_BOOK_NO_SLOT;
+    }
+
+  pos = iex_book_hash( key, book->bits );
+  while ( 0 != book->index[pos].key )
+    {
+      if ( book->index[pos].key == key )
+        {
+          return book->index[pos].slot;
+        }
+
+      pos = ( pos + 1 ) & book->mask;
+    }
+
+  slot = book->header->n_slots;
+  if ( slot == book->capacity )
+    {
+      return IEX_BOOK_NO_SLOT;
+    }
+
+  memcpy( book->slots[slot].symbol, symbol, IEX_BOOK_SYMBOL_LEN );
+  __atomic_store_n( &book->header->n_slots, slot + 1, __ATOMIC_RELEASE );
+
+  entry = &book->index[pos];
+  entry->slot = slot;
+  __atomic_store_n( &entry->key, key, __ATOMIC_RELEASE );
+
+  return slot;
+}
+
+
+/* Writer only: the quote's symbol is ignored, the slot's stays as interned */
+void
+iex_book_publish( iex_book *book, guint32 slot, const iex_book_quote *quote )
+{
+  iex_book_slot *s = &book->slots[slot];
+  guint32 seq;
+
+  seq = s->seq;
+  __atomic_store_n( &s->seq, seq + 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+
+  s->flags = quote->flags;
+  s->timestamp = quote->timestamp;
+  s->bid_price = quote->bid_price;
+  s->ask_price = quote->ask_price;
+  s->bid_size = quote->bid_size;
+  s->ask_size = quote->ask_size;
+  s->send_time = quote->send_time;
+  s->updates++;
+
+  __atomic_store_n( &s->seq, seq + 2, __ATOMIC_RELEASE );
+  __atomic_store_n( &book->header->updates, book->header->updates + 1, __ATOMIC_RELAXED );
+}
+
+
+void
+iex_book_set_send_time( iex_book *book, gint64 send_time )
+{
+  __atomic_store_n( &book->header->send_time, send_time, __ATOMIC_RELAXED );
+}
+
+
+/* Look up a symbol given as a C string, e.g. "AAPL", padded with spaces as on the wire */
+guint32
+iex_book_lookup( const iex_book *book, const gchar *symbol )
+{
+  gchar padded[IEX_BOOK_SYMBOL_LEN];
+  guint64 key;
+  guint64 found;
+  guint32 pos;
+  gsize len;
+
+  len = strlen( symbol );
+  if ( 0 == len || len > IEX_BOOK_SYMBOL_LEN )
+    {
+      return IEX_BOOK_NO_SLOT;
+    }
+
+  memset( padded, ' ', sizeof( padded ) );
+  memcpy( padded, symbol, len );
+  key = iex_book_key( padded );
+
+  pos = iex_book_hash( key, book->bits );
+  while ( 0 != ( found = __atomic_load_n( &book->index[pos].key, __ATOMIC_ACQUIRE ) ) )
+    {
+      if ( found == key )
+        {
+          return book->index[pos].slot;
+        }
+
+      pos = ( pos + 1 ) & book->mask;
+    }
+
+  return IEX_BOOK_NO_SLOT;
+}
+
+
+/*
+ * Whether the table will not change again: marked closed, or its publisher
+ * is no longer running (killed without closing it, perhaps part way through
+ * an update).
+ */
+static gboolean
+iex_book_header_closed( const iex_book_header *header )
+{
+  guint32 pid;
+
+  if ( 0 != __atomic_load_n( &header->closed, __ATOMIC_ACQUIRE ) )
+    {
+      return TRUE;
+    }
+
+  pid = header->publisher_pid;
+
+  return 0 != pid && -1 == kill( ( pid_t ) pid, 0 ) && ESRCH == errno;
+}
+
+
+/*
+ * Copy a slot, retrying while the writer is part way through changing it.
+ * Readers never write to the table, so they do not slow each other (or the
+ * writer) down. FALSE if the slot has not been interned, or if it has been
+ * part way through an update for a while and the table is closed (so the
+ * update will never finish, and the caller should open the table again).
+ */
+gboolean
+iex_book_read( const iex_book *book, guint32 slot, iex_book_quote *quote )
+{
+  const iex_book_slot *s;
+  guint32 spins = 0;
+  guint32 seq;
+
+  if ( slot >= __atomic_load_n( &book->header->n_slots, __ATOMIC_ACQUIRE ) )
+    {
+      return FALSE;
+    }
+
+  s = &book->slots[slot];
+
+  for ( ;; )
+    {
+      seq = __atomic_load_n( &s->seq, __ATOMIC_ACQUIRE );
+      if ( 0 != ( seq & 1 ) )
+        {
+          if ( ++spins == IEX_BOOK_READ_SPINS )
+            {
+              if ( iex_book_header_closed( book->header ) )
+                {
+                  return FALSE;
+                }
+
+              spins = 0;
+            }
+
+          iex_book_relax();
+          continue;
+        }
+
+      memcpy( quote->symbol, s->symbol, IEX_BOOK_SYMBOL_LEN );
+      quote->flags = s->flags;
+      quote->timestamp = s->timestamp;
+      quote->bid_price = s->bid_price;
+      quote->ask_price = s->ask_price;
+      quote->bid_size = s->bid_size;
+      quote->ask_size = s->ask_size;
+      quote->send_time = s->send_time;
+      quote->updates = s->updates;
+
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+      if ( seq == __atomic_load_n( &s->seq, __ATOMIC_RELAXED ) )
+        {
+          break;
+        }
+    }
+
+  quote->__padding = 0;
+
+  return TRUE;
+}
+
+
+guint32
+iex_book_size( const iex_book *book )
+{
+  return __atomic_load_n( &book->header->n_slots, __ATOMIC_ACQUIRE );
+}
+
+
+/* TRUE once the publisher has exited (or been killed) or replaced the table, so it will not change again */
+gboolean
+iex_book_is_closed( const iex_book *book )
+{
+  return iex_book_header_closed( book->header );
+}
+
+
+/* The send time of the last segment the publisher read, which may have had no quotes */
+gint64
+iex_book_send_time( const iex_book *book )
+{
+  return __atomic_load_n( &book->header->send_time, __ATOMIC_RELAXED );
+}
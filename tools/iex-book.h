@@ -0,0 +1,136 @@
+/*
+ * iex-book.h - Shared memory top of book table, published from decoded TOPS quotes
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_BOOK_H__
+#define __IEX_BOOK_H__
+
+/* Installed, so the padding checks are popped again at the end rather than left on for includers */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+/* "IEXBOOK" and a layout version in the last byte */
+#define IEX_BOOK_MAGIC   0x014b4f4f42584549ULL
+#define IEX_BOOK_VERSION 1
+
+#define IEX_BOOK_DEFAULT_NAME "/iex-book"
+#define IEX_BOOK_DEFAULT_CAPACITY 16384
+
+#define IEX_BOOK_SYMBOL_LEN 8
+
+/* Returned by lookups for symbols which are not in the table */
+#define IEX_BOOK_NO_SLOT G_MAXUINT32
+
+/*
+ * The shared memory object is a header, then an index from symbol to slot
+ * (open addressed, index_size entries), then capacity slots, all on cache
+ * line boundaries. There is one writer, which only ever adds symbols: an
+ * index entry's slot is set before its key, and a slot's symbol before it is
+ * counted in n_slots, so readers never see either half made.
+ */
+typedef struct _iex_book_header
+{
+  guint64 magic;
+  guint32 version;
+  guint32 capacity;
+  guint32 index_size;
+  guint32 n_slots;
+  guint32 closed;
+  guint32 publisher_pid;
+  gint64  created;
+  gint64  send_time;
+  guint64 updates;
+  guint8  __padding[8];
+} __attribute__( ( aligned( 64 ) ) ) iex_book_header;
+
+typedef struct _iex_book_entry
+{
+  guint64 key;
+  guint32 slot;
+  guint32 __padding;
+} iex_book_entry;
+
+/*
+ * One symbol's quote, a cache line each so updates to one symbol never slow
+ * down readers of another. seq is a seqlock: odd while the writer is
+ * changing the rest, and bumped again when it is done.
+ */
+typedef struct _iex_book_slot
+{
+  guint32 seq;
+  guint32 flags;
+  gchar   symbol[IEX_BOOK_SYMBOL_LEN];
+  gint64  timestamp;
+  gint64  bid_price;
+  gint64  ask_price;
+  guint32 bid_size;
+  guint32 ask_size;
+  gint64  send_time;
+  guint64 updates;
+} __attribute__( ( aligned( 64 ) ) ) iex_book_slot;
+
+/* A consistent copy of a slot */
+typedef struct _iex_book_quote
+{
+  gchar   symbol[IEX_BOOK_SYMBOL_LEN];
+  gint64  timestamp;
+  gint64  bid_price;
+  gint64  ask_price;
+  guint32 bid_size;
+  guint32 ask_size;
+  gint64  send_time;
+  guint64 updates;
+  guint32 flags;
+  guint32 __padding;
+} iex_book_quote;
+
+typedef struct _iex_book iex_book;
+
+/* Readers */
+iex_book *iex_book_open( const gchar *name, GError **error );
+void iex_book_close( iex_book *book );
+
+guint32 iex_book_lookup( const iex_book *book, const gchar *symbol );
+gboolean iex_book_read( const iex_book *book, guint32 slot, iex_book_quote *quote );
+guint32 iex_book_size( const iex_book *book );
+gboolean iex_book_is_closed( const iex_book *book );
+gint64 iex_book_send_time( const iex_book *book );
+
+/* The writer */
+iex_book *iex_book_create( const gchar *name, guint32 capacity, GError **error );
+guint32 iex_book_intern( iex_book *book, const gchar *symbol );
+void iex_book_publish( iex_book *book, guint32 slot, const iex_book_quote *quote );
+void iex_book_set_send_time( iex_book *book, gint64 send_time );
+gboolean iex_book_unlink( const gchar *name, GError **error );
+
+GQuark iex_book_error_quark( void );
+#define IEX_BOOK_ERROR iex_book_error_quark()
+
+G_END_DECLS
+
+#pragma GCC diagnostic pop
+
+#endif /* __IEX_BOOK_H__ */
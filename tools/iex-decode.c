@@ -0,0 +1,822 @@
+/*
+ * iex-decode.c - Batch decoder for IEX-TP/TOPS captures
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-pcap.h"
+#include "iex-seg.h"
+#include "iex-spsc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pipelined mode: bytes of segments per batch, and batches in flight per ring */
+#define DECODE_BATCH_BYTES ( 256U << 10 )
+#define DECODE_BATCH_ITEMS ( DECODE_BATCH_BYTES / ( sizeof( guint16 ) + sizeof( iextops_msg ) ) + 1 )
+#define DECODE_RING_DEPTH 8
+
+/* Flush formatted output once this much is buffered */
+#define DECODE_OUTPUT_FLUSH ( 1U << 20 )
+
+/* Totals for one run */
+typedef struct _iex_decode_stats
+{
+  guint64 bytes;
+  guint64 packets;
+  guint64 segments;
+  guint64 heartbeats;
+  guint64 messages;
+  guint64 quotes;
+  guint64 gaps;
+  guint64 gap_messages;
+  guint64 duplicates;
+} iex_decode_stats;
+
+/* A decoded quote, with where it came from */
+typedef struct _decode_item
+{
+  iex_quote quote;
+  gint64    send_time;
+  gint64    seqno;
+  guint32   channel;
+  guint32   session;
+} decode_item;
+
+/*
+ * A unit of work passed between pipeline stages: length-prefixed IEX-TP
+ * payloads, and (once decoded) the quotes found in them.
+ */
+typedef struct _decode_batch
+{
+  guint64      seq;
+  guint8      *data;
+  decode_item *items;
+  gsize        used;
+  guint        n_items;
+  guint        n_segs;
+  gboolean     last;
+  guint        shard;
+} decode_batch;
+
+/* Pipelined mode state */
+typedef struct _decode_pipeline
+{
+  iex_pcap_reader  *reader;
+  GError           *error;
+  iex_spsc         *raw;
+  iex_spsc         *raw_free;
+  iex_spsc        **shard_in;
+  iex_spsc        **shard_out;
+  iex_spsc        **shard_free;
+  GPtrArray        *batches;
+  iex_decode_stats *shard_stats;
+  iex_decode_stats  read_stats;
+  iex_decode_stats  seg_stats;
+  guint             n_shards;
+  gboolean          pin;
+} decode_pipeline;
+
+/* Pipeline thread arguments */
+typedef struct _decode_stage
+{
+  decode_pipeline *pipeline;
+  guint            shard;
+  guint            cpu;
+} decode_stage;
+
+/* Command line options */
+static gint decode_threads = 0;
+static gint decode_shards = 0;
+static gboolean decode_print = FALSE;
+static gboolean decode_quiet = FALSE;
+static gboolean decode_pipelined = FALSE;
+static gboolean decode_pin = TRUE;
+static gchar **decode_files = NULL;
+
+static GOptionEntry decode_options[] =
+{
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &decode_threads,
+    "Decompression threads for compressed captures (default: all processors)", "N" },
+  { "print", 'p', 0, G_OPTION_ARG_NONE, &decode_print, "Print every TOPS quote", NULL },
+  { "quiet", 'q', 0, G_OPTION_ARG_NONE, &decode_quiet, "Do not print the summary", NULL },
+  { "pipeline", 'P', 0, G_OPTION_ARG_NONE, &decode_pipelined,
+    "Decode on a pipeline of threads: reading, segment checks, TOPS decoding and output", NULL },
+  { "shards", 's', 0, G_OPTION_ARG_INT, &decode_shards,
+    "TOPS decoding threads in pipelined mode, sessions are split between them (default: 2)", "N" },
+  { "no-pin", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &decode_pin,
+    "Do not pin each pipeline stage to its own CPU", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &decode_files, NULL, "CAPTURE..." },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+static void
+decode_stats_add( iex_decode_stats *total, const iex_decode_stats *stats )
+{
+  total->bytes += stats->bytes;
+  total->packets += stats->packets;
+  total->segments += stats->segments;
+  total->heartbeats += stats->heartbeats;
+  total->messages += stats->messages;
+  total->quotes += stats->quotes;
+  total->gaps += stats->gaps;
+  total->gap_messages += stats->gap_messages;
+  total->duplicates += stats->duplicates;
+}
+
+
+/* Check a segment's sequence numbers against the next expected for its session */
+static void
+decode_track_gaps( GHashTable *next_seqnos, const iex_seg *seg, iex_decode_stats *stats )
+{
+  gint64 *next;
+
+  next = ( gint64 * ) g_hash_table_lookup( next_seqnos, GUINT_TO_POINTER( seg->session ) );
+  if ( NULL == next )
+    {
+      next = g_new( gint64, 1 );
+      *next = seg->first_seqno;
+      g_hash_table_insert( next_seqnos, GUINT_TO_POINTER( seg->session ), next );
+    }
+
+  if ( seg->first_seqno > *next )
+    {
+      stats->gaps++;
+      stats->gap_messages += ( guint64 )( seg->first_seqno - *next );
+    }
+  else if ( 0 != seg->count && seg->first_seqno + seg->count <= *next )
+    {
+      stats->duplicates++;
+    }
+
+  *next = MAX( *next, seg->first_seqno + seg->count );
+}
+
+
+/* Decode a segment's TOPS quotes into items, returns how many */
+static guint
+decode_segment( const iex_seg *seg, decode_item *items, iex_decode_stats *stats )
+{
+  iex_seg_iter iter;
+  const guint8 *msg;
+  guint16 msg_len;
+  guint n_items = 0;
+
+  iex_seg_iter_init( &iter, seg );
+  while ( NULL != ( msg = iex_seg_iter_next( &iter, &msg_len ) ) )
+    {
+      decode_item *item = &items[n_items];
+
+      stats->messages++;
+
+      if ( IEXTP_PROTO_IEXTOPS == seg->protocol && iex_tops_quote( msg, msg_len, &item->quote ) )
+        {
+          stats->quotes++;
+
+          item->send_time = seg->send_time;
+          item->seqno = seg->first_seqno + iter.index - 1;
+          item->channel = seg->channel;
+          item->session = seg->session;
+          n_items++;
+        }
+    }
+
+  return n_items;
+}
+
+
+static void
+decode_format_item( GString *out, const decode_item *item )
+{
+  const iex_quote *quote = &item->quote;
+
+  g_string_append_printf( out, "%" G_GINT64_FORMAT " %" G_GUINT32_FORMAT " %" G_GINT64_FORMAT " %.8s %" G_GUINT32_FORMAT
+                          " %" G_GINT64_FORMAT ".%04" G_GINT64_FORMAT " %" G_GINT64_FORMAT ".%04" G_GINT64_FORMAT " %"
+                          G_GUINT32_FORMAT "\n",
+                          item->send_time, item->session, item->seqno, quote->symbol, quote->bid_size,
+                          quote->bid_price / 10000, quote->bid_price % 10000, quote->ask_price / 10000,
+                          quote->ask_price % 10000, quote->ask_size );
+}
+
+
+static void
+decode_flush( GString *out, gboolean force )
+{
+  if ( out->len >= DECODE_OUTPUT_FLUSH || ( force && 0 != out->len ) )
+    {
+      fwrite( out->str, 1, out->len, stdout );
+      g_string_truncate( out, 0 );
+    }
+}
+
+
+/*
+ * Serial mode
+ */
+
+static gboolean
+decode_file_serial( const gchar *path, iex_decode_stats *stats, GError **error )
+{
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  GError *local_error = NULL;
+  GHashTable *next_seqnos;
+  decode_item *items;
+  GString *out;
+  guint32 linktype;
+
+  reader = iex_pcap_open( path, ( guint ) decode_threads, error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  linktype = iex_pcap_linktype( reader );
+  next_seqnos = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, g_free );
+  items = g_new( decode_item, G_MAXUINT16 + 1 );
+  out = g_string_sized_new( 2 * DECODE_OUTPUT_FLUSH );
+
+  while ( iex_pcap_next( reader, &record, &local_error ) )
+    {
+      iex_udp udp;
+      iex_seg seg;
+      guint n_items;
+
+      stats->packets++;
+      stats->bytes += 16 + record.caplen;
+
+      if ( !iex_pcap_udp( linktype, record.data, record.caplen, &udp ) || !iex_seg_parse( udp.payload, udp.len, &seg ) )
+        {
+          continue;
+        }
+
+      stats->segments++;
+      decode_track_gaps( next_seqnos, &seg, stats );
+      if ( 0 == seg.length )
+        {
+          stats->heartbeats++;
+          continue;
+        }
+
+      n_items = decode_segment( &seg, items, stats );
+      if ( decode_print )
+        {
+          for ( guint i = 0; i < n_items; i++ )
+            {
+              decode_format_item( out, &items[i] );
+            }
+
+          decode_flush( out, FALSE );
+        }
+    }
+
+  decode_flush( out, TRUE );
+  g_string_free( out, TRUE );
+  g_free( items );
+  g_hash_table_destroy( next_seqnos );
+  iex_pcap_close( reader );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_prefixed_error( error, local_error, "%s: ", path );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/*
+ * Pipelined mode
+ *
+ *   read -> segments -> TOPS shard 0..n-1 -> output
+ *
+ * Each arrow is an SPSC ring of batches, and every batch comes from a fixed
+ * pool which is handed back upstream once used, so a slow stage stalls the
+ * ones before it instead of letting buffers grow. Batches are numbered as the
+ * segment stage sends them on, and output takes them back in that order.
+ */
+
+static decode_batch *
+decode_batch_new( decode_pipeline *pipeline, gboolean with_items )
+{
+  decode_batch *batch;
+
+  batch = g_new0( decode_batch, 1 );
+  batch->data = g_malloc( DECODE_BATCH_BYTES );
+  if ( with_items )
+    {
+      batch->items = g_new( decode_item, DECODE_BATCH_ITEMS );
+    }
+
+  g_ptr_array_add( pipeline->batches, batch );
+
+  return batch;
+}
+
+
+static void
+decode_batch_free( gpointer data )
+{
+  decode_batch *batch = ( decode_batch * ) data;
+
+  g_free( batch->data );
+  g_free( batch->items );
+  g_free( batch );
+}
+
+
+static inline void
+decode_batch_reset( decode_batch *batch )
+{
+  batch->used = 0;
+  batch->n_items = 0;
+  batch->n_segs = 0;
+  batch->last = FALSE;
+}
+
+
+static inline gboolean
+decode_batch_append( decode_batch *batch, const guint8 *payload, guint32 len )
+{
+  if ( DECODE_BATCH_BYTES - batch->used < sizeof( guint32 ) + len )
+    {
+      return FALSE;
+    }
+
+  memcpy( batch->data + batch->used, &len, sizeof( guint32 ) );
+  memcpy( batch->data + batch->used + sizeof( guint32 ), payload, len );
+  batch->used += sizeof( guint32 ) + len;
+  batch->n_segs++;
+
+  return TRUE;
+}
+
+
+/* Iterate a batch's payloads, pos starts at zero */
+static inline const guint8 *
+decode_batch_next( const decode_batch *batch, gsize *pos, guint32 *len )
+{
+  const guint8 *payload;
+
+  if ( *pos >= batch->used )
+    {
+      return NULL;
+    }
+
+  memcpy( len, batch->data + *pos, sizeof( guint32 ) );
+  payload = batch->data + *pos + sizeof( guint32 );
+  *pos += sizeof( guint32 ) + *len;
+
+  return payload;
+}
+
+
+static void
+decode_stage_start( const decode_stage *stage )
+{
+  if ( stage->pipeline->pin && !iex_pin_thread( stage->cpu ) )
+    {
+      g_printerr( "could not pin thread to CPU %u\n", stage->cpu );
+    }
+}
+
+
+/* Stage 1: read the capture, keep UDP payloads big enough to be IEX-TP */
+static gpointer
+decode_read_stage( gpointer data )
+{
+  decode_stage *stage = ( decode_stage * ) data;
+  decode_pipeline *pipeline = stage->pipeline;
+  iex_decode_stats *stats = &pipeline->read_stats;
+  iex_pcap_record record;
+  decode_batch *batch;
+  guint32 linktype;
+
+  decode_stage_start( stage );
+
+  linktype = iex_pcap_linktype( pipeline->reader );
+  batch = ( decode_batch * ) iex_spsc_pop_wait( pipeline->raw_free );
+  decode_batch_reset( batch );
+
+  while ( iex_pcap_next( pipeline->reader, &record, &pipeline->error ) )
+    {
+      iex_udp udp;
+
+      stats->packets++;
+      stats->bytes += 16 + record.caplen;
+
+      if ( !iex_pcap_udp( linktype, record.data, record.caplen, &udp ) || sizeof( iextp_seg ) > udp.len )
+        {
+          continue;
+        }
+
+      if ( !decode_batch_append( batch, udp.payload, udp.len ) )
+        {
+          iex_spsc_push_wait( pipeline->raw, batch );
+          batch = ( decode_batch * ) iex_spsc_pop_wait( pipeline->raw_free );
+          decode_batch_reset( batch );
+          decode_batch_append( batch, udp.payload, udp.len );
+        }
+    }
+
+  batch->last = TRUE;
+  iex_spsc_push_wait( pipeline->raw, batch );
+
+  return NULL;
+}
+
+
+/* Stage 2: validate segments, track gaps, and split them by session into shards */
+static gpointer
+decode_segment_stage( gpointer data )
+{
+  decode_stage *stage = ( decode_stage * ) data;
+  decode_pipeline *pipeline = stage->pipeline;
+  iex_decode_stats *stats = &pipeline->seg_stats;
+  GHashTable *next_seqnos;
+  decode_batch **current;
+  guint64 seq = 0;
+  gboolean last = FALSE;
+
+  decode_stage_start( stage );
+
+  next_seqnos = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, g_free );
+  current = g_new0( decode_batch *, pipeline->n_shards );
+
+  while ( !last )
+    {
+      decode_batch *raw;
+      const guint8 *payload;
+      guint32 len;
+      gsize pos = 0;
+
+      raw = ( decode_batch * ) iex_spsc_pop_wait( pipeline->raw );
+      last = raw->last;
+
+      while ( NULL != ( payload = decode_batch_next( raw, &pos, &len ) ) )
+        {
+          iex_seg seg;
+          guint shard;
+
+          if ( !iex_seg_parse( payload, len, &seg ) )
+            {
+              continue;
+            }
+
+          stats->segments++;
+          decode_track_gaps( next_seqnos, &seg, stats );
+          if ( 0 == seg.length )
+            {
+              stats->heartbeats++;
+              continue;
+            }
+
+          shard = seg.session % pipeline->n_shards;
+          if ( NULL != current[shard] && !decode_batch_append( current[shard], payload, len ) )
+            {
+              current[shard]->seq = seq++;
+              iex_spsc_push_wait( pipeline->shard_in[shard], current[shard] );
+              current[shard] = NULL;
+            }
+
+          if ( NULL == current[shard] )
+            {
+              current[shard] = ( decode_batch * ) iex_spsc_pop_wait( pipeline->shard_free[shard] );
+              decode_batch_reset( current[shard] );
+              decode_batch_append( current[shard], payload, len );
+            }
+        }
+
+      iex_spsc_push_wait( pipeline->raw_free, raw );
+    }
+
+  /* Flush what is left, then tell every shard (and through it, output) to stop */
+  for ( guint shard = 0; shard < pipeline->n_shards; shard++ )
+    {
+      if ( NULL != current[shard] )
+        {
+          current[shard]->seq = seq++;
+          iex_spsc_push_wait( pipeline->shard_in[shard], current[shard] );
+        }
+    }
+
+  for ( guint shard = 0; shard < pipeline->n_shards; shard++ )
+    {
+      decode_batch *end;
+
+      end = ( decode_batch * ) iex_spsc_pop_wait( pipeline->shard_free[shard] );
+      decode_batch_reset( end );
+      end->seq = seq++;
+      end->last = TRUE;
+      iex_spsc_push_wait( pipeline->shard_in[shard], end );
+    }
+
+  g_free( current );
+  g_hash_table_destroy( next_seqnos );
+
+  return NULL;
+}
+
+
+/* Stage 3: decode the TOPS messages of one shard's sessions */
+static gpointer
+decode_tops_stage( gpointer data )
+{
+  decode_stage *stage = ( decode_stage * ) data;
+  decode_pipeline *pipeline = stage->pipeline;
+  iex_decode_stats *stats = &pipeline->shard_stats[stage->shard];
+  gboolean last = FALSE;
+
+  decode_stage_start( stage );
+
+  while ( !last )
+    {
+      decode_batch *batch;
+      const guint8 *payload;
+      guint32 len;
+      gsize pos = 0;
+
+      batch = ( decode_batch * ) iex_spsc_pop_wait( pipeline->shard_in[stage->shard] );
+      last = batch->last;
+
+      while ( NULL != ( payload = decode_batch_next( batch, &pos, &len ) ) )
+        {
+          iex_seg seg;
+
+          if ( iex_seg_parse( payload, len, &seg ) )
+            {
+              batch->n_items += decode_segment( &seg, batch->items + batch->n_items, stats );
+            }
+        }
+
+      iex_spsc_push_wait( pipeline->shard_out[stage->shard], batch );
+    }
+
+  return NULL;
+}
+
+
+/* Stage 4: format the decoded quotes, in the order the segment stage numbered them */
+static gpointer
+decode_output_stage( gpointer data )
+{
+  decode_stage *stage = ( decode_stage * ) data;
+  decode_pipeline *pipeline = stage->pipeline;
+  GString *out;
+  guint64 seq = 0;
+  guint done = 0;
+  guint waits = 0;
+
+  decode_stage_start( stage );
+
+  out = g_string_sized_new( 2 * DECODE_OUTPUT_FLUSH );
+
+  while ( done < pipeline->n_shards )
+    {
+      decode_batch *batch = NULL;
+      guint shard;
+
+      for ( shard = 0; shard < pipeline->n_shards; shard++ )
+        {
+          batch = ( decode_batch * ) iex_spsc_peek( pipeline->shard_out[shard] );
+          if ( NULL != batch && seq == batch->seq )
+            {
+              break;
+            }
+
+          batch = NULL;
+        }
+
+      if ( NULL == batch )
+        {
+          if ( ++waits > 256 )
+            {
+              g_usleep( 20 );
+            }
+          continue;
+        }
+
+      waits = 0;
+      iex_spsc_pop( pipeline->shard_out[shard] );
+      seq++;
+
+      if ( batch->last )
+        {
+          done++;
+        }
+
+      if ( decode_print )
+        {
+          for ( guint i = 0; i < batch->n_items; i++ )
+            {
+              decode_format_item( out, &batch->items[i] );
+            }
+
+          decode_flush( out, FALSE );
+        }
+
+      iex_spsc_push_wait( pipeline->shard_free[shard], batch );
+    }
+
+  decode_flush( out, TRUE );
+  g_string_free( out, TRUE );
+
+  return NULL;
+}
+
+
+static gboolean
+decode_file_pipelined( const gchar *path, iex_decode_stats *stats, GError **error )
+{
+  decode_pipeline pipeline;
+  decode_stage *stages;
+  GThread **threads;
+  guint n_stages;
+  guint i;
+
+  memset( &pipeline, 0, sizeof( pipeline ) );
+  pipeline.reader = iex_pcap_open( path, ( guint ) decode_threads, error );
+  if ( NULL == pipeline.reader )
+    {
+      return FALSE;
+    }
+
+  pipeline.n_shards = ( guint ) decode_shards;
+  pipeline.pin = decode_pin;
+  pipeline.batches = g_ptr_array_new_with_free_func( decode_batch_free );
+  pipeline.shard_stats = g_new0( iex_decode_stats, pipeline.n_shards );
+
+  pipeline.raw = iex_spsc_new( DECODE_RING_DEPTH );
+  pipeline.raw_free = iex_spsc_new( DECODE_RING_DEPTH );
+  for ( i = 0; i < DECODE_RING_DEPTH; i++ )
+    {
+      iex_spsc_push( pipeline.raw_free, decode_batch_new( &pipeline, FALSE ) );
+    }
+
+  pipeline.shard_in = g_new0( iex_spsc *, pipeline.n_shards );
+  pipeline.shard_out = g_new0( iex_spsc *, pipeline.n_shards );
+  pipeline.shard_free = g_new0( iex_spsc *, pipeline.n_shards );
+  for ( guint shard = 0; shard < pipeline.n_shards; shard++ )
+    {
+      pipeline.shard_in[shard] = iex_spsc_new( DECODE_RING_DEPTH );
+      pipeline.shard_out[shard] = iex_spsc_new( DECODE_RING_DEPTH );
+      pipeline.shard_free[shard] = iex_spsc_new( DECODE_RING_DEPTH );
+      for ( i = 0; i < DECODE_RING_DEPTH; i++ )
+        {
+          iex_spsc_push( pipeline.shard_free[shard], decode_batch_new( &pipeline, TRUE ) );
+        }
+    }
+
+  /* One CPU each, in pipeline order */
+  n_stages = 3 + pipeline.n_shards;
+  stages = g_new0( decode_stage, n_stages );
+  threads = g_new0( GThread *, n_stages );
+  for ( i = 0; i < n_stages; i++ )
+    {
+      stages[i].pipeline = &pipeline;
+      stages[i].cpu = i;
+      stages[i].shard = i >= 2 ? i - 2 : 0;
+    }
+
+  threads[0] = g_thread_new( "iex-read", decode_read_stage, &stages[0] );
+  threads[1] = g_thread_new( "iex-segments", decode_segment_stage, &stages[1] );
+  for ( i = 2; i < n_stages - 1; i++ )
+    {
+      threads[i] = g_thread_new( "iex-tops", decode_tops_stage, &stages[i] );
+    }
+  threads[n_stages - 1] = g_thread_new( "iex-output", decode_output_stage, &stages[n_stages - 1] );
+
+  for ( i = 0; i < n_stages; i++ )
+    {
+      g_thread_join( threads[i] );
+    }
+
+  decode_stats_add( stats, &pipeline.read_stats );
+  decode_stats_add( stats, &pipeline.seg_stats );
+  for ( guint shard = 0; shard < pipeline.n_shards; shard++ )
+    {
+      decode_stats_add( stats, &pipeline.shard_stats[shard] );
+      iex_spsc_free( pipeline.shard_in[shard] );
+      iex_spsc_free( pipeline.shard_out[shard] );
+      iex_spsc_free( pipeline.shard_free[shard] );
+    }
+
+  iex_spsc_free( pipeline.raw );
+  iex_spsc_free( pipeline.raw_free );
+  g_free( pipeline.shard_in );
+  g_free( pipeline.shard_out );
+  g_free( pipeline.shard_free );
+  g_free( pipeline.shard_stats );
+  g_ptr_array_free( pipeline.batches, TRUE );
+  g_free( stages );
+  g_free( threads );
+  iex_pcap_close( pipeline.reader );
+
+  if ( NULL != pipeline.error )
+    {
+      g_propagate_prefixed_error( error, pipeline.error, "%s: ", path );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  iex_decode_stats stats;
+  gint64 start;
+  gdouble elapsed;
+  int rc = EXIT_SUCCESS;
+
+  context = g_option_context_new( "- decode IEX-TP/TOPS captures" );
+  g_option_context_set_summary( context, "Reads pcap files (optionally gzip or zstd compressed) and decodes "
+                                "every IEX-TP segment and TOPS message in them." );
+  g_option_context_add_main_entries( context, decode_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) || NULL == decode_files )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "no capture files given" );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( 0 >= decode_threads )
+    {
+      decode_threads = ( gint ) g_get_num_processors();
+    }
+
+  if ( 0 >= decode_shards )
+    {
+      decode_shards = 2;
+    }
+
+  memset( &stats, 0, sizeof( stats ) );
+  start = g_get_monotonic_time();
+
+  for ( gchar **file = decode_files; NULL != *file; file++ )
+    {
+      gboolean ok;
+
+      if ( decode_pipelined )
+        {
+          ok = decode_file_pipelined( *file, &stats, &error );
+        }
+      else
+        {
+          ok = decode_file_serial( *file, &stats, &error );
+        }
+
+      if ( !ok )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+    }
+
+  fflush( stdout );
+  elapsed = ( gdouble )( g_get_monotonic_time() - start ) / 1e6;
+
+  if ( !decode_quiet )
+    {
+      g_printerr( "%" G_GUINT64_FORMAT " packets, %" G_GUINT64_FORMAT " segments (%" G_GUINT64_FORMAT " heartbeats), %"
+                  G_GUINT64_FORMAT " messages (%" G_GUINT64_FORMAT " quotes) in %.3f s, %.1f MB/s of pcap\n",
+                  stats.packets, stats.segments, stats.heartbeats, stats.messages, stats.quotes, elapsed,
+                  0 < elapsed ? ( gdouble ) stats.bytes / elapsed / 1e6 : 0.0 );
+      g_printerr( "%" G_GUINT64_FORMAT " gaps (%" G_GUINT64_FORMAT " messages missing), %" G_GUINT64_FORMAT
+                  " duplicate segments\n", stats.gaps, stats.gap_messages, stats.duplicates );
+    }
+
+  g_strfreev( decode_files );
+
+  return rc;
+}
@@ -0,0 +1,700 @@
+/*
+ * iex-diff.c - Compare the IEX-TP messages of two captures by session and sequence number
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-pcap.h"
+#include "iex-seg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Exit statuses, as diff(1) */
+#define DIFF_EXIT_SAME      0
+#define DIFF_EXIT_DIFFERENT 1
+#define DIFF_EXIT_TROUBLE   2
+
+#define DIFF_DEFAULT_WINDOW 65536
+
+/* The captures being compared, the first is the reference */
+#define DIFF_A 0
+#define DIFF_B 1
+
+/* What is reported for a run of sequence numbers */
+typedef enum _diff_kind
+{
+  DIFF_MISSING,
+  DIFF_EXTRA
+} diff_kind;
+
+/*
+ * Which of one side's most recent sequence numbers in a session have been
+ * seen, a bit each in a ring covering the window below next, so duplicates
+ * are recognised without keeping the messages.
+ */
+typedef struct _diff_track
+{
+  guint64 *seen;
+  gint64   next;
+  gboolean started;
+  guint32  __padding;
+} diff_track;
+
+/* A message one side has and the other has not (yet), queued by session and side, and by age */
+typedef struct _diff_entry
+{
+  GList    link;
+  GList    age;
+  gint64   seqno;
+  gint64   send_time;
+  guint32  session;
+  guint16  len;
+  guint8   side;
+  guint8   __padding;
+  guint8   data[];
+} diff_entry;
+
+typedef struct _diff_session
+{
+  diff_track track[2];
+  GQueue     pending[2];
+  guint32    session;
+  guint32    __padding;
+} diff_session;
+
+/* One capture, read a segment at a time */
+typedef struct _diff_side
+{
+  iex_pcap_reader *reader;
+  const gchar     *path;
+  GError          *error;
+  iex_seg          seg;
+  guint64          packets;
+  guint64          segments;
+  guint64          messages;
+  guint64          duplicates;
+  guint64          late;
+  guint32          linktype;
+  gboolean         done;
+} diff_side;
+
+/* A run of missing or extra sequence numbers, printed once it ends */
+typedef struct _diff_run
+{
+  gint64    first;
+  gint64    last;
+  guint32   session;
+  diff_kind kind;
+  gboolean  open;
+  guint32   __padding;
+} diff_run;
+
+typedef struct _diff_state
+{
+  diff_side   sides[2];
+  GHashTable *sessions;
+  GHashTable *pending;
+  GQueue      oldest;
+  diff_run    run;
+  guint64     n_pending;
+  guint64     max_pending;
+  guint64     matched;
+  guint64     mismatched;
+  guint64     missing;
+  guint64     extra;
+  guint64     send_time_differs;
+  gint64      send_time_min;
+  gint64      send_time_max;
+  gint64      send_time_sum;
+  guint64     window;
+} diff_state;
+
+/* Command line options */
+static gint diff_threads = 0;
+static gint diff_window = DIFF_DEFAULT_WINDOW;
+static gint diff_max_pending = 0;
+static gboolean diff_quiet = FALSE;
+static gchar **diff_files = NULL;
+
+static GOptionEntry diff_options[] =
+{
+  { "window", 'w', 0, G_OPTION_ARG_INT, &diff_window,
+    "Messages either capture may reorder or run ahead by before a message is reported missing (default: 65536)",
+    "N" },
+  { "max-pending", 'm', 0, G_OPTION_ARG_INT, &diff_max_pending,
+    "Most unmatched messages held at once, the oldest are reported beyond it (default: four windows)", "N" },
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &diff_threads,
+    "Decompression threads for each compressed capture (default: half the processors)", "N" },
+  { "quiet", 'q', 0, G_OPTION_ARG_NONE, &diff_quiet, "Only print the summary", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &diff_files, NULL, "CAPTURE-A CAPTURE-B" },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+static guint
+diff_entry_hash( gconstpointer key )
+{
+  const diff_entry *entry = ( const diff_entry * ) key;
+
+  return ( guint )( ( ( guint64 ) entry->seqno * G_GUINT64_CONSTANT( 0x9E3779B97F4A7C15 ) ) >> 32 ) ^ entry->session;
+}
+
+
+static gboolean
+diff_entry_equal( gconstpointer a, gconstpointer b )
+{
+  const diff_entry *ea = ( const diff_entry * ) a;
+  const diff_entry *eb = ( const diff_entry * ) b;
+
+  return ea->seqno == eb->seqno && ea->session == eb->session;
+}
+
+
+static void
+diff_session_free( gpointer data )
+{
+  diff_session *session = ( diff_session * ) data;
+
+  g_free( session->track[DIFF_A].seen );
+  g_free( session->track[DIFF_B].seen );
+  g_free( session );
+}
+
+
+static diff_session *
+diff_get_session( diff_state *state, guint32 session_id )
+{
+  diff_session *session;
+
+  session = ( diff_session * ) g_hash_table_lookup( state->sessions, GUINT_TO_POINTER( session_id ) );
+  if ( NULL == session )
+    {
+      session = g_new0( diff_session, 1 );
+      session->session = session_id;
+      session->track[DIFF_A].seen = g_new0( guint64, state->window / 64 );
+      session->track[DIFF_B].seen = g_new0( guint64, state->window / 64 );
+      g_queue_init( &session->pending[DIFF_A] );
+      g_queue_init( &session->pending[DIFF_B] );
+      g_hash_table_insert( state->sessions, GUINT_TO_POINTER( session_id ), session );
+    }
+
+  return session;
+}
+
+
+/*
+ * Reporting
+ */
+
+static void
+diff_run_flush( diff_state *state )
+{
+  diff_run *run = &state->run;
+
+  if ( !run->open )
+    {
+      return;
+    }
+
+  if ( !diff_quiet )
+    {
+      printf( "%s %" G_GUINT32_FORMAT " %" G_GINT64_FORMAT, DIFF_MISSING == run->kind ? "missing" : "extra",
+              run->session, run->first );
+      if ( run->last != run->first )
+        {
+          printf( "-%" G_GINT64_FORMAT " (%" G_GINT64_FORMAT ")", run->last, run->last - run->first + 1 );
+        }
+
+      putchar( '\n' );
+    }
+
+  run->open = FALSE;
+}
+
+
+/* Missing and extra messages are reported as runs of consecutive sequence numbers */
+static void
+diff_report_run( diff_state *state, diff_kind kind, guint32 session, gint64 seqno )
+{
+  diff_run *run = &state->run;
+
+  if ( DIFF_MISSING == kind )
+    {
+      state->missing++;
+    }
+  else
+    {
+      state->extra++;
+    }
+
+  if ( run->open && run->kind == kind && run->session == session && run->last + 1 == seqno )
+    {
+      run->last = seqno;
+      return;
+    }
+
+  diff_run_flush( state );
+  run->open = TRUE;
+  run->kind = kind;
+  run->session = session;
+  run->first = seqno;
+  run->last = seqno;
+}
+
+
+/* The pending message is not in the other capture */
+static void
+diff_expire( diff_state *state, diff_session *session, diff_entry *entry )
+{
+  g_queue_unlink( &session->pending[entry->side], &entry->link );
+  g_queue_unlink( &state->oldest, &entry->age );
+  g_hash_table_remove( state->pending, entry );
+  state->n_pending--;
+
+  diff_report_run( state, DIFF_A == entry->side ? DIFF_MISSING : DIFF_EXTRA, entry->session, entry->seqno );
+  g_free( entry );
+}
+
+
+static void
+diff_compare( diff_state *state, guint32 session, gint64 seqno, const diff_entry *a, const guint8 *b_data,
+              guint16 b_len, gint64 b_send_time )
+{
+  gint64 delta = b_send_time - a->send_time;
+
+  if ( a->len != b_len || 0 != memcmp( a->data, b_data, b_len ) )
+    {
+      guint16 at = 0;
+
+      while ( at < MIN( a->len, b_len ) && a->data[at] == b_data[at] )
+        {
+          at++;
+        }
+
+      state->mismatched++;
+      if ( !diff_quiet )
+        {
+          diff_run_flush( state );
+          printf( "mismatch %" G_GUINT32_FORMAT " %" G_GINT64_FORMAT " at byte %u (%u and %u bytes)\n", session, seqno,
+                  at, a->len, b_len );
+        }
+    }
+  else
+    {
+      state->matched++;
+    }
+
+  if ( 0 != delta )
+    {
+      if ( 0 == state->send_time_differs++ )
+        {
+          state->send_time_min = delta;
+          state->send_time_max = delta;
+        }
+
+      state->send_time_min = MIN( state->send_time_min, delta );
+      state->send_time_max = MAX( state->send_time_max, delta );
+      state->send_time_sum += delta;
+    }
+}
+
+
+/*
+ * Matching
+ */
+
+/* Mark seqno seen by one side, FALSE if it already was (or is too old to tell) */
+static gboolean
+diff_track_seen( diff_track *track, gint64 seqno, guint64 window, diff_side *side )
+{
+  guint64 bit;
+
+  if ( !track->started )
+    {
+      track->started = TRUE;
+      track->next = seqno;
+    }
+
+  if ( seqno < track->next - ( gint64 ) window )
+    {
+      side->late++;
+      return FALSE;
+    }
+
+  if ( seqno >= track->next )
+    {
+      /* Forget the sequence numbers the window moves past */
+      if ( ( guint64 )( seqno + 1 - track->next ) >= window )
+        {
+          memset( track->seen, 0, window / 8 );
+        }
+      else
+        {
+          for ( gint64 n = track->next; n <= seqno; n++ )
+            {
+              bit = ( guint64 ) n & ( window - 1 );
+              track->seen[bit / 64] &= ~( G_GUINT64_CONSTANT( 1 ) << ( bit % 64 ) );
+            }
+        }
+
+      track->next = seqno + 1;
+    }
+
+  bit = ( guint64 ) seqno & ( window - 1 );
+  if ( track->seen[bit / 64] & ( G_GUINT64_CONSTANT( 1 ) << ( bit % 64 ) ) )
+    {
+      side->duplicates++;
+      return FALSE;
+    }
+
+  track->seen[bit / 64] |= G_GUINT64_CONSTANT( 1 ) << ( bit % 64 );
+
+  return TRUE;
+}
+
+
+static void
+diff_message( diff_state *state, guint side, guint32 session_id, gint64 seqno, gint64 send_time, const guint8 *msg,
+              guint16 len )
+{
+  guint other = DIFF_A == side ? DIFF_B : DIFF_A;
+  diff_session *session;
+  diff_entry *entry;
+  diff_entry probe;
+  GList *head;
+
+  session = diff_get_session( state, session_id );
+  if ( !diff_track_seen( &session->track[side], seqno, state->window, &state->sides[side] ) )
+    {
+      return;
+    }
+
+  probe.seqno = seqno;
+  probe.session = session_id;
+  entry = ( diff_entry * ) g_hash_table_lookup( state->pending, &probe );
+
+  if ( NULL != entry )
+    {
+      /* Only the other side can have it pending, as this side's duplicates were dropped above */
+      if ( DIFF_A == entry->side )
+        {
+          diff_compare( state, session_id, seqno, entry, msg, len, send_time );
+        }
+      else
+        {
+          diff_entry *a = ( diff_entry * ) g_alloca( sizeof( diff_entry ) + len );
+
+          a->send_time = send_time;
+          a->len = len;
+          memcpy( a->data, msg, len );
+          diff_compare( state, session_id, seqno, a, entry->data, entry->len, entry->send_time );
+        }
+
+      g_queue_unlink( &session->pending[other], &entry->link );
+      g_queue_unlink( &state->oldest, &entry->age );
+      g_hash_table_remove( state->pending, entry );
+      state->n_pending--;
+      g_free( entry );
+    }
+  else
+    {
+      entry = ( diff_entry * ) g_malloc( sizeof( diff_entry ) + len );
+      entry->link.data = entry;
+      entry->link.next = NULL;
+      entry->link.prev = NULL;
+      entry->age.data = entry;
+      entry->age.next = NULL;
+      entry->age.prev = NULL;
+      entry->seqno = seqno;
+      entry->send_time = send_time;
+      entry->session = session_id;
+      entry->len = len;
+      entry->side = ( guint8 ) side;
+      entry->__padding = 0;
+      memcpy( entry->data, msg, len );
+
+      g_queue_push_tail_link( &session->pending[side], &entry->link );
+      g_queue_push_tail_link( &state->oldest, &entry->age );
+      g_hash_table_add( state->pending, entry );
+      state->n_pending++;
+
+      /* Past the limit, the longest unmatched message is given up on, whichever session it is from */
+      if ( state->n_pending > state->max_pending )
+        {
+          diff_entry *old = ( diff_entry * ) g_queue_peek_head( &state->oldest );
+
+          diff_expire( state, diff_get_session( state, old->session ), old );
+        }
+    }
+
+  /* The other side's older messages this side has moved a window past are not coming */
+  while ( NULL != ( head = g_queue_peek_head_link( &session->pending[other] ) )
+          && ( ( diff_entry * ) head->data )->seqno + ( gint64 ) state->window < session->track[side].next )
+    {
+      diff_expire( state, session, ( diff_entry * ) head->data );
+    }
+}
+
+
+/* Move a side on to its next segment with messages, FALSE at its end */
+static gboolean
+diff_side_next( diff_side *side )
+{
+  iex_pcap_record record;
+
+  while ( iex_pcap_next( side->reader, &record, &side->error ) )
+    {
+      iex_udp udp;
+
+      side->packets++;
+      if ( iex_pcap_udp( side->linktype, record.data, record.caplen, &udp )
+           && iex_seg_parse( udp.payload, udp.len, &side->seg ) )
+        {
+          side->segments++;
+          if ( 0 != side->seg.count )
+            {
+              return TRUE;
+            }
+        }
+    }
+
+  side->done = TRUE;
+
+  return FALSE;
+}
+
+
+static void
+diff_segment( diff_state *state, guint side_index )
+{
+  diff_side *side = &state->sides[side_index];
+  iex_seg_iter iter;
+  const guint8 *msg;
+  guint16 msg_len;
+
+  iex_seg_iter_init( &iter, &side->seg );
+  while ( NULL != ( msg = iex_seg_iter_next( &iter, &msg_len ) ) )
+    {
+      side->messages++;
+      diff_message( state, side_index, side->seg.session, side->seg.first_seqno + iter.index - 1,
+                    side->seg.send_time, msg, msg_len );
+    }
+}
+
+
+static gint
+diff_session_cmp( gconstpointer a, gconstpointer b )
+{
+  const diff_session *sa = *( const diff_session * const * ) a;
+  const diff_session *sb = *( const diff_session * const * ) b;
+
+  return sa->session < sb->session ? -1 : sa->session > sb->session;
+}
+
+
+/* Report everything still pending, session by session */
+static void
+diff_drain( diff_state *state )
+{
+  GHashTableIter iter;
+  GPtrArray *sessions;
+  gpointer value;
+
+  sessions = g_ptr_array_new();
+  g_hash_table_iter_init( &iter, state->sessions );
+  while ( g_hash_table_iter_next( &iter, NULL, &value ) )
+    {
+      g_ptr_array_add( sessions, value );
+    }
+
+  g_ptr_array_sort( sessions, diff_session_cmp );
+
+  for ( guint i = 0; i < sessions->len; i++ )
+    {
+      diff_session *session = ( diff_session * ) g_ptr_array_index( sessions, i );
+
+      for ( guint side = DIFF_A; side <= DIFF_B; side++ )
+        {
+          while ( !g_queue_is_empty( &session->pending[side] ) )
+            {
+              diff_expire( state, session, ( diff_entry * ) g_queue_peek_head( &session->pending[side] ) );
+            }
+        }
+    }
+
+  diff_run_flush( state );
+  g_ptr_array_free( sessions, TRUE );
+}
+
+
+/*
+ * Both captures are read a segment at a time, always taking the one sent
+ * earlier, so copies of a message are read close together whatever the
+ * captures' own timestamps; only messages the other side has not reached yet
+ * are held, and no more than --max-pending of them.
+ */
+static void
+diff_run_captures( diff_state *state )
+{
+  diff_side *a = &state->sides[DIFF_A];
+  diff_side *b = &state->sides[DIFF_B];
+
+  diff_side_next( a );
+  diff_side_next( b );
+
+  while ( !a->done || !b->done )
+    {
+      guint side;
+
+      if ( a->done )
+        {
+          side = DIFF_B;
+        }
+      else if ( b->done )
+        {
+          side = DIFF_A;
+        }
+      else
+        {
+          side = b->seg.send_time < a->seg.send_time ? DIFF_B : DIFF_A;
+        }
+
+      diff_segment( state, side );
+      diff_side_next( &state->sides[side] );
+    }
+
+  diff_drain( state );
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  diff_state state;
+  gint64 start;
+  int rc = DIFF_EXIT_SAME;
+
+  context = g_option_context_new( "- compare the IEX-TP messages of two captures" );
+  g_option_context_set_summary( context, "Reads two pcap files (optionally gzip or zstd compressed) side by side, "
+                                "matches their messages by session and sequence number, and compares their bytes. "
+                                "Prints runs of messages missing from the second capture or extra in it, and "
+                                "messages whose bytes differ; exits with 0 when the captures carry the same "
+                                "messages, 1 when they do not, and 2 on errors." );
+  g_option_context_add_main_entries( context, diff_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) || NULL == diff_files || NULL == diff_files[1]
+       || NULL != diff_files[2] )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "give two capture files" );
+      g_clear_error( &error );
+      g_option_context_free( context );
+      return DIFF_EXIT_TROUBLE;
+    }
+
+  g_option_context_free( context );
+
+  if ( 0 >= diff_threads )
+    {
+      diff_threads = MAX( 1, ( gint ) g_get_num_processors() / 2 );
+    }
+
+  memset( &state, 0, sizeof( state ) );
+
+  /* A power of two, at least a word of the seen bitmap */
+  state.window = 64;
+  while ( state.window < ( guint64 ) MAX( diff_window, 1 ) && state.window < ( G_GUINT64_CONSTANT( 1 ) << 30 ) )
+    {
+      state.window <<= 1;
+    }
+
+  state.max_pending = 0 < diff_max_pending ? ( guint64 ) diff_max_pending : 4 * state.window;
+
+  for ( guint i = DIFF_A; i <= DIFF_B; i++ )
+    {
+      diff_side *side = &state.sides[i];
+
+      side->path = diff_files[i];
+      side->reader = iex_pcap_open( side->path, ( guint ) diff_threads, &error );
+      if ( NULL == side->reader )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          iex_pcap_close( state.sides[DIFF_A].reader );
+          g_strfreev( diff_files );
+          return DIFF_EXIT_TROUBLE;
+        }
+
+      side->linktype = iex_pcap_linktype( side->reader );
+    }
+
+  state.sessions = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, diff_session_free );
+  state.pending = g_hash_table_new( diff_entry_hash, diff_entry_equal );
+  g_queue_init( &state.oldest );
+  start = g_get_monotonic_time();
+
+  diff_run_captures( &state );
+  fflush( stdout );
+
+  for ( guint i = DIFF_A; i <= DIFF_B; i++ )
+    {
+      diff_side *side = &state.sides[i];
+
+      if ( NULL != side->error )
+        {
+          g_printerr( "%s: %s\n", side->path, side->error->message );
+          g_clear_error( &side->error );
+          rc = DIFF_EXIT_TROUBLE;
+        }
+
+      g_printerr( "%s: %" G_GUINT64_FORMAT " packets, %" G_GUINT64_FORMAT " segments, %" G_GUINT64_FORMAT
+                  " messages (%" G_GUINT64_FORMAT " duplicates, %" G_GUINT64_FORMAT " too late to match)\n",
+                  side->path, side->packets, side->segments, side->messages, side->duplicates, side->late );
+      iex_pcap_close( side->reader );
+    }
+
+  g_printerr( "%" G_GUINT64_FORMAT " matched, %" G_GUINT64_FORMAT " mismatched, %" G_GUINT64_FORMAT " missing, %"
+              G_GUINT64_FORMAT " extra in %.3f s\n", state.matched, state.mismatched, state.missing, state.extra,
+              ( gdouble )( g_get_monotonic_time() - start ) / 1e6 );
+
+  if ( 0 != state.send_time_differs )
+    {
+      g_printerr( "send_time differs for %" G_GUINT64_FORMAT " messages: min %" G_GINT64_FORMAT " ns, mean %.1f ns, "
+                  "max %" G_GINT64_FORMAT " ns\n", state.send_time_differs, state.send_time_min,
+                  ( gdouble ) state.send_time_sum / ( gdouble ) state.send_time_differs, state.send_time_max );
+    }
+
+  if ( DIFF_EXIT_SAME == rc && 0 != state.mismatched + state.missing + state.extra )
+    {
+      rc = DIFF_EXIT_DIFFERENT;
+    }
+
+  g_hash_table_destroy( state.pending );
+  g_hash_table_destroy( state.sessions );
+  g_strfreev( diff_files );
+
+  return rc;
+}
@@ -0,0 +1,883 @@
+/*
+ * iex-export.c - CSV and JSON export of IEX-TP/TOPS captures
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-input.h"
+#include "iex-pcap.h"
+#include "iex-seg.h"
+#include "iex-text.h"
+#include "iex-convert.h"
+
+#include <stdlib.h>
+
+/* Quotes converted together, from one segment */
+#define EXPORT_BATCH 64
+
+/* TOPS prices have four implied decimal places */
+#define EXPORT_PRICE_SCALE 1e-4
+
+/* Room reserved for one row: every column at its longest, with JSON keys and escaping */
+#define EXPORT_ROW_MAX 1024
+
+#define EXPORT_DEFAULT_COLUMNS "send_time,session,seqno,timestamp,symbol,bid_size,bid_price,ask_price,ask_size"
+
+/* Default columns when conflating */
+#define EXPORT_CONFLATE_COLUMNS "bucket,symbol,timestamp,bid_size,bid_price,ask_price,ask_size"
+
+typedef enum _export_column
+{
+  EXPORT_COL_BUCKET,
+  EXPORT_COL_TIME,
+  EXPORT_COL_SEND_TIME,
+  EXPORT_COL_CHANNEL,
+  EXPORT_COL_SESSION,
+  EXPORT_COL_SEQNO,
+  EXPORT_COL_TYPE,
+  EXPORT_COL_FLAGS,
+  EXPORT_COL_TIMESTAMP,
+  EXPORT_COL_SYMBOL,
+  EXPORT_COL_BID_SIZE,
+  EXPORT_COL_BID_PRICE,
+  EXPORT_COL_ASK_PRICE,
+  EXPORT_COL_ASK_SIZE,
+  EXPORT_COL_LAST
+} export_column;
+
+static const gchar *export_column_names[EXPORT_COL_LAST] =
+{
+  "bucket",
+  "time",
+  "send_time",
+  "channel",
+  "session",
+  "seqno",
+  "type",
+  "flags",
+  "timestamp",
+  "symbol",
+  "bid_size",
+  "bid_price",
+  "ask_price",
+  "ask_size"
+};
+
+/* The time columns of a row, in the order they are split into seconds for --time-format=s */
+typedef enum _export_time
+{
+  EXPORT_TIME_BUCKET,
+  EXPORT_TIME_TIME,
+  EXPORT_TIME_SEND_TIME,
+  EXPORT_TIME_TIMESTAMP,
+  EXPORT_TIME_LAST
+} export_time;
+
+/* The price columns of a row, in the order they are converted for --price-format=float */
+typedef enum _export_price
+{
+  EXPORT_PRICE_BID,
+  EXPORT_PRICE_ASK,
+  EXPORT_PRICE_LAST
+} export_price;
+
+/* One TOPS message to export */
+typedef struct _export_row
+{
+  iex_quote quote;
+  gint64    bucket;
+  gint64    time;
+  gint64    send_time;
+  gint64    seqno;
+  guint32   channel;
+  guint32   session;
+  guint8    type;
+  guint8    flags;
+  guint8    symbol_len;
+  guint8    symbol_plain;
+  guint8    __padding[4];
+} export_row;
+
+/* Per-symbol conflation state */
+typedef enum _export_slot_state
+{
+  EXPORT_SLOT_SEEN    = 1 << 0,
+  EXPORT_SLOT_DIRTY   = 1 << 1,
+  EXPORT_SLOT_WRITTEN = 1 << 2
+} export_slot_state;
+
+/*
+ * Conflation: the latest row for each symbol (a dense array indexed through
+ * the book's intern table), and the symbols updated in the current bucket,
+ * in the order they were first updated.
+ */
+typedef struct _export_conflator
+{
+  iex_quote_book *symbols;
+  GArray         *latest;
+  GArray         *written;
+  GArray         *dirty;
+  GByteArray     *state;
+  gint64          interval;
+  gint64          bucket;
+  gboolean        started;
+  guint32         __padding;
+} export_conflator;
+
+/* Command line options */
+static gint export_threads = 0;
+static gchar *export_format = NULL;
+static gchar *export_columns_arg = NULL;
+static gchar *export_output = NULL;
+static gchar *export_conflate_arg = NULL;
+static gchar *export_time_format = NULL;
+static gchar *export_price_format = NULL;
+static gboolean export_header = TRUE;
+static gchar **export_files = NULL;
+
+static GOptionEntry export_options[] =
+{
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &export_threads,
+    "Decompression threads for compressed captures (default: all processors)", "N" },
+  { "format", 'f', 0, G_OPTION_ARG_STRING, &export_format, "Output format: csv (default) or json", "FORMAT" },
+  { "columns", 'c', 0, G_OPTION_ARG_STRING, &export_columns_arg,
+    "Comma-separated columns (default: " EXPORT_DEFAULT_COLUMNS ")", "COLUMNS" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &export_output, "Write to a file instead of stdout", "FILE" },
+  { "conflate", 'C', 0, G_OPTION_ARG_STRING, &export_conflate_arg,
+    "Only write each symbol's latest quote, once per interval of the quote timestamp, if it changed "
+    "(e.g. 500us, 100ms, 1s)", "INTERVAL" },
+  { "time-format", 't', 0, G_OPTION_ARG_STRING, &export_time_format,
+    "Times as ns (nanoseconds since the epoch, the default) or s (seconds, with nine decimals)", "FORMAT" },
+  { "price-format", 'p', 0, G_OPTION_ARG_STRING, &export_price_format,
+    "Prices as fixed (always four decimals, the default) or float (dollars without trailing zeros)", "FORMAT" },
+  { "no-header", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &export_header, "Do not write a CSV header line", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &export_files, NULL, "CAPTURE..." },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+/* Parsed column set, and each column's JSON key ("name":) */
+static export_column export_columns[EXPORT_COL_LAST];
+static guint export_n_columns = 0;
+static gboolean export_json = FALSE;
+static gboolean export_seconds = FALSE;
+static gboolean export_float_prices = FALSE;
+static gchar *export_keys[EXPORT_COL_LAST];
+static gsize export_key_lens[EXPORT_COL_LAST];
+static export_conflator *export_conflation = NULL;
+
+
+static gboolean
+export_parse_columns( const gchar *spec, GError **error )
+{
+  gchar **names;
+  gboolean ok = TRUE;
+
+  names = g_strsplit( spec, ",", -1 );
+  for ( gchar **name = names; ok && NULL != *name; name++ )
+    {
+      export_column col;
+
+      g_strstrip( *name );
+      for ( col = 0; col < EXPORT_COL_LAST; col++ )
+        {
+          if ( 0 == strcmp( *name, export_column_names[col] ) )
+            {
+              break;
+            }
+        }
+
+      if ( EXPORT_COL_LAST == col )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "unknown column '%s'", *name );
+          ok = FALSE;
+        }
+      else if ( export_n_columns == EXPORT_COL_LAST )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "too many columns" );
+          ok = FALSE;
+        }
+      else
+        {
+          export_columns[export_n_columns++] = col;
+        }
+    }
+
+  g_strfreev( names );
+
+  if ( ok && 0 == export_n_columns )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "no columns given" );
+      ok = FALSE;
+    }
+
+  for ( export_column col = 0; col < EXPORT_COL_LAST; col++ )
+    {
+      export_keys[col] = g_strdup_printf( "\"%s\":", export_column_names[col] );
+      export_key_lens[col] = strlen( export_keys[col] );
+    }
+
+  return ok;
+}
+
+
+/*
+ * Symbols are space padded ASCII. Trailing padding is dropped, and anything
+ * which is not printable is escaped for JSON (or for CSV, the field quoted).
+ * The length and whether the symbol is plain come from iex_convert_symbols().
+ */
+static inline gchar *
+export_put_symbol( gchar *p, const gchar *symbol, gsize len, gboolean plain )
+{
+  if ( plain )
+    {
+      if ( export_json )
+        {
+          *p++ = '"';
+        }
+
+      p = iex_text_put( p, symbol, len );
+
+      if ( export_json )
+        {
+          *p++ = '"';
+        }
+
+      return p;
+    }
+
+  *p++ = '"';
+  for ( gsize i = 0; i < len; i++ )
+    {
+      guchar c = ( guchar ) symbol[i];
+
+      if ( export_json && ( 0x20 > c || 0x7f <= c ) )
+        {
+          p = iex_text_put( p, "\\u00", 4 );
+          *p++ = "0123456789abcdef"[c >> 4];
+          *p++ = "0123456789abcdef"[c & 0x0f];
+        }
+      else if ( '"' == c )
+        {
+          *p++ = export_json ? '\\' : '"';
+          *p++ = '"';
+        }
+      else if ( '\\' == c && export_json )
+        {
+          *p++ = '\\';
+          *p++ = '\\';
+        }
+      else
+        {
+          *p++ = ( gchar ) c;
+        }
+    }
+  *p++ = '"';
+
+  return p;
+}
+
+
+/* A time column, in nanoseconds or from the row's times split by iex_convert_timestamps() */
+static inline gchar *
+export_put_time( gchar *p, gint64 ns, const gint64 *secs, const gint32 *nsecs, export_time which )
+{
+  if ( NULL == secs )
+    {
+      return iex_text_put_i64( p, ns );
+    }
+
+  return iex_text_put_seconds( p, secs[which], nsecs[which] );
+}
+
+
+/* A price column, fixed-point or from the row's prices converted by iex_convert_prices() */
+static inline gchar *
+export_put_price( gchar *p, gint64 price, const gdouble *dollars, export_price which )
+{
+  if ( NULL == dollars )
+    {
+      return iex_text_put_price( p, price );
+    }
+
+  return iex_text_put_double( p, dollars[which] );
+}
+
+
+static inline void
+export_write_row( iex_text *text, const export_row *row, const gint64 *secs, const gint32 *nsecs,
+                  const gdouble *dollars )
+{
+  gchar *p;
+
+  p = iex_text_reserve( text, EXPORT_ROW_MAX );
+  if ( export_json )
+    {
+      *p++ = '{';
+    }
+
+  for ( guint i = 0; i < export_n_columns; i++ )
+    {
+      export_column col = export_columns[i];
+
+      if ( 0 != i )
+        {
+          *p++ = ',';
+        }
+
+      if ( export_json )
+        {
+          p = iex_text_put( p, export_keys[col], export_key_lens[col] );
+        }
+
+      switch ( col )
+        {
+        case EXPORT_COL_BUCKET:
+          p = export_put_time( p, row->bucket, secs, nsecs, EXPORT_TIME_BUCKET );
+          break;
+
+        case EXPORT_COL_TIME:
+          p = export_put_time( p, row->time, secs, nsecs, EXPORT_TIME_TIME );
+          break;
+
+        case EXPORT_COL_SEND_TIME:
+          p = export_put_time( p, row->send_time, secs, nsecs, EXPORT_TIME_SEND_TIME );
+          break;
+
+        case EXPORT_COL_CHANNEL:
+          p = iex_text_put_u64( p, row->channel );
+          break;
+
+        case EXPORT_COL_SESSION:
+          p = iex_text_put_u64( p, row->session );
+          break;
+
+        case EXPORT_COL_SEQNO:
+          p = iex_text_put_i64( p, row->seqno );
+          break;
+
+        case EXPORT_COL_TYPE:
+          if ( export_json )
+            {
+              *p++ = '"';
+            }
+          *p++ = 0x20 <= row->type && 0x7f > row->type && '"' != row->type && '\\' != row->type ? ( gchar ) row->type : '?';
+          if ( export_json )
+            {
+              *p++ = '"';
+            }
+          break;
+
+        case EXPORT_COL_FLAGS:
+          p = iex_text_put_u64( p, row->flags );
+          break;
+
+        case EXPORT_COL_TIMESTAMP:
+          p = export_put_time( p, row->quote.timestamp, secs, nsecs, EXPORT_TIME_TIMESTAMP );
+          break;
+
+        case EXPORT_COL_SYMBOL:
+          p = export_put_symbol( p, row->quote.symbol, row->symbol_len, row->symbol_plain );
+          break;
+
+        case EXPORT_COL_BID_SIZE:
+          p = iex_text_put_u64( p, row->quote.bid_size );
+          break;
+
+        case EXPORT_COL_BID_PRICE:
+          p = export_put_price( p, row->quote.bid_price, dollars, EXPORT_PRICE_BID );
+          break;
+
+        case EXPORT_COL_ASK_PRICE:
+          p = export_put_price( p, row->quote.ask_price, dollars, EXPORT_PRICE_ASK );
+          break;
+
+        case EXPORT_COL_ASK_SIZE:
+          p = iex_text_put_u64( p, row->quote.ask_size );
+          break;
+
+        case EXPORT_COL_LAST:
+        default:
+          break;
+        }
+    }
+
+  if ( export_json )
+    {
+      *p++ = '}';
+    }
+  *p++ = '\n';
+
+  iex_text_commit( text, p );
+}
+
+
+static void
+export_write_header( iex_text *text )
+{
+  gchar *p;
+
+  p = iex_text_reserve( text, EXPORT_ROW_MAX );
+  for ( guint i = 0; i < export_n_columns; i++ )
+    {
+      const gchar *name = export_column_names[export_columns[i]];
+
+      if ( 0 != i )
+        {
+          *p++ = ',';
+        }
+
+      p = iex_text_put( p, name, strlen( name ) );
+    }
+  *p++ = '\n';
+
+  iex_text_commit( text, p );
+}
+
+
+/*
+ * Write a batch of rows, splitting their times into seconds and converting
+ * their prices to dollars together if they are wanted that way.
+ */
+static void
+export_write_rows( iex_text *text, export_row *const *rows, guint n, guint64 *n_rows )
+{
+  gint64 times[EXPORT_BATCH * EXPORT_TIME_LAST];
+  gint64 secs[EXPORT_BATCH * EXPORT_TIME_LAST];
+  gint32 nsecs[EXPORT_BATCH * EXPORT_TIME_LAST];
+  gint64 prices[EXPORT_BATCH * EXPORT_PRICE_LAST];
+  gdouble dollars[EXPORT_BATCH * EXPORT_PRICE_LAST];
+
+  if ( 0 == n )
+    {
+      return;
+    }
+
+  if ( export_seconds )
+    {
+      for ( guint i = 0; i < n; i++ )
+        {
+          gint64 *t = times + i * EXPORT_TIME_LAST;
+
+          t[EXPORT_TIME_BUCKET] = rows[i]->bucket;
+          t[EXPORT_TIME_TIME] = rows[i]->time;
+          t[EXPORT_TIME_SEND_TIME] = rows[i]->send_time;
+          t[EXPORT_TIME_TIMESTAMP] = rows[i]->quote.timestamp;
+        }
+
+      iex_convert_timestamps( times, n * EXPORT_TIME_LAST, secs, nsecs );
+    }
+
+  if ( export_float_prices )
+    {
+      for ( guint i = 0; i < n; i++ )
+        {
+          prices[i * EXPORT_PRICE_LAST + EXPORT_PRICE_BID] = rows[i]->quote.bid_price;
+          prices[i * EXPORT_PRICE_LAST + EXPORT_PRICE_ASK] = rows[i]->quote.ask_price;
+        }
+
+      iex_convert_prices( prices, n * EXPORT_PRICE_LAST, EXPORT_PRICE_SCALE, dollars );
+    }
+
+  for ( guint i = 0; i < n; i++ )
+    {
+      export_write_row( text, rows[i], export_seconds ? secs + i * EXPORT_TIME_LAST : NULL,
+                        export_seconds ? nsecs + i * EXPORT_TIME_LAST : NULL,
+                        export_float_prices ? dollars + i * EXPORT_PRICE_LAST : NULL );
+    }
+
+  *n_rows += n;
+}
+
+
+static export_conflator *
+export_conflator_new( gint64 interval )
+{
+  export_conflator *conflator;
+
+  conflator = g_new0( export_conflator, 1 );
+  conflator->symbols = iex_quote_book_new();
+  conflator->latest = g_array_new( FALSE, TRUE, sizeof( export_row ) );
+  conflator->written = g_array_new( FALSE, TRUE, sizeof( iex_quote ) );
+  conflator->dirty = g_array_new( FALSE, FALSE, sizeof( guint32 ) );
+  conflator->state = g_byte_array_new();
+  conflator->interval = interval;
+
+  return conflator;
+}
+
+
+static void
+export_conflator_free( export_conflator *conflator )
+{
+  iex_quote_book_free( conflator->symbols );
+  g_array_free( conflator->latest, TRUE );
+  g_array_free( conflator->written, TRUE );
+  g_array_free( conflator->dirty, TRUE );
+  g_byte_array_free( conflator->state, TRUE );
+  g_free( conflator );
+}
+
+
+/* Write the symbols updated in the current bucket whose quote differs from the one last written */
+static void
+export_conflator_flush( export_conflator *conflator, iex_text *text, guint64 *n_rows )
+{
+  guint32 *dirty = ( guint32 * ) conflator->dirty->data;
+  export_row *batch[EXPORT_BATCH];
+  guint n = 0;
+
+  for ( guint i = 0; i < conflator->dirty->len; i++ )
+    {
+      export_row *row = &g_array_index( conflator->latest, export_row, dirty[i] );
+      iex_quote *written = &g_array_index( conflator->written, iex_quote, dirty[i] );
+      guint8 *state = &conflator->state->data[dirty[i]];
+
+      *state &= ( guint8 ) ~EXPORT_SLOT_DIRTY;
+      if ( 0 != ( *state & EXPORT_SLOT_WRITTEN ) && row->quote.bid_price == written->bid_price
+           && row->quote.ask_price == written->ask_price && row->quote.bid_size == written->bid_size
+           && row->quote.ask_size == written->ask_size )
+        {
+          continue;
+        }
+
+      row->bucket = conflator->bucket + conflator->interval;
+      batch[n++] = row;
+      if ( EXPORT_BATCH == n )
+        {
+          export_write_rows( text, batch, n, n_rows );
+          n = 0;
+        }
+
+      *written = row->quote;
+      *state |= EXPORT_SLOT_WRITTEN;
+    }
+
+  export_write_rows( text, batch, n, n_rows );
+  g_array_set_size( conflator->dirty, 0 );
+}
+
+
+/*
+ * Fold a quote into the current bucket, closing the bucket first if the quote
+ * belongs to a later one. Quotes from an earlier bucket (sessions are not
+ * strictly ordered against each other) count towards the current one, but
+ * never replace a symbol's quote with an older one.
+ */
+static void
+export_conflator_add( export_conflator *conflator, const export_row *row, iex_text *text, guint64 *n_rows )
+{
+  gint64 bucket;
+  guint32 slot;
+  guint8 *state;
+
+  bucket = row->quote.timestamp - row->quote.timestamp % conflator->interval;
+  if ( !conflator->started )
+    {
+      conflator->bucket = bucket;
+      conflator->started = TRUE;
+    }
+  else if ( bucket > conflator->bucket )
+    {
+      export_conflator_flush( conflator, text, n_rows );
+      conflator->bucket = bucket;
+    }
+
+  slot = iex_quote_book_intern( conflator->symbols, row->quote.symbol );
+  if ( IEX_QUOTE_NO_SLOT == slot )
+    {
+      return;
+    }
+
+  if ( slot >= conflator->latest->len )
+    {
+      g_array_set_size( conflator->latest, slot + 1 );
+      g_array_set_size( conflator->written, slot + 1 );
+      g_byte_array_set_size( conflator->state, slot + 1 );
+      conflator->state->data[slot] = 0;
+    }
+
+  state = &conflator->state->data[slot];
+  if ( 0 == ( *state & EXPORT_SLOT_SEEN )
+       || row->quote.timestamp >= g_array_index( conflator->latest, export_row, slot ).quote.timestamp )
+    {
+      g_array_index( conflator->latest, export_row, slot ) = *row;
+    }
+
+  if ( 0 == ( *state & EXPORT_SLOT_DIRTY ) )
+    {
+      g_array_append_val( conflator->dirty, slot );
+    }
+
+  *state |= EXPORT_SLOT_SEEN | EXPORT_SLOT_DIRTY;
+}
+
+
+/* Convert a batch of quotes' symbols together, then write (or conflate) them in order */
+static void
+export_rows( export_row *rows, guint n, iex_text *text, guint64 *n_rows )
+{
+  gchar symbols[EXPORT_BATCH * IEX_SYMBOL_LEN];
+  guint8 lens[EXPORT_BATCH];
+  guint8 plain[EXPORT_BATCH];
+  export_row *batch[EXPORT_BATCH];
+  guint n_batch = 0;
+
+  for ( guint i = 0; i < n; i++ )
+    {
+      memcpy( symbols + i * IEX_SYMBOL_LEN, rows[i].quote.symbol, IEX_SYMBOL_LEN );
+    }
+
+  iex_convert_symbols( symbols, n, lens, plain );
+
+  for ( guint i = 0; i < n; i++ )
+    {
+      export_row *row = &rows[i];
+
+      row->symbol_len = lens[i];
+      row->symbol_plain = plain[i];
+
+      if ( NULL != export_conflation )
+        {
+          export_conflator_add( export_conflation, row, text, n_rows );
+          continue;
+        }
+
+      row->bucket = row->quote.timestamp;
+      batch[n_batch++] = row;
+    }
+
+  export_write_rows( text, batch, n_batch, n_rows );
+}
+
+
+static gboolean
+export_file( const gchar *path, iex_text *text, guint64 *n_rows, GError **error )
+{
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  GError *local_error = NULL;
+  export_row rows[EXPORT_BATCH];
+  guint32 linktype;
+
+  reader = iex_pcap_open( path, ( guint ) export_threads, error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  linktype = iex_pcap_linktype( reader );
+  memset( rows, 0, sizeof( rows ) );
+
+  while ( iex_pcap_next( reader, &record, &local_error ) && NULL == text->error )
+    {
+      iex_udp udp;
+      iex_seg seg;
+      iex_seg_iter iter;
+      const guint8 *msg;
+      guint16 msg_len;
+      guint n = 0;
+
+      if ( !iex_pcap_udp( linktype, record.data, record.caplen, &udp ) || !iex_seg_parse( udp.payload, udp.len, &seg )
+           || IEXTP_PROTO_IEXTOPS != seg.protocol )
+        {
+          continue;
+        }
+
+      iex_seg_iter_init( &iter, &seg );
+      while ( NULL != ( msg = iex_seg_iter_next( &iter, &msg_len ) ) )
+        {
+          export_row *row = &rows[n];
+
+          if ( iex_tops_quote( msg, msg_len, &row->quote ) )
+            {
+              row->time = record.ts;
+              row->send_time = seg.send_time;
+              row->channel = seg.channel;
+              row->session = seg.session;
+              row->seqno = seg.first_seqno + iter.index - 1;
+              row->type = msg[offsetof( iextops_msg, msgtype )];
+              row->flags = msg[offsetof( iextops_msg, flags )];
+
+              if ( EXPORT_BATCH == ++n )
+                {
+                  export_rows( rows, n, text, n_rows );
+                  n = 0;
+                }
+            }
+        }
+
+      export_rows( rows, n, text, n_rows );
+    }
+
+  iex_pcap_close( reader );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_prefixed_error( error, local_error, "%s: ", path );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  iex_text *text;
+  guint64 n_rows = 0;
+  gint64 start;
+  int rc = EXIT_SUCCESS;
+
+  context = g_option_context_new( "- export IEX-TP/TOPS captures as CSV or JSON" );
+  g_option_context_set_summary( context, "Writes one line per TOPS quote in the given pcap files (optionally gzip "
+                                "or zstd compressed), as CSV or newline-delimited JSON." );
+  g_option_context_add_main_entries( context, export_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) || NULL == export_files )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "no capture files given" );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( NULL != export_format && 0 == strcmp( export_format, "json" ) )
+    {
+      export_json = TRUE;
+    }
+  else if ( NULL != export_format && 0 != strcmp( export_format, "csv" ) )
+    {
+      g_printerr( "unknown format '%s', expected csv or json\n", export_format );
+      return EXIT_FAILURE;
+    }
+
+  if ( NULL != export_time_format && 0 == strcmp( export_time_format, "s" ) )
+    {
+      export_seconds = TRUE;
+    }
+  else if ( NULL != export_time_format && 0 != strcmp( export_time_format, "ns" ) )
+    {
+      g_printerr( "unknown time format '%s', expected ns or s\n", export_time_format );
+      return EXIT_FAILURE;
+    }
+
+  if ( NULL != export_price_format && 0 == strcmp( export_price_format, "float" ) )
+    {
+      export_float_prices = TRUE;
+    }
+  else if ( NULL != export_price_format && 0 != strcmp( export_price_format, "fixed" ) )
+    {
+      g_printerr( "unknown price format '%s', expected fixed or float\n", export_price_format );
+      return EXIT_FAILURE;
+    }
+
+  if ( NULL != export_conflate_arg )
+    {
+      gint64 interval;
+
+      if ( !iex_text_parse_duration( export_conflate_arg, &interval ) )
+        {
+          g_printerr( "invalid conflation interval '%s'\n", export_conflate_arg );
+          return EXIT_FAILURE;
+        }
+
+      export_conflation = export_conflator_new( interval );
+    }
+
+  if ( NULL == export_columns_arg )
+    {
+      export_columns_arg = g_strdup( NULL != export_conflation ? EXPORT_CONFLATE_COLUMNS : EXPORT_DEFAULT_COLUMNS );
+    }
+
+  if ( !export_parse_columns( export_columns_arg, &error ) )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      return EXIT_FAILURE;
+    }
+
+  if ( 0 >= export_threads )
+    {
+      export_threads = ( gint ) g_get_num_processors();
+    }
+
+  text = iex_text_open( export_output, &error );
+  if ( NULL == text )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      return EXIT_FAILURE;
+    }
+
+  start = g_get_monotonic_time();
+
+  if ( export_header && !export_json )
+    {
+      export_write_header( text );
+    }
+
+  for ( gchar **file = export_files; NULL != *file && NULL == text->error; file++ )
+    {
+      if ( !export_file( *file, text, &n_rows, &error ) )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+    }
+
+  if ( NULL != export_conflation )
+    {
+      export_conflator_flush( export_conflation, text, &n_rows );
+      export_conflator_free( export_conflation );
+    }
+
+  if ( !iex_text_close( text, &error ) )
+    {
+      g_printerr( "%s: %s\n", NULL != export_output ? export_output : "stdout", error->message );
+      g_clear_error( &error );
+      rc = EXIT_FAILURE;
+    }
+
+  g_printerr( "%" G_GUINT64_FORMAT " rows in %.3f s\n", n_rows,
+              ( gdouble )( g_get_monotonic_time() - start ) / 1e6 );
+
+  for ( export_column col = 0; col < EXPORT_COL_LAST; col++ )
+    {
+      g_free( export_keys[col] );
+    }
+
+  g_free( export_format );
+  g_free( export_columns_arg );
+  g_free( export_conflate_arg );
+  g_free( export_time_format );
+  g_free( export_price_format );
+  g_free( export_output );
+  g_strfreev( export_files );
+
+  return rc;
+}
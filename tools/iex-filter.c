@@ -0,0 +1,1149 @@
+/*
+ * iex-filter.c - Generate capture filters for IEX-TP channels and sessions
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-input.h"
+#include "iex-pcap.h"
+#include "iex-seg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Classic BPF opcodes, as in <net/bpf.h> and <linux/filter.h> */
+#define FILTER_LD   0x00
+#define FILTER_LDX  0x01
+#define FILTER_ALU  0x04
+#define FILTER_JMP  0x05
+#define FILTER_RET  0x06
+#define FILTER_MISC 0x07
+
+#define FILTER_W 0x00
+#define FILTER_H 0x08
+#define FILTER_B 0x10
+
+#define FILTER_ABS 0x20
+#define FILTER_IND 0x40
+#define FILTER_MSH 0xa0
+
+#define FILTER_ADD 0x00
+#define FILTER_AND 0x50
+
+#define FILTER_JA   0x00
+#define FILTER_JEQ  0x10
+#define FILTER_JGE  0x30
+#define FILTER_JSET 0x40
+
+#define FILTER_K   0x00
+#define FILTER_TAX 0x00
+#define FILTER_TXA 0x80
+
+#define FILTER_MAX_INSNS 4096
+#define FILTER_DEFAULT_SNAPLEN 262144
+
+/* Jump to the next instruction */
+#define FILTER_NEXT -1
+
+#define FILTER_ETHERTYPE_IPV4  0x0800
+#define FILTER_ETHERTYPE_VLAN  0x8100
+#define FILTER_ETHERTYPE_QINQ  0x88a8
+#define FILTER_ETHERTYPE_QINQ1 0x9100
+
+/* Segment header fields a selector can match on, in the order they are tested */
+typedef enum _filter_field
+{
+  FILTER_PROTOCOL,
+  FILTER_CHANNEL,
+  FILTER_SESSION,
+  FILTER_N_FIELDS
+} filter_field;
+
+typedef struct _filter_field_info
+{
+  const gchar *name;
+  guint32      offset;
+  guint32      size;
+} filter_field_info;
+
+/* Offsets from the start of the UDP payload, i.e. of the iextp_seg */
+static const filter_field_info filter_fields[FILTER_N_FIELDS] =
+{
+  { "protocol", G_STRUCT_OFFSET( iextp_seg, protocol ), 2 },
+  { "channel", G_STRUCT_OFFSET( iextp_seg, channel ), 4 },
+  { "session", G_STRUCT_OFFSET( iextp_seg, session ), 4 }
+};
+
+/* One selector: the fields in the set mask must all match */
+typedef struct _filter_selector
+{
+  guint32 value[FILTER_N_FIELDS];
+  guint32 set;
+} filter_selector;
+
+/* An instruction, with jumps to labels until they are resolved */
+typedef struct _filter_insn
+{
+  guint16 code;
+  guint8  jt;
+  guint8  jf;
+  guint32 k;
+  gint    jt_label;
+  gint    jf_label;
+} filter_insn;
+
+typedef struct _filter_prog
+{
+  GArray *insns;
+  GArray *labels;
+  gint    reject;
+  guint32 udp_base;
+} filter_prog;
+
+/* Command line options */
+static gint filter_dump = 0;
+static gchar *filter_linktype_arg = NULL;
+static gboolean filter_vlan = FALSE;
+static gint filter_snaplen = FILTER_DEFAULT_SNAPLEN;
+static gchar *filter_check = NULL;
+static gchar **filter_args = NULL;
+
+
+static gboolean
+filter_count_dump( const gchar *option_name __attribute__( ( unused ) ),
+                   const gchar *value __attribute__( ( unused ) ),
+                   gpointer data __attribute__( ( unused ) ),
+                   GError **error __attribute__( ( unused ) ) )
+{
+  filter_dump++;
+
+  return TRUE;
+}
+
+
+static GOptionEntry filter_options[] =
+{
+  { "dump", 'd', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, filter_count_dump,
+    "Print a BPF program instead of an expression: -d as assembly, -dd as C, -ddd as decimal", NULL },
+  { "linktype", 'l', 0, G_OPTION_ARG_STRING, &filter_linktype_arg,
+    "Link type of the BPF program: ethernet, sll or raw (default: ethernet)", "TYPE" },
+  { "vlan", 'v', 0, G_OPTION_ARG_NONE, &filter_vlan, "Also match frames with one or two VLAN tags", NULL },
+  { "snaplen", 's', 0, G_OPTION_ARG_INT, &filter_snaplen, "Bytes of matching packets to keep (default: 262144)",
+    "BYTES" },
+  { "check", 'c', 0, G_OPTION_ARG_FILENAME, &filter_check,
+    "Run the BPF program over a capture and compare it with the tools' own decoding", "CAPTURE" },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &filter_args, NULL, "[SELECTOR...]" },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+/*
+ * Selectors
+ */
+
+/* "channel=1,session=1150681088,protocol=tops", any of them left out matching anything */
+static gboolean
+filter_parse_selector( const gchar *spec, filter_selector *sel, GError **error )
+{
+  gchar **terms;
+  gboolean ok = TRUE;
+
+  memset( sel, 0, sizeof( *sel ) );
+  terms = g_strsplit( spec, ",", -1 );
+
+  for ( gchar **term = terms; NULL != *term && ok; term++ )
+    {
+      gchar *eq;
+      gchar *end;
+      guint64 value;
+      guint f;
+
+      eq = strchr( *term, '=' );
+      if ( NULL == eq )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "expected FIELD=VALUE in '%s'", *term );
+          ok = FALSE;
+          break;
+        }
+
+      *eq = '\0';
+      for ( f = 0; f < FILTER_N_FIELDS; f++ )
+        {
+          if ( 0 == g_ascii_strcasecmp( g_strstrip( *term ), filter_fields[f].name ) )
+            {
+              break;
+            }
+        }
+
+      if ( FILTER_N_FIELDS == f )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "unknown field '%s' (expected protocol, channel or session)",
+                       *term );
+          ok = FALSE;
+          break;
+        }
+
+      if ( FILTER_PROTOCOL == f && 0 == g_ascii_strcasecmp( g_strstrip( eq + 1 ), "tops" ) )
+        {
+          value = IEXTP_PROTO_IEXTOPS;
+        }
+      else
+        {
+          value = g_ascii_strtoull( eq + 1, &end, 0 );
+          if ( end == eq + 1 || '\0' != *end || 0 == value || value > ( 2 == filter_fields[f].size ? G_MAXUINT16
+                                                                        : G_MAXUINT32 ) )
+            {
+              g_set_error( error, IEX_TOOLS_ERROR, 0, "invalid %s '%s'", filter_fields[f].name, eq + 1 );
+              ok = FALSE;
+              break;
+            }
+        }
+
+      sel->value[f] = ( guint32 ) value;
+      sel->set |= 1U << f;
+    }
+
+  g_strfreev( terms );
+
+  return ok;
+}
+
+
+/* TRUE if sel matches anything in the fields from f on */
+static inline gboolean
+filter_selector_done( const filter_selector *sel, guint f )
+{
+  return 0 == ( sel->set >> f );
+}
+
+
+/* The distinct values of field f among the selectors which set it, in order of appearance */
+static GArray *
+filter_distinct_values( GPtrArray *sels, guint f )
+{
+  GArray *values;
+
+  values = g_array_new( FALSE, FALSE, sizeof( guint32 ) );
+
+  for ( guint i = 0; i < sels->len; i++ )
+    {
+      const filter_selector *sel = g_ptr_array_index( sels, i );
+      gboolean seen = FALSE;
+
+      if ( 0 == ( sel->set & ( 1U << f ) ) )
+        {
+          continue;
+        }
+
+      for ( guint j = 0; j < values->len && !seen; j++ )
+        {
+          seen = g_array_index( values, guint32, j ) == sel->value[f];
+        }
+
+      if ( !seen )
+        {
+          g_array_append_val( values, sel->value[f] );
+        }
+    }
+
+  return values;
+}
+
+
+/* The selectors which want value in field f if matching, and those which do not test it if untested */
+static GPtrArray *
+filter_subset( GPtrArray *sels, guint f, guint32 value, gboolean matching, gboolean untested )
+{
+  GPtrArray *subset;
+
+  subset = g_ptr_array_new();
+
+  for ( guint i = 0; i < sels->len; i++ )
+    {
+      filter_selector *sel = g_ptr_array_index( sels, i );
+      gboolean set = 0 != ( sel->set & ( 1U << f ) );
+
+      if ( ( matching && set && sel->value[f] == value ) || ( untested && !set ) )
+        {
+          g_ptr_array_add( subset, sel );
+        }
+    }
+
+  return subset;
+}
+
+
+static gboolean
+filter_any_done( GPtrArray *sels, guint f )
+{
+  for ( guint i = 0; i < sels->len; i++ )
+    {
+      if ( filter_selector_done( g_ptr_array_index( sels, i ), f ) )
+        {
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+
+/* The field value as a big-endian load at its offset sees it, the segment header being little-endian */
+static guint32
+filter_wire_value( guint f, guint32 value )
+{
+  return 2 == filter_fields[f].size ? GUINT16_SWAP_LE_BE( ( guint16 ) value ) : GUINT32_SWAP_LE_BE( value );
+}
+
+
+/*
+ * libpcap expressions
+ */
+
+/* NULL if the selectors match everything from field f on */
+static gchar *
+filter_expr_node( GPtrArray *sels, guint f )
+{
+  GPtrArray *parts;
+  GPtrArray *any;
+  GArray *values;
+  gchar *expr;
+
+  if ( f >= FILTER_N_FIELDS || filter_any_done( sels, f ) )
+    {
+      return NULL;
+    }
+
+  parts = g_ptr_array_new_with_free_func( g_free );
+  values = filter_distinct_values( sels, f );
+
+  for ( guint i = 0; i < values->len; i++ )
+    {
+      guint32 value = g_array_index( values, guint32, i );
+      GPtrArray *subset = filter_subset( sels, f, value, TRUE, FALSE );
+      gchar *child = filter_expr_node( subset, f + 1 );
+      gchar *test;
+
+      test = g_strdup_printf( "udp[%u:%u] = 0x%0*x", 8 + filter_fields[f].offset, filter_fields[f].size,
+                              ( gint ) filter_fields[f].size * 2, filter_wire_value( f, value ) );
+      if ( NULL != child )
+        {
+          g_ptr_array_add( parts, g_strdup_printf( "%s and (%s)", test, child ) );
+          g_free( test );
+        }
+      else
+        {
+          g_ptr_array_add( parts, test );
+        }
+
+      g_free( child );
+      g_ptr_array_free( subset, TRUE );
+    }
+
+  any = filter_subset( sels, f, 0, FALSE, TRUE );
+
+  if ( 0 != any->len )
+    {
+      g_ptr_array_add( parts, filter_expr_node( any, f + 1 ) );
+    }
+
+  g_ptr_array_free( any, TRUE );
+  g_array_free( values, TRUE );
+
+  if ( 1 == parts->len )
+    {
+      expr = g_strdup( g_ptr_array_index( parts, 0 ) );
+    }
+  else
+    {
+      GString *joined = g_string_new( NULL );
+
+      for ( guint i = 0; i < parts->len; i++ )
+        {
+          g_string_append_printf( joined, "%s(%s)", 0 == i ? "" : " or ", ( gchar * ) g_ptr_array_index( parts, i ) );
+        }
+
+      expr = g_string_free( joined, FALSE );
+    }
+
+  g_ptr_array_free( parts, TRUE );
+
+  return expr;
+}
+
+
+/*
+ * libpcap's udp[] follows the IP header length and skips later fragments.
+ * After "vlan" it looks one tag further in, for the rest of the expression,
+ * so the tagged copy has to come last.
+ */
+static gchar *
+filter_expression( GPtrArray *sels )
+{
+  gchar *tests;
+  gchar *expr;
+
+  tests = filter_expr_node( sels, 0 );
+  expr = g_strdup_printf( "udp[8] = 1 and udp[4:2] >= %u%s%s%s", ( guint )( 8 + sizeof( iextp_seg ) ),
+                          NULL != tests ? " and (" : "", NULL != tests ? tests : "", NULL != tests ? ")" : "" );
+  g_free( tests );
+
+  if ( filter_vlan )
+    {
+      gchar *both = g_strdup_printf( "(%s) or (vlan and %s)", expr, expr );
+
+      g_free( expr );
+      expr = both;
+    }
+
+  return expr;
+}
+
+
+/*
+ * BPF programs
+ */
+
+static gint
+filter_label_new( filter_prog *prog )
+{
+  gint pos = -1;
+
+  g_array_append_val( prog->labels, pos );
+
+  return ( gint ) prog->labels->len - 1;
+}
+
+
+static void
+filter_label_place( filter_prog *prog, gint label )
+{
+  g_array_index( prog->labels, gint, label ) = ( gint ) prog->insns->len;
+}
+
+
+static void
+filter_emit( filter_prog *prog, guint16 code, guint32 k, gint jt_label, gint jf_label )
+{
+  filter_insn insn;
+
+  insn.code = code;
+  insn.jt = 0;
+  insn.jf = 0;
+  insn.k = k;
+  insn.jt_label = jt_label;
+  insn.jf_label = jf_label;
+
+  g_array_append_val( prog->insns, insn );
+}
+
+
+/* Load a segment header field into A; X holds the offset of the UDP header less udp_base */
+static void
+filter_emit_load( filter_prog *prog, guint32 offset, guint32 size )
+{
+  guint16 width = 1 == size ? FILTER_B : 2 == size ? FILTER_H : FILTER_W;
+
+  filter_emit( prog, FILTER_LD | width | FILTER_IND, prog->udp_base + 8 + offset, FILTER_NEXT, FILTER_NEXT );
+}
+
+
+/*
+ * A decision tree over the fields in order: each node loads its field once
+ * and compares it with every value the remaining selectors want, jumping to
+ * a subtree for each. Selectors which do not test the field are copied into
+ * every subtree (and get one of their own), so no path has to back up.
+ */
+static void
+filter_emit_node( filter_prog *prog, GPtrArray *sels, guint f, guint32 accept )
+{
+  GPtrArray *any;
+  GArray *values;
+  gint *labels;
+  gint any_label = -1;
+
+  if ( f >= FILTER_N_FIELDS || filter_any_done( sels, f ) )
+    {
+      filter_emit( prog, FILTER_RET | FILTER_K, accept, FILTER_NEXT, FILTER_NEXT );
+      return;
+    }
+
+  values = filter_distinct_values( sels, f );
+  any = filter_subset( sels, f, 0, FALSE, TRUE );
+
+  if ( 0 == values->len )
+    {
+      filter_emit_node( prog, any, f + 1, accept );
+      g_ptr_array_free( any, TRUE );
+      g_array_free( values, TRUE );
+      return;
+    }
+
+  labels = g_new( gint, values->len );
+  filter_emit_load( prog, filter_fields[f].offset, filter_fields[f].size );
+
+  for ( guint i = 0; i < values->len; i++ )
+    {
+      labels[i] = filter_label_new( prog );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, filter_wire_value( f, g_array_index( values, guint32, i ) ),
+                   labels[i], FILTER_NEXT );
+    }
+
+  if ( 0 != any->len )
+    {
+      any_label = filter_label_new( prog );
+      filter_emit( prog, FILTER_JMP | FILTER_JA, 0, any_label, FILTER_NEXT );
+    }
+  else
+    {
+      filter_emit( prog, FILTER_RET | FILTER_K, 0, FILTER_NEXT, FILTER_NEXT );
+    }
+
+  for ( guint i = 0; i < values->len; i++ )
+    {
+      GPtrArray *subset = filter_subset( sels, f, g_array_index( values, guint32, i ), TRUE, TRUE );
+
+      filter_label_place( prog, labels[i] );
+      filter_emit_node( prog, subset, f + 1, accept );
+      g_ptr_array_free( subset, TRUE );
+    }
+
+  if ( 0 != any->len )
+    {
+      filter_label_place( prog, any_label );
+      filter_emit_node( prog, any, f + 1, accept );
+    }
+
+  g_free( labels );
+  g_ptr_array_free( any, TRUE );
+  g_array_free( values, TRUE );
+}
+
+
+/* Check an IPv4 header at off is UDP and not a later fragment, and point X at it */
+static void
+filter_emit_ipv4( filter_prog *prog, guint32 off, gboolean add_off )
+{
+  filter_emit( prog, FILTER_LD | FILTER_B | FILTER_ABS, off + 9, FILTER_NEXT, FILTER_NEXT );
+  filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, 17, FILTER_NEXT, prog->reject );
+  filter_emit( prog, FILTER_LD | FILTER_H | FILTER_ABS, off + 6, FILTER_NEXT, FILTER_NEXT );
+  filter_emit( prog, FILTER_JMP | FILTER_JSET | FILTER_K, 0x1fff, prog->reject, FILTER_NEXT );
+  filter_emit( prog, FILTER_LDX | FILTER_B | FILTER_MSH, off, FILTER_NEXT, FILTER_NEXT );
+
+  if ( add_off )
+    {
+      filter_emit( prog, FILTER_MISC | FILTER_TXA, 0, FILTER_NEXT, FILTER_NEXT );
+      filter_emit( prog, FILTER_ALU | FILTER_ADD | FILTER_K, off, FILTER_NEXT, FILTER_NEXT );
+      filter_emit( prog, FILTER_MISC | FILTER_TAX, 0, FILTER_NEXT, FILTER_NEXT );
+    }
+}
+
+
+/*
+ * Link layer, IPv4 and UDP checks, then the version and length checks the
+ * dissector's heuristic makes, then the selectors. Without VLAN tags the IP
+ * header is at a fixed offset, so X is just its length; with them it can be
+ * at one of three, so X is the UDP header's offset in the frame.
+ */
+static gboolean
+filter_build( filter_prog *prog, GPtrArray *sels, guint32 linktype, guint32 accept, GError **error )
+{
+  gint udp = filter_label_new( prog );
+  gint selectors;
+
+  prog->reject = filter_label_new( prog );
+
+  if ( IEX_LINKTYPE_ETHERNET == linktype && filter_vlan )
+    {
+      gint ip[3];
+      gint tag[2];
+
+      for ( guint i = 0; i < G_N_ELEMENTS( ip ); i++ )
+        {
+          ip[i] = filter_label_new( prog );
+        }
+
+      for ( guint i = 0; i < G_N_ELEMENTS( tag ); i++ )
+        {
+          tag[i] = filter_label_new( prog );
+        }
+
+      prog->udp_base = 0;
+      filter_emit( prog, FILTER_LD | FILTER_H | FILTER_ABS, 12, FILTER_NEXT, FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, FILTER_ETHERTYPE_IPV4, ip[0], FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, FILTER_ETHERTYPE_VLAN, tag[0], FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, FILTER_ETHERTYPE_QINQ, tag[0], FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, FILTER_ETHERTYPE_QINQ1, tag[0], prog->reject );
+
+      filter_label_place( prog, tag[0] );
+      filter_emit( prog, FILTER_LD | FILTER_H | FILTER_ABS, 16, FILTER_NEXT, FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, FILTER_ETHERTYPE_IPV4, ip[1], FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, FILTER_ETHERTYPE_VLAN, tag[1], prog->reject );
+
+      filter_label_place( prog, tag[1] );
+      filter_emit( prog, FILTER_LD | FILTER_H | FILTER_ABS, 20, FILTER_NEXT, FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, FILTER_ETHERTYPE_IPV4, ip[2], prog->reject );
+
+      for ( guint i = 0; i < G_N_ELEMENTS( ip ); i++ )
+        {
+          filter_label_place( prog, ip[i] );
+          filter_emit_ipv4( prog, 14 + 4 * i, TRUE );
+          if ( i + 1 < G_N_ELEMENTS( ip ) )
+            {
+              filter_emit( prog, FILTER_JMP | FILTER_JA, 0, udp, FILTER_NEXT );
+            }
+        }
+    }
+  else if ( IEX_LINKTYPE_ETHERNET == linktype || IEX_LINKTYPE_LINUX_SLL == linktype )
+    {
+      guint32 hdr = IEX_LINKTYPE_ETHERNET == linktype ? 14 : 16;
+
+      prog->udp_base = hdr;
+      filter_emit( prog, FILTER_LD | FILTER_H | FILTER_ABS, hdr - 2, FILTER_NEXT, FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, FILTER_ETHERTYPE_IPV4, FILTER_NEXT, prog->reject );
+      filter_emit_ipv4( prog, hdr, FALSE );
+    }
+  else if ( IEX_LINKTYPE_RAW == linktype )
+    {
+      prog->udp_base = 0;
+      filter_emit( prog, FILTER_LD | FILTER_B | FILTER_ABS, 0, FILTER_NEXT, FILTER_NEXT );
+      filter_emit( prog, FILTER_ALU | FILTER_AND | FILTER_K, 0xf0, FILTER_NEXT, FILTER_NEXT );
+      filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, 0x40, FILTER_NEXT, prog->reject );
+      filter_emit_ipv4( prog, 0, FALSE );
+    }
+  else
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "unsupported link type %u", linktype );
+      return FALSE;
+    }
+
+  /* The shared reject sits just before the selectors, so everything above can reach it */
+  filter_label_place( prog, udp );
+  selectors = filter_label_new( prog );
+  filter_emit_load( prog, G_STRUCT_OFFSET( iextp_seg, version ), 1 );
+  filter_emit( prog, FILTER_JMP | FILTER_JEQ | FILTER_K, 1, FILTER_NEXT, prog->reject );
+  filter_emit( prog, FILTER_LD | FILTER_H | FILTER_IND, prog->udp_base + 4, FILTER_NEXT, FILTER_NEXT );
+  filter_emit( prog, FILTER_JMP | FILTER_JGE | FILTER_K, ( guint32 )( 8 + sizeof( iextp_seg ) ), selectors,
+               prog->reject );
+  filter_label_place( prog, prog->reject );
+  filter_emit( prog, FILTER_RET | FILTER_K, 0, FILTER_NEXT, FILTER_NEXT );
+
+  filter_label_place( prog, selectors );
+  filter_emit_node( prog, sels, 0, accept );
+
+  return TRUE;
+}
+
+
+/* Turn labels into offsets; conditional jumps only reach 255 instructions ahead */
+static gboolean
+filter_resolve( filter_prog *prog, GError **error )
+{
+  if ( prog->insns->len > FILTER_MAX_INSNS )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "the program is too long (%u instructions, at most %d)",
+                   prog->insns->len, FILTER_MAX_INSNS );
+      return FALSE;
+    }
+
+  for ( guint i = 0; i < prog->insns->len; i++ )
+    {
+      filter_insn *insn = &g_array_index( prog->insns, filter_insn, i );
+      gint jt = FILTER_NEXT == insn->jt_label ? ( gint ) i + 1 : g_array_index( prog->labels, gint, insn->jt_label );
+      gint jf = FILTER_NEXT == insn->jf_label ? ( gint ) i + 1 : g_array_index( prog->labels, gint, insn->jf_label );
+
+      g_assert( jt > ( gint ) i && jf > ( gint ) i );
+
+      if ( ( FILTER_JMP | FILTER_JA ) == insn->code )
+        {
+          insn->k = ( guint32 )( jt - ( gint ) i - 1 );
+        }
+      else if ( FILTER_JMP == ( insn->code & 0x07 ) )
+        {
+          if ( jt - ( gint ) i - 1 > G_MAXUINT8 || jf - ( gint ) i - 1 > G_MAXUINT8 )
+            {
+              g_set_error( error, IEX_TOOLS_ERROR, 0, "too many selectors for one program" );
+              return FALSE;
+            }
+
+          insn->jt = ( guint8 )( jt - ( gint ) i - 1 );
+          insn->jf = ( guint8 )( jf - ( gint ) i - 1 );
+        }
+    }
+
+  return TRUE;
+}
+
+
+/* As tcpdump -d prints it */
+static void
+filter_print_insn( GString *out, guint pc, const filter_insn *insn )
+{
+  const gchar *op;
+  gchar *arg;
+  gboolean jump = FALSE;
+
+  switch ( insn->code )
+    {
+    case FILTER_LD | FILTER_W | FILTER_ABS:
+    case FILTER_LD | FILTER_H | FILTER_ABS:
+    case FILTER_LD | FILTER_B | FILTER_ABS:
+      op = FILTER_W == ( insn->code & 0x18 ) ? "ld" : FILTER_H == ( insn->code & 0x18 ) ? "ldh" : "ldb";
+      arg = g_strdup_printf( "[%u]", insn->k );
+      break;
+
+    case FILTER_LD | FILTER_W | FILTER_IND:
+    case FILTER_LD | FILTER_H | FILTER_IND:
+    case FILTER_LD | FILTER_B | FILTER_IND:
+      op = FILTER_W == ( insn->code & 0x18 ) ? "ld" : FILTER_H == ( insn->code & 0x18 ) ? "ldh" : "ldb";
+      arg = g_strdup_printf( "[x + %u]", insn->k );
+      break;
+
+    case FILTER_LDX | FILTER_B | FILTER_MSH:
+      op = "ldxb";
+      arg = g_strdup_printf( "4*([%u]&0xf)", insn->k );
+      break;
+
+    case FILTER_ALU | FILTER_ADD | FILTER_K:
+      op = "add";
+      arg = g_strdup_printf( "#%u", insn->k );
+      break;
+
+    case FILTER_ALU | FILTER_AND | FILTER_K:
+      op = "and";
+      arg = g_strdup_printf( "#0x%x", insn->k );
+      break;
+
+    case FILTER_JMP | FILTER_JA:
+      op = "ja";
+      arg = g_strdup_printf( "%u", pc + 1 + insn->k );
+      break;
+
+    case FILTER_JMP | FILTER_JEQ | FILTER_K:
+    case FILTER_JMP | FILTER_JGE | FILTER_K:
+    case FILTER_JMP | FILTER_JSET | FILTER_K:
+      op = FILTER_JEQ == ( insn->code & 0xf0 ) ? "jeq" : FILTER_JGE == ( insn->code & 0xf0 ) ? "jge" : "jset";
+      arg = g_strdup_printf( "#0x%x", insn->k );
+      jump = TRUE;
+      break;
+
+    case FILTER_RET | FILTER_K:
+      op = "ret";
+      arg = g_strdup_printf( "#%u", insn->k );
+      break;
+
+    case FILTER_MISC | FILTER_TAX:
+      op = "tax";
+      arg = g_strdup( "" );
+      break;
+
+    case FILTER_MISC | FILTER_TXA:
+      op = "txa";
+      arg = g_strdup( "" );
+      break;
+
+    default:
+      op = "unimp";
+      arg = g_strdup_printf( "0x%x", insn->code );
+      break;
+    }
+
+  if ( jump )
+    {
+      g_string_append_printf( out, "(%03u) %-8s %-16s jt %u\tjf %u\n", pc, op, arg, pc + 1 + insn->jt,
+                              pc + 1 + insn->jf );
+    }
+  else
+    {
+      g_string_append_printf( out, "(%03u) %-8s %s\n", pc, op, arg );
+    }
+
+  g_free( arg );
+}
+
+
+static void
+filter_print( GString *out, const filter_prog *prog )
+{
+  if ( 3 <= filter_dump )
+    {
+      g_string_append_printf( out, "%u\n", prog->insns->len );
+    }
+
+  for ( guint i = 0; i < prog->insns->len; i++ )
+    {
+      const filter_insn *insn = &g_array_index( prog->insns, filter_insn, i );
+
+      switch ( filter_dump )
+        {
+        case 1:
+          filter_print_insn( out, i, insn );
+          break;
+
+        case 2:
+          g_string_append_printf( out, "{ 0x%x, %u, %u, 0x%08x },\n", insn->code, insn->jt, insn->jf, insn->k );
+          break;
+
+        default:
+          g_string_append_printf( out, "%u %u %u %u\n", insn->code, insn->jt, insn->jf, insn->k );
+          break;
+        }
+    }
+}
+
+
+/*
+ * Checking against a capture
+ */
+
+/* Just the instructions filter_build() emits; 0 for anything out of bounds, as in the kernel */
+static guint32
+filter_run( const filter_prog *prog, const guint8 *data, guint32 len )
+{
+  const filter_insn *insns = ( const filter_insn * ) prog->insns->data;
+  guint32 a = 0;
+  guint32 x = 0;
+  guint pc = 0;
+
+  for ( ;; )
+    {
+      const filter_insn *insn = &insns[pc++];
+      guint32 off = insn->k;
+      guint32 size;
+
+      switch ( insn->code & 0x07 )
+        {
+        case FILTER_LD:
+          size = FILTER_W == ( insn->code & 0x18 ) ? 4 : FILTER_H == ( insn->code & 0x18 ) ? 2 : 1;
+          if ( FILTER_IND == ( insn->code & 0xe0 ) )
+            {
+              off += x;
+            }
+
+          if ( off < insn->k && FILTER_IND == ( insn->code & 0xe0 ) )
+            {
+              return 0;
+            }
+
+          if ( off > len || len - off < size )
+            {
+              return 0;
+            }
+
+          a = 4 == size ? ( guint32 ) data[off] << 24 | ( guint32 ) data[off + 1] << 16 | ( guint32 ) data[off + 2] << 8
+                          | data[off + 3]
+            : 2 == size ? ( guint32 ) data[off] << 8 | data[off + 1] : data[off];
+          break;
+
+        case FILTER_LDX:
+          if ( off >= len )
+            {
+              return 0;
+            }
+
+          x = ( guint32 )( data[off] & 0x0f ) * 4;
+          break;
+
+        case FILTER_ALU:
+          a = FILTER_ADD == ( insn->code & 0xf0 ) ? a + insn->k : a & insn->k;
+          break;
+
+        case FILTER_JMP:
+          switch ( insn->code & 0xf0 )
+            {
+            case FILTER_JA:
+              pc += insn->k;
+              break;
+
+            case FILTER_JEQ:
+              pc += a == insn->k ? insn->jt : insn->jf;
+              break;
+
+            case FILTER_JGE:
+              pc += a >= insn->k ? insn->jt : insn->jf;
+              break;
+
+            default:
+              pc += 0 != ( a & insn->k ) ? insn->jt : insn->jf;
+              break;
+            }
+          break;
+
+        case FILTER_RET:
+          return insn->k;
+
+        default:
+          if ( FILTER_TAX == ( insn->code & 0xf8 ) )
+            {
+              x = a;
+            }
+          else
+            {
+              a = x;
+            }
+          break;
+        }
+    }
+}
+
+
+/* What the filter should say, from the tools' own decoding of the packet */
+static gboolean
+filter_expected( GPtrArray *sels, guint32 linktype, const iex_pcap_record *record )
+{
+  const iextp_seg *hdr;
+  iex_udp udp;
+  guint32 value[FILTER_N_FIELDS];
+
+  if ( !iex_pcap_udp( linktype, record->data, record->caplen, &udp ) || sizeof( iextp_seg ) > udp.len )
+    {
+      return FALSE;
+    }
+
+  hdr = ( const iextp_seg * ) udp.payload;
+  if ( 1 != hdr->version )
+    {
+      return FALSE;
+    }
+
+  value[FILTER_PROTOCOL] = GUINT16_FROM_LE( hdr->protocol );
+  value[FILTER_CHANNEL] = GUINT32_FROM_LE( hdr->channel );
+  value[FILTER_SESSION] = GUINT32_FROM_LE( hdr->session );
+
+  for ( guint i = 0; i < sels->len; i++ )
+    {
+      const filter_selector *sel = g_ptr_array_index( sels, i );
+      gboolean match = TRUE;
+
+      for ( guint f = 0; f < FILTER_N_FIELDS && match; f++ )
+        {
+          match = 0 == ( sel->set & ( 1U << f ) ) || sel->value[f] == value[f];
+        }
+
+      if ( match )
+        {
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+
+static gboolean
+filter_check_file( GPtrArray *sels, const gchar *path, GError **error )
+{
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  filter_prog prog;
+  GError *local_error = NULL;
+  guint64 packets = 0;
+  guint64 accepted = 0;
+  guint64 expected = 0;
+  guint64 differ = 0;
+  guint32 linktype;
+  gboolean ok;
+
+  reader = iex_pcap_open( path, g_get_num_processors(), error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  linktype = iex_pcap_linktype( reader );
+  if ( IEX_LINKTYPE_IPV4 == linktype )
+    {
+      linktype = IEX_LINKTYPE_RAW;
+    }
+
+  prog.insns = g_array_new( FALSE, FALSE, sizeof( filter_insn ) );
+  prog.labels = g_array_new( FALSE, FALSE, sizeof( gint ) );
+  ok = filter_build( &prog, sels, linktype, 1, error ) && filter_resolve( &prog, error );
+
+  while ( ok && iex_pcap_next( reader, &record, &local_error ) )
+    {
+      gboolean got = 0 != filter_run( &prog, record.data, record.caplen );
+      gboolean want = filter_expected( sels, linktype, &record );
+
+      packets++;
+      accepted += got;
+      expected += want;
+
+      if ( got != want && differ++ < 10 )
+        {
+          g_printerr( "packet %" G_GUINT64_FORMAT ": filter %s, expected %s\n", packets, got ? "accepts" : "rejects",
+                      want ? "accept" : "reject" );
+        }
+    }
+
+  iex_pcap_close( reader );
+  g_array_free( prog.insns, TRUE );
+  g_array_free( prog.labels, TRUE );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_prefixed_error( error, local_error, "%s: ", path );
+      return FALSE;
+    }
+
+  if ( ok )
+    {
+      printf( "%" G_GUINT64_FORMAT " packets, %" G_GUINT64_FORMAT " accepted, %" G_GUINT64_FORMAT " expected, %"
+              G_GUINT64_FORMAT " different\n", packets, accepted, expected, differ );
+    }
+
+  return ok && 0 == differ;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GPtrArray *sels;
+  filter_selector *selectors;
+  guint n_selectors;
+  guint32 linktype = IEX_LINKTYPE_ETHERNET;
+  int rc = EXIT_SUCCESS;
+
+  context = g_option_context_new( "- generate capture filters for IEX-TP channels and sessions" );
+  g_option_context_set_summary( context, "Prints a capture filter accepting IEX-TP segments, for tcpdump or "
+                                "dumpcap -f, or as a classic BPF program with -d. Each SELECTOR is a comma-separated "
+                                "list of protocol=, channel= and session= values (the protocol may be 'tops'); a "
+                                "segment is kept if it matches any selector, or is IEX-TP at all if none are given." );
+  g_option_context_add_main_entries( context, filter_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( NULL != filter_linktype_arg )
+    {
+      if ( 0 == g_ascii_strcasecmp( filter_linktype_arg, "ethernet" ) )
+        {
+          linktype = IEX_LINKTYPE_ETHERNET;
+        }
+      else if ( 0 == g_ascii_strcasecmp( filter_linktype_arg, "sll" ) )
+        {
+          linktype = IEX_LINKTYPE_LINUX_SLL;
+        }
+      else if ( 0 == g_ascii_strcasecmp( filter_linktype_arg, "raw" ) )
+        {
+          linktype = IEX_LINKTYPE_RAW;
+        }
+      else
+        {
+          g_printerr( "unknown link type '%s'\n", filter_linktype_arg );
+          return EXIT_FAILURE;
+        }
+    }
+
+  if ( 0 >= filter_snaplen )
+    {
+      filter_snaplen = FILTER_DEFAULT_SNAPLEN;
+    }
+
+  n_selectors = NULL != filter_args ? g_strv_length( filter_args ) : 0;
+  selectors = g_new0( filter_selector, MAX( 1, n_selectors ) );
+  sels = g_ptr_array_new();
+
+  for ( guint i = 0; i < n_selectors; i++ )
+    {
+      if ( !filter_parse_selector( filter_args[i], &selectors[i], &error ) )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+          break;
+        }
+
+      g_ptr_array_add( sels, &selectors[i] );
+    }
+
+  /* No selectors at all matches every segment */
+  if ( EXIT_SUCCESS == rc && 0 == n_selectors )
+    {
+      g_ptr_array_add( sels, &selectors[0] );
+    }
+
+  if ( EXIT_SUCCESS == rc && NULL != filter_check )
+    {
+      if ( !filter_check_file( sels, filter_check, &error ) )
+        {
+          if ( NULL != error )
+            {
+              g_printerr( "%s\n", error->message );
+              g_clear_error( &error );
+            }
+
+          rc = EXIT_FAILURE;
+        }
+    }
+  else if ( EXIT_SUCCESS == rc && 0 != filter_dump )
+    {
+      filter_prog prog;
+      GString *out;
+
+      prog.insns = g_array_new( FALSE, FALSE, sizeof( filter_insn ) );
+      prog.labels = g_array_new( FALSE, FALSE, sizeof( gint ) );
+      out = g_string_new( NULL );
+
+      if ( filter_build( &prog, sels, linktype, ( guint32 ) filter_snaplen, &error ) && filter_resolve( &prog, &error ) )
+        {
+          filter_print( out, &prog );
+          fputs( out->str, stdout );
+        }
+      else
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+
+      g_string_free( out, TRUE );
+      g_array_free( prog.insns, TRUE );
+      g_array_free( prog.labels, TRUE );
+    }
+  else if ( EXIT_SUCCESS == rc )
+    {
+      gchar *expr = filter_expression( sels );
+
+      printf( "%s\n", expr );
+      g_free( expr );
+    }
+
+  g_ptr_array_free( sels, TRUE );
+  g_free( selectors );
+  g_free( filter_linktype_arg );
+  g_free( filter_check );
+  g_strfreev( filter_args );
+
+  return rc;
+}
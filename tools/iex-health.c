@@ -0,0 +1,216 @@
+/*
+ * iex-health.c - Report microbursts and feed health from IEX-TP captures
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-input.h"
+#include "iex-pcap.h"
+#include "iex-seg.h"
+#include "iex-text.h"
+#include "iex-health.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HEALTH_DEFAULT_WINDOWS "1us,10us,100us,1ms"
+
+/* Command line options */
+static gint health_threads = 0;
+static gint health_top_k = 10;
+static gchar *health_windows_arg = NULL;
+static gchar **health_files = NULL;
+
+static GOptionEntry health_options[] =
+{
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &health_threads,
+    "Decompression threads for compressed captures (default: all processors)", "N" },
+  { "windows", 'w', 0, G_OPTION_ARG_STRING, &health_windows_arg,
+    "Comma-separated window sizes, each a multiple of 10 ns (default: " HEALTH_DEFAULT_WINDOWS ")", "WINDOWS" },
+  { "top", 'k', 0, G_OPTION_ARG_INT, &health_top_k, "Bursts to report per window size (default: 10)", "K" },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &health_files, NULL, "CAPTURE..." },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+static gboolean
+health_parse_windows( const gchar *spec, gint64 *windows, guint *n_windows, GError **error )
+{
+  gchar **names;
+  gboolean ok = TRUE;
+
+  names = g_strsplit( spec, ",", -1 );
+  *n_windows = 0;
+
+  for ( gchar **name = names; NULL != *name && ok; name++ )
+    {
+      if ( IEX_HEALTH_MAX_WINDOWS == *n_windows )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "too many windows (at most %d)", IEX_HEALTH_MAX_WINDOWS );
+          ok = FALSE;
+        }
+      else if ( !iex_text_parse_duration( g_strstrip( *name ), &windows[*n_windows] ) )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "invalid window '%s'", *name );
+          ok = FALSE;
+        }
+      else if ( windows[*n_windows] < IEX_HEALTH_BUCKETS || 0 != windows[*n_windows] % IEX_HEALTH_BUCKETS )
+        {
+          /* Otherwise the buckets would not add up to the window asked for */
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "window '%s' is not a multiple of %d ns", *name,
+                       IEX_HEALTH_BUCKETS );
+          ok = FALSE;
+        }
+      else
+        {
+          ( *n_windows )++;
+        }
+    }
+
+  if ( ok && 0 == *n_windows )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "no windows given" );
+      ok = FALSE;
+    }
+
+  g_strfreev( names );
+
+  return ok;
+}
+
+
+/* Frame numbers carry on from one capture to the next, as if they were concatenated */
+static gboolean
+health_file( iex_health *health, const gchar *path, guint64 *frame, guint64 *segments, GError **error )
+{
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  GError *local_error = NULL;
+  guint32 linktype;
+
+  reader = iex_pcap_open( path, ( guint ) health_threads, error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  linktype = iex_pcap_linktype( reader );
+
+  while ( iex_pcap_next( reader, &record, &local_error ) )
+    {
+      iex_udp udp;
+      iex_seg seg;
+
+      ( *frame )++;
+
+      if ( !iex_pcap_udp( linktype, record.data, record.caplen, &udp ) || !iex_seg_parse( udp.payload, udp.len, &seg ) )
+        {
+          continue;
+        }
+
+      iex_health_add( health, *frame, seg.send_time, seg.channel, seg.session, seg.count, seg.length );
+      ( *segments )++;
+    }
+
+  iex_pcap_close( reader );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_error( error, local_error );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  iex_health *health;
+  GString *report;
+  gint64 windows[IEX_HEALTH_MAX_WINDOWS];
+  guint n_windows;
+  guint64 frame = 0;
+  guint64 segments = 0;
+  gint64 start;
+  int rc = EXIT_SUCCESS;
+
+  context = g_option_context_new( "- report microbursts and feed health" );
+  g_option_context_set_summary( context, "Reads pcap files (optionally gzip or zstd compressed) in one pass and "
+                                "reports, per IEX-TP channel, the peak messages and bytes per window of send "
+                                "time, the largest segment and the heartbeat cadence, followed by the worst bursts "
+                                "with the frames they span. Frames are numbered across all captures in order." );
+  g_option_context_add_main_entries( context, health_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) || NULL == health_files )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "no capture files given" );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( !health_parse_windows( NULL != health_windows_arg ? health_windows_arg : HEALTH_DEFAULT_WINDOWS, windows,
+                              &n_windows, &error ) )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      return EXIT_FAILURE;
+    }
+
+  if ( 0 >= health_threads )
+    {
+      health_threads = ( gint ) g_get_num_processors();
+    }
+
+  health = iex_health_new( windows, n_windows, ( guint ) MAX( 1, health_top_k ) );
+  start = g_get_monotonic_time();
+
+  for ( gchar **path = health_files; NULL != *path; path++ )
+    {
+      if ( !health_file( health, *path, &frame, &segments, &error ) )
+        {
+          g_printerr( "%s: %s\n", *path, error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+    }
+
+  report = g_string_new( NULL );
+  iex_health_report( health, report );
+  fputs( report->str, stdout );
+
+  g_printerr( "%" G_GUINT64_FORMAT " segments in %" G_GUINT64_FORMAT " frames in %.3f s\n", segments, frame,
+              ( gdouble )( g_get_monotonic_time() - start ) / 1e6 );
+
+  g_string_free( report, TRUE );
+  iex_health_free( health );
+  g_free( health_windows_arg );
+  g_strfreev( health_files );
+
+  return rc;
+}
@@ -0,0 +1,937 @@
+/*
+ * iex-input.c - Capture file input with parallel block decompression
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-input.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic ignored "-Wpadded"
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+# define IEX_INPUT_HAVE_ZLIB TRUE
+#else
+# define IEX_INPUT_HAVE_ZLIB FALSE
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+# define IEX_INPUT_HAVE_ZSTD TRUE
+#else
+# define IEX_INPUT_HAVE_ZSTD FALSE
+#endif /* HAVE_ZSTD */
+
+#pragma GCC diagnostic error "-Wpadded"
+
+/* Buffer size used when a file can only be decompressed as one stream */
+#define IEX_INPUT_STREAM_CHUNK ( 4U << 20 )
+#define IEX_INPUT_STREAM_SLOTS 4
+
+/* Blocks bigger than this are not worth a buffer per slot, stream them instead */
+#define IEX_INPUT_MAX_BLOCK ( 64U << 20 )
+
+#define IEX_ZSTD_MAGIC           0xFD2FB528U
+#define IEX_ZSTD_SKIPPABLE_MAGIC 0x184D2A50U
+#define IEX_ZSTD_SKIPPABLE_MASK  0xFFFFFFF0U
+#define IEX_ZSTD_SEEKABLE_MAGIC  0x8F92EAB1U
+#define IEX_ZSTD_SEEKABLE_FOOTER 9
+
+#define IEX_BGZF_HEADER_LEN 18
+
+/* An independently decompressible block of the input */
+typedef struct _iex_input_block
+{
+  const guint8 *src;
+  gsize         src_len;
+  gsize         dst_len;
+} iex_input_block;
+
+/* A decompressed buffer in the ring, holding block "seq" once ready */
+typedef struct _iex_input_slot
+{
+  guint8  *data;
+  gsize    len;
+  gsize    cap;
+  guint64  seq;
+  gboolean ready;
+  guint32  __padding;
+} iex_input_slot;
+
+struct _iex_input
+{
+  const guint8    *map;
+  gsize            map_len;
+  GArray          *blocks;
+  iex_input_slot  *slots;
+  GThread        **threads;
+  gchar           *error;
+
+  GMutex           lock;
+  GCond            cond;
+
+  /* Protected by lock */
+  guint64          next_block;
+  guint64          released;
+  guint64          n_blocks;
+  guint64          read_seq;
+  gboolean         stopping;
+  gboolean         held;
+
+  iex_input_format format;
+  gint             fd;
+  guint            n_slots;
+  guint            n_threads;
+  gboolean         streaming;
+  gboolean         plain_done;
+};
+
+
+G_DEFINE_QUARK( iex-tools-error-quark, iex_tools_error )
+
+
+static inline guint32
+iex_input_le32( const guint8 *p )
+{
+  return ( guint32 ) p[0] | ( ( guint32 ) p[1] << 8 ) | ( ( guint32 ) p[2] << 16 ) | ( ( guint32 ) p[3] << 24 );
+}
+
+
+static inline guint16
+iex_input_le16( const guint8 *p )
+{
+  return ( guint16 )( p[0] | ( p[1] << 8 ) );
+}
+
+
+/* Record the first worker error and stop everything, lock must be held */
+static void
+iex_input_fail( iex_input *input, gchar *message )
+{
+  if ( NULL == input->error )
+    {
+      input->error = message;
+    }
+  else
+    {
+      g_free( message );
+    }
+
+  input->stopping = TRUE;
+  g_cond_broadcast( &input->cond );
+}
+
+
+/*
+ * Block indexing
+ */
+
+/* BGZF is gzip with each member's size in a "BC" extra field, written by bgzip */
+static gboolean
+iex_input_index_bgzf( iex_input *input )
+{
+  gsize pos = 0;
+
+  while ( pos < input->map_len )
+    {
+      const guint8 *p = input->map + pos;
+      iex_input_block block;
+      gsize bsize;
+
+      if ( input->map_len - pos < IEX_BGZF_HEADER_LEN || 0x1f != p[0] || 0x8b != p[1] || 8 != p[2]
+           || 0 == ( p[3] & 0x04 ) || 'B' != p[12] || 'C' != p[13] || 2 != iex_input_le16( p + 14 ) )
+        {
+          return FALSE;
+        }
+
+      bsize = ( gsize ) iex_input_le16( p + 16 ) + 1;
+      if ( bsize > input->map_len - pos )
+        {
+          return FALSE;
+        }
+
+      block.src = p;
+      block.src_len = bsize;
+      block.dst_len = iex_input_le32( p + bsize - 4 );
+      g_array_append_val( input->blocks, block );
+
+      pos += bsize;
+    }
+
+  return TRUE;
+}
+
+
+#ifdef HAVE_ZSTD
+/* The seekable format appends a skippable frame listing every frame's sizes */
+static gboolean
+iex_input_index_zstd_seekable( iex_input *input )
+{
+  const guint8 *footer;
+  const guint8 *entry;
+  gsize entry_len;
+  gsize table_len;
+  guint32 n_frames;
+  gsize pos = 0;
+
+  if ( input->map_len < IEX_ZSTD_SEEKABLE_FOOTER + 8 )
+    {
+      return FALSE;
+    }
+
+  footer = input->map + input->map_len - IEX_ZSTD_SEEKABLE_FOOTER;
+  if ( IEX_ZSTD_SEEKABLE_MAGIC != iex_input_le32( footer + 5 ) )
+    {
+      return FALSE;
+    }
+
+  n_frames = iex_input_le32( footer );
+  entry_len = ( footer[4] & 0x80 ) ? 12 : 8;
+  table_len = 8 + ( gsize ) n_frames * entry_len + IEX_ZSTD_SEEKABLE_FOOTER;
+  if ( table_len > input->map_len )
+    {
+      return FALSE;
+    }
+
+  entry = input->map + input->map_len - table_len + 8;
+  for ( guint32 i = 0; i < n_frames; i++, entry += entry_len )
+    {
+      iex_input_block block;
+
+      block.src = input->map + pos;
+      block.src_len = iex_input_le32( entry );
+      block.dst_len = iex_input_le32( entry + 4 );
+
+      if ( block.src_len > input->map_len - table_len - pos )
+        {
+          return FALSE;
+        }
+
+      g_array_append_val( input->blocks, block );
+      pos += block.src_len;
+    }
+
+  return pos == input->map_len - table_len;
+}
+
+
+/* Any sequence of zstd frames which all record their content size */
+static gboolean
+iex_input_index_zstd_frames( iex_input *input )
+{
+  gsize pos = 0;
+
+  while ( pos < input->map_len )
+    {
+      const guint8 *p = input->map + pos;
+      gsize remaining = input->map_len - pos;
+      iex_input_block block;
+      unsigned long long content_size;
+      gsize frame_size;
+
+      if ( remaining < 8 )
+        {
+          return FALSE;
+        }
+
+      if ( IEX_ZSTD_SKIPPABLE_MAGIC == ( iex_input_le32( p ) & IEX_ZSTD_SKIPPABLE_MASK ) )
+        {
+          frame_size = 8 + ( gsize ) iex_input_le32( p + 4 );
+          if ( frame_size > remaining )
+            {
+              return FALSE;
+            }
+
+          pos += frame_size;
+          continue;
+        }
+
+      frame_size = ZSTD_findFrameCompressedSize( p, remaining );
+      content_size = ZSTD_getFrameContentSize( p, remaining );
+      if ( ZSTD_isError( frame_size ) || ZSTD_CONTENTSIZE_UNKNOWN == content_size
+           || ZSTD_CONTENTSIZE_ERROR == content_size )
+        {
+          return FALSE;
+        }
+
+      block.src = p;
+      block.src_len = frame_size;
+      block.dst_len = ( gsize ) content_size;
+      g_array_append_val( input->blocks, block );
+
+      pos += frame_size;
+    }
+
+  return TRUE;
+}
+#endif /* HAVE_ZSTD */
+
+
+/*
+ * Decompression
+ */
+
+static gboolean
+iex_input_inflate_block( const iex_input_block *block, iex_input_slot *slot, gchar **message )
+{
+#ifdef HAVE_ZLIB
+  z_stream zs;
+  int rc;
+
+  memset( &zs, 0, sizeof( zs ) );
+  if ( Z_OK != inflateInit2( &zs, 16 + MAX_WBITS ) )
+    {
+      *message = g_strdup( "could not initialize zlib" );
+      return FALSE;
+    }
+
+  zs.next_in = ( Bytef * ) block->src;
+  zs.avail_in = ( uInt ) block->src_len;
+  zs.next_out = slot->data;
+  zs.avail_out = ( uInt ) slot->cap;
+
+  rc = inflate( &zs, Z_FINISH );
+  slot->len = zs.total_out;
+
+  if ( Z_STREAM_END != rc || slot->len != block->dst_len )
+    {
+      inflateEnd( &zs );
+      *message = g_strdup_printf( "corrupt gzip block: %s", NULL != zs.msg ? zs.msg : "size mismatch" );
+      return FALSE;
+    }
+
+  inflateEnd( &zs );
+
+  return TRUE;
+#else
+  ( void ) block;
+  ( void ) slot;
+  *message = g_strdup( "gzip support was not built in" );
+  return FALSE;
+#endif /* HAVE_ZLIB */
+}
+
+
+static gboolean
+iex_input_unzstd_block( const iex_input_block *block, iex_input_slot *slot, gchar **message )
+{
+#ifdef HAVE_ZSTD
+  gsize rc;
+
+  rc = ZSTD_decompress( slot->data, slot->cap, block->src, block->src_len );
+  if ( ZSTD_isError( rc ) || rc != block->dst_len )
+    {
+      *message = g_strdup_printf( "corrupt zstd frame: %s", ZSTD_isError( rc ) ? ZSTD_getErrorName( rc ) : "size mismatch" );
+      return FALSE;
+    }
+
+  slot->len = rc;
+
+  return TRUE;
+#else
+  ( void ) block;
+  ( void ) slot;
+  *message = g_strdup( "zstd support was not built in" );
+  return FALSE;
+#endif /* HAVE_ZSTD */
+}
+
+
+/* Parallel workers: each claims the next block once its ring slot is free */
+static gpointer
+iex_input_block_worker( gpointer data )
+{
+  iex_input *input = ( iex_input * ) data;
+
+  for ( ;; )
+    {
+      const iex_input_block *block;
+      iex_input_slot *slot;
+      gchar *message = NULL;
+      gboolean ok;
+      guint64 seq;
+
+      g_mutex_lock( &input->lock );
+      while ( !input->stopping && input->next_block < input->n_blocks
+              && input->next_block >= input->released + input->n_slots )
+        {
+          g_cond_wait( &input->cond, &input->lock );
+        }
+
+      if ( input->stopping || input->next_block >= input->n_blocks )
+        {
+          g_mutex_unlock( &input->lock );
+          break;
+        }
+
+      seq = input->next_block++;
+      g_mutex_unlock( &input->lock );
+
+      block = &g_array_index( input->blocks, iex_input_block, seq );
+      slot = &input->slots[seq % input->n_slots];
+
+      if ( IEX_INPUT_BGZF == input->format )
+        {
+          ok = iex_input_inflate_block( block, slot, &message );
+        }
+      else
+        {
+          ok = iex_input_unzstd_block( block, slot, &message );
+        }
+
+      g_mutex_lock( &input->lock );
+      if ( !ok )
+        {
+          iex_input_fail( input, message );
+        }
+
+      slot->seq = seq;
+      slot->ready = TRUE;
+      g_cond_broadcast( &input->cond );
+      g_mutex_unlock( &input->lock );
+    }
+
+  return NULL;
+}
+
+
+/* Wait for the next free slot in streaming mode, NULL if stopping */
+static iex_input_slot *
+iex_input_stream_slot( iex_input *input, guint64 seq )
+{
+  iex_input_slot *slot = NULL;
+
+  g_mutex_lock( &input->lock );
+  while ( !input->stopping && seq >= input->released + input->n_slots )
+    {
+      g_cond_wait( &input->cond, &input->lock );
+    }
+
+  if ( !input->stopping )
+    {
+      slot = &input->slots[seq % input->n_slots];
+      slot->len = 0;
+    }
+  g_mutex_unlock( &input->lock );
+
+  return slot;
+}
+
+
+static void
+iex_input_stream_publish( iex_input *input, iex_input_slot *slot, guint64 seq, gboolean eof, gchar *message )
+{
+  g_mutex_lock( &input->lock );
+  if ( NULL != message )
+    {
+      iex_input_fail( input, message );
+    }
+
+  slot->seq = seq;
+  slot->ready = TRUE;
+  if ( eof )
+    {
+      input->n_blocks = seq + 1;
+    }
+
+  g_cond_broadcast( &input->cond );
+  g_mutex_unlock( &input->lock );
+}
+
+
+#ifdef HAVE_ZLIB
+static void
+iex_input_stream_gzip( iex_input *input )
+{
+  z_stream zs;
+  guint64 seq = 0;
+  gboolean eof = FALSE;
+
+  memset( &zs, 0, sizeof( zs ) );
+  if ( Z_OK != inflateInit2( &zs, 16 + MAX_WBITS ) )
+    {
+      g_mutex_lock( &input->lock );
+      iex_input_fail( input, g_strdup( "could not initialize zlib" ) );
+      g_mutex_unlock( &input->lock );
+      return;
+    }
+
+  zs.next_in = ( Bytef * ) input->map;
+  zs.avail_in = ( uInt ) MIN( input->map_len, G_MAXUINT32 );
+
+  while ( !eof )
+    {
+      iex_input_slot *slot;
+      gchar *message = NULL;
+
+      slot = iex_input_stream_slot( input, seq );
+      if ( NULL == slot )
+        {
+          break;
+        }
+
+      zs.next_out = slot->data;
+      zs.avail_out = ( uInt ) slot->cap;
+
+      while ( 0 != zs.avail_out && !eof && NULL == message )
+        {
+          int rc;
+          gsize consumed;
+
+          rc = inflate( &zs, Z_NO_FLUSH );
+          consumed = ( gsize )( zs.next_in - input->map );
+
+          /* Top up avail_in for inputs bigger than a uInt */
+          zs.avail_in = ( uInt ) MIN( input->map_len - consumed, G_MAXUINT32 );
+
+          if ( Z_STREAM_END == rc )
+            {
+              /* Concatenated gzip members are one stream */
+              if ( consumed >= input->map_len )
+                {
+                  eof = TRUE;
+                }
+              else
+                {
+                  inflateReset( &zs );
+                }
+            }
+          else if ( Z_OK != rc && Z_BUF_ERROR != rc )
+            {
+              message = g_strdup_printf( "corrupt gzip stream: %s", NULL != zs.msg ? zs.msg : "unknown error" );
+            }
+          else if ( Z_BUF_ERROR == rc && 0 == zs.avail_in )
+            {
+              message = g_strdup( "truncated gzip stream" );
+            }
+        }
+
+      slot->len = slot->cap - zs.avail_out;
+      iex_input_stream_publish( input, slot, seq++, eof || NULL != message, message );
+      if ( NULL != message )
+        {
+          break;
+        }
+    }
+
+  inflateEnd( &zs );
+}
+#endif /* HAVE_ZLIB */
+
+
+#ifdef HAVE_ZSTD
+static void
+iex_input_stream_zstd( iex_input *input )
+{
+  ZSTD_DStream *zds;
+  ZSTD_inBuffer in;
+  guint64 seq = 0;
+  gboolean eof = FALSE;
+
+  zds = ZSTD_createDStream();
+  ZSTD_initDStream( zds );
+
+  in.src = input->map;
+  in.size = input->map_len;
+  in.pos = 0;
+
+  while ( !eof )
+    {
+      iex_input_slot *slot;
+      ZSTD_outBuffer out;
+      gchar *message = NULL;
+
+      slot = iex_input_stream_slot( input, seq );
+      if ( NULL == slot )
+        {
+          break;
+        }
+
+      out.dst = slot->data;
+      out.size = slot->cap;
+      out.pos = 0;
+
+      while ( out.pos < out.size && !eof )
+        {
+          gsize rc;
+
+          rc = ZSTD_decompressStream( zds, &out, &in );
+          if ( ZSTD_isError( rc ) )
+            {
+              message = g_strdup_printf( "corrupt zstd stream: %s", ZSTD_getErrorName( rc ) );
+              break;
+            }
+
+          if ( in.pos == in.size && out.pos < out.size )
+            {
+              if ( 0 != rc )
+                {
+                  message = g_strdup( "truncated zstd stream" );
+                }
+
+              eof = TRUE;
+            }
+        }
+
+      slot->len = out.pos;
+      iex_input_stream_publish( input, slot, seq++, eof || NULL != message, message );
+      if ( NULL != message )
+        {
+          break;
+        }
+    }
+
+  ZSTD_freeDStream( zds );
+}
+#endif /* HAVE_ZSTD */
+
+
+static gpointer
+iex_input_stream_worker( gpointer data )
+{
+  iex_input *input = ( iex_input * ) data;
+
+  switch ( input->format )
+    {
+#ifdef HAVE_ZLIB
+    case IEX_INPUT_GZIP:
+      iex_input_stream_gzip( input );
+      break;
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_ZSTD
+    case IEX_INPUT_ZSTD:
+      iex_input_stream_zstd( input );
+      break;
+#endif /* HAVE_ZSTD */
+
+    default:
+      break;
+    }
+
+  return NULL;
+}
+
+
+/*
+ * Public API
+ */
+
+static gboolean
+iex_input_setup( iex_input *input, guint threads, GError **error )
+{
+  const guint8 *p = input->map;
+  gsize max_block = 0;
+
+  if ( input->map_len >= 2 && 0x1f == p[0] && 0x8b == p[1] )
+    {
+      if ( !IEX_INPUT_HAVE_ZLIB )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "gzip support was not built in" );
+          return FALSE;
+        }
+
+      input->format = iex_input_index_bgzf( input ) ? IEX_INPUT_BGZF : IEX_INPUT_GZIP;
+    }
+  else if ( input->map_len >= 4 && ( IEX_ZSTD_MAGIC == iex_input_le32( p )
+                                     || IEX_ZSTD_SKIPPABLE_MAGIC == ( iex_input_le32( p ) & IEX_ZSTD_SKIPPABLE_MASK ) ) )
+    {
+      if ( !IEX_INPUT_HAVE_ZSTD )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "zstd support was not built in" );
+          return FALSE;
+        }
+
+      input->format = IEX_INPUT_ZSTD;
+#ifdef HAVE_ZSTD
+      if ( iex_input_index_zstd_seekable( input ) )
+        {
+          input->format = IEX_INPUT_ZSTD_SEEKABLE;
+        }
+      else
+        {
+          g_array_set_size( input->blocks, 0 );
+          if ( iex_input_index_zstd_frames( input ) )
+            {
+              input->format = IEX_INPUT_ZSTD_SEEKABLE;
+            }
+        }
+#endif /* HAVE_ZSTD */
+    }
+  else
+    {
+      input->format = IEX_INPUT_PLAIN;
+      return TRUE;
+    }
+
+  for ( guint i = 0; i < input->blocks->len; i++ )
+    {
+      max_block = MAX( max_block, g_array_index( input->blocks, iex_input_block, i ).dst_len );
+    }
+
+  /* Fall back to one streaming worker when blocks are unusable */
+  if ( IEX_INPUT_GZIP == input->format || IEX_INPUT_ZSTD == input->format || 0 == input->blocks->len
+       || max_block > IEX_INPUT_MAX_BLOCK )
+    {
+      if ( IEX_INPUT_BGZF == input->format )
+        {
+          input->format = IEX_INPUT_GZIP;
+        }
+      else if ( IEX_INPUT_ZSTD_SEEKABLE == input->format )
+        {
+          input->format = IEX_INPUT_ZSTD;
+        }
+
+      g_array_set_size( input->blocks, 0 );
+      input->streaming = TRUE;
+      input->n_threads = 1;
+      input->n_slots = IEX_INPUT_STREAM_SLOTS;
+      input->n_blocks = G_MAXUINT64;
+      max_block = IEX_INPUT_STREAM_CHUNK;
+    }
+  else
+    {
+      input->n_threads = MAX( 1, MIN( threads, input->blocks->len ) );
+      input->n_slots = 2 * input->n_threads;
+      input->n_blocks = input->blocks->len;
+    }
+
+  input->slots = g_new0( iex_input_slot, input->n_slots );
+  for ( guint i = 0; i < input->n_slots; i++ )
+    {
+      input->slots[i].cap = MAX( max_block, 1 );
+      input->slots[i].data = g_malloc( input->slots[i].cap );
+    }
+
+  input->threads = g_new0( GThread *, input->n_threads );
+  for ( guint i = 0; i < input->n_threads; i++ )
+    {
+      input->threads[i] = g_thread_new( "iex-input", input->streaming ? iex_input_stream_worker
+                                        : iex_input_block_worker, input );
+    }
+
+  return TRUE;
+}
+
+
+iex_input *
+iex_input_open( const gchar *path, guint threads, GError **error )
+{
+  iex_input *input;
+  struct stat st;
+
+  input = g_new0( iex_input, 1 );
+  input->blocks = g_array_new( FALSE, FALSE, sizeof( iex_input_block ) );
+  g_mutex_init( &input->lock );
+  g_cond_init( &input->cond );
+
+  input->fd = open( path, O_RDONLY );
+  if ( 0 > input->fd || 0 != fstat( input->fd, &st ) )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, errno, "%s: %s", path, g_strerror( errno ) );
+      iex_input_close( input );
+      return NULL;
+    }
+
+  input->map_len = ( gsize ) st.st_size;
+  if ( 0 < input->map_len )
+    {
+      void *map;
+
+      map = mmap( NULL, input->map_len, PROT_READ, MAP_PRIVATE, input->fd, 0 );
+      if ( MAP_FAILED == map )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, errno, "%s: %s", path, g_strerror( errno ) );
+          input->map_len = 0;
+          iex_input_close( input );
+          return NULL;
+        }
+
+      input->map = ( const guint8 * ) map;
+      madvise( map, input->map_len, MADV_SEQUENTIAL );
+    }
+
+  if ( !iex_input_setup( input, MAX( threads, 1 ), error ) )
+    {
+      g_prefix_error( error, "%s: ", path );
+      iex_input_close( input );
+      return NULL;
+    }
+
+  return input;
+}
+
+
+void
+iex_input_close( iex_input *input )
+{
+  if ( NULL == input )
+    {
+      return;
+    }
+
+  if ( NULL != input->threads )
+    {
+      g_mutex_lock( &input->lock );
+      input->stopping = TRUE;
+      g_cond_broadcast( &input->cond );
+      g_mutex_unlock( &input->lock );
+
+      for ( guint i = 0; i < input->n_threads; i++ )
+        {
+          g_thread_join( input->threads[i] );
+        }
+
+      g_free( input->threads );
+    }
+
+  if ( NULL != input->slots )
+    {
+      for ( guint i = 0; i < input->n_slots; i++ )
+        {
+          g_free( input->slots[i].data );
+        }
+
+      g_free( input->slots );
+    }
+
+  if ( NULL != input->map )
+    {
+      munmap( ( void * ) input->map, input->map_len );
+    }
+
+  if ( 0 <= input->fd )
+    {
+      close( input->fd );
+    }
+
+  g_array_free( input->blocks, TRUE );
+  g_mutex_clear( &input->lock );
+  g_cond_clear( &input->cond );
+  g_free( input->error );
+  g_free( input );
+}
+
+
+/*
+ * Return the next chunk of decompressed data, which stays valid until the
+ * next call (or until close, for stable inputs). Returns FALSE at the end of
+ * the file, or on error with error set.
+ */
+gboolean
+iex_input_next( iex_input *input, const guint8 **data, gsize *len, GError **error )
+{
+  if ( IEX_INPUT_PLAIN == input->format )
+    {
+      if ( input->plain_done || 0 == input->map_len )
+        {
+          return FALSE;
+        }
+
+      input->plain_done = TRUE;
+      *data = input->map;
+      *len = input->map_len;
+
+      return TRUE;
+    }
+
+  g_mutex_lock( &input->lock );
+
+  for ( ;; )
+    {
+      iex_input_slot *slot;
+
+      /* Hand the previous buffer back to the workers */
+      if ( input->held )
+        {
+          input->slots[( input->read_seq - 1 ) % input->n_slots].ready = FALSE;
+          input->released = input->read_seq;
+          input->held = FALSE;
+          g_cond_broadcast( &input->cond );
+        }
+
+      slot = &input->slots[input->read_seq % input->n_slots];
+      while ( NULL == input->error && !( slot->ready && slot->seq == input->read_seq )
+              && input->read_seq < input->n_blocks )
+        {
+          g_cond_wait( &input->cond, &input->lock );
+        }
+
+      if ( NULL != input->error )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "%s", input->error );
+          g_mutex_unlock( &input->lock );
+          return FALSE;
+        }
+
+      if ( input->read_seq >= input->n_blocks )
+        {
+          g_mutex_unlock( &input->lock );
+          return FALSE;
+        }
+
+      input->read_seq++;
+      input->held = TRUE;
+
+      if ( 0 != slot->len )
+        {
+          *data = slot->data;
+          *len = slot->len;
+          break;
+        }
+    }
+
+  g_mutex_unlock( &input->lock );
+
+  return TRUE;
+}
+
+
+iex_input_format
+iex_input_get_format( const iex_input *input )
+{
+  return input->format;
+}
+
+
+/* Whether chunks stay valid until the input is closed (i.e. it is mapped) */
+gboolean
+iex_input_is_stable( const iex_input *input )
+{
+  return IEX_INPUT_PLAIN == input->format;
+}
+
+
+guint64
+iex_input_file_size( const iex_input *input )
+{
+  return input->map_len;
+}
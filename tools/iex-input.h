@@ -0,0 +1,65 @@
+/*
+ * iex-input.h - Capture file input with parallel block decompression
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_INPUT_H__
+#define __IEX_INPUT_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+typedef enum _iex_input_format
+{
+  IEX_INPUT_PLAIN,
+  IEX_INPUT_GZIP,
+  IEX_INPUT_BGZF,
+  IEX_INPUT_ZSTD,
+  IEX_INPUT_ZSTD_SEEKABLE
+} iex_input_format;
+
+/*
+ * A capture file read as a sequence of contiguous chunks. Uncompressed files
+ * are mapped and returned as one chunk. Compressed files are decompressed by
+ * worker threads into a bounded ring of buffers: block-compressed files (BGZF
+ * gzip, seekable or multi-frame zstd) a block per worker in parallel, anything
+ * else by one worker streaming ahead of the reader.
+ */
+typedef struct _iex_input iex_input;
+
+iex_input *iex_input_open( const gchar *path, guint threads, GError **error );
+void iex_input_close( iex_input *input );
+
+gboolean iex_input_next( iex_input *input, const guint8 **data, gsize *len, GError **error );
+
+iex_input_format iex_input_get_format( const iex_input *input );
+gboolean iex_input_is_stable( const iex_input *input );
+guint64 iex_input_file_size( const iex_input *input );
+
+GQuark iex_tools_error_quark( void );
+#define IEX_TOOLS_ERROR iex_tools_error_quark()
+
+G_END_DECLS
+
+#endif /* __IEX_INPUT_H__ */
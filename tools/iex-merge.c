@@ -0,0 +1,333 @@
+/*
+ * iex-merge.c - Merge IEX-TP captures in send time order
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-input.h"
+#include "iex-pcap.h"
+#include "iex-seg.h"
+
+#include <stdlib.h>
+
+/*
+ * One input, and the record at its head. The record's data stays valid until
+ * the input is advanced, so only the heads are ever held in memory.
+ */
+typedef struct _merge_input
+{
+  iex_pcap_reader *reader;
+  const gchar     *path;
+  iex_pcap_record  record;
+  gint64           send_time;
+  gint64           seqno;
+  guint32          session;
+  guint32          index;
+} merge_input;
+
+/* Command line options */
+static gint merge_threads = 0;
+static gchar *merge_output = NULL;
+static gboolean merge_iex_only = FALSE;
+static gboolean merge_quiet = FALSE;
+static gchar **merge_files = NULL;
+
+static GOptionEntry merge_options[] =
+{
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &merge_output, "Write to a file instead of stdout", "FILE" },
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &merge_threads,
+    "Decompression threads for each compressed capture (default: processors / captures)", "N" },
+  { "iex-only", 0, 0, G_OPTION_ARG_NONE, &merge_iex_only, "Drop packets which are not IEX-TP segments", NULL },
+  { "quiet", 'q', 0, G_OPTION_ARG_NONE, &merge_quiet, "Do not print the summary", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &merge_files, NULL, "CAPTURE..." },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+/* Order by send time, then session and sequence number, then input */
+static inline gboolean
+merge_before( const merge_input *a, const merge_input *b )
+{
+  if ( a->send_time != b->send_time )
+    {
+      return a->send_time < b->send_time;
+    }
+
+  if ( a->session != b->session )
+    {
+      return a->session < b->session;
+    }
+
+  if ( a->seqno != b->seqno )
+    {
+      return a->seqno < b->seqno;
+    }
+
+  return a->index < b->index;
+}
+
+
+static void
+merge_sift_down( merge_input **heap, guint n, guint i )
+{
+  merge_input *item = heap[i];
+
+  for ( ;; )
+    {
+      guint child = 2 * i + 1;
+
+      if ( child >= n )
+        {
+          break;
+        }
+
+      if ( child + 1 < n && merge_before( heap[child + 1], heap[child] ) )
+        {
+          child++;
+        }
+
+      if ( !merge_before( heap[child], item ) )
+        {
+          break;
+        }
+
+      heap[i] = heap[child];
+      i = child;
+    }
+
+  heap[i] = item;
+}
+
+
+/*
+ * Read an input's next record and work out its merge key. Packets which are
+ * not IEX-TP keep the key of the segment before them, so they stay where
+ * they were relative to their own input. Returns FALSE when the input is
+ * done, with error set if it failed.
+ */
+static gboolean
+merge_advance( merge_input *input, guint64 *dropped, GError **error )
+{
+  guint32 linktype = iex_pcap_linktype( input->reader );
+
+  while ( iex_pcap_next( input->reader, &input->record, error ) )
+    {
+      iex_udp udp;
+      iex_seg seg;
+
+      if ( iex_pcap_udp( linktype, input->record.data, input->record.caplen, &udp )
+           && iex_seg_parse( udp.payload, udp.len, &seg ) )
+        {
+          input->send_time = seg.send_time;
+          input->session = seg.session;
+          input->seqno = seg.first_seqno;
+          return TRUE;
+        }
+
+      if ( !merge_iex_only )
+        {
+          return TRUE;
+        }
+
+      ( *dropped )++;
+    }
+
+  return FALSE;
+}
+
+
+/* Merge the inputs into writer, returns FALSE if any of them failed */
+static gboolean
+merge_inputs( merge_input *inputs, guint n_inputs, iex_pcap_writer *writer )
+{
+  GError *error = NULL;
+  merge_input **heap;
+  guint n_heap = 0;
+  guint64 written = 0;
+  guint64 dropped = 0;
+  guint64 disordered = 0;
+  gint64 last_send_time = G_MININT64;
+  gint64 start;
+  gboolean ok = TRUE;
+
+  heap = g_new0( merge_input *, n_inputs );
+  start = g_get_monotonic_time();
+
+  for ( guint i = 0; i < n_inputs; i++ )
+    {
+      if ( merge_advance( &inputs[i], &dropped, &error ) )
+        {
+          heap[n_heap++] = &inputs[i];
+        }
+      else if ( NULL != error )
+        {
+          g_printerr( "%s: %s\n", inputs[i].path, error->message );
+          g_clear_error( &error );
+          ok = FALSE;
+        }
+    }
+
+  for ( guint i = n_heap / 2; i-- > 0; )
+    {
+      merge_sift_down( heap, n_heap, i );
+    }
+
+  while ( 0 != n_heap )
+    {
+      merge_input *input = heap[0];
+
+      if ( input->send_time < last_send_time )
+        {
+          disordered++;
+        }
+
+      last_send_time = input->send_time;
+      iex_pcap_write( writer, &input->record );
+      written++;
+
+      if ( !merge_advance( input, &dropped, &error ) )
+        {
+          if ( NULL != error )
+            {
+              g_printerr( "%s: %s\n", input->path, error->message );
+              g_clear_error( &error );
+              ok = FALSE;
+            }
+
+          heap[0] = heap[--n_heap];
+        }
+
+      if ( 0 != n_heap )
+        {
+          merge_sift_down( heap, n_heap, 0 );
+        }
+    }
+
+  if ( !merge_quiet )
+    {
+      g_printerr( "%" G_GUINT64_FORMAT " packets from %u captures in %.3f s (%" G_GUINT64_FORMAT " dropped, %"
+                  G_GUINT64_FORMAT " out of send time order in their capture)\n", written, n_inputs,
+                  ( gdouble )( g_get_monotonic_time() - start ) / 1e6, dropped, disordered );
+    }
+
+  g_free( heap );
+
+  return ok;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  iex_pcap_writer *writer = NULL;
+  merge_input *inputs;
+  guint n_inputs;
+  guint32 linktype = 0;
+  guint32 snaplen = 0;
+  int rc = EXIT_SUCCESS;
+
+  context = g_option_context_new( "- merge IEX-TP captures by send time" );
+  g_option_context_set_summary( context, "Merges pcap files (optionally gzip or zstd compressed), each already in "
+                                "send time order, into one pcap ordered by IEX-TP send time, then session and "
+                                "sequence number. Packets are copied as they were captured." );
+  g_option_context_add_main_entries( context, merge_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) || NULL == merge_files )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "no capture files given" );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  n_inputs = g_strv_length( merge_files );
+  if ( 0 >= merge_threads )
+    {
+      merge_threads = ( gint ) MAX( 1, g_get_num_processors() / n_inputs );
+    }
+
+  inputs = g_new0( merge_input, n_inputs );
+
+  for ( guint i = 0; i < n_inputs; i++ )
+    {
+      inputs[i].path = merge_files[i];
+      inputs[i].index = i;
+      inputs[i].send_time = G_MININT64;
+      inputs[i].reader = iex_pcap_open( merge_files[i], ( guint ) merge_threads, &error );
+      if ( NULL == inputs[i].reader )
+        {
+          break;
+        }
+
+      if ( 0 != i && linktype != iex_pcap_linktype( inputs[i].reader ) )
+        {
+          g_set_error( &error, IEX_TOOLS_ERROR, 0, "%s: link type %" G_GUINT32_FORMAT " does not match %s (%"
+                       G_GUINT32_FORMAT ")", merge_files[i], iex_pcap_linktype( inputs[i].reader ),
+                       merge_files[0], linktype );
+          break;
+        }
+
+      linktype = iex_pcap_linktype( inputs[i].reader );
+      snaplen = MAX( snaplen, iex_pcap_snaplen( inputs[i].reader ) );
+    }
+
+  if ( NULL == error )
+    {
+      writer = iex_pcap_writer_open( merge_output, linktype, snaplen, &error );
+    }
+
+  if ( NULL == writer )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      rc = EXIT_FAILURE;
+    }
+  else
+    {
+      if ( !merge_inputs( inputs, n_inputs, writer ) )
+        {
+          rc = EXIT_FAILURE;
+        }
+
+      if ( !iex_pcap_writer_close( writer, &error ) )
+        {
+          g_printerr( "%s: %s\n", NULL != merge_output ? merge_output : "stdout", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+    }
+
+  for ( guint i = 0; i < n_inputs; i++ )
+    {
+      iex_pcap_close( inputs[i].reader );
+    }
+
+  g_free( inputs );
+  g_free( merge_output );
+  g_strfreev( merge_files );
+
+  return rc;
+}
@@ -0,0 +1,634 @@
+/*
+ * iex-pcap.c - Minimal pcap reading and writing for the IEX capture tools
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-pcap.h"
+#include "iex-input.h"
+#include "iex-slim.h"
+#include "iex-text.h"
+
+#include <string.h>
+
+#define IEX_PCAP_MAGIC_USEC 0xa1b2c3d4U
+#define IEX_PCAP_MAGIC_NSEC 0xa1b23c4dU
+
+/* Anything bigger than this is a corrupt record header rather than a packet */
+#define IEX_PCAP_MAX_RECORD ( 256U << 10 )
+
+#define IEX_ETHERTYPE_IPV4  0x0800
+#define IEX_ETHERTYPE_VLAN  0x8100
+#define IEX_ETHERTYPE_QINQ  0x88a8
+#define IEX_ETHERTYPE_QINQ1 0x9100
+
+#define IEX_IPPROTO_UDP 17
+
+/* Exported PDU tags read by iex_pcap_udp(), see iex-slim.c */
+#define IEX_PDU_TAG_END        0
+#define IEX_PDU_TAG_PROTO_NAME 12
+#define IEX_PDU_TAG_IPV4_SRC   20
+#define IEX_PDU_TAG_IPV4_DST   21
+#define IEX_PDU_TAG_SRC_PORT   25
+#define IEX_PDU_TAG_DST_PORT   26
+
+struct _iex_pcap_reader
+{
+  iex_input      *input;
+  const guint8   *chunk;
+  gsize           chunk_len;
+  gsize           pos;
+  guint8         *carry;
+  gsize           carry_cap;
+  guint8         *pdu;
+  iex_slim_cursor cursor;
+  guint32         linktype;
+  guint32         snaplen;
+  gboolean        swapped;
+  gboolean        nsec;
+  gboolean        slim;
+  guint32         block_size;
+};
+
+struct _iex_pcap_writer
+{
+  iex_text *text;
+};
+
+
+static inline guint16
+iex_pcap_be16( const guint8 *p )
+{
+  return ( guint16 )( ( p[0] << 8 ) | p[1] );
+}
+
+
+static inline guint32
+iex_pcap_be32( const guint8 *p )
+{
+  return ( ( guint32 ) p[0] << 24 ) | ( ( guint32 ) p[1] << 16 ) | ( ( guint32 ) p[2] << 8 ) | p[3];
+}
+
+
+static inline guint32
+iex_pcap_u32( const iex_pcap_reader *reader, const guint8 *p )
+{
+  guint32 v;
+
+  memcpy( &v, p, sizeof( v ) );
+
+  return reader->swapped ? GUINT32_SWAP_LE_BE( v ) : v;
+}
+
+
+/*
+ * Return n contiguous bytes from the input. They are referenced in place when
+ * the current chunk holds them, and only copied when they straddle chunks.
+ * Returns FALSE at a clean end of file, or with error set.
+ */
+static gboolean
+iex_pcap_gather( iex_pcap_reader *reader, gsize n, const guint8 **out, GError **error )
+{
+  GError *local_error = NULL;
+  gsize have;
+
+  if ( reader->chunk_len - reader->pos >= n )
+    {
+      *out = reader->chunk + reader->pos;
+      reader->pos += n;
+      return TRUE;
+    }
+
+  if ( reader->carry_cap < n )
+    {
+      reader->carry_cap = MAX( n, 2 * reader->carry_cap );
+      reader->carry = g_realloc( reader->carry, reader->carry_cap );
+    }
+
+  have = reader->chunk_len - reader->pos;
+  if ( 0 != have )
+    {
+      memcpy( reader->carry, reader->chunk + reader->pos, have );
+    }
+
+  while ( have < n )
+    {
+      gsize take;
+
+      if ( !iex_input_next( reader->input, &reader->chunk, &reader->chunk_len, &local_error ) )
+        {
+          reader->chunk = NULL;
+          reader->chunk_len = 0;
+          reader->pos = 0;
+
+          if ( NULL != local_error )
+            {
+              g_propagate_error( error, local_error );
+            }
+          else if ( 0 != have )
+            {
+              g_set_error( error, IEX_TOOLS_ERROR, 0, "truncated capture file" );
+            }
+
+          return FALSE;
+        }
+
+      take = MIN( n - have, reader->chunk_len );
+      memcpy( reader->carry + have, reader->chunk, take );
+      have += take;
+      reader->pos = take;
+    }
+
+  *out = reader->carry;
+
+  return TRUE;
+}
+
+
+iex_pcap_reader *
+iex_pcap_open( const gchar *path, guint threads, GError **error )
+{
+  iex_pcap_reader *reader;
+  const guint8 *header;
+  GError *local_error = NULL;
+  guint32 magic;
+
+  reader = g_new0( iex_pcap_reader, 1 );
+  reader->input = iex_input_open( path, threads, error );
+  if ( NULL == reader->input )
+    {
+      g_free( reader );
+      return NULL;
+    }
+
+  if ( !iex_pcap_gather( reader, IEX_PCAP_HEADER_LEN, &header, &local_error ) )
+    {
+      if ( NULL == local_error )
+        {
+          g_set_error( &local_error, IEX_TOOLS_ERROR, 0, "empty capture file" );
+        }
+
+      g_propagate_prefixed_error( error, local_error, "%s: ", path );
+      iex_pcap_close( reader );
+      return NULL;
+    }
+
+  if ( iex_slim_is_header( header ) )
+    {
+      /* Slim captures read as exported PDU packets, built one at a time in pdu */
+      reader->slim = TRUE;
+      reader->block_size = iex_slim_header_block_size( header );
+      reader->linktype = IEX_LINKTYPE_UPPER_PDU;
+      reader->snaplen = IEX_SLIM_SNAPLEN;
+      reader->pdu = g_malloc( IEX_SLIM_SNAPLEN );
+      reader->cursor.sources = g_array_new( FALSE, FALSE, sizeof( iex_slim_source ) );
+      return reader;
+    }
+
+  memcpy( &magic, header, sizeof( magic ) );
+  if ( IEX_PCAP_MAGIC_USEC == magic || IEX_PCAP_MAGIC_NSEC == magic )
+    {
+      reader->nsec = IEX_PCAP_MAGIC_NSEC == magic;
+    }
+  else if ( IEX_PCAP_MAGIC_USEC == GUINT32_SWAP_LE_BE( magic ) || IEX_PCAP_MAGIC_NSEC == GUINT32_SWAP_LE_BE( magic ) )
+    {
+      reader->swapped = TRUE;
+      reader->nsec = IEX_PCAP_MAGIC_NSEC == GUINT32_SWAP_LE_BE( magic );
+    }
+  else
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "%s: not a pcap file (pcapng is not supported)", path );
+      iex_pcap_close( reader );
+      return NULL;
+    }
+
+  reader->snaplen = iex_pcap_u32( reader, header + 16 );
+  reader->linktype = iex_pcap_u32( reader, header + 20 );
+
+  return reader;
+}
+
+
+void
+iex_pcap_close( iex_pcap_reader *reader )
+{
+  if ( NULL == reader )
+    {
+      return;
+    }
+
+  if ( reader->slim )
+    {
+      g_array_free( reader->cursor.sources, TRUE );
+    }
+
+  iex_input_close( reader->input );
+  g_free( reader->carry );
+  g_free( reader->pdu );
+  g_free( reader );
+}
+
+
+/* The next record of a slim capture, reading in a block at a time; the index marks the end */
+static gboolean
+iex_pcap_next_slim( iex_pcap_reader *reader, iex_pcap_record *record, GError **error )
+{
+  GError *local_error = NULL;
+  const guint8 *segment;
+  guint16 source;
+  guint16 len;
+
+  while ( !iex_slim_cursor_next( &reader->cursor, &record->ts, &source, &segment, &len, &local_error ) )
+    {
+      const guint8 *header;
+      const guint8 *records;
+      iex_slim_block block;
+      guint32 magic;
+
+      if ( NULL != local_error )
+        {
+          g_propagate_error( error, local_error );
+          return FALSE;
+        }
+
+      if ( !iex_pcap_gather( reader, IEX_SLIM_BLOCK_HEADER_LEN, &header, error ) )
+        {
+          return FALSE;
+        }
+
+      if ( !iex_slim_parse_block( header, IEX_SLIM_BLOCK_HEADER_LEN, &block ) )
+        {
+          memcpy( &magic, header, sizeof( magic ) );
+          if ( IEX_SLIM_INDEX_MAGIC == GUINT32_FROM_LE( magic ) )
+            {
+              return FALSE;
+            }
+
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "corrupt slim block header" );
+          return FALSE;
+        }
+
+      if ( block.size > reader->block_size )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "corrupt slim block (%" G_GUINT32_FORMAT " bytes)", block.size );
+          return FALSE;
+        }
+
+      if ( !iex_pcap_gather( reader, block.size - IEX_SLIM_BLOCK_HEADER_LEN, &records, error ) )
+        {
+          if ( NULL != error && NULL == *error )
+            {
+              g_set_error( error, IEX_TOOLS_ERROR, 0, "truncated capture file" );
+            }
+
+          return FALSE;
+        }
+
+      iex_slim_cursor_init( &reader->cursor, records, &block, reader->cursor.sources );
+    }
+
+  iex_slim_put_pdu_header( reader->pdu, &g_array_index( reader->cursor.sources, iex_slim_source, source ) );
+  memcpy( reader->pdu + IEX_SLIM_PDU_HEADER_LEN, segment, len );
+  record->data = reader->pdu;
+  record->caplen = IEX_SLIM_PDU_HEADER_LEN + len;
+  record->origlen = record->caplen;
+
+  return TRUE;
+}
+
+
+/* Read the next record, returns FALSE at the end of the file or with error set */
+gboolean
+iex_pcap_next( iex_pcap_reader *reader, iex_pcap_record *record, GError **error )
+{
+  const guint8 *header;
+  guint32 secs;
+  guint32 frac;
+
+  if ( reader->slim )
+    {
+      return iex_pcap_next_slim( reader, record, error );
+    }
+
+  if ( !iex_pcap_gather( reader, IEX_PCAP_RECORD_HEADER_LEN, &header, error ) )
+    {
+      return FALSE;
+    }
+
+  secs = iex_pcap_u32( reader, header );
+  frac = iex_pcap_u32( reader, header + 4 );
+  record->caplen = iex_pcap_u32( reader, header + 8 );
+  record->origlen = iex_pcap_u32( reader, header + 12 );
+  record->ts = ( gint64 ) secs * 1000000000L + ( reader->nsec ? frac : ( gint64 ) frac * 1000L );
+
+  if ( record->caplen > MAX( reader->snaplen, IEX_PCAP_MAX_RECORD ) )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "corrupt record (%" G_GUINT32_FORMAT " bytes)", record->caplen );
+      return FALSE;
+    }
+
+  if ( !iex_pcap_gather( reader, record->caplen, &record->data, error ) )
+    {
+      if ( NULL != error && NULL == *error )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "truncated capture file" );
+        }
+
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+guint32
+iex_pcap_linktype( const iex_pcap_reader *reader )
+{
+  return reader->linktype;
+}
+
+
+guint32
+iex_pcap_snaplen( const iex_pcap_reader *reader )
+{
+  return reader->snaplen;
+}
+
+
+guint64
+iex_pcap_file_size( const iex_pcap_reader *reader )
+{
+  return iex_input_file_size( reader->input );
+}
+
+
+/* Whether record data stays valid until close, rather than until the next record */
+gboolean
+iex_pcap_is_stable( const iex_pcap_reader *reader )
+{
+  return !reader->slim && iex_input_is_stable( reader->input );
+}
+
+
+/* The header of a nanosecond pcap file, as written by iex_pcap_writer_open() */
+void
+iex_pcap_put_header( guint8 *p, guint32 linktype, guint32 snaplen )
+{
+  guint32 header[6];
+
+  header[0] = IEX_PCAP_MAGIC_NSEC;
+  header[1] = 2 | ( 4 << 16 );
+  header[2] = 0;
+  header[3] = 0;
+  header[4] = snaplen;
+  header[5] = linktype;
+  memcpy( p, header, sizeof( header ) );
+}
+
+
+/* The header of a record, which is followed by its caplen bytes of data */
+void
+iex_pcap_put_record_header( guint8 *p, const iex_pcap_record *record )
+{
+  guint32 header[4];
+  gint64 secs;
+
+  secs = record->ts / 1000000000L;
+  if ( 0 > record->ts % 1000000000L )
+    {
+      secs--;
+    }
+
+  header[0] = ( guint32 ) secs;
+  header[1] = ( guint32 )( record->ts - secs * 1000000000L );
+  header[2] = record->caplen;
+  header[3] = record->origlen;
+  memcpy( p, header, sizeof( header ) );
+}
+
+
+/* Write a nanosecond pcap file in host byte order, to stdout when path is NULL or "-" */
+iex_pcap_writer *
+iex_pcap_writer_open( const gchar *path, guint32 linktype, guint32 snaplen, GError **error )
+{
+  iex_pcap_writer *writer;
+  guint8 header[IEX_PCAP_HEADER_LEN];
+
+  writer = g_new0( iex_pcap_writer, 1 );
+  writer->text = iex_text_open( path, error );
+  if ( NULL == writer->text )
+    {
+      g_free( writer );
+      return NULL;
+    }
+
+  iex_pcap_put_header( header, linktype, snaplen );
+  iex_text_write( writer->text, header, sizeof( header ) );
+
+  return writer;
+}
+
+
+gboolean
+iex_pcap_writer_close( iex_pcap_writer *writer, GError **error )
+{
+  gboolean ok;
+
+  ok = iex_text_close( writer->text, error );
+  g_free( writer );
+
+  return ok;
+}
+
+
+/* Copy a record out as it was captured, write errors are reported by iex_pcap_writer_close() */
+void
+iex_pcap_write( iex_pcap_writer *writer, const iex_pcap_record *record )
+{
+  guint8 header[IEX_PCAP_RECORD_HEADER_LEN];
+
+  if ( IEX_PCAP_RECORD_HEADER_LEN + record->caplen <= writer->text->chunk_size )
+    {
+      gchar *p = iex_text_reserve( writer->text, IEX_PCAP_RECORD_HEADER_LEN + record->caplen );
+
+      iex_pcap_put_record_header( ( guint8 * ) p, record );
+      p += IEX_PCAP_RECORD_HEADER_LEN;
+      iex_text_commit( writer->text, iex_text_put( p, ( const gchar * ) record->data, record->caplen ) );
+      return;
+    }
+
+  iex_pcap_put_record_header( header, record );
+  iex_text_write( writer->text, header, IEX_PCAP_RECORD_HEADER_LEN );
+  iex_text_write( writer->text, record->data, record->caplen );
+}
+
+
+/* An exported PDU packet for the iextp dissector, as read from a slim capture, carries the segment itself */
+static gboolean
+iex_pcap_upper_pdu( const guint8 *data, guint32 len, iex_udp *udp )
+{
+  gboolean iextp = FALSE;
+  guint32 off = 0;
+
+  memset( udp, 0, sizeof( *udp ) );
+
+  while ( len - off >= 4 )
+    {
+      guint16 tag = iex_pcap_be16( data + off );
+      guint16 tag_len = iex_pcap_be16( data + off + 2 );
+      const guint8 *value = data + off + 4;
+
+      off += 4;
+      if ( IEX_PDU_TAG_END == tag )
+        {
+          if ( !iextp )
+            {
+              return FALSE;
+            }
+
+          udp->payload = data + off;
+          udp->len = len - off;
+          return TRUE;
+        }
+
+      if ( len - off < tag_len )
+        {
+          return FALSE;
+        }
+
+      off += tag_len;
+      switch ( tag )
+        {
+        case IEX_PDU_TAG_PROTO_NAME:
+          iextp = tag_len >= 5 && 0 == memcmp( value, "iextp", 5 ) && ( 5 == tag_len || '\0' == value[5] );
+          break;
+
+        case IEX_PDU_TAG_IPV4_SRC:
+        case IEX_PDU_TAG_IPV4_DST:
+          if ( 4 == tag_len )
+            {
+              *( IEX_PDU_TAG_IPV4_SRC == tag ? &udp->src_addr : &udp->dst_addr ) = iex_pcap_be32( value );
+            }
+          break;
+
+        case IEX_PDU_TAG_SRC_PORT:
+        case IEX_PDU_TAG_DST_PORT:
+          if ( 4 == tag_len )
+            {
+              *( IEX_PDU_TAG_SRC_PORT == tag ? &udp->src_port : &udp->dst_port ) = ( guint16 ) iex_pcap_be32( value );
+            }
+          break;
+
+        default:
+          break;
+        }
+    }
+
+  return FALSE;
+}
+
+
+/* Find an unfragmented IPv4 UDP datagram in a packet of the given link type */
+gboolean
+iex_pcap_udp( guint32 linktype, const guint8 *data, guint32 len, iex_udp *udp )
+{
+  const guint8 *ip;
+  const guint8 *hdr;
+  guint32 off;
+  guint32 ihl;
+  guint32 ip_len;
+  guint32 udp_len;
+  guint16 ethertype;
+
+  switch ( linktype )
+    {
+    case IEX_LINKTYPE_ETHERNET:
+      if ( len < 14 )
+        {
+          return FALSE;
+        }
+
+      ethertype = iex_pcap_be16( data + 12 );
+      off = 14;
+      while ( ( IEX_ETHERTYPE_VLAN == ethertype || IEX_ETHERTYPE_QINQ == ethertype
+                || IEX_ETHERTYPE_QINQ1 == ethertype ) && len >= off + 4 )
+        {
+          ethertype = iex_pcap_be16( data + off + 2 );
+          off += 4;
+        }
+      break;
+
+    case IEX_LINKTYPE_LINUX_SLL:
+      if ( len < 16 )
+        {
+          return FALSE;
+        }
+
+      ethertype = iex_pcap_be16( data + 14 );
+      off = 16;
+      break;
+
+    case IEX_LINKTYPE_RAW:
+    case IEX_LINKTYPE_IPV4:
+      ethertype = IEX_ETHERTYPE_IPV4;
+      off = 0;
+      break;
+
+    case IEX_LINKTYPE_UPPER_PDU:
+      return iex_pcap_upper_pdu( data, len, udp );
+
+    default:
+      return FALSE;
+    }
+
+  if ( IEX_ETHERTYPE_IPV4 != ethertype || len - off < 20 )
+    {
+      return FALSE;
+    }
+
+  ip = data + off;
+  ihl = ( guint32 )( ip[0] & 0x0f ) * 4;
+  ip_len = iex_pcap_be16( ip + 2 );
+  if ( 4 != ( ip[0] >> 4 ) || 20 > ihl || IEX_IPPROTO_UDP != ip[9] || 0 != ( iex_pcap_be16( ip + 6 ) & 0x3fff )
+       || len - off < ihl + 8 || ip_len < ihl + 8 )
+    {
+      return FALSE;
+    }
+
+  hdr = ip + ihl;
+  udp_len = iex_pcap_be16( hdr + 4 );
+  if ( udp_len < 8 )
+    {
+      return FALSE;
+    }
+
+  udp->payload = hdr + 8;
+  udp->len = MIN( MIN( udp_len, ip_len - ihl ), len - off - ihl ) - 8;
+  udp->src_addr = iex_pcap_be32( ip + 12 );
+  udp->dst_addr = iex_pcap_be32( ip + 16 );
+  udp->src_port = iex_pcap_be16( hdr );
+  udp->dst_port = iex_pcap_be16( hdr + 2 );
+
+  return TRUE;
+}
@@ -0,0 +1,87 @@
+/*
+ * iex-pcap.h - Minimal pcap reading and writing for the IEX capture tools
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_PCAP_H__
+#define __IEX_PCAP_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+#define IEX_LINKTYPE_ETHERNET 1
+#define IEX_LINKTYPE_RAW      101
+#define IEX_LINKTYPE_LINUX_SLL 113
+#define IEX_LINKTYPE_IPV4     228
+#define IEX_LINKTYPE_UPPER_PDU 252
+
+#define IEX_PCAP_HEADER_LEN 24
+#define IEX_PCAP_RECORD_HEADER_LEN 16
+
+/* A captured packet, data stays valid until the next call to iex_pcap_next() */
+typedef struct _iex_pcap_record
+{
+  gint64        ts;
+  const guint8 *data;
+  guint32       caplen;
+  guint32       origlen;
+} iex_pcap_record;
+
+/* The UDP datagram found in a captured packet */
+typedef struct _iex_udp
+{
+  const guint8 *payload;
+  guint32       len;
+  guint32       src_addr;
+  guint32       dst_addr;
+  guint16       src_port;
+  guint16       dst_port;
+} iex_udp;
+
+typedef struct _iex_pcap_reader iex_pcap_reader;
+typedef struct _iex_pcap_writer iex_pcap_writer;
+
+iex_pcap_reader *iex_pcap_open( const gchar *path, guint threads, GError **error );
+void iex_pcap_close( iex_pcap_reader *reader );
+
+gboolean iex_pcap_next( iex_pcap_reader *reader, iex_pcap_record *record, GError **error );
+
+guint32 iex_pcap_linktype( const iex_pcap_reader *reader );
+guint32 iex_pcap_snaplen( const iex_pcap_reader *reader );
+guint64 iex_pcap_file_size( const iex_pcap_reader *reader );
+gboolean iex_pcap_is_stable( const iex_pcap_reader *reader );
+
+iex_pcap_writer *iex_pcap_writer_open( const gchar *path, guint32 linktype, guint32 snaplen, GError **error );
+gboolean iex_pcap_writer_close( iex_pcap_writer *writer, GError **error );
+
+void iex_pcap_write( iex_pcap_writer *writer, const iex_pcap_record *record );
+
+void iex_pcap_put_header( guint8 *p, guint32 linktype, guint32 snaplen );
+void iex_pcap_put_record_header( guint8 *p, const iex_pcap_record *record );
+
+gboolean iex_pcap_udp( guint32 linktype, const guint8 *data, guint32 len, iex_udp *udp );
+
+G_END_DECLS
+
+#endif /* __IEX_PCAP_H__ */
@@ -0,0 +1,461 @@
+/*
+ * iex-publish.c - Publish the latest TOPS quote per symbol to a shared memory table
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-input.h"
+#include "iex-pcap.h"
+#include "iex-seg.h"
+#include "iex-book.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Room for any UDP datagram */
+#define PUBLISH_DATAGRAM_MAX 65536
+
+/* How often a live publisher wakes up to check whether it has been asked to stop */
+#define PUBLISH_POLL_MS 200
+
+typedef struct _publish_stats
+{
+  guint64 segments;
+  guint64 quotes;
+  guint64 dropped;
+} publish_stats;
+
+/* Command line options */
+static gchar *publish_name = NULL;
+static gint publish_capacity = IEX_BOOK_DEFAULT_CAPACITY;
+static gdouble publish_speed = 0.0;
+static gchar *publish_listen = NULL;
+static gchar *publish_interface = NULL;
+static gboolean publish_unlink = FALSE;
+static gint publish_threads = 0;
+static gchar **publish_files = NULL;
+
+static GOptionEntry publish_options[] =
+{
+  { "name", 'n', 0, G_OPTION_ARG_STRING, &publish_name,
+    "Shared memory object to publish to (default: " IEX_BOOK_DEFAULT_NAME ")", "NAME" },
+  { "capacity", 'c', 0, G_OPTION_ARG_INT, &publish_capacity, "Symbols the table has room for (default: 16384)",
+    "N" },
+  { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &publish_speed,
+    "Replay at this multiple of the captured send times (default: 0, as fast as possible)", "X" },
+  { "listen", 'l', 0, G_OPTION_ARG_STRING, &publish_listen,
+    "Publish live from UDP datagrams sent to [GROUP:]PORT instead of captures", "[GROUP:]PORT" },
+  { "interface", 'i', 0, G_OPTION_ARG_STRING, &publish_interface,
+    "Local IPv4 address to join the multicast group on (default: any)", "ADDR" },
+  { "unlink", 'u', 0, G_OPTION_ARG_NONE, &publish_unlink, "Remove the table on exit rather than leaving it", NULL },
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &publish_threads,
+    "Decompression threads for compressed captures (default: all processors)", "N" },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &publish_files, NULL, "[CAPTURE...]" },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+static volatile sig_atomic_t publish_stopping = 0;
+
+
+static void
+publish_stop( int signum __attribute__( ( unused ) ) )
+{
+  publish_stopping = 1;
+}
+
+
+static void
+publish_segment( iex_book *book, const iex_seg *seg, publish_stats *stats )
+{
+  iex_seg_iter iter;
+  const guint8 *msg;
+  guint16 msg_len;
+
+  stats->segments++;
+  iex_book_set_send_time( book, seg->send_time );
+
+  if ( IEXTP_PROTO_IEXTOPS != seg->protocol )
+    {
+      return;
+    }
+
+  iex_seg_iter_init( &iter, seg );
+  while ( NULL != ( msg = iex_seg_iter_next( &iter, &msg_len ) ) )
+    {
+      iex_quote quote;
+      iex_book_quote out;
+      guint32 slot;
+
+      if ( !iex_tops_quote( msg, msg_len, &quote ) )
+        {
+          continue;
+        }
+
+      slot = iex_book_intern( book, quote.symbol );
+      if ( IEX_BOOK_NO_SLOT == slot )
+        {
+          stats->dropped++;
+          continue;
+        }
+
+      out.timestamp = quote.timestamp;
+      out.bid_price = quote.bid_price;
+      out.ask_price = quote.ask_price;
+      out.bid_size = quote.bid_size;
+      out.ask_size = quote.ask_size;
+      out.send_time = seg->send_time;
+      out.flags = msg[offsetof( iextops_msg, flags )];
+
+      iex_book_publish( book, slot, &out );
+      stats->quotes++;
+    }
+}
+
+
+/*
+ * Replay: when pacing, each segment is held back until as much time has
+ * passed since the first one as its send time says, divided by the speed.
+ */
+static gboolean
+publish_file( iex_book *book, const gchar *path, gint64 *first_send_time, gint64 *start, publish_stats *stats,
+              GError **error )
+{
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  GError *local_error = NULL;
+  guint32 linktype;
+
+  reader = iex_pcap_open( path, ( guint ) publish_threads, error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  linktype = iex_pcap_linktype( reader );
+
+  while ( !publish_stopping && iex_pcap_next( reader, &record, &local_error ) )
+    {
+      iex_udp udp;
+      iex_seg seg;
+
+      if ( !iex_pcap_udp( linktype, record.data, record.caplen, &udp ) || !iex_seg_parse( udp.payload, udp.len, &seg ) )
+        {
+          continue;
+        }
+
+      if ( publish_speed > 0.0 )
+        {
+          gint64 due;
+          gint64 now;
+
+          if ( 0 == *start )
+            {
+              *first_send_time = seg.send_time;
+              *start = g_get_monotonic_time();
+            }
+
+          due = *start + ( gint64 )( ( gdouble )( seg.send_time - *first_send_time ) / 1000.0 / publish_speed );
+          now = g_get_monotonic_time();
+          if ( due > now )
+            {
+              g_usleep( ( gulong )( due - now ) );
+            }
+        }
+
+      publish_segment( book, &seg, stats );
+    }
+
+  iex_pcap_close( reader );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_prefixed_error( error, local_error, "%s: ", path );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/* [GROUP:]PORT, e.g. "233.215.21.4:10378" */
+static int
+publish_socket( const gchar *spec, const gchar *interface, GError **error )
+{
+  union
+  {
+    struct sockaddr    sa;
+    struct sockaddr_in in;
+  } addr;
+  struct timeval timeout;
+  const gchar *colon;
+  gchar *group = NULL;
+  gchar *end;
+  guint64 port;
+  int one = 1;
+  int rcvbuf = 16 * 1024 * 1024;
+  int fd;
+
+  memset( &addr, 0, sizeof( addr ) );
+  addr.in.sin_family = AF_INET;
+  addr.in.sin_addr.s_addr = htonl( INADDR_ANY );
+
+  colon = strrchr( spec, ':' );
+  port = g_ascii_strtoull( NULL != colon ? colon + 1 : spec, &end, 10 );
+  if ( '\0' != *end || end == ( NULL != colon ? colon + 1 : spec ) || 0 == port || port > G_MAXUINT16 )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "invalid port in '%s'", spec );
+      return -1;
+    }
+
+  addr.in.sin_port = htons( ( guint16 ) port );
+
+  if ( NULL != colon )
+    {
+      group = g_strndup( spec, ( gsize )( colon - spec ) );
+      if ( 1 != inet_pton( AF_INET, group, &addr.in.sin_addr ) )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "invalid IPv4 address '%s'", group );
+          g_free( group );
+          return -1;
+        }
+
+      g_free( group );
+    }
+
+  fd = socket( AF_INET, SOCK_DGRAM, 0 );
+  if ( -1 == fd )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, errno, "socket: %s", g_strerror( errno ) );
+      return -1;
+    }
+
+  /* Several publishers (or other listeners) may share a group; a big buffer rides out bursts */
+  setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+  setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof( rcvbuf ) );
+
+  timeout.tv_sec = 0;
+  timeout.tv_usec = PUBLISH_POLL_MS * 1000;
+  setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+
+  if ( -1 == bind( fd, &addr.sa, sizeof( addr.in ) ) )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, errno, "%s: %s", spec, g_strerror( errno ) );
+      close( fd );
+      return -1;
+    }
+
+  if ( IN_MULTICAST( ntohl( addr.in.sin_addr.s_addr ) ) )
+    {
+      struct ip_mreq mreq;
+
+      mreq.imr_multiaddr = addr.in.sin_addr;
+      mreq.imr_interface.s_addr = htonl( INADDR_ANY );
+
+      if ( NULL != interface && 1 != inet_pton( AF_INET, interface, &mreq.imr_interface ) )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "invalid IPv4 address '%s'", interface );
+          close( fd );
+          return -1;
+        }
+
+      if ( -1 == setsockopt( fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof( mreq ) ) )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, errno, "joining %s: %s", spec, g_strerror( errno ) );
+          close( fd );
+          return -1;
+        }
+    }
+
+  return fd;
+}
+
+
+static gboolean
+publish_live( iex_book *book, int fd, publish_stats *stats, GError **error )
+{
+  guint8 *datagram;
+  gboolean ok = TRUE;
+
+  datagram = g_malloc( PUBLISH_DATAGRAM_MAX );
+
+  while ( !publish_stopping )
+    {
+      iex_seg seg;
+      ssize_t len;
+
+      len = recv( fd, datagram, PUBLISH_DATAGRAM_MAX, 0 );
+      if ( -1 == len )
+        {
+          if ( EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno )
+            {
+              continue;
+            }
+
+          g_set_error( error, IEX_TOOLS_ERROR, errno, "recv: %s", g_strerror( errno ) );
+          ok = FALSE;
+          break;
+        }
+
+      if ( iex_seg_parse( datagram, ( gsize ) len, &seg ) )
+        {
+          publish_segment( book, &seg, stats );
+        }
+    }
+
+  g_free( datagram );
+
+  return ok;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  iex_book *book;
+  struct sigaction sa;
+  publish_stats stats = { 0, 0, 0 };
+  const gchar *name;
+  gint64 first_send_time = 0;
+  gint64 start = 0;
+  gint64 began;
+  int fd = -1;
+  int rc = EXIT_SUCCESS;
+
+  context = g_option_context_new( "- publish top of book to shared memory" );
+  g_option_context_set_summary( context, "Keeps the latest TOPS quote for every symbol in a shared memory table, "
+                                "replaying pcap files (optionally gzip or zstd compressed, and optionally paced by "
+                                "send time) or listening for the feed live. Any number of processes can read the "
+                                "table with libiexbook without slowing the publisher or each other." );
+  g_option_context_add_main_entries( context, publish_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error )
+       || ( NULL == publish_files ) == ( NULL == publish_listen ) )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "give either capture files or --listen" );
+      g_clear_error( &error );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( 0 >= publish_capacity )
+    {
+      g_printerr( "invalid capacity %d\n", publish_capacity );
+      return EXIT_FAILURE;
+    }
+
+  if ( 0 >= publish_threads )
+    {
+      publish_threads = ( gint ) g_get_num_processors();
+    }
+
+  if ( NULL != publish_listen )
+    {
+      fd = publish_socket( publish_listen, publish_interface, &error );
+      if ( -1 == fd )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          return EXIT_FAILURE;
+        }
+    }
+
+  name = NULL != publish_name ? publish_name : IEX_BOOK_DEFAULT_NAME;
+  book = iex_book_create( name, ( guint32 ) publish_capacity, &error );
+  if ( NULL == book )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      if ( -1 != fd )
+        {
+          close( fd );
+        }
+
+      return EXIT_FAILURE;
+    }
+
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_handler = publish_stop;
+  sigemptyset( &sa.sa_mask );
+  sigaction( SIGINT, &sa, NULL );
+  sigaction( SIGTERM, &sa, NULL );
+
+  began = g_get_monotonic_time();
+
+  if ( -1 != fd )
+    {
+      if ( !publish_live( book, fd, &stats, &error ) )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+
+      close( fd );
+    }
+  else
+    {
+      for ( gchar **path = publish_files; NULL != *path && !publish_stopping; path++ )
+        {
+          if ( !publish_file( book, *path, &first_send_time, &start, &stats, &error ) )
+            {
+              g_printerr( "%s\n", error->message );
+              g_clear_error( &error );
+              rc = EXIT_FAILURE;
+            }
+        }
+    }
+
+  g_printerr( "%" G_GUINT64_FORMAT " quotes for %u symbols from %" G_GUINT64_FORMAT " segments in %.3f s\n",
+              stats.quotes, iex_book_size( book ), stats.segments,
+              ( gdouble )( g_get_monotonic_time() - began ) / 1e6 );
+
+  if ( 0 != stats.dropped )
+    {
+      g_printerr( "%" G_GUINT64_FORMAT " quotes dropped, the table is full (see --capacity)\n", stats.dropped );
+    }
+
+  iex_book_close( book );
+
+  if ( publish_unlink && !iex_book_unlink( name, &error ) )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      rc = EXIT_FAILURE;
+    }
+
+  g_free( publish_name );
+  g_free( publish_listen );
+  g_free( publish_interface );
+  g_strfreev( publish_files );
+
+  return rc;
+}
@@ -0,0 +1,155 @@
+/*
+ * iex-seg.h - IEX-TP segment and TOPS message walking for the capture tools
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_SEG_H__
+#define __IEX_SEG_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+#include <string.h>
+
+#include "packet-iextp.h"
+#include "packet-iextops.h"
+#include "iex-quote.h"
+
+G_BEGIN_DECLS
+
+/* A validated IEX-TP segment header, in host byte order */
+typedef struct _iex_seg
+{
+  const guint8 *msgs;
+  const guint8 *end;
+  gint64        offset;
+  gint64        first_seqno;
+  gint64        send_time;
+  guint32       channel;
+  guint32       session;
+  guint16       protocol;
+  guint16       length;
+  guint16       count;
+  guint16       __padding;
+} iex_seg;
+
+/* Walks the length-prefixed messages of a segment */
+typedef struct _iex_seg_iter
+{
+  const guint8 *next;
+  const guint8 *end;
+  guint16       remaining;
+  guint16       index;
+  guint32       __padding;
+} iex_seg_iter;
+
+
+/* Parse a UDP payload as an IEX-TP segment, as dissect_iextp_heur() would accept it */
+static inline gboolean
+iex_seg_parse( const guint8 *payload, gsize len, iex_seg *seg )
+{
+  const iextp_seg *hdr = ( const iextp_seg * ) payload;
+
+  if ( !iextp_seg_check( payload, len ) )
+    {
+      return FALSE;
+    }
+
+  seg->protocol = GUINT16_FROM_LE( hdr->protocol );
+  seg->channel = GUINT32_FROM_LE( hdr->channel );
+  seg->session = GUINT32_FROM_LE( hdr->session );
+  seg->length = GUINT16_FROM_LE( hdr->length );
+  seg->count = GUINT16_FROM_LE( hdr->count );
+  seg->offset = GINT64_FROM_LE( hdr->offset );
+  seg->first_seqno = GINT64_FROM_LE( hdr->first_seqno );
+  seg->send_time = GINT64_FROM_LE( hdr->send_time );
+  seg->__padding = 0;
+  seg->msgs = payload + sizeof( iextp_seg );
+  seg->end = seg->msgs + MIN( ( gsize ) seg->length, len - sizeof( iextp_seg ) );
+
+  return TRUE;
+}
+
+
+static inline void
+iex_seg_iter_init( iex_seg_iter *iter, const iex_seg *seg )
+{
+  iter->next = seg->msgs;
+  iter->end = seg->end;
+  iter->remaining = seg->count;
+  iter->index = 0;
+  iter->__padding = 0;
+}
+
+
+/* Return the next message (and its length), or NULL when done or truncated */
+static inline const guint8 *
+iex_seg_iter_next( iex_seg_iter *iter, guint16 *msg_len )
+{
+  const guint8 *msg;
+  guint16 len;
+
+  if ( 0 == iter->remaining || iter->end - iter->next < ( gssize ) sizeof( guint16 ) )
+    {
+      return NULL;
+    }
+
+  len = ( guint16 )( iter->next[0] | ( iter->next[1] << 8 ) );
+  msg = iter->next + sizeof( guint16 );
+  if ( iter->end - msg < ( gssize ) len )
+    {
+      return NULL;
+    }
+
+  iter->next = msg + len;
+  iter->remaining--;
+  iter->index++;
+  *msg_len = len;
+
+  return msg;
+}
+
+
+/* Decode a TOPS quote message, FALSE if it is not one */
+static inline gboolean
+iex_tops_quote( const guint8 *msg, guint16 len, iex_quote *quote )
+{
+  const iextops_msg *tops = ( const iextops_msg * ) msg;
+
+  if ( sizeof( iextops_msg ) > len || IEXTOPS_MSG_QUOTE != tops->msgtype )
+    {
+      return FALSE;
+    }
+
+  memcpy( quote->symbol, tops->symbol, IEX_SYMBOL_LEN );
+  quote->timestamp = GINT64_FROM_LE( tops->timestamp );
+  quote->bid_size = GUINT32_FROM_LE( tops->bid_size );
+  quote->bid_price = GINT64_FROM_LE( tops->bid_price );
+  quote->ask_price = GINT64_FROM_LE( tops->ask_price );
+  quote->ask_size = GUINT32_FROM_LE( tops->ask_size );
+
+  return TRUE;
+}
+
+G_END_DECLS
+
+#endif /* __IEX_SEG_H__ */
@@ -0,0 +1,619 @@
+/*
+ * iex-slim-tool.c - Pack captures into slim captures, and unpack them again
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-input.h"
+#include "iex-pcap.h"
+#include "iex-seg.h"
+#include "iex-slim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLIM_NS_PER_DAY G_GINT64_CONSTANT( 86400000000000 )
+
+/* IPv4 and UDP headers put in front of segments by --ipv4 */
+#define SLIM_IPV4_HEADER_LEN 28
+
+/* A --from or --to time, either absolute or a time of day on the first record's (UTC) day */
+typedef struct _slim_bound
+{
+  gint64   ns;
+  gboolean set;
+  gboolean of_day;
+} slim_bound;
+
+typedef struct _slim_unpack
+{
+  iex_pcap_writer *writer;
+  guint8          *buf;
+  slim_bound       from;
+  slim_bound       to;
+  guint64          records;
+  guint64          written;
+} slim_unpack;
+
+/* Command line options */
+static gchar *slim_output = NULL;
+static gint slim_block_kb = IEX_SLIM_DEFAULT_BLOCK_SIZE >> 10;
+static gboolean slim_unpack_mode = FALSE;
+static gboolean slim_info = FALSE;
+static gboolean slim_ipv4 = FALSE;
+static gchar *slim_from_arg = NULL;
+static gchar *slim_to_arg = NULL;
+static gint slim_threads = 0;
+static gboolean slim_quiet = FALSE;
+static gchar **slim_files = NULL;
+
+static GOptionEntry slim_options[] =
+{
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &slim_output, "Write to FILE (default: stdout)", "FILE" },
+  { "block", 'b', 0, G_OPTION_ARG_INT, &slim_block_kb, "Block size when packing, in KiB (default: 1024)", "KIB" },
+  { "unpack", 'x', 0, G_OPTION_ARG_NONE, &slim_unpack_mode,
+    "Unpack a slim capture into a pcap of exported PDUs, which Wireshark decodes with the iextp dissector", NULL },
+  { "ipv4", 0, 0, G_OPTION_ARG_NONE, &slim_ipv4, "Unpack into IPv4/UDP packets instead, for replaying", NULL },
+  { "from", 0, 0, G_OPTION_ARG_STRING, &slim_from_arg,
+    "Unpack records captured at or after TIME: nanoseconds since the epoch, or HH:MM:SS[.fraction] UTC", "TIME" },
+  { "to", 0, 0, G_OPTION_ARG_STRING, &slim_to_arg, "Unpack records captured before TIME", "TIME" },
+  { "info", 'i', 0, G_OPTION_ARG_NONE, &slim_info, "Print a slim capture's flows and index", NULL },
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &slim_threads,
+    "Decompression threads for compressed captures (default: all processors)", "N" },
+  { "quiet", 'q', 0, G_OPTION_ARG_NONE, &slim_quiet, "Do not print the summary", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &slim_files, NULL, "CAPTURE..." },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+static gboolean
+slim_parse_bound( const gchar *spec, slim_bound *bound )
+{
+  guint hours;
+  guint minutes;
+  guint seconds;
+  gchar *end;
+  int used = 0;
+
+  if ( NULL == spec )
+    {
+      return TRUE;
+    }
+
+  bound->set = TRUE;
+
+  if ( NULL == strchr( spec, ':' ) )
+    {
+      bound->ns = g_ascii_strtoll( spec, &end, 10 );
+      return end != spec && '\0' == *end;
+    }
+
+  if ( 3 != sscanf( spec, "%2u:%2u:%2u%n", &hours, &minutes, &seconds, &used ) || hours > 23 || minutes > 59
+       || seconds > 60 )
+    {
+      return FALSE;
+    }
+
+  bound->of_day = TRUE;
+  bound->ns = ( ( gint64 ) hours * 3600 + minutes * 60 + seconds ) * 1000000000L;
+
+  if ( '.' == spec[used] )
+    {
+      gint64 scale = 100000000L;
+
+      for ( used++; g_ascii_isdigit( spec[used] ); used++, scale /= 10 )
+        {
+          bound->ns += ( spec[used] - '0' ) * scale;
+        }
+    }
+
+  return '\0' == spec[used];
+}
+
+
+/* Times of day become absolute once the first record's time is known */
+static void
+slim_resolve_bounds( slim_unpack *unpack, gint64 first_ts )
+{
+  gint64 day = first_ts - ( ( first_ts % SLIM_NS_PER_DAY ) + SLIM_NS_PER_DAY ) % SLIM_NS_PER_DAY;
+
+  if ( unpack->from.of_day )
+    {
+      unpack->from.ns += day;
+      unpack->from.of_day = FALSE;
+    }
+
+  if ( unpack->to.of_day )
+    {
+      unpack->to.ns += day;
+      unpack->to.of_day = FALSE;
+    }
+}
+
+
+static inline gboolean
+slim_in_bounds( const slim_unpack *unpack, gint64 ts )
+{
+  return ( !unpack->from.set || ts >= unpack->from.ns ) && ( !unpack->to.set || ts < unpack->to.ns );
+}
+
+
+static inline void
+slim_put_be16( guint8 *p, guint16 v )
+{
+  p[0] = ( guint8 )( v >> 8 );
+  p[1] = ( guint8 ) v;
+}
+
+
+static inline void
+slim_put_be32( guint8 *p, guint32 v )
+{
+  slim_put_be16( p, ( guint16 )( v >> 16 ) );
+  slim_put_be16( p + 2, ( guint16 ) v );
+}
+
+
+/* An IPv4 header (with its checksum) and a UDP header (without one) for the datagram */
+static void
+slim_put_ipv4( guint8 *p, const iex_udp *udp )
+{
+  guint32 sum = 0;
+
+  memset( p, 0, SLIM_IPV4_HEADER_LEN );
+  p[0] = 0x45;
+  slim_put_be16( p + 2, ( guint16 )( SLIM_IPV4_HEADER_LEN + udp->len ) );
+  slim_put_be16( p + 6, 0x4000 );
+  p[8] = 64;
+  p[9] = 17;
+  slim_put_be32( p + 12, udp->src_addr );
+  slim_put_be32( p + 16, udp->dst_addr );
+
+  for ( guint i = 0; i < 20; i += 2 )
+    {
+      sum += ( guint32 )( p[i] << 8 | p[i + 1] );
+    }
+
+  sum = ( sum & 0xffff ) + ( sum >> 16 );
+  sum += sum >> 16;
+  slim_put_be16( p + 10, ( guint16 ) ~sum );
+
+  slim_put_be16( p + 20, udp->src_port );
+  slim_put_be16( p + 22, udp->dst_port );
+  slim_put_be16( p + 24, ( guint16 )( 8 + udp->len ) );
+}
+
+
+static void
+slim_emit( slim_unpack *unpack, gint64 ts, const iex_udp *udp )
+{
+  iex_pcap_record record;
+  iex_slim_source source;
+  guint32 header_len;
+
+  unpack->records++;
+  if ( !slim_in_bounds( unpack, ts ) )
+    {
+      return;
+    }
+
+  if ( slim_ipv4 )
+    {
+      header_len = SLIM_IPV4_HEADER_LEN;
+      slim_put_ipv4( unpack->buf, udp );
+    }
+  else
+    {
+      header_len = IEX_SLIM_PDU_HEADER_LEN;
+      source.src_addr = udp->src_addr;
+      source.dst_addr = udp->dst_addr;
+      source.src_port = udp->src_port;
+      source.dst_port = udp->dst_port;
+      iex_slim_put_pdu_header( unpack->buf, &source );
+    }
+
+  memcpy( unpack->buf + header_len, udp->payload, udp->len );
+
+  record.ts = ts;
+  record.data = unpack->buf;
+  record.caplen = header_len + udp->len;
+  record.origlen = record.caplen;
+  iex_pcap_write( unpack->writer, &record );
+  unpack->written++;
+}
+
+
+/* Read every block in turn, for compressed slim captures (or unbounded unpacking) */
+static gboolean
+slim_unpack_stream( slim_unpack *unpack, const gchar *path, GError **error )
+{
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  GError *local_error = NULL;
+  gboolean first = TRUE;
+  iex_udp udp;
+
+  reader = iex_pcap_open( path, ( guint ) slim_threads, error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  if ( IEX_LINKTYPE_UPPER_PDU != iex_pcap_linktype( reader ) )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "%s: not a slim capture", path );
+      iex_pcap_close( reader );
+      return FALSE;
+    }
+
+  while ( iex_pcap_next( reader, &record, &local_error ) )
+    {
+      if ( first )
+        {
+          slim_resolve_bounds( unpack, record.ts );
+          first = FALSE;
+        }
+
+      if ( iex_pcap_udp( IEX_LINKTYPE_UPPER_PDU, record.data, record.caplen, &udp ) )
+        {
+          slim_emit( unpack, record.ts, &udp );
+        }
+    }
+
+  iex_pcap_close( reader );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_prefixed_error( error, local_error, "%s: ", path );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/* Seek with the index to the first block which can hold --from, for uncompressed slim captures */
+static gboolean
+slim_unpack_indexed( slim_unpack *unpack, const iex_slim_file *file, GError **error )
+{
+  GArray *sources = iex_slim_file_sources( file );
+  iex_slim_cursor cursor;
+  iex_slim_block block;
+  const guint8 *data;
+  const guint8 *segment;
+  guint16 source;
+  guint16 len;
+  gint64 ts;
+  GError *local_error = NULL;
+  iex_udp udp;
+  guint32 n_blocks = iex_slim_file_n_blocks( file );
+  guint32 i;
+
+  if ( 0 == n_blocks )
+    {
+      return TRUE;
+    }
+
+  slim_resolve_bounds( unpack, iex_slim_file_entry( file, 0 )->first_ts );
+
+  /* Capture times can go backwards, so any later block may still hold records before --to */
+  for ( i = iex_slim_file_find( file, unpack->from.ns ); i < n_blocks; i++ )
+    {
+      data = iex_slim_file_block( file, i, &block, error );
+      if ( NULL == data )
+        {
+          return FALSE;
+        }
+
+      iex_slim_cursor_init( &cursor, data + IEX_SLIM_BLOCK_HEADER_LEN, &block, sources );
+      while ( iex_slim_cursor_next( &cursor, &ts, &source, &segment, &len, &local_error ) )
+        {
+          const iex_slim_source *s = &g_array_index( sources, iex_slim_source, source );
+
+          udp.payload = segment;
+          udp.len = len;
+          udp.src_addr = s->src_addr;
+          udp.dst_addr = s->dst_addr;
+          udp.src_port = s->src_port;
+          udp.dst_port = s->dst_port;
+          slim_emit( unpack, ts, &udp );
+        }
+
+      if ( NULL != local_error )
+        {
+          g_propagate_prefixed_error( error, local_error, "block %u: ", i );
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+
+static int
+slim_do_unpack( void )
+{
+  slim_unpack unpack;
+  iex_slim_file *file = NULL;
+  GError *error = NULL;
+  gboolean ok;
+  gint64 start;
+
+  memset( &unpack, 0, sizeof( unpack ) );
+  if ( !slim_parse_bound( slim_from_arg, &unpack.from ) || !slim_parse_bound( slim_to_arg, &unpack.to ) )
+    {
+      g_printerr( "times are nanoseconds since the epoch, or HH:MM:SS[.fraction]\n" );
+      return EXIT_FAILURE;
+    }
+
+  if ( NULL == slim_files[0] || NULL != slim_files[1] )
+    {
+      g_printerr( "give one slim capture to unpack\n" );
+      return EXIT_FAILURE;
+    }
+
+  /* The index only helps with a --from bound, and needs an uncompressed file */
+  if ( unpack.from.set )
+    {
+      file = iex_slim_file_open( slim_files[0], NULL );
+    }
+
+  unpack.writer = iex_pcap_writer_open( slim_output, slim_ipv4 ? IEX_LINKTYPE_IPV4 : IEX_LINKTYPE_UPPER_PDU,
+                                        IEX_SLIM_SNAPLEN, &error );
+  if ( NULL == unpack.writer )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      iex_slim_file_close( file );
+      return EXIT_FAILURE;
+    }
+
+  unpack.buf = g_malloc( IEX_SLIM_SNAPLEN );
+  start = g_get_monotonic_time();
+
+  if ( NULL != file )
+    {
+      ok = slim_unpack_indexed( &unpack, file, &error );
+      iex_slim_file_close( file );
+    }
+  else
+    {
+      ok = slim_unpack_stream( &unpack, slim_files[0], &error );
+    }
+
+  if ( !iex_pcap_writer_close( unpack.writer, ok ? &error : NULL ) )
+    {
+      ok = FALSE;
+    }
+
+  if ( !ok )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "write failed" );
+      g_clear_error( &error );
+    }
+  else if ( !slim_quiet )
+    {
+      g_printerr( "%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " records written in %.3f s\n", unpack.written,
+                  unpack.records, ( gdouble )( g_get_monotonic_time() - start ) / 1e6 );
+    }
+
+  g_free( unpack.buf );
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static int
+slim_do_pack( void )
+{
+  iex_slim_writer *writer;
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  GError *error = NULL;
+  guint64 in_bytes = 0;
+  guint64 packets = 0;
+  guint64 written = 0;
+  guint64 dropped = 0;
+  guint64 out_bytes;
+  gint64 start;
+  int rc = EXIT_SUCCESS;
+
+  if ( slim_block_kb < ( gint )( IEX_SLIM_MIN_BLOCK_SIZE >> 10 ) || slim_block_kb > ( 1 << 20 ) )
+    {
+      g_printerr( "blocks are %u KiB to 1 GiB\n", IEX_SLIM_MIN_BLOCK_SIZE >> 10 );
+      return EXIT_FAILURE;
+    }
+
+  writer = iex_slim_writer_open( slim_output, ( guint32 ) slim_block_kb << 10, &error );
+  if ( NULL == writer )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      return EXIT_FAILURE;
+    }
+
+  start = g_get_monotonic_time();
+
+  for ( gchar **path = slim_files; NULL != *path; path++ )
+    {
+      guint32 linktype;
+      iex_udp udp;
+      iex_seg seg;
+
+      reader = iex_pcap_open( *path, ( guint ) slim_threads, &error );
+      if ( NULL == reader )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+          continue;
+        }
+
+      linktype = iex_pcap_linktype( reader );
+      while ( iex_pcap_next( reader, &record, &error ) )
+        {
+          packets++;
+
+          /* Only segments the dissectors would accept are kept */
+          if ( !iex_pcap_udp( linktype, record.data, record.caplen, &udp ) || !iex_seg_parse( udp.payload, udp.len, &seg )
+               || !iex_slim_write( writer, record.ts, &udp ) )
+            {
+              dropped++;
+              continue;
+            }
+
+          written++;
+        }
+
+      in_bytes += iex_pcap_file_size( reader );
+      iex_pcap_close( reader );
+
+      if ( NULL != error )
+        {
+          g_printerr( "%s: %s\n", *path, error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+    }
+
+  out_bytes = iex_slim_writer_bytes( writer );
+  if ( !iex_slim_writer_close( writer, &error ) )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      return EXIT_FAILURE;
+    }
+
+  if ( !slim_quiet )
+    {
+      g_printerr( "%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " packets kept (%" G_GUINT64_FORMAT
+                  " dropped), %" G_GUINT64_FORMAT " bytes read and %" G_GUINT64_FORMAT " written (%.1f%%) in %.3f s\n",
+                  written, packets, dropped, in_bytes, out_bytes,
+                  0 != in_bytes ? 100.0 * ( gdouble ) out_bytes / ( gdouble ) in_bytes : 0.0,
+                  ( gdouble )( g_get_monotonic_time() - start ) / 1e6 );
+    }
+
+  return rc;
+}
+
+
+/* Footer and index details; the size ratio is only known to the packer */
+static int
+slim_do_info( void )
+{
+  GError *error = NULL;
+  int rc = EXIT_SUCCESS;
+
+  for ( gchar **path = slim_files; NULL != *path; path++ )
+    {
+      iex_slim_file *file;
+      GArray *sources;
+      guint32 n_blocks;
+
+      file = iex_slim_file_open( *path, &error );
+      if ( NULL == file )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+          continue;
+        }
+
+      n_blocks = iex_slim_file_n_blocks( file );
+      sources = iex_slim_file_sources( file );
+
+      printf( "%s: %" G_GUINT64_FORMAT " records in %u blocks of %u KiB, %u flows\n", *path,
+              iex_slim_file_n_records( file ), n_blocks, iex_slim_file_block_size( file ) >> 10, sources->len );
+
+      if ( 0 != n_blocks )
+        {
+          printf( "  first %" G_GINT64_FORMAT " last %" G_GINT64_FORMAT "\n", iex_slim_file_entry( file, 0 )->first_ts,
+                  iex_slim_file_entry( file, n_blocks - 1 )->max_ts );
+        }
+
+      for ( guint i = 0; i < sources->len; i++ )
+        {
+          const iex_slim_source *s = &g_array_index( sources, iex_slim_source, i );
+
+          printf( "  flow %u %u.%u.%u.%u:%u > %u.%u.%u.%u:%u\n", i, s->src_addr >> 24, ( s->src_addr >> 16 ) & 0xff,
+                  ( s->src_addr >> 8 ) & 0xff, s->src_addr & 0xff, s->src_port, s->dst_addr >> 24,
+                  ( s->dst_addr >> 16 ) & 0xff, ( s->dst_addr >> 8 ) & 0xff, s->dst_addr & 0xff, s->dst_port );
+        }
+
+      iex_slim_file_close( file );
+    }
+
+  return rc;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  int rc;
+
+  context = g_option_context_new( "- pack captures into slim captures, or unpack them" );
+  g_option_context_set_summary( context, "Packs pcap files (optionally gzip or zstd compressed) into a slim capture "
+                                "holding only the IEX-TP segments, their capture times and a table of UDP flows, "
+                                "in indexed blocks. The other tools read slim captures (also compressed) as they "
+                                "read pcap files; --unpack writes a pcap which Wireshark decodes." );
+  g_option_context_add_main_entries( context, slim_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) || NULL == slim_files )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "no capture files given" );
+      g_clear_error( &error );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( 0 >= slim_threads )
+    {
+      slim_threads = ( gint ) g_get_num_processors();
+    }
+
+  if ( slim_info )
+    {
+      rc = slim_do_info();
+    }
+  else if ( slim_unpack_mode )
+    {
+      rc = slim_do_unpack();
+    }
+  else
+    {
+      rc = slim_do_pack();
+    }
+
+  g_free( slim_output );
+  g_free( slim_from_arg );
+  g_free( slim_to_arg );
+  g_strfreev( slim_files );
+
+  return rc;
+}
@@ -0,0 +1,775 @@
+/*
+ * iex-slim.c - Slim captures: IEX-TP segments and their capture times, in indexed blocks
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-slim.h"
+#include "iex-input.h"
+#include "iex-text.h"
+
+#include <string.h>
+
+/* Exported PDU tags, from Wireshark's epan/exported_pdu.h */
+#define IEX_SLIM_TAG_END        0
+#define IEX_SLIM_TAG_PROTO_NAME 12
+#define IEX_SLIM_TAG_IPV4_SRC   20
+#define IEX_SLIM_TAG_IPV4_DST   21
+#define IEX_SLIM_TAG_PORT_TYPE  24
+#define IEX_SLIM_TAG_SRC_PORT   25
+#define IEX_SLIM_TAG_DST_PORT   26
+
+/* PT_UDP in epan/address.h */
+#define IEX_SLIM_PORT_TYPE_UDP 3
+
+struct _iex_slim_writer
+{
+  iex_text *text;
+  guint8   *block;
+  GArray   *sources;
+  GArray   *index;
+  guint64   offset;
+  guint64   n_records;
+  gint64    first_ts;
+  gint64    prev_ts;
+  gint64    max_ts;
+  guint32   block_size;
+  guint32   used;
+  guint32   block_records;
+  guint32   last_source;
+};
+
+struct _iex_slim_file
+{
+  GMappedFile  *mapped;
+  const guint8 *data;
+  gsize         size;
+  GArray       *index;
+  GArray       *sources;
+  guint64       n_records;
+  guint32       block_size;
+  guint32       __padding;
+};
+
+
+static inline guint16
+iex_slim_get_u16( const guint8 *p )
+{
+  guint16 v;
+
+  memcpy( &v, p, sizeof( v ) );
+
+  return GUINT16_FROM_LE( v );
+}
+
+
+static inline guint32
+iex_slim_get_u32( const guint8 *p )
+{
+  guint32 v;
+
+  memcpy( &v, p, sizeof( v ) );
+
+  return GUINT32_FROM_LE( v );
+}
+
+
+static inline guint64
+iex_slim_get_u64( const guint8 *p )
+{
+  guint64 v;
+
+  memcpy( &v, p, sizeof( v ) );
+
+  return GUINT64_FROM_LE( v );
+}
+
+
+static inline guint8 *
+iex_slim_put_u16( guint8 *p, guint16 v )
+{
+  v = GUINT16_TO_LE( v );
+  memcpy( p, &v, sizeof( v ) );
+
+  return p + sizeof( v );
+}
+
+
+static inline guint8 *
+iex_slim_put_u32( guint8 *p, guint32 v )
+{
+  v = GUINT32_TO_LE( v );
+  memcpy( p, &v, sizeof( v ) );
+
+  return p + sizeof( v );
+}
+
+
+static inline guint8 *
+iex_slim_put_u64( guint8 *p, guint64 v )
+{
+  v = GUINT64_TO_LE( v );
+  memcpy( p, &v, sizeof( v ) );
+
+  return p + sizeof( v );
+}
+
+
+/* Exported PDU tags are big-endian, a 16-bit tag and length then the value */
+static inline guint8 *
+iex_slim_put_tag32( guint8 *p, guint16 tag, guint32 value )
+{
+  p[0] = ( guint8 )( tag >> 8 );
+  p[1] = ( guint8 ) tag;
+  p[2] = 0;
+  p[3] = 4;
+  p[4] = ( guint8 )( value >> 24 );
+  p[5] = ( guint8 )( value >> 16 );
+  p[6] = ( guint8 )( value >> 8 );
+  p[7] = ( guint8 ) value;
+
+  return p + 8;
+}
+
+
+gboolean
+iex_slim_is_header( const guint8 *header )
+{
+  return IEX_SLIM_MAGIC == iex_slim_get_u64( header );
+}
+
+
+guint32
+iex_slim_header_block_size( const guint8 *header )
+{
+  return iex_slim_get_u32( header + 8 );
+}
+
+
+/* Check a block header, given at least IEX_SLIM_BLOCK_HEADER_LEN bytes; FALSE at the index */
+gboolean
+iex_slim_parse_block( const guint8 *p, gsize len, iex_slim_block *block )
+{
+  if ( IEX_SLIM_BLOCK_HEADER_LEN > len || IEX_SLIM_BLOCK_MAGIC != iex_slim_get_u32( p ) )
+    {
+      return FALSE;
+    }
+
+  block->size = iex_slim_get_u32( p + 4 );
+  block->used = iex_slim_get_u32( p + 8 );
+  block->n_records = iex_slim_get_u32( p + 12 );
+  block->first_ts = ( gint64 ) iex_slim_get_u64( p + 16 );
+  block->__padding = 0;
+
+  return block->used >= IEX_SLIM_BLOCK_HEADER_LEN && block->size >= block->used;
+}
+
+
+/* records points just past the block header */
+void
+iex_slim_cursor_init( iex_slim_cursor *cursor, const guint8 *records, const iex_slim_block *info, GArray *sources )
+{
+  cursor->pos = records;
+  cursor->end = records + info->used - IEX_SLIM_BLOCK_HEADER_LEN;
+  cursor->sources = sources;
+  cursor->ts = info->first_ts;
+}
+
+
+/* The next segment in the block, FALSE at its end or with error set if it is corrupt */
+gboolean
+iex_slim_cursor_next( iex_slim_cursor *cursor, gint64 *ts, guint16 *source, const guint8 **segment, guint16 *len,
+                      GError **error )
+{
+  while ( cursor->pos < cursor->end )
+    {
+      const guint8 *p = cursor->pos;
+      guint16 id;
+      guint16 n;
+
+      if ( ( gsize )( cursor->end - p ) < IEX_SLIM_RECORD_HEADER_LEN )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "corrupt slim record" );
+          return FALSE;
+        }
+
+      id = iex_slim_get_u16( p + 4 );
+      n = iex_slim_get_u16( p + 6 );
+      if ( ( gsize )( cursor->end - p ) - IEX_SLIM_RECORD_HEADER_LEN < n )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "corrupt slim record" );
+          return FALSE;
+        }
+
+      cursor->pos = p + IEX_SLIM_RECORD_HEADER_LEN + n;
+      p += IEX_SLIM_RECORD_HEADER_LEN;
+
+      if ( IEX_SLIM_SOURCE_DEFINE == id )
+        {
+          iex_slim_source def;
+          guint16 def_id;
+
+          if ( 2 + IEX_SLIM_SOURCE_LEN != n )
+            {
+              g_set_error( error, IEX_TOOLS_ERROR, 0, "corrupt slim source definition" );
+              return FALSE;
+            }
+
+          def_id = iex_slim_get_u16( p );
+          def.src_addr = iex_slim_get_u32( p + 2 );
+          def.dst_addr = iex_slim_get_u32( p + 6 );
+          def.src_port = iex_slim_get_u16( p + 10 );
+          def.dst_port = iex_slim_get_u16( p + 12 );
+
+          if ( def_id >= cursor->sources->len )
+            {
+              g_array_set_size( cursor->sources, def_id + 1U );
+            }
+
+          g_array_index( cursor->sources, iex_slim_source, def_id ) = def;
+          continue;
+        }
+
+      if ( IEX_SLIM_SOURCE_TIME == id )
+        {
+          if ( 8 != n )
+            {
+              g_set_error( error, IEX_TOOLS_ERROR, 0, "corrupt slim time record" );
+              return FALSE;
+            }
+
+          cursor->ts = ( gint64 ) iex_slim_get_u64( p );
+          continue;
+        }
+
+      if ( id >= cursor->sources->len )
+        {
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "slim record from undefined source %u", id );
+          return FALSE;
+        }
+
+      cursor->ts += ( gint32 ) iex_slim_get_u32( p - IEX_SLIM_RECORD_HEADER_LEN );
+      *ts = cursor->ts;
+      *source = id;
+      *segment = p;
+      *len = n;
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+
+/* The IEX_SLIM_PDU_HEADER_LEN bytes of exported PDU tags for a segment from source */
+void
+iex_slim_put_pdu_header( guint8 *p, const iex_slim_source *source )
+{
+  p[0] = 0;
+  p[1] = IEX_SLIM_TAG_PROTO_NAME;
+  p[2] = 0;
+  p[3] = 8;
+  memcpy( p + 4, "iextp\0\0\0", 8 );
+  p += 12;
+
+  p = iex_slim_put_tag32( p, IEX_SLIM_TAG_IPV4_SRC, source->src_addr );
+  p = iex_slim_put_tag32( p, IEX_SLIM_TAG_IPV4_DST, source->dst_addr );
+  p = iex_slim_put_tag32( p, IEX_SLIM_TAG_PORT_TYPE, IEX_SLIM_PORT_TYPE_UDP );
+  p = iex_slim_put_tag32( p, IEX_SLIM_TAG_SRC_PORT, source->src_port );
+  p = iex_slim_put_tag32( p, IEX_SLIM_TAG_DST_PORT, source->dst_port );
+
+  memset( p, IEX_SLIM_TAG_END, 4 );
+}
+
+
+/*
+ * Writing
+ */
+
+/* Write to stdout when path is NULL or "-" */
+iex_slim_writer *
+iex_slim_writer_open( const gchar *path, guint32 block_size, GError **error )
+{
+  iex_slim_writer *writer;
+  guint8 header[IEX_SLIM_HEADER_LEN];
+
+  if ( block_size < IEX_SLIM_MIN_BLOCK_SIZE )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "blocks must be at least %u KiB", IEX_SLIM_MIN_BLOCK_SIZE >> 10 );
+      return NULL;
+    }
+
+  writer = g_new0( iex_slim_writer, 1 );
+  writer->text = iex_text_open( path, error );
+  if ( NULL == writer->text )
+    {
+      g_free( writer );
+      return NULL;
+    }
+
+  writer->block_size = block_size;
+  writer->block = g_malloc( block_size );
+  writer->used = IEX_SLIM_BLOCK_HEADER_LEN;
+  writer->sources = g_array_new( FALSE, FALSE, sizeof( iex_slim_source ) );
+  writer->index = g_array_new( FALSE, FALSE, sizeof( iex_slim_index_entry ) );
+  writer->max_ts = G_MININT64;
+
+  memset( header, 0, sizeof( header ) );
+  iex_slim_put_u64( header, IEX_SLIM_MAGIC );
+  iex_slim_put_u32( header + 8, block_size );
+  iex_text_write( writer->text, header, sizeof( header ) );
+  writer->offset = IEX_SLIM_HEADER_LEN;
+
+  return writer;
+}
+
+
+/* Write out the current block, padded to the block size unless it is the last */
+static void
+iex_slim_flush_block( iex_slim_writer *writer, gboolean last )
+{
+  iex_slim_index_entry entry;
+  guint32 size;
+  guint8 *p;
+
+  if ( 0 == writer->block_records )
+    {
+      return;
+    }
+
+  size = last ? writer->used : writer->block_size;
+  memset( writer->block + writer->used, 0, size - writer->used );
+
+  p = iex_slim_put_u32( writer->block, IEX_SLIM_BLOCK_MAGIC );
+  p = iex_slim_put_u32( p, size );
+  p = iex_slim_put_u32( p, writer->used );
+  p = iex_slim_put_u32( p, writer->block_records );
+  iex_slim_put_u64( p, ( guint64 ) writer->first_ts );
+
+  iex_text_write( writer->text, writer->block, size );
+
+  entry.offset = writer->offset;
+  entry.first_ts = writer->first_ts;
+  entry.max_ts = writer->max_ts;
+  entry.first_record = writer->n_records;
+  entry.n_records = writer->block_records;
+  entry.size = size;
+  g_array_append_val( writer->index, entry );
+
+  writer->offset += size;
+  writer->n_records += writer->block_records;
+  writer->used = IEX_SLIM_BLOCK_HEADER_LEN;
+  writer->block_records = 0;
+}
+
+
+static guint8 *
+iex_slim_put_record_header( guint8 *p, gint32 delta, guint16 source, guint16 len )
+{
+  p = iex_slim_put_u32( p, ( guint32 ) delta );
+  p = iex_slim_put_u16( p, source );
+
+  return iex_slim_put_u16( p, len );
+}
+
+
+static guint8 *
+iex_slim_put_source( guint8 *p, guint16 id, const iex_slim_source *source )
+{
+  p = iex_slim_put_record_header( p, 0, IEX_SLIM_SOURCE_DEFINE, 2 + IEX_SLIM_SOURCE_LEN );
+  p = iex_slim_put_u16( p, id );
+  p = iex_slim_put_u32( p, source->src_addr );
+  p = iex_slim_put_u32( p, source->dst_addr );
+  p = iex_slim_put_u16( p, source->src_port );
+
+  return iex_slim_put_u16( p, source->dst_port );
+}
+
+
+/* Find (or add) the flow's source id; there are rarely more than a few, so a scan will do */
+static guint32
+iex_slim_writer_source( iex_slim_writer *writer, const iex_udp *udp, gboolean *added )
+{
+  iex_slim_source source;
+
+  *added = FALSE;
+
+  if ( writer->last_source < writer->sources->len )
+    {
+      const iex_slim_source *last = &g_array_index( writer->sources, iex_slim_source, writer->last_source );
+
+      if ( last->src_addr == udp->src_addr && last->dst_addr == udp->dst_addr && last->src_port == udp->src_port
+           && last->dst_port == udp->dst_port )
+        {
+          return writer->last_source;
+        }
+    }
+
+  for ( guint32 i = 0; i < writer->sources->len; i++ )
+    {
+      const iex_slim_source *s = &g_array_index( writer->sources, iex_slim_source, i );
+
+      if ( s->src_addr == udp->src_addr && s->dst_addr == udp->dst_addr && s->src_port == udp->src_port
+           && s->dst_port == udp->dst_port )
+        {
+          writer->last_source = i;
+          return i;
+        }
+    }
+
+  if ( IEX_SLIM_MAX_SOURCES == writer->sources->len )
+    {
+      return IEX_SLIM_MAX_SOURCES;
+    }
+
+  source.src_addr = udp->src_addr;
+  source.dst_addr = udp->dst_addr;
+  source.src_port = udp->src_port;
+  source.dst_port = udp->dst_port;
+  g_array_append_val( writer->sources, source );
+
+  *added = TRUE;
+  writer->last_source = writer->sources->len - 1;
+
+  return writer->last_source;
+}
+
+
+/* Add a segment (the UDP payload) captured at ts; FALSE if there are too many flows to record it */
+gboolean
+iex_slim_write( iex_slim_writer *writer, gint64 ts, const iex_udp *udp )
+{
+  guint32 source;
+  guint32 need;
+  gboolean added;
+  gint64 delta;
+  guint8 *p;
+
+  source = iex_slim_writer_source( writer, udp, &added );
+  if ( IEX_SLIM_MAX_SOURCES == source )
+    {
+      return FALSE;
+    }
+
+  need = IEX_SLIM_RECORD_HEADER_LEN + udp->len;
+  if ( added )
+    {
+      need += IEX_SLIM_RECORD_HEADER_LEN + 2 + IEX_SLIM_SOURCE_LEN;
+    }
+
+  if ( 0 != writer->block_records )
+    {
+      delta = ts - writer->prev_ts;
+      if ( delta < G_MININT32 || delta > G_MAXINT32 )
+        {
+          need += IEX_SLIM_RECORD_HEADER_LEN + 8;
+        }
+
+      if ( writer->used + need > writer->block_size )
+        {
+          iex_slim_flush_block( writer, FALSE );
+        }
+    }
+
+  p = writer->block + writer->used;
+
+  if ( 0 == writer->block_records )
+    {
+      writer->first_ts = ts;
+      writer->prev_ts = ts;
+    }
+
+  if ( added )
+    {
+      p = iex_slim_put_source( p, ( guint16 ) source, &g_array_index( writer->sources, iex_slim_source, source ) );
+    }
+
+  delta = ts - writer->prev_ts;
+  if ( delta < G_MININT32 || delta > G_MAXINT32 )
+    {
+      p = iex_slim_put_record_header( p, 0, IEX_SLIM_SOURCE_TIME, 8 );
+      p = iex_slim_put_u64( p, ( guint64 ) ts );
+      delta = 0;
+    }
+
+  p = iex_slim_put_record_header( p, ( gint32 ) delta, ( guint16 ) source, ( guint16 ) udp->len );
+  memcpy( p, udp->payload, udp->len );
+  p += udp->len;
+
+  writer->used = ( guint32 )( p - writer->block );
+  writer->block_records++;
+  writer->prev_ts = ts;
+
+  /* Kept as a running maximum, so the index can be searched even if capture times go backwards */
+  writer->max_ts = MAX( writer->max_ts, ts );
+
+  return TRUE;
+}
+
+
+/* Bytes written so far and in the block being filled, which is all but the index */
+guint64
+iex_slim_writer_bytes( const iex_slim_writer *writer )
+{
+  return writer->offset + ( 0 != writer->block_records ? writer->used : 0 );
+}
+
+
+gboolean
+iex_slim_writer_close( iex_slim_writer *writer, GError **error )
+{
+  guint8 buf[MAX( IEX_SLIM_INDEX_ENTRY_LEN, IEX_SLIM_FOOTER_LEN )];
+  guint64 index_offset;
+  gboolean ok;
+  guint8 *p;
+
+  iex_slim_flush_block( writer, TRUE );
+  index_offset = writer->offset;
+
+  p = iex_slim_put_u32( buf, IEX_SLIM_INDEX_MAGIC );
+  p = iex_slim_put_u32( p, writer->index->len );
+  p = iex_slim_put_u32( p, writer->sources->len );
+  iex_slim_put_u32( p, 0 );
+  iex_text_write( writer->text, buf, IEX_SLIM_INDEX_HEADER_LEN );
+
+  for ( guint i = 0; i < writer->index->len; i++ )
+    {
+      const iex_slim_index_entry *entry = &g_array_index( writer->index, iex_slim_index_entry, i );
+
+      p = iex_slim_put_u64( buf, entry->offset );
+      p = iex_slim_put_u64( p, ( guint64 ) entry->first_ts );
+      p = iex_slim_put_u64( p, ( guint64 ) entry->max_ts );
+      p = iex_slim_put_u64( p, entry->first_record );
+      p = iex_slim_put_u32( p, entry->n_records );
+      iex_slim_put_u32( p, entry->size );
+      iex_text_write( writer->text, buf, IEX_SLIM_INDEX_ENTRY_LEN );
+    }
+
+  for ( guint i = 0; i < writer->sources->len; i++ )
+    {
+      const iex_slim_source *source = &g_array_index( writer->sources, iex_slim_source, i );
+
+      p = iex_slim_put_u32( buf, source->src_addr );
+      p = iex_slim_put_u32( p, source->dst_addr );
+      p = iex_slim_put_u16( p, source->src_port );
+      iex_slim_put_u16( p, source->dst_port );
+      iex_text_write( writer->text, buf, IEX_SLIM_SOURCE_LEN );
+    }
+
+  p = iex_slim_put_u64( buf, index_offset );
+  iex_slim_put_u64( p, IEX_SLIM_MAGIC );
+  iex_text_write( writer->text, buf, IEX_SLIM_FOOTER_LEN );
+
+  ok = iex_text_close( writer->text, error );
+
+  g_free( writer->block );
+  g_array_free( writer->sources, TRUE );
+  g_array_free( writer->index, TRUE );
+  g_free( writer );
+
+  return ok;
+}
+
+
+/*
+ * Reading with the index, uncompressed files only
+ */
+
+iex_slim_file *
+iex_slim_file_open( const gchar *path, GError **error )
+{
+  iex_slim_file *file;
+  const guint8 *p;
+  guint64 index_offset;
+  guint32 n_blocks;
+  guint32 n_sources;
+
+  file = g_new0( iex_slim_file, 1 );
+  file->mapped = g_mapped_file_new( path, FALSE, error );
+  if ( NULL == file->mapped )
+    {
+      g_free( file );
+      return NULL;
+    }
+
+  file->data = ( const guint8 * ) g_mapped_file_get_contents( file->mapped );
+  file->size = g_mapped_file_get_length( file->mapped );
+  file->index = g_array_new( FALSE, FALSE, sizeof( iex_slim_index_entry ) );
+  file->sources = g_array_new( FALSE, FALSE, sizeof( iex_slim_source ) );
+
+  if ( IEX_SLIM_HEADER_LEN + IEX_SLIM_INDEX_HEADER_LEN + IEX_SLIM_FOOTER_LEN > file->size
+       || !iex_slim_is_header( file->data ) )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "%s: not a slim capture (or compressed)", path );
+      iex_slim_file_close( file );
+      return NULL;
+    }
+
+  file->block_size = iex_slim_header_block_size( file->data );
+
+  p = file->data + file->size - IEX_SLIM_FOOTER_LEN;
+  index_offset = iex_slim_get_u64( p );
+  if ( IEX_SLIM_MAGIC != iex_slim_get_u64( p + 8 ) || index_offset < IEX_SLIM_HEADER_LEN
+       || index_offset > file->size - IEX_SLIM_FOOTER_LEN - IEX_SLIM_INDEX_HEADER_LEN )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "%s: the slim capture has no index (was it written completely?)",
+                   path );
+      iex_slim_file_close( file );
+      return NULL;
+    }
+
+  p = file->data + index_offset;
+  n_blocks = iex_slim_get_u32( p + 4 );
+  n_sources = iex_slim_get_u32( p + 8 );
+  if ( IEX_SLIM_INDEX_MAGIC != iex_slim_get_u32( p )
+       || ( guint64 ) n_blocks * IEX_SLIM_INDEX_ENTRY_LEN + ( guint64 ) n_sources * IEX_SLIM_SOURCE_LEN
+          != file->size - IEX_SLIM_FOOTER_LEN - IEX_SLIM_INDEX_HEADER_LEN - index_offset )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "%s: corrupt slim index", path );
+      iex_slim_file_close( file );
+      return NULL;
+    }
+
+  p += IEX_SLIM_INDEX_HEADER_LEN;
+  g_array_set_size( file->index, n_blocks );
+  for ( guint32 i = 0; i < n_blocks; i++, p += IEX_SLIM_INDEX_ENTRY_LEN )
+    {
+      iex_slim_index_entry *entry = &g_array_index( file->index, iex_slim_index_entry, i );
+
+      entry->offset = iex_slim_get_u64( p );
+      entry->first_ts = ( gint64 ) iex_slim_get_u64( p + 8 );
+      entry->max_ts = ( gint64 ) iex_slim_get_u64( p + 16 );
+      entry->first_record = iex_slim_get_u64( p + 24 );
+      entry->n_records = iex_slim_get_u32( p + 32 );
+      entry->size = iex_slim_get_u32( p + 36 );
+      file->n_records = entry->first_record + entry->n_records;
+    }
+
+  g_array_set_size( file->sources, n_sources );
+  for ( guint32 i = 0; i < n_sources; i++, p += IEX_SLIM_SOURCE_LEN )
+    {
+      iex_slim_source *source = &g_array_index( file->sources, iex_slim_source, i );
+
+      source->src_addr = iex_slim_get_u32( p );
+      source->dst_addr = iex_slim_get_u32( p + 4 );
+      source->src_port = iex_slim_get_u16( p + 8 );
+      source->dst_port = iex_slim_get_u16( p + 10 );
+    }
+
+  return file;
+}
+
+
+void
+iex_slim_file_close( iex_slim_file *file )
+{
+  if ( NULL == file )
+    {
+      return;
+    }
+
+  g_mapped_file_unref( file->mapped );
+  g_array_free( file->index, TRUE );
+  g_array_free( file->sources, TRUE );
+  g_free( file );
+}
+
+
+guint32
+iex_slim_file_block_size( const iex_slim_file *file )
+{
+  return file->block_size;
+}
+
+
+guint32
+iex_slim_file_n_blocks( const iex_slim_file *file )
+{
+  return file->index->len;
+}
+
+
+guint64
+iex_slim_file_n_records( const iex_slim_file *file )
+{
+  return file->n_records;
+}
+
+
+/* Every flow in the file, which a cursor starting at any block can use */
+GArray *
+iex_slim_file_sources( const iex_slim_file *file )
+{
+  return file->sources;
+}
+
+
+const iex_slim_index_entry *
+iex_slim_file_entry( const iex_slim_file *file, guint32 i )
+{
+  return &g_array_index( file->index, iex_slim_index_entry, i );
+}
+
+
+/* The first block which may hold records captured at or after ts, or the number of blocks */
+guint32
+iex_slim_file_find( const iex_slim_file *file, gint64 ts )
+{
+  guint32 lo = 0;
+  guint32 hi = file->index->len;
+
+  while ( lo < hi )
+    {
+      guint32 mid = lo + ( hi - lo ) / 2;
+
+      if ( g_array_index( file->index, iex_slim_index_entry, mid ).max_ts < ts )
+        {
+          lo = mid + 1;
+        }
+      else
+        {
+          hi = mid;
+        }
+    }
+
+  return lo;
+}
+
+
+/* The i'th block, its header checked against the index */
+const guint8 *
+iex_slim_file_block( const iex_slim_file *file, guint32 i, iex_slim_block *block, GError **error )
+{
+  const iex_slim_index_entry *entry = iex_slim_file_entry( file, i );
+
+  if ( entry->offset > file->size || file->size - entry->offset < entry->size
+       || !iex_slim_parse_block( file->data + entry->offset, entry->size, block ) || block->size != entry->size
+       || block->n_records != entry->n_records )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "corrupt slim block %u", i );
+      return NULL;
+    }
+
+  return file->data + entry->offset;
+}
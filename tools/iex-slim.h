@@ -0,0 +1,151 @@
+/*
+ * iex-slim.h - Slim captures: IEX-TP segments and their capture times, in indexed blocks
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_SLIM_H__
+#define __IEX_SLIM_H__
+
+#include "iex-pcap.h"
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+/*
+ * A slim capture keeps only what replaying or decoding a feed needs: each
+ * IEX-TP segment's bytes, its capture time, and which of a small table of
+ * UDP flows (addresses and ports) it came from. Everything is little-endian:
+ *
+ *   header    24 bytes: magic, block size
+ *   blocks    each block_size bytes (the last only as long as its records),
+ *             a 24-byte block header and then records, never split across
+ *             blocks, so any block can be decoded on its own
+ *   index     one entry per block, then the flow table
+ *   footer    16 bytes: the index offset, magic
+ *
+ * A record is an 8-byte header (nanoseconds since the previous record's
+ * time, or the block's first time, then source and length) and that many
+ * bytes. Two sources are reserved: one defines a flow before its first use,
+ * the other gives an absolute time when a gap does not fit the delta. Stream
+ * readers learn flows from the definitions; readers which seek use the
+ * index's table.
+ */
+#define IEX_SLIM_MAGIC G_GUINT64_CONSTANT( 0x014d494c53584549 )  /* "IEXSLIM" and version 1 */
+
+#define IEX_SLIM_HEADER_LEN        24
+#define IEX_SLIM_BLOCK_HEADER_LEN  24
+#define IEX_SLIM_RECORD_HEADER_LEN 8
+#define IEX_SLIM_INDEX_HEADER_LEN  16
+#define IEX_SLIM_INDEX_ENTRY_LEN   40
+#define IEX_SLIM_SOURCE_LEN        12
+#define IEX_SLIM_FOOTER_LEN        16
+
+#define IEX_SLIM_BLOCK_MAGIC 0x42584549U  /* "IEXB" */
+#define IEX_SLIM_INDEX_MAGIC 0x49584549U  /* "IEXI" */
+
+#define IEX_SLIM_DEFAULT_BLOCK_SIZE ( 1U << 20 )
+#define IEX_SLIM_MIN_BLOCK_SIZE     ( 128U << 10 )
+
+#define IEX_SLIM_SOURCE_DEFINE 0xffff
+#define IEX_SLIM_SOURCE_TIME   0xfffe
+#define IEX_SLIM_MAX_SOURCES   0xfffe
+
+/*
+ * Slim records are read back as Wireshark "exported PDU" packets: tags naming
+ * the iextp dissector and giving the flow's addresses and ports, then the
+ * segment, so Wireshark hands the segment straight to dissect_iextp() and on
+ * through "iextp.proto".
+ */
+#define IEX_SLIM_PDU_HEADER_LEN 56
+#define IEX_SLIM_SNAPLEN ( IEX_SLIM_PDU_HEADER_LEN + G_MAXUINT16 )
+
+typedef struct _iex_slim_source
+{
+  guint32 src_addr;
+  guint32 dst_addr;
+  guint16 src_port;
+  guint16 dst_port;
+} iex_slim_source;
+
+typedef struct _iex_slim_block
+{
+  gint64  first_ts;
+  guint32 size;
+  guint32 used;
+  guint32 n_records;
+  guint32 __padding;
+} iex_slim_block;
+
+typedef struct _iex_slim_index_entry
+{
+  guint64 offset;
+  gint64  first_ts;
+  gint64  max_ts;
+  guint64 first_record;
+  guint32 n_records;
+  guint32 size;
+} iex_slim_index_entry;
+
+/* Walks the records of one block in memory; sources grows as flows are defined */
+typedef struct _iex_slim_cursor
+{
+  const guint8 *pos;
+  const guint8 *end;
+  GArray       *sources;
+  gint64        ts;
+} iex_slim_cursor;
+
+typedef struct _iex_slim_writer iex_slim_writer;
+typedef struct _iex_slim_file iex_slim_file;
+
+gboolean iex_slim_is_header( const guint8 *header );
+guint32 iex_slim_header_block_size( const guint8 *header );
+
+gboolean iex_slim_parse_block( const guint8 *p, gsize len, iex_slim_block *block );
+void iex_slim_cursor_init( iex_slim_cursor *cursor, const guint8 *records, const iex_slim_block *info,
+                           GArray *sources );
+gboolean iex_slim_cursor_next( iex_slim_cursor *cursor, gint64 *ts, guint16 *source, const guint8 **segment,
+                               guint16 *len, GError **error );
+
+void iex_slim_put_pdu_header( guint8 *p, const iex_slim_source *source );
+
+iex_slim_writer *iex_slim_writer_open( const gchar *path, guint32 block_size, GError **error );
+gboolean iex_slim_writer_close( iex_slim_writer *writer, GError **error );
+gboolean iex_slim_write( iex_slim_writer *writer, gint64 ts, const iex_udp *udp );
+guint64 iex_slim_writer_bytes( const iex_slim_writer *writer );
+
+iex_slim_file *iex_slim_file_open( const gchar *path, GError **error );
+void iex_slim_file_close( iex_slim_file *file );
+
+guint32 iex_slim_file_block_size( const iex_slim_file *file );
+guint32 iex_slim_file_n_blocks( const iex_slim_file *file );
+guint64 iex_slim_file_n_records( const iex_slim_file *file );
+GArray *iex_slim_file_sources( const iex_slim_file *file );
+const iex_slim_index_entry *iex_slim_file_entry( const iex_slim_file *file, guint32 i );
+guint32 iex_slim_file_find( const iex_slim_file *file, gint64 ts );
+const guint8 *iex_slim_file_block( const iex_slim_file *file, guint32 i, iex_slim_block *block, GError **error );
+
+G_END_DECLS
+
+#endif /* __IEX_SLIM_H__ */
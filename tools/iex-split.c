@@ -0,0 +1,595 @@
+/*
+ * iex-split.c - Split captures into one pcap per IEX-TP channel and session
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-input.h"
+#include "iex-pcap.h"
+#include "iex-seg.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SPLIT_DEFAULT_TEMPLATE "iextp-%c-%s.pcap"
+
+/*
+ * One output file. Packets are copied into its own buffer, and it only needs
+ * an open file while that is written out: descriptors are shared between the
+ * outputs through an LRU list, so any number of outputs can be written with
+ * a bounded number of files open.
+ */
+typedef struct _split_output
+{
+  GList    lru;
+  gchar   *path;
+  guint8  *buf;
+  GError  *error;
+  gsize    used;
+  guint64  packets;
+  guint64  bytes;
+  guint32  channel;
+  guint32  session;
+  int      fd;
+  gboolean created;
+} split_output;
+
+typedef struct _split_state
+{
+  GHashTable   *outputs;
+  GQueue        open;
+  split_output *last;
+  split_output *other;
+  guint32       linktype;
+  guint32       snaplen;
+  guint64       frames;
+  guint64       dropped;
+  guint64       reopened;
+  gboolean      started;
+  guint32       __padding;
+} split_state;
+
+/* Command line options */
+static gint split_threads = 0;
+static gint split_max_open = 64;
+static gint split_buffer_kb = 4096;
+static gchar *split_template = NULL;
+static gchar *split_other = NULL;
+static gboolean split_quiet = FALSE;
+static gchar **split_files = NULL;
+
+static GOptionEntry split_options[] =
+{
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &split_template,
+    "Output file names, with %c for the channel and %s for the session (default: " SPLIT_DEFAULT_TEMPLATE ")",
+    "TEMPLATE" },
+  { "other", 0, 0, G_OPTION_ARG_FILENAME, &split_other, "Write packets which are not IEX-TP to this file", "FILE" },
+  { "max-open", 'm', 0, G_OPTION_ARG_INT, &split_max_open, "Most output files open at once (default: 64)", "N" },
+  { "buffer", 'b', 0, G_OPTION_ARG_INT, &split_buffer_kb, "Buffer for each output, in KiB (default: 4096)", "KIB" },
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &split_threads,
+    "Decompression threads for compressed captures (default: all processors)", "N" },
+  { "quiet", 'q', 0, G_OPTION_ARG_NONE, &split_quiet, "Do not print the summary", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &split_files, NULL, "CAPTURE..." },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+/* The template with %c, %s and %% replaced */
+static gchar *
+split_path( const gchar *template, guint32 channel, guint32 session )
+{
+  GString *path = g_string_new( NULL );
+
+  for ( const gchar *p = template; '\0' != *p; p++ )
+    {
+      if ( '%' != *p || '\0' == p[1] )
+        {
+          g_string_append_c( path, *p );
+          continue;
+        }
+
+      switch ( *++p )
+        {
+        case 'c':
+          g_string_append_printf( path, "%" G_GUINT32_FORMAT, channel );
+          break;
+
+        case 's':
+          g_string_append_printf( path, "%" G_GUINT32_FORMAT, session );
+          break;
+
+        default:
+          g_string_append_c( path, *p );
+          break;
+        }
+    }
+
+  return g_string_free( path, FALSE );
+}
+
+
+static gboolean
+split_check_template( const gchar *template, GError **error )
+{
+  gboolean channel = FALSE;
+  gboolean session = FALSE;
+
+  for ( const gchar *p = template; '\0' != *p; p++ )
+    {
+      if ( '%' != *p )
+        {
+          continue;
+        }
+
+      switch ( *++p )
+        {
+        case 'c':
+          channel = TRUE;
+          break;
+
+        case 's':
+          session = TRUE;
+          break;
+
+        case '%':
+          break;
+
+        default:
+          g_set_error( error, IEX_TOOLS_ERROR, 0, "unknown '%%%c' in output template", *p );
+          return FALSE;
+        }
+    }
+
+  if ( !channel || !session )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "output template must contain %%c and %%s" );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+static void
+split_close_fd( split_state *state, split_output *output )
+{
+  if ( 0 > output->fd )
+    {
+      return;
+    }
+
+  if ( 0 != close( output->fd ) && NULL == output->error )
+    {
+      g_set_error( &output->error, IEX_TOOLS_ERROR, 0, "%s: %s", output->path, g_strerror( errno ) );
+    }
+
+  g_queue_unlink( &state->open, &output->lru );
+  output->fd = -1;
+}
+
+
+/* An open descriptor for the output, closing the least recently written one if there are too many */
+static gboolean
+split_open_fd( split_state *state, split_output *output )
+{
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+
+  if ( 0 <= output->fd )
+    {
+      g_queue_unlink( &state->open, &output->lru );
+      g_queue_push_head_link( &state->open, &output->lru );
+      return TRUE;
+    }
+
+  if ( state->open.length >= ( guint ) split_max_open )
+    {
+      split_close_fd( state, g_queue_peek_tail_link( &state->open )->data );
+    }
+
+  flags |= output->created ? O_APPEND : O_TRUNC;
+  output->fd = open( output->path, flags, 0666 );
+  if ( 0 > output->fd )
+    {
+      g_set_error( &output->error, IEX_TOOLS_ERROR, 0, "%s: %s", output->path, g_strerror( errno ) );
+      return FALSE;
+    }
+
+  if ( output->created )
+    {
+      state->reopened++;
+    }
+
+  output->created = TRUE;
+  g_queue_push_head_link( &state->open, &output->lru );
+
+  return TRUE;
+}
+
+
+static void
+split_write_fd( split_state *state, split_output *output, const guint8 *data, gsize len )
+{
+  if ( NULL != output->error || !split_open_fd( state, output ) )
+    {
+      return;
+    }
+
+  while ( 0 != len )
+    {
+      ssize_t written = write( output->fd, data, len );
+
+      if ( 0 > written )
+        {
+          if ( EINTR != errno )
+            {
+              g_set_error( &output->error, IEX_TOOLS_ERROR, 0, "%s: %s", output->path, g_strerror( errno ) );
+              return;
+            }
+          continue;
+        }
+
+      data += written;
+      len -= ( gsize ) written;
+    }
+}
+
+
+static void
+split_flush( split_state *state, split_output *output )
+{
+  if ( 0 != output->used )
+    {
+      split_write_fd( state, output, output->buf, output->used );
+      output->used = 0;
+    }
+}
+
+
+static void
+split_put( split_state *state, split_output *output, const guint8 *data, gsize len )
+{
+  gsize size = ( gsize ) split_buffer_kb << 10;
+
+  if ( output->used + len > size )
+    {
+      split_flush( state, output );
+    }
+
+  if ( len > size )
+    {
+      split_write_fd( state, output, data, len );
+      return;
+    }
+
+  memcpy( output->buf + output->used, data, len );
+  output->used += len;
+}
+
+
+static split_output *
+split_output_new( split_state *state, gchar *path, guint32 channel, guint32 session )
+{
+  split_output *output;
+  guint8 header[IEX_PCAP_HEADER_LEN];
+
+  output = g_new0( split_output, 1 );
+  output->path = path;
+  output->buf = g_malloc( ( gsize ) split_buffer_kb << 10 );
+  output->lru.data = output;
+  output->channel = channel;
+  output->session = session;
+  output->fd = -1;
+
+  iex_pcap_put_header( header, state->linktype, state->snaplen );
+  split_put( state, output, header, sizeof( header ) );
+
+  return output;
+}
+
+
+static void
+split_output_free( gpointer data )
+{
+  split_output *output = data;
+
+  g_free( output->path );
+  g_free( output->buf );
+  g_clear_error( &output->error );
+  g_free( output );
+}
+
+
+static split_output *
+split_get_output( split_state *state, guint32 channel, guint32 session )
+{
+  guint64 key = ( ( guint64 ) channel << 32 ) | session;
+  split_output *output;
+
+  if ( NULL != state->last && channel == state->last->channel && session == state->last->session )
+    {
+      return state->last;
+    }
+
+  output = g_hash_table_lookup( state->outputs, &key );
+  if ( NULL == output )
+    {
+      gint64 *stored = g_new( gint64, 1 );
+
+      *stored = ( gint64 ) key;
+      output = split_output_new( state, split_path( split_template, channel, session ), channel, session );
+      g_hash_table_insert( state->outputs, stored, output );
+    }
+
+  state->last = output;
+
+  return output;
+}
+
+
+static void
+split_packet( split_state *state, const iex_pcap_record *record )
+{
+  split_output *output;
+  guint8 header[IEX_PCAP_RECORD_HEADER_LEN];
+  iex_udp udp;
+  iex_seg seg;
+
+  if ( iex_pcap_udp( state->linktype, record->data, record->caplen, &udp )
+       && iex_seg_parse( udp.payload, udp.len, &seg ) )
+    {
+      output = split_get_output( state, seg.channel, seg.session );
+    }
+  else if ( NULL != state->other )
+    {
+      output = state->other;
+    }
+  else
+    {
+      state->dropped++;
+      return;
+    }
+
+  iex_pcap_put_record_header( header, record );
+  split_put( state, output, header, sizeof( header ) );
+  split_put( state, output, record->data, record->caplen );
+  output->packets++;
+  output->bytes += record->caplen;
+}
+
+
+/*
+ * Outputs take the largest snapshot length of all the captures, as iex-merge
+ * does, so it has to be known before the first output is created. Captures
+ * which cannot be opened are skipped here and reported by split_file().
+ */
+static void
+split_scan( split_state *state )
+{
+  for ( gchar **path = split_files; NULL != *path; path++ )
+    {
+      iex_pcap_reader *reader = iex_pcap_open( *path, 1, NULL );
+
+      if ( NULL != reader )
+        {
+          state->snaplen = MAX( state->snaplen, iex_pcap_snaplen( reader ) );
+          iex_pcap_close( reader );
+        }
+    }
+}
+
+
+static gboolean
+split_file( split_state *state, const gchar *path, GError **error )
+{
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  GError *local_error = NULL;
+
+  reader = iex_pcap_open( path, ( guint ) split_threads, error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  if ( !state->started )
+    {
+      state->linktype = iex_pcap_linktype( reader );
+      state->started = TRUE;
+    }
+  else if ( state->linktype != iex_pcap_linktype( reader ) )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "link type %" G_GUINT32_FORMAT " does not match the first capture (%"
+                   G_GUINT32_FORMAT ")", iex_pcap_linktype( reader ), state->linktype );
+      iex_pcap_close( reader );
+      return FALSE;
+    }
+
+  if ( NULL != split_other && NULL == state->other )
+    {
+      state->other = split_output_new( state, g_strdup( split_other ), 0, 0 );
+    }
+
+  while ( iex_pcap_next( reader, &record, &local_error ) )
+    {
+      state->frames++;
+      split_packet( state, &record );
+    }
+
+  iex_pcap_close( reader );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_error( error, local_error );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/* Flush and close an output, returns FALSE (after saying why) if anything failed */
+static gboolean
+split_finish( split_state *state, split_output *output )
+{
+  split_flush( state, output );
+  split_close_fd( state, output );
+
+  if ( NULL != output->error )
+    {
+      g_printerr( "%s\n", output->error->message );
+      return FALSE;
+    }
+
+  if ( !split_quiet )
+    {
+      g_printerr( "%s: %" G_GUINT64_FORMAT " packets, %" G_GUINT64_FORMAT " bytes\n", output->path, output->packets,
+                  output->bytes );
+    }
+
+  return TRUE;
+}
+
+
+static gint
+split_output_cmp( gconstpointer a, gconstpointer b )
+{
+  const split_output *x = *( split_output * const * ) a;
+  const split_output *y = *( split_output * const * ) b;
+
+  if ( x->channel != y->channel )
+    {
+      return x->channel < y->channel ? -1 : 1;
+    }
+
+  return x->session < y->session ? -1 : x->session > y->session;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  split_state state;
+  GPtrArray *outputs;
+  GHashTableIter iter;
+  gpointer value;
+  gint64 start;
+  int rc = EXIT_SUCCESS;
+
+  context = g_option_context_new( "- split captures by IEX-TP channel and session" );
+  g_option_context_set_summary( context, "Reads pcap files (optionally gzip or zstd compressed) once, and copies "
+                                "each IEX-TP segment into a pcap for its channel and session. Packets which are "
+                                "not IEX-TP are dropped, unless --other is given." );
+  g_option_context_add_main_entries( context, split_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) || NULL == split_files )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "no capture files given" );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( NULL == split_template )
+    {
+      split_template = g_strdup( SPLIT_DEFAULT_TEMPLATE );
+    }
+
+  if ( !split_check_template( split_template, &error ) )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      return EXIT_FAILURE;
+    }
+
+  split_max_open = MAX( 1, split_max_open );
+  split_buffer_kb = MAX( 64, split_buffer_kb );
+  if ( 0 >= split_threads )
+    {
+      split_threads = ( gint ) g_get_num_processors();
+    }
+
+  memset( &state, 0, sizeof( state ) );
+  g_queue_init( &state.open );
+  state.outputs = g_hash_table_new_full( g_int64_hash, g_int64_equal, g_free, split_output_free );
+  start = g_get_monotonic_time();
+
+  split_scan( &state );
+
+  for ( gchar **path = split_files; NULL != *path; path++ )
+    {
+      if ( !split_file( &state, *path, &error ) )
+        {
+          g_printerr( "%s: %s\n", *path, error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+    }
+
+  outputs = g_ptr_array_new();
+  g_hash_table_iter_init( &iter, state.outputs );
+  while ( g_hash_table_iter_next( &iter, NULL, &value ) )
+    {
+      g_ptr_array_add( outputs, value );
+    }
+
+  g_ptr_array_sort( outputs, split_output_cmp );
+
+  for ( guint i = 0; i < outputs->len; i++ )
+    {
+      if ( !split_finish( &state, g_ptr_array_index( outputs, i ) ) )
+        {
+          rc = EXIT_FAILURE;
+        }
+    }
+
+  if ( NULL != state.other )
+    {
+      if ( !split_finish( &state, state.other ) )
+        {
+          rc = EXIT_FAILURE;
+        }
+
+      split_output_free( state.other );
+    }
+
+  if ( !split_quiet )
+    {
+      g_printerr( "%" G_GUINT64_FORMAT " packets into %u files in %.3f s (%" G_GUINT64_FORMAT " dropped, %"
+                  G_GUINT64_FORMAT " reopens)\n", state.frames, outputs->len, ( gdouble )( g_get_monotonic_time() - start )
+                  / 1e6, state.dropped, state.reopened );
+    }
+
+  g_ptr_array_free( outputs, TRUE );
+  g_hash_table_destroy( state.outputs );
+  g_free( split_template );
+  g_free( split_other );
+  g_strfreev( split_files );
+
+  return rc;
+}
@@ -0,0 +1,145 @@
+/*
+ * iex-spsc.c - Lock-free single-producer/single-consumer rings for pipelines
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif /* _GNU_SOURCE */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-spsc.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Busy-wait this many times before yielding, and yield this many before sleeping */
+#define IEX_SPSC_SPINS  256
+#define IEX_SPSC_YIELDS 64
+#define IEX_SPSC_SLEEP_US 50
+
+
+iex_spsc *
+iex_spsc_new( guint capacity )
+{
+  iex_spsc *ring;
+  void *mem;
+  guint64 size = 2;
+
+  while ( size < capacity )
+    {
+      size <<= 1;
+    }
+
+  if ( 0 != posix_memalign( &mem, IEX_CACHELINE, sizeof( iex_spsc ) ) )
+    {
+      g_error( "out of memory" );
+    }
+
+  ring = ( iex_spsc * ) mem;
+  memset( ring, 0, sizeof( *ring ) );
+  ring->slots = g_new0( gpointer, size );
+  ring->mask = size - 1;
+
+  return ring;
+}
+
+
+void
+iex_spsc_free( iex_spsc *ring )
+{
+  if ( NULL == ring )
+    {
+      return;
+    }
+
+  g_free( ring->slots );
+  free( ring );
+}
+
+
+/* Back off gradually while the other side catches up */
+static inline void
+iex_spsc_backoff( guint *waits )
+{
+  if ( *waits < IEX_SPSC_SPINS )
+    {
+#if defined( __x86_64__ ) || defined( __i386__ )
+      __builtin_ia32_pause();
+#endif /* x86 */
+    }
+  else if ( *waits < IEX_SPSC_SPINS + IEX_SPSC_YIELDS )
+    {
+      sched_yield();
+    }
+  else
+    {
+      g_usleep( IEX_SPSC_SLEEP_US );
+    }
+
+  ( *waits )++;
+}
+
+
+/* Push, waiting while the ring is full: this is the pipeline's back-pressure */
+void
+iex_spsc_push_wait( iex_spsc *ring, gpointer item )
+{
+  guint waits = 0;
+
+  while ( !iex_spsc_push( ring, item ) )
+    {
+      iex_spsc_backoff( &waits );
+    }
+}
+
+
+gpointer
+iex_spsc_pop_wait( iex_spsc *ring )
+{
+  gpointer item;
+  guint waits = 0;
+
+  while ( NULL == ( item = iex_spsc_pop( ring ) ) )
+    {
+      iex_spsc_backoff( &waits );
+    }
+
+  return item;
+}
+
+
+/* Pin the calling thread to one CPU (modulo the number of CPUs) */
+gboolean
+iex_pin_thread( guint cpu )
+{
+  cpu_set_t set;
+
+  CPU_ZERO( &set );
+  CPU_SET( cpu % g_get_num_processors(), &set );
+
+  return 0 == pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+}
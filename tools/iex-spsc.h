@@ -0,0 +1,124 @@
+/*
+ * iex-spsc.h - Lock-free single-producer/single-consumer rings for pipelines
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_SPSC_H__
+#define __IEX_SPSC_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+G_BEGIN_DECLS
+
+#define IEX_CACHELINE 64
+
+/*
+ * A bounded ring of pointers between exactly one producer thread and one
+ * consumer thread. The indices live on their own cache lines, and each side
+ * keeps a cached copy of the other's index so it only touches the shared
+ * line when the ring looks full (or empty).
+ */
+typedef struct _iex_spsc
+{
+  /* Written by the producer */
+  guint64  head __attribute__( ( aligned( IEX_CACHELINE ) ) );
+  guint64  tail_cache;
+  guint8   __pad_head[IEX_CACHELINE - 2 * sizeof( guint64 )];
+
+  /* Written by the consumer */
+  guint64  tail __attribute__( ( aligned( IEX_CACHELINE ) ) );
+  guint64  head_cache;
+  guint8   __pad_tail[IEX_CACHELINE - 2 * sizeof( guint64 )];
+
+  /* Read-only after creation */
+  gpointer *slots __attribute__( ( aligned( IEX_CACHELINE ) ) );
+  guint64  mask;
+  guint8   __pad_ro[IEX_CACHELINE - sizeof( gpointer * ) - sizeof( guint64 )];
+} iex_spsc;
+
+iex_spsc *iex_spsc_new( guint capacity );
+void iex_spsc_free( iex_spsc *ring );
+
+void iex_spsc_push_wait( iex_spsc *ring, gpointer item );
+gpointer iex_spsc_pop_wait( iex_spsc *ring );
+
+gboolean iex_pin_thread( guint cpu );
+
+
+static inline gboolean
+iex_spsc_push( iex_spsc *ring, gpointer item )
+{
+  guint64 head = ring->head;
+
+  if ( head - ring->tail_cache > ring->mask )
+    {
+      ring->tail_cache = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+      if ( head - ring->tail_cache > ring->mask )
+        {
+          return FALSE;
+        }
+    }
+
+  ring->slots[head & ring->mask] = item;
+  __atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE );
+
+  return TRUE;
+}
+
+
+/* Return the next item without removing it, NULL if the ring is empty */
+static inline gpointer
+iex_spsc_peek( iex_spsc *ring )
+{
+  guint64 tail = ring->tail;
+
+  if ( tail == ring->head_cache )
+    {
+      ring->head_cache = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+      if ( tail == ring->head_cache )
+        {
+          return NULL;
+        }
+    }
+
+  return ring->slots[tail & ring->mask];
+}
+
+
+static inline gpointer
+iex_spsc_pop( iex_spsc *ring )
+{
+  gpointer item;
+
+  item = iex_spsc_peek( ring );
+  if ( NULL != item )
+    {
+      __atomic_store_n( &ring->tail, ring->tail + 1, __ATOMIC_RELEASE );
+    }
+
+  return item;
+}
+
+G_END_DECLS
+
+#endif /* __IEX_SPSC_H__ */
@@ -0,0 +1,911 @@
+/*
+ * iex-symbols.c - Build per-symbol quote state from captures, optionally sharded by symbol across threads
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-pcap.h"
+#include "iex-seg.h"
+#include "iex-spsc.h"
+#include "iex-text.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Parallel mode: message references per batch, and batches in flight per shard */
+#define SYMBOLS_BATCH_REFS 4096
+#define SYMBOLS_RING_DEPTH 8
+
+/* Parallel mode on unstable input: segments are copied once into a ring of arenas */
+#define SYMBOLS_ARENA_SIZE ( 4U << 20 )
+#define SYMBOLS_ARENAS     8
+
+/* Counts kept for each symbol, in the same slot order as its session's book */
+typedef struct _symbols_counts
+{
+  guint64 quotes;
+  guint64 crossed;
+  guint64 locked;
+  guint64 zero_bid_size;
+  guint64 zero_ask_size;
+  guint64 stale;
+} symbols_counts;
+
+/* One session's symbols, as seen by one shard */
+typedef struct _symbols_session
+{
+  iex_quote_book *book;
+  GArray         *counts;
+  guint32         session;
+  guint32         __padding;
+} symbols_session;
+
+/* All the state one shard (or the serial loop) owns */
+typedef struct _symbols_state
+{
+  GHashTable      *sessions;
+  symbols_session *last;
+} symbols_state;
+
+/* Totals for one run, counted where the capture is framed */
+typedef struct _symbols_stats
+{
+  guint64 bytes;
+  guint64 packets;
+  guint64 segments;
+  guint64 messages;
+} symbols_stats;
+
+/* A TOPS message where the framing thread found it: in the capture's mapping, or an arena */
+typedef struct _symbols_ref
+{
+  const guint8 *msg;
+  guint32       session;
+  guint16       len;
+  guint16       __padding;
+} symbols_ref;
+
+/* Copied segments, reused once every batch referring to them is done */
+typedef struct _symbols_arena
+{
+  guint8 *data;
+  gsize   used;
+  gint    refs;
+  guint32 __padding;
+} symbols_arena;
+
+typedef struct _symbols_batch
+{
+  symbols_ref   *refs;
+  symbols_arena *arena;
+  guint          n_refs;
+  gboolean       last;
+} symbols_batch;
+
+/* Parallel mode state */
+typedef struct _symbols_parallel
+{
+  iex_spsc      **in;
+  iex_spsc      **free;
+  symbols_state  *states;
+  GPtrArray      *batches;
+  guint           n_shards;
+  gboolean        pin;
+} symbols_parallel;
+
+/* Worker thread arguments */
+typedef struct _symbols_worker
+{
+  symbols_parallel *parallel;
+  guint             shard;
+  guint             __padding;
+} symbols_worker;
+
+/* A symbol's results, gathered from whichever shard built them */
+typedef struct _symbols_row
+{
+  const iex_quote      *quote;
+  const symbols_counts *counts;
+  guint32               session;
+  guint32               __padding;
+} symbols_row;
+
+/* Command line options */
+static gint symbols_threads = 0;
+static gboolean symbols_parallel_mode = FALSE;
+static gint symbols_shards = 0;
+static gboolean symbols_pin = TRUE;
+static gchar *symbols_stale_arg = NULL;
+static gboolean symbols_quiet = FALSE;
+static gchar **symbols_files = NULL;
+
+static gint64 symbols_stale_ns = 0;
+
+static GOptionEntry symbols_options[] =
+{
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &symbols_threads,
+    "Decompression threads for compressed captures (default: all processors)", "N" },
+  { "parallel", 'P', 0, G_OPTION_ARG_NONE, &symbols_parallel_mode,
+    "Frame segments on one thread and build each symbol's state on the thread owning its shard", NULL },
+  { "shards", 's', 0, G_OPTION_ARG_INT, &symbols_shards,
+    "Worker threads in parallel mode, symbols are split between them (default: processors less one)", "N" },
+  { "no-pin", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &symbols_pin,
+    "Do not pin the framing thread and each worker to their own CPUs", NULL },
+  { "stale", 0, 0, G_OPTION_ARG_STRING, &symbols_stale_arg,
+    "Count quotes arriving more than DURATION after the symbol's previous one (default: off)", "DURATION" },
+  { "quiet", 'q', 0, G_OPTION_ARG_NONE, &symbols_quiet, "Do not print the summary", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &symbols_files, NULL, "CAPTURE..." },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+static void
+symbols_session_free( gpointer data )
+{
+  symbols_session *session = ( symbols_session * ) data;
+
+  iex_quote_book_free( session->book );
+  g_array_free( session->counts, TRUE );
+  g_free( session );
+}
+
+
+static void
+symbols_state_init( symbols_state *state )
+{
+  state->sessions = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, symbols_session_free );
+  state->last = NULL;
+}
+
+
+static void
+symbols_state_clear( symbols_state *state )
+{
+  g_hash_table_destroy( state->sessions );
+}
+
+
+static symbols_session *
+symbols_get_session( symbols_state *state, guint32 session_id )
+{
+  symbols_session *session = state->last;
+
+  if ( NULL != session && session->session == session_id )
+    {
+      return session;
+    }
+
+  session = ( symbols_session * ) g_hash_table_lookup( state->sessions, GUINT_TO_POINTER( session_id ) );
+  if ( NULL == session )
+    {
+      session = g_new0( symbols_session, 1 );
+      session->book = iex_quote_book_new();
+      session->counts = g_array_new( FALSE, TRUE, sizeof( symbols_counts ) );
+      session->session = session_id;
+      g_hash_table_insert( state->sessions, GUINT_TO_POINTER( session_id ), session );
+    }
+
+  state->last = session;
+
+  return session;
+}
+
+
+/* Check a quote against its symbol's previous one as the dissector does, then make it the latest */
+static inline void
+symbols_update( symbols_state *state, guint32 session_id, const guint8 *msg, guint16 len )
+{
+  symbols_session *session;
+  symbols_counts *counts;
+  iex_quote quote;
+  iex_quote *prev;
+  guint32 flags;
+  guint32 slot;
+
+  if ( !iex_tops_quote( msg, len, &quote ) )
+    {
+      return;
+    }
+
+  session = symbols_get_session( state, session_id );
+  slot = iex_quote_book_intern( session->book, quote.symbol );
+  if ( slot >= session->counts->len )
+    {
+      g_array_set_size( session->counts, slot + 1 );
+    }
+
+  prev = iex_quote_book_get( session->book, slot );
+  flags = iex_quote_check( prev, &quote, symbols_stale_ns );
+  *prev = quote;
+
+  counts = &g_array_index( session->counts, symbols_counts, slot );
+  counts->quotes++;
+  counts->crossed += 0 != ( flags & IEX_QUOTE_CROSSED );
+  counts->locked += 0 != ( flags & IEX_QUOTE_LOCKED );
+  counts->zero_bid_size += 0 != ( flags & IEX_QUOTE_ZERO_BID_SIZE );
+  counts->zero_ask_size += 0 != ( flags & IEX_QUOTE_ZERO_ASK_SIZE );
+  counts->stale += 0 != ( flags & IEX_QUOTE_STALE );
+}
+
+
+/* Which shard owns a symbol, from its 8 bytes as an integer */
+static inline guint
+symbols_shard( const guint8 *msg, guint n_shards )
+{
+  guint64 key;
+
+  memcpy( &key, msg + offsetof( iextops_msg, symbol ), sizeof( key ) );
+
+  return ( guint )( ( ( key * G_GUINT64_CONSTANT( 0x9E3779B97F4A7C15 ) ) >> 32 ) % n_shards );
+}
+
+
+/*
+ * Serial mode
+ */
+
+static gboolean
+symbols_file_serial( const gchar *path, symbols_state *state, symbols_stats *stats, GError **error )
+{
+  iex_pcap_reader *reader;
+  iex_pcap_record record;
+  GError *local_error = NULL;
+  guint32 linktype;
+
+  reader = iex_pcap_open( path, ( guint ) symbols_threads, error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  linktype = iex_pcap_linktype( reader );
+
+  while ( iex_pcap_next( reader, &record, &local_error ) )
+    {
+      iex_seg_iter iter;
+      const guint8 *msg;
+      guint16 msg_len;
+      iex_udp udp;
+      iex_seg seg;
+
+      stats->packets++;
+      stats->bytes += 16 + record.caplen;
+
+      if ( !iex_pcap_udp( linktype, record.data, record.caplen, &udp ) || !iex_seg_parse( udp.payload, udp.len, &seg ) )
+        {
+          continue;
+        }
+
+      stats->segments++;
+      if ( IEXTP_PROTO_IEXTOPS != seg.protocol )
+        {
+          continue;
+        }
+
+      iex_seg_iter_init( &iter, &seg );
+      while ( NULL != ( msg = iex_seg_iter_next( &iter, &msg_len ) ) )
+        {
+          stats->messages++;
+          symbols_update( state, seg.session, msg, msg_len );
+        }
+    }
+
+  iex_pcap_close( reader );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_prefixed_error( error, local_error, "%s: ", path );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/*
+ * Parallel mode
+ *
+ *   framing -> shard 0..n-1
+ *
+ * The framing thread reads the capture, checks segment headers, and hands
+ * each TOPS message to the shard owning its symbol, as a reference to the
+ * bytes rather than a copy. Every shard has its own SPSC ring of batches and
+ * a ring handing them back, so a symbol's messages reach its shard in feed
+ * order and no shard shares state with another. When the reader's data only
+ * lives until the next record (compressed input), segments are first copied
+ * once into an arena, which every batch pointing into it keeps alive.
+ */
+
+static symbols_batch *
+symbols_batch_new( symbols_parallel *parallel )
+{
+  symbols_batch *batch;
+
+  batch = g_new0( symbols_batch, 1 );
+  batch->refs = g_new( symbols_ref, SYMBOLS_BATCH_REFS );
+  g_ptr_array_add( parallel->batches, batch );
+
+  return batch;
+}
+
+
+static void
+symbols_batch_free( gpointer data )
+{
+  symbols_batch *batch = ( symbols_batch * ) data;
+
+  g_free( batch->refs );
+  g_free( batch );
+}
+
+
+static inline symbols_batch *
+symbols_batch_take( symbols_parallel *parallel, guint shard, symbols_arena *arena )
+{
+  symbols_batch *batch;
+
+  batch = ( symbols_batch * ) iex_spsc_pop_wait( parallel->free[shard] );
+  batch->n_refs = 0;
+  batch->last = FALSE;
+  batch->arena = arena;
+
+  return batch;
+}
+
+
+static inline void
+symbols_batch_send( symbols_parallel *parallel, guint shard, symbols_batch *batch )
+{
+  if ( NULL != batch->arena )
+    {
+      __atomic_add_fetch( &batch->arena->refs, 1, __ATOMIC_RELAXED );
+    }
+
+  iex_spsc_push_wait( parallel->in[shard], batch );
+}
+
+
+static gpointer
+symbols_worker_run( gpointer data )
+{
+  symbols_worker *worker = ( symbols_worker * ) data;
+  symbols_parallel *parallel = worker->parallel;
+  symbols_state *state = &parallel->states[worker->shard];
+  gboolean last = FALSE;
+
+  if ( parallel->pin && !iex_pin_thread( worker->shard + 1 ) )
+    {
+      g_printerr( "could not pin thread to CPU %u\n", worker->shard + 1 );
+    }
+
+  while ( !last )
+    {
+      symbols_batch *batch;
+
+      batch = ( symbols_batch * ) iex_spsc_pop_wait( parallel->in[worker->shard] );
+      last = batch->last;
+
+      for ( guint i = 0; i < batch->n_refs; i++ )
+        {
+          const symbols_ref *ref = &batch->refs[i];
+
+          symbols_update( state, ref->session, ref->msg, ref->len );
+        }
+
+      if ( NULL != batch->arena )
+        {
+          __atomic_sub_fetch( &batch->arena->refs, 1, __ATOMIC_RELEASE );
+        }
+
+      iex_spsc_push_wait( parallel->free[worker->shard], batch );
+    }
+
+  return NULL;
+}
+
+
+/* Send every partly filled batch on, before the arena they point into is left behind */
+static void
+symbols_flush( symbols_parallel *parallel, symbols_batch **current )
+{
+  for ( guint shard = 0; shard < parallel->n_shards; shard++ )
+    {
+      if ( NULL != current[shard] )
+        {
+          symbols_batch_send( parallel, shard, current[shard] );
+          current[shard] = NULL;
+        }
+    }
+}
+
+
+/* The next arena in the ring, once no shard still refers to it */
+static symbols_arena *
+symbols_arena_next( symbols_arena *arenas, guint *index )
+{
+  symbols_arena *arena;
+  guint waits = 0;
+
+  *index = ( *index + 1 ) % SYMBOLS_ARENAS;
+  arena = &arenas[*index];
+
+  while ( 0 != __atomic_load_n( &arena->refs, __ATOMIC_ACQUIRE ) )
+    {
+      if ( ++waits > 256 )
+        {
+          g_usleep( 20 );
+        }
+    }
+
+  arena->used = 0;
+
+  return arena;
+}
+
+
+static void
+symbols_frame( symbols_parallel *parallel, iex_pcap_reader *reader, symbols_stats *stats, GError **error )
+{
+  symbols_batch **current;
+  symbols_arena *arenas = NULL;
+  symbols_arena *arena = NULL;
+  iex_pcap_record record;
+  guint32 linktype;
+  guint arena_index = 0;
+
+  current = g_new0( symbols_batch *, parallel->n_shards );
+  linktype = iex_pcap_linktype( reader );
+
+  if ( !iex_pcap_is_stable( reader ) )
+    {
+      arenas = g_new0( symbols_arena, SYMBOLS_ARENAS );
+      for ( guint i = 0; i < SYMBOLS_ARENAS; i++ )
+        {
+          arenas[i].data = g_malloc( SYMBOLS_ARENA_SIZE );
+        }
+
+      arena = &arenas[0];
+    }
+
+  while ( iex_pcap_next( reader, &record, error ) )
+    {
+      iex_seg_iter iter;
+      const guint8 *msg;
+      guint16 msg_len;
+      iex_udp udp;
+      iex_seg seg;
+
+      stats->packets++;
+      stats->bytes += 16 + record.caplen;
+
+      if ( !iex_pcap_udp( linktype, record.data, record.caplen, &udp ) || !iex_seg_parse( udp.payload, udp.len, &seg ) )
+        {
+          continue;
+        }
+
+      stats->segments++;
+      if ( IEXTP_PROTO_IEXTOPS != seg.protocol )
+        {
+          continue;
+        }
+
+      if ( NULL != arena )
+        {
+          gsize len = ( gsize )( seg.end - udp.payload );
+          guint8 *copy;
+
+          if ( SYMBOLS_ARENA_SIZE - arena->used < len )
+            {
+              symbols_flush( parallel, current );
+              arena = symbols_arena_next( arenas, &arena_index );
+            }
+
+          copy = arena->data + arena->used;
+          memcpy( copy, udp.payload, len );
+          arena->used += len;
+
+          seg.msgs = copy + ( seg.msgs - udp.payload );
+          seg.end = copy + len;
+        }
+
+      iex_seg_iter_init( &iter, &seg );
+      while ( NULL != ( msg = iex_seg_iter_next( &iter, &msg_len ) ) )
+        {
+          symbols_batch *batch;
+          symbols_ref *ref;
+          guint shard;
+
+          stats->messages++;
+          if ( sizeof( iextops_msg ) > msg_len )
+            {
+              continue;
+            }
+
+          shard = symbols_shard( msg, parallel->n_shards );
+          batch = current[shard];
+          if ( NULL == batch )
+            {
+              batch = current[shard] = symbols_batch_take( parallel, shard, arena );
+            }
+
+          ref = &batch->refs[batch->n_refs++];
+          ref->msg = msg;
+          ref->len = msg_len;
+          ref->session = seg.session;
+
+          if ( SYMBOLS_BATCH_REFS == batch->n_refs )
+            {
+              symbols_batch_send( parallel, shard, batch );
+              current[shard] = NULL;
+            }
+        }
+    }
+
+  symbols_flush( parallel, current );
+
+  /* Tell every shard to stop, then wait for them to be done with the arenas */
+  for ( guint shard = 0; shard < parallel->n_shards; shard++ )
+    {
+      symbols_batch *end = symbols_batch_take( parallel, shard, NULL );
+
+      end->last = TRUE;
+      symbols_batch_send( parallel, shard, end );
+    }
+
+  if ( NULL != arenas )
+    {
+      for ( guint i = 0; i < SYMBOLS_ARENAS; i++ )
+        {
+          arena = &arenas[i];
+          while ( 0 != __atomic_load_n( &arena->refs, __ATOMIC_ACQUIRE ) )
+            {
+              g_usleep( 20 );
+            }
+
+          g_free( arena->data );
+        }
+
+      g_free( arenas );
+    }
+
+  g_free( current );
+}
+
+
+static gboolean
+symbols_file_parallel( const gchar *path, symbols_parallel *parallel, symbols_stats *stats, GError **error )
+{
+  iex_pcap_reader *reader;
+  symbols_worker *workers;
+  GThread **threads;
+  GError *local_error = NULL;
+  guint shard;
+
+  reader = iex_pcap_open( path, ( guint ) symbols_threads, error );
+  if ( NULL == reader )
+    {
+      return FALSE;
+    }
+
+  workers = g_new0( symbols_worker, parallel->n_shards );
+  threads = g_new0( GThread *, parallel->n_shards );
+  for ( shard = 0; shard < parallel->n_shards; shard++ )
+    {
+      workers[shard].parallel = parallel;
+      workers[shard].shard = shard;
+      threads[shard] = g_thread_new( "iex-symbols", symbols_worker_run, &workers[shard] );
+    }
+
+  if ( parallel->pin && !iex_pin_thread( 0 ) )
+    {
+      g_printerr( "could not pin thread to CPU 0\n" );
+    }
+
+  symbols_frame( parallel, reader, stats, &local_error );
+
+  for ( shard = 0; shard < parallel->n_shards; shard++ )
+    {
+      g_thread_join( threads[shard] );
+    }
+
+  g_free( threads );
+  g_free( workers );
+  iex_pcap_close( reader );
+
+  if ( NULL != local_error )
+    {
+      g_propagate_prefixed_error( error, local_error, "%s: ", path );
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+static symbols_parallel *
+symbols_parallel_new( guint n_shards, gboolean pin )
+{
+  symbols_parallel *parallel;
+
+  parallel = g_new0( symbols_parallel, 1 );
+  parallel->n_shards = n_shards;
+  parallel->pin = pin;
+  parallel->batches = g_ptr_array_new_with_free_func( symbols_batch_free );
+  parallel->states = g_new0( symbols_state, n_shards );
+  parallel->in = g_new0( iex_spsc *, n_shards );
+  parallel->free = g_new0( iex_spsc *, n_shards );
+
+  for ( guint shard = 0; shard < n_shards; shard++ )
+    {
+      symbols_state_init( &parallel->states[shard] );
+      parallel->in[shard] = iex_spsc_new( SYMBOLS_RING_DEPTH );
+      parallel->free[shard] = iex_spsc_new( SYMBOLS_RING_DEPTH );
+      for ( guint i = 0; i < SYMBOLS_RING_DEPTH; i++ )
+        {
+          iex_spsc_push( parallel->free[shard], symbols_batch_new( parallel ) );
+        }
+    }
+
+  return parallel;
+}
+
+
+static void
+symbols_parallel_free( symbols_parallel *parallel )
+{
+  for ( guint shard = 0; shard < parallel->n_shards; shard++ )
+    {
+      symbols_state_clear( &parallel->states[shard] );
+      iex_spsc_free( parallel->in[shard] );
+      iex_spsc_free( parallel->free[shard] );
+    }
+
+  g_ptr_array_free( parallel->batches, TRUE );
+  g_free( parallel->states );
+  g_free( parallel->in );
+  g_free( parallel->free );
+  g_free( parallel );
+}
+
+
+/*
+ * Results
+ */
+
+static gint
+symbols_row_cmp( gconstpointer a, gconstpointer b )
+{
+  const symbols_row *ra = ( const symbols_row * ) a;
+  const symbols_row *rb = ( const symbols_row * ) b;
+
+  if ( ra->session != rb->session )
+    {
+      return ra->session < rb->session ? -1 : 1;
+    }
+
+  return memcmp( ra->quote->symbol, rb->quote->symbol, IEX_SYMBOL_LEN );
+}
+
+
+/* Merge the shards' symbols into one list, ordered by session and symbol, and print it */
+static guint
+symbols_print( symbols_state *states, guint n_states, guint64 *quotes, guint64 *crossed )
+{
+  iex_text *text;
+  GArray *rows;
+  GHashTableIter iter;
+  gpointer value;
+  guint n_rows;
+
+  rows = g_array_new( FALSE, FALSE, sizeof( symbols_row ) );
+  for ( guint i = 0; i < n_states; i++ )
+    {
+      g_hash_table_iter_init( &iter, states[i].sessions );
+      while ( g_hash_table_iter_next( &iter, NULL, &value ) )
+        {
+          symbols_session *session = ( symbols_session * ) value;
+
+          for ( guint32 slot = 0; slot < iex_quote_book_size( session->book ); slot++ )
+            {
+              symbols_row row;
+
+              row.quote = iex_quote_book_get( session->book, slot );
+              row.counts = &g_array_index( session->counts, symbols_counts, slot );
+              row.session = session->session;
+              row.__padding = 0;
+              g_array_append_val( rows, row );
+            }
+        }
+    }
+
+  g_array_sort( rows, symbols_row_cmp );
+
+  text = iex_text_new( STDOUT_FILENO, FALSE, 256U << 10, 4 );
+  for ( guint i = 0; i < rows->len; i++ )
+    {
+      const symbols_row *row = &g_array_index( rows, symbols_row, i );
+      const symbols_counts *counts = row->counts;
+      const iex_quote *quote = row->quote;
+      gsize symbol_len = IEX_SYMBOL_LEN;
+      gchar *p;
+
+      while ( 0 < symbol_len && ( ' ' == quote->symbol[symbol_len - 1] || '\0' == quote->symbol[symbol_len - 1] ) )
+        {
+          symbol_len--;
+        }
+
+      p = iex_text_reserve( text, 14 * ( IEX_TEXT_NUMBER_MAX + 1 ) + IEX_SYMBOL_LEN );
+      p = iex_text_put_u64( p, row->session );
+      *p++ = ' ';
+      p = iex_text_put( p, quote->symbol, symbol_len );
+      *p++ = ' ';
+      p = iex_text_put_u64( p, counts->quotes );
+      *p++ = ' ';
+      p = iex_text_put_u64( p, counts->crossed );
+      *p++ = ' ';
+      p = iex_text_put_u64( p, counts->locked );
+      *p++ = ' ';
+      p = iex_text_put_u64( p, counts->zero_bid_size );
+      *p++ = ' ';
+      p = iex_text_put_u64( p, counts->zero_ask_size );
+      *p++ = ' ';
+      p = iex_text_put_u64( p, counts->stale );
+      *p++ = ' ';
+      p = iex_text_put_i64( p, quote->timestamp );
+      *p++ = ' ';
+      p = iex_text_put_u64( p, quote->bid_size );
+      *p++ = ' ';
+      p = iex_text_put_price( p, quote->bid_price );
+      *p++ = ' ';
+      p = iex_text_put_price( p, quote->ask_price );
+      *p++ = ' ';
+      p = iex_text_put_u64( p, quote->ask_size );
+      *p++ = '\n';
+      iex_text_commit( text, p );
+
+      *quotes += counts->quotes;
+      *crossed += counts->crossed;
+    }
+
+  if ( !iex_text_close( text, NULL ) )
+    {
+      g_printerr( "could not write the results\n" );
+    }
+
+  n_rows = rows->len;
+  g_array_free( rows, TRUE );
+
+  return n_rows;
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  symbols_parallel *parallel = NULL;
+  symbols_state serial = { NULL, NULL };
+  symbols_stats stats;
+  guint64 quotes = 0;
+  guint64 crossed = 0;
+  guint n_symbols;
+  gint64 start;
+  gdouble elapsed;
+  int rc = EXIT_SUCCESS;
+
+  context = g_option_context_new( "- build per-symbol quote state from IEX-TP/TOPS captures" );
+  g_option_context_set_summary( context, "Reads pcap files (optionally gzip or zstd compressed), keeps the latest "
+                                "quote for every session and symbol and checks each quote as the TOPS dissector "
+                                "does, then prints one line per symbol: session, symbol, quotes, crossed, locked, "
+                                "zero bid size, zero ask size and stale counts, and the last quote's timestamp, "
+                                "bid size, bid price, ask price and ask size." );
+  g_option_context_add_main_entries( context, symbols_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) || NULL == symbols_files )
+    {
+      g_printerr( "%s\n", NULL != error ? error->message : "no capture files given" );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  if ( NULL != symbols_stale_arg && !iex_text_parse_duration( symbols_stale_arg, &symbols_stale_ns ) )
+    {
+      g_printerr( "bad duration '%s'\n", symbols_stale_arg );
+      return EXIT_FAILURE;
+    }
+
+  if ( 0 >= symbols_threads )
+    {
+      symbols_threads = ( gint ) g_get_num_processors();
+    }
+
+  if ( 0 >= symbols_shards )
+    {
+      symbols_shards = MAX( 1, ( gint ) g_get_num_processors() - 1 );
+    }
+
+  if ( symbols_parallel_mode )
+    {
+      parallel = symbols_parallel_new( ( guint ) symbols_shards, symbols_pin );
+    }
+  else
+    {
+      symbols_state_init( &serial );
+    }
+
+  memset( &stats, 0, sizeof( stats ) );
+  start = g_get_monotonic_time();
+
+  for ( gchar **file = symbols_files; NULL != *file; file++ )
+    {
+      gboolean ok;
+
+      if ( NULL != parallel )
+        {
+          ok = symbols_file_parallel( *file, parallel, &stats, &error );
+        }
+      else
+        {
+          ok = symbols_file_serial( *file, &serial, &stats, &error );
+        }
+
+      if ( !ok )
+        {
+          g_printerr( "%s\n", error->message );
+          g_clear_error( &error );
+          rc = EXIT_FAILURE;
+        }
+    }
+
+  elapsed = ( gdouble )( g_get_monotonic_time() - start ) / 1e6;
+
+  if ( NULL != parallel )
+    {
+      n_symbols = symbols_print( parallel->states, parallel->n_shards, &quotes, &crossed );
+      symbols_parallel_free( parallel );
+    }
+  else
+    {
+      n_symbols = symbols_print( &serial, 1, &quotes, &crossed );
+      symbols_state_clear( &serial );
+    }
+
+  if ( !symbols_quiet )
+    {
+      g_printerr( "%" G_GUINT64_FORMAT " packets, %" G_GUINT64_FORMAT " segments, %" G_GUINT64_FORMAT " messages (%"
+                  G_GUINT64_FORMAT " quotes, %" G_GUINT64_FORMAT " crossed) for %u symbols in %.3f s, %.1f MB/s of "
+                  "pcap\n", stats.packets, stats.segments, stats.messages, quotes, crossed, n_symbols, elapsed,
+                  0 < elapsed ? ( gdouble ) stats.bytes / elapsed / 1e6 : 0.0 );
+    }
+
+  g_free( symbols_stale_arg );
+  g_strfreev( symbols_files );
+
+  return rc;
+}
@@ -0,0 +1,276 @@
+/*
+ * iex-text.c - Buffered output and number formatting for the capture tools
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-text.h"
+#include "iex-input.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Defaults for iex_text_open(): 16 chunks of 256 KiB */
+#define IEX_TEXT_CHUNK_SIZE ( 256U << 10 )
+#define IEX_TEXT_CHUNKS     16
+
+/* Well below any IOV_MAX */
+#define IEX_TEXT_MAX_CHUNKS 64
+
+const gchar iex_text_digits[200] =
+{
+  '0', '0', '0', '1', '0', '2', '0', '3', '0', '4', '0', '5', '0', '6', '0', '7', '0', '8', '0', '9',
+  '1', '0', '1', '1', '1', '2', '1', '3', '1', '4', '1', '5', '1', '6', '1', '7', '1', '8', '1', '9',
+  '2', '0', '2', '1', '2', '2', '2', '3', '2', '4', '2', '5', '2', '6', '2', '7', '2', '8', '2', '9',
+  '3', '0', '3', '1', '3', '2', '3', '3', '3', '4', '3', '5', '3', '6', '3', '7', '3', '8', '3', '9',
+  '4', '0', '4', '1', '4', '2', '4', '3', '4', '4', '4', '5', '4', '6', '4', '7', '4', '8', '4', '9',
+  '5', '0', '5', '1', '5', '2', '5', '3', '5', '4', '5', '5', '5', '6', '5', '7', '5', '8', '5', '9',
+  '6', '0', '6', '1', '6', '2', '6', '3', '6', '4', '6', '5', '6', '6', '6', '7', '6', '8', '6', '9',
+  '7', '0', '7', '1', '7', '2', '7', '3', '7', '4', '7', '5', '7', '6', '7', '7', '7', '8', '7', '9',
+  '8', '0', '8', '1', '8', '2', '8', '3', '8', '4', '8', '5', '8', '6', '8', '7', '8', '8', '8', '9',
+  '9', '0', '9', '1', '9', '2', '9', '3', '9', '4', '9', '5', '9', '6', '9', '7', '9', '8', '9', '9'
+};
+
+
+iex_text *
+iex_text_new( int fd, gboolean close_fd, gsize chunk_size, guint n_chunks )
+{
+  iex_text *text;
+
+  text = g_new0( iex_text, 1 );
+  text->fd = fd;
+  text->close_fd = close_fd;
+  text->chunk_size = chunk_size;
+  text->n_chunks = CLAMP( n_chunks, 1, IEX_TEXT_MAX_CHUNKS );
+  text->buf = g_malloc( text->chunk_size * text->n_chunks );
+  text->used = g_new0( gsize, text->n_chunks );
+  text->chunk = text->buf;
+  text->pos = text->chunk;
+  text->end = text->chunk + text->chunk_size;
+
+  return text;
+}
+
+
+/* Write to a file, or to stdout when path is NULL or "-" */
+iex_text *
+iex_text_open( const gchar *path, GError **error )
+{
+  int fd;
+
+  if ( NULL == path || 0 == strcmp( path, "-" ) )
+    {
+      return iex_text_new( STDOUT_FILENO, FALSE, IEX_TEXT_CHUNK_SIZE, IEX_TEXT_CHUNKS );
+    }
+
+  fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+  if ( 0 > fd )
+    {
+      g_set_error( error, IEX_TOOLS_ERROR, 0, "%s: %s", path, g_strerror( errno ) );
+      return NULL;
+    }
+
+  return iex_text_new( fd, TRUE, IEX_TEXT_CHUNK_SIZE, IEX_TEXT_CHUNKS );
+}
+
+
+/* Write out a vector of buffers completely, or set the sticky error */
+static void
+iex_text_writev( iex_text *text, struct iovec *iov, guint n_iov )
+{
+  guint first = 0;
+
+  while ( NULL == text->error && first < n_iov )
+    {
+      ssize_t written;
+
+      written = writev( text->fd, iov + first, ( int )( n_iov - first ) );
+      if ( 0 > written )
+        {
+          if ( EINTR != errno )
+            {
+              g_set_error( &text->error, IEX_TOOLS_ERROR, 0, "write failed: %s", g_strerror( errno ) );
+            }
+          continue;
+        }
+
+      /* Skip what went out, and trim a partly written buffer */
+      while ( first < n_iov && ( gsize ) written >= iov[first].iov_len )
+        {
+          written -= ( ssize_t ) iov[first].iov_len;
+          first++;
+        }
+
+      if ( first < n_iov )
+        {
+          iov[first].iov_base = ( gchar * ) iov[first].iov_base + written;
+          iov[first].iov_len -= ( gsize ) written;
+        }
+    }
+}
+
+
+/*
+ * Write out every chunk, including the one being filled. The first error is
+ * kept and reported by iex_text_close(), later output is discarded.
+ */
+gboolean
+iex_text_flush( iex_text *text )
+{
+  struct iovec iov[IEX_TEXT_MAX_CHUNKS];
+  guint n_iov = 0;
+
+  text->used[text->n_full] = ( gsize )( text->pos - text->chunk );
+  for ( guint i = 0; i <= text->n_full && i < text->n_chunks; i++ )
+    {
+      if ( 0 != text->used[i] )
+        {
+          iov[n_iov].iov_base = text->buf + i * text->chunk_size;
+          iov[n_iov].iov_len = text->used[i];
+          n_iov++;
+        }
+    }
+
+  iex_text_writev( text, iov, n_iov );
+
+  memset( text->used, 0, text->n_chunks * sizeof( gsize ) );
+  text->n_full = 0;
+  text->chunk = text->buf;
+  text->pos = text->chunk;
+  text->end = text->chunk + text->chunk_size;
+
+  return NULL == text->error;
+}
+
+
+/* Copy bytes to the output, anything bigger than a chunk is written straight out */
+void
+iex_text_write( iex_text *text, gconstpointer data, gsize len )
+{
+  struct iovec iov;
+
+  if ( len <= text->chunk_size )
+    {
+      gchar *p = iex_text_reserve( text, len );
+
+      iex_text_commit( text, iex_text_put( p, ( const gchar * ) data, len ) );
+      return;
+    }
+
+  iex_text_flush( text );
+
+  iov.iov_base = ( gpointer ) data;
+  iov.iov_len = len;
+  iex_text_writev( text, &iov, 1 );
+}
+
+
+/* Slow path of iex_text_reserve(): move on to the next chunk, writing them all out when none are left */
+gchar *
+iex_text_next_chunk( iex_text *text, gsize n )
+{
+  g_return_val_if_fail( n <= text->chunk_size, NULL );
+
+  if ( text->n_full + 1 >= text->n_chunks )
+    {
+      iex_text_flush( text );
+      return text->pos;
+    }
+
+  text->used[text->n_full] = ( gsize )( text->pos - text->chunk );
+  text->n_full++;
+  text->chunk = text->buf + text->n_full * text->chunk_size;
+  text->pos = text->chunk;
+  text->end = text->chunk + text->chunk_size;
+
+  return text->pos;
+}
+
+
+gboolean
+iex_text_close( iex_text *text, GError **error )
+{
+  gboolean ok;
+
+  iex_text_flush( text );
+  if ( text->close_fd && 0 != close( text->fd ) && NULL == text->error )
+    {
+      g_set_error( &text->error, IEX_TOOLS_ERROR, 0, "close failed: %s", g_strerror( errno ) );
+    }
+
+  ok = NULL == text->error;
+  if ( !ok )
+    {
+      g_propagate_error( error, text->error );
+    }
+
+  g_free( text->used );
+  g_free( text->buf );
+  g_free( text );
+
+  return ok;
+}
+
+
+/* Parse a duration such as 250us, 100ms or 1s (a bare number is milliseconds) */
+gboolean
+iex_text_parse_duration( const gchar *spec, gint64 *ns )
+{
+  gchar *end;
+  gint64 value;
+  gint64 scale;
+
+  value = g_ascii_strtoll( spec, &end, 10 );
+  if ( 0 == strcmp( end, "ns" ) )
+    {
+      scale = 1;
+    }
+  else if ( 0 == strcmp( end, "us" ) )
+    {
+      scale = 1000;
+    }
+  else if ( 0 == strcmp( end, "ms" ) || '\0' == *end )
+    {
+      scale = 1000000;
+    }
+  else if ( 0 == strcmp( end, "s" ) )
+    {
+      scale = 1000000000;
+    }
+  else
+    {
+      scale = 0;
+    }
+
+  if ( end == spec || 0 >= value || 0 == scale || value > G_MAXINT64 / scale )
+    {
+      return FALSE;
+    }
+
+  *ns = value * scale;
+
+  return TRUE;
+}
@@ -0,0 +1,222 @@
+/*
+ * iex-text.h - Buffered output and number formatting for the capture tools
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IEX_TEXT_H__
+#define __IEX_TEXT_H__
+
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <glib.h>
+#pragma GCC diagnostic error "-Wpadded"
+
+#include <string.h>
+
+G_BEGIN_DECLS
+
+/* Longest text any of the iex_text_put_*() functions below write */
+#define IEX_TEXT_NUMBER_MAX 21
+
+/*
+ * Output written into a ring of large chunks which are handed to writev()
+ * together once they are all full, so formatting never allocates and the
+ * kernel sees a few big writes. Callers reserve room for a whole record,
+ * format into it directly, and then commit what they used.
+ */
+typedef struct _iex_text
+{
+  gchar        *pos;
+  gchar        *end;
+  gchar        *chunk;
+  gchar        *buf;
+  gsize        *used;
+  GError       *error;
+  gsize         chunk_size;
+  guint         n_chunks;
+  guint         n_full;
+  int           fd;
+  gboolean      close_fd;
+} iex_text;
+
+/* "00" "01" ... "99" */
+extern const gchar iex_text_digits[200];
+
+iex_text *iex_text_new( int fd, gboolean close_fd, gsize chunk_size, guint n_chunks );
+iex_text *iex_text_open( const gchar *path, GError **error );
+gboolean iex_text_close( iex_text *text, GError **error );
+
+gboolean iex_text_flush( iex_text *text );
+void iex_text_write( iex_text *text, gconstpointer data, gsize len );
+gchar *iex_text_next_chunk( iex_text *text, gsize n );
+
+gboolean iex_text_parse_duration( const gchar *spec, gint64 *ns );
+
+
+/* Room for at least n bytes (no more than the chunk size) */
+static inline gchar *
+iex_text_reserve( iex_text *text, gsize n )
+{
+  if ( G_UNLIKELY( ( gsize )( text->end - text->pos ) < n ) )
+    {
+      return iex_text_next_chunk( text, n );
+    }
+
+  return text->pos;
+}
+
+
+static inline void
+iex_text_commit( iex_text *text, gchar *end )
+{
+  text->pos = end;
+}
+
+
+static inline gchar *
+iex_text_put_u64( gchar *p, guint64 v )
+{
+  gchar buf[20];
+  gchar *q = buf + sizeof( buf );
+  gsize len;
+
+  while ( v >= 100 )
+    {
+      q -= 2;
+      memcpy( q, iex_text_digits + ( v % 100 ) * 2, 2 );
+      v /= 100;
+    }
+
+  if ( v >= 10 )
+    {
+      q -= 2;
+      memcpy( q, iex_text_digits + v * 2, 2 );
+    }
+  else
+    {
+      *--q = ( gchar )( '0' + v );
+    }
+
+  len = ( gsize )( buf + sizeof( buf ) - q );
+  memcpy( p, q, len );
+
+  return p + len;
+}
+
+
+static inline gchar *
+iex_text_put_i64( gchar *p, gint64 v )
+{
+  if ( v < 0 )
+    {
+      *p++ = '-';
+      return iex_text_put_u64( p, ( guint64 )( -( v + 1 ) ) + 1 );
+    }
+
+  return iex_text_put_u64( p, ( guint64 ) v );
+}
+
+
+/* A fixed-point price with four implied decimal places, always printed with four */
+static inline gchar *
+iex_text_put_price( gchar *p, gint64 price )
+{
+  guint64 v;
+  guint frac;
+
+  if ( price < 0 )
+    {
+      *p++ = '-';
+      v = ( guint64 )( -( price + 1 ) ) + 1;
+    }
+  else
+    {
+      v = ( guint64 ) price;
+    }
+
+  frac = ( guint )( v % 10000 );
+  p = iex_text_put_u64( p, v / 10000 );
+  *p++ = '.';
+  memcpy( p, iex_text_digits + ( frac / 100 ) * 2, 2 );
+  memcpy( p + 2, iex_text_digits + ( frac % 100 ) * 2, 2 );
+
+  return p + 4;
+}
+
+
+/* Seconds and nanoseconds as C division splits them (so with the same sign), as seconds with nine decimals */
+static inline gchar *
+iex_text_put_seconds( gchar *p, gint64 secs, gint32 nsecs )
+{
+  guint64 v;
+  guint frac;
+
+  if ( secs < 0 || nsecs < 0 )
+    {
+      *p++ = '-';
+      v = ( guint64 )( -( secs + 1 ) ) + 1;
+      frac = ( guint )( -nsecs );
+    }
+  else
+    {
+      v = ( guint64 ) secs;
+      frac = ( guint ) nsecs;
+    }
+
+  p = iex_text_put_u64( p, v );
+  *p++ = '.';
+  *p++ = ( gchar )( '0' + frac / 100000000 );
+  frac %= 100000000;
+  memcpy( p, iex_text_digits + ( frac / 1000000 ) * 2, 2 );
+  memcpy( p + 2, iex_text_digits + ( frac / 10000 % 100 ) * 2, 2 );
+  memcpy( p + 4, iex_text_digits + ( frac / 100 % 100 ) * 2, 2 );
+  memcpy( p + 6, iex_text_digits + ( frac % 100 ) * 2, 2 );
+
+  return p + 8;
+}
+
+
+static inline gchar *
+iex_text_put( gchar *p, const gchar *s, gsize len )
+{
+  memcpy( p, s, len );
+
+  return p + len;
+}
+
+
+/*
+ * A double to 15 significant digits, so a price converted from four implied
+ * decimals prints as that decimal with its trailing zeros dropped. This one
+ * goes through printf.
+ */
+static inline gchar *
+iex_text_put_double( gchar *p, gdouble v )
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_ascii_formatd( buf, sizeof( buf ), "%.15g", v );
+
+  return iex_text_put( p, buf, strlen( buf ) );
+}
+
+G_END_DECLS
+
+#endif /* __IEX_TEXT_H__ */
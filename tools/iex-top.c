@@ -0,0 +1,220 @@
+/*
+ * iex-top.c - Print quotes from a shared memory top of book table
+ *
+ * Copyright (C) 2014 IEX Group, Inc.
+ *
+ * Authors:
+ *
+ * james.cape@iextrading.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "iex-book.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Reads between clock checks when benchmarking */
+#define TOP_BENCH_BATCH 65536
+
+/* Command line options */
+static gchar *top_name = NULL;
+static gdouble top_watch = 0.0;
+static gboolean top_bench = FALSE;
+static gchar **top_symbols = NULL;
+
+static GOptionEntry top_options[] =
+{
+  { "name", 'n', 0, G_OPTION_ARG_STRING, &top_name,
+    "Shared memory object to read (default: " IEX_BOOK_DEFAULT_NAME ")", "NAME" },
+  { "watch", 'w', 0, G_OPTION_ARG_DOUBLE, &top_watch, "Print again every SECONDS until the publisher exits",
+    "SECONDS" },
+  { "bench", 'b', 0, G_OPTION_ARG_NONE, &top_bench, "Time consistent reads of the symbols for a second", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &top_symbols, NULL, "[SYMBOL...]" },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+
+static void
+top_print_quote( GString *out, const iex_book_quote *quote )
+{
+  g_string_append_printf( out, "%" G_GINT64_FORMAT " %.8s %" G_GUINT32_FORMAT " %" G_GINT64_FORMAT ".%04" G_GINT64_FORMAT
+                          " %" G_GINT64_FORMAT ".%04" G_GINT64_FORMAT " %" G_GUINT32_FORMAT " %" G_GUINT64_FORMAT "\n",
+                          quote->timestamp, quote->symbol, quote->bid_size, quote->bid_price / 10000,
+                          quote->bid_price % 10000, quote->ask_price / 10000, quote->ask_price % 10000, quote->ask_size,
+                          quote->updates );
+}
+
+
+/* The named symbols' slots, or every slot in the table */
+static GArray *
+top_slots( const iex_book *book )
+{
+  GArray *slots;
+
+  slots = g_array_new( FALSE, FALSE, sizeof( guint32 ) );
+
+  if ( NULL == top_symbols )
+    {
+      for ( guint32 slot = 0; slot < iex_book_size( book ); slot++ )
+        {
+          g_array_append_val( slots, slot );
+        }
+    }
+  else
+    {
+      for ( gchar **symbol = top_symbols; NULL != *symbol; symbol++ )
+        {
+          guint32 slot = iex_book_lookup( book, *symbol );
+
+          if ( IEX_BOOK_NO_SLOT != slot )
+            {
+              g_array_append_val( slots, slot );
+            }
+        }
+    }
+
+  return slots;
+}
+
+
+static void
+top_print( const iex_book *book )
+{
+  GArray *slots;
+  GString *out;
+  iex_book_quote quote;
+
+  out = g_string_new( NULL );
+  slots = top_slots( book );
+
+  for ( guint i = 0; i < slots->len; i++ )
+    {
+      if ( iex_book_read( book, g_array_index( slots, guint32, i ), &quote ) )
+        {
+          top_print_quote( out, &quote );
+        }
+    }
+
+  g_string_append_printf( out, "# %u symbols, send time %" G_GINT64_FORMAT "%s\n", iex_book_size( book ),
+                          iex_book_send_time( book ), iex_book_is_closed( book ) ? ", closed" : "" );
+  fputs( out->str, stdout );
+  fflush( stdout );
+
+  g_array_free( slots, TRUE );
+  g_string_free( out, TRUE );
+}
+
+
+static void
+top_benchmark( const iex_book *book )
+{
+  GArray *slots;
+  iex_book_quote quote;
+  guint64 reads = 0;
+  guint64 sum = 0;
+  gint64 start;
+  gint64 elapsed;
+
+  slots = top_slots( book );
+  if ( 0 == slots->len )
+    {
+      g_printerr( "nothing to read\n" );
+      g_array_free( slots, TRUE );
+      return;
+    }
+
+  start = g_get_monotonic_time();
+  do
+    {
+      for ( guint i = 0; i < TOP_BENCH_BATCH; i++ )
+        {
+          if ( !iex_book_read( book, g_array_index( slots, guint32, i % slots->len ), &quote ) )
+            {
+              g_printerr( "the table was closed part way through an update\n" );
+              g_array_free( slots, TRUE );
+              return;
+            }
+
+          sum += quote.updates;
+        }
+
+      reads += TOP_BENCH_BATCH;
+      elapsed = g_get_monotonic_time() - start;
+    }
+  while ( elapsed < G_USEC_PER_SEC );
+
+  printf( "%" G_GUINT64_FORMAT " reads of %u symbols in %.3f s, %.1f ns per read (checksum %" G_GUINT64_FORMAT ")\n",
+          reads, slots->len, ( gdouble ) elapsed / 1e6, ( gdouble ) elapsed * 1e3 / ( gdouble ) reads, sum );
+
+  g_array_free( slots, TRUE );
+}
+
+
+int
+main( int argc, char **argv )
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  iex_book *book;
+
+  context = g_option_context_new( "- print quotes from a top of book table" );
+  g_option_context_set_summary( context, "Prints the latest quote for the given symbols (or every symbol) from a "
+                                "table written by iex-publish: timestamp, symbol, bid size, bid price, ask price, "
+                                "ask size and the number of updates." );
+  g_option_context_add_main_entries( context, top_options, NULL );
+  if ( !g_option_context_parse( context, &argc, &argv, &error ) )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      g_option_context_free( context );
+      return EXIT_FAILURE;
+    }
+
+  g_option_context_free( context );
+
+  book = iex_book_open( NULL != top_name ? top_name : IEX_BOOK_DEFAULT_NAME, &error );
+  if ( NULL == book )
+    {
+      g_printerr( "%s\n", error->message );
+      g_clear_error( &error );
+      return EXIT_FAILURE;
+    }
+
+  if ( top_bench )
+    {
+      top_benchmark( book );
+    }
+  else
+    {
+      top_print( book );
+
+      while ( top_watch > 0.0 && !iex_book_is_closed( book ) )
+        {
+          g_usleep( ( gulong )( top_watch * G_USEC_PER_SEC ) );
+          top_print( book );
+        }
+    }
+
+  iex_book_close( book );
+  g_free( top_name );
+  g_strfreev( top_symbols );
+
+  return EXIT_SUCCESS;
+}